@@ -14,11 +14,16 @@
 #include "cpu.h"
 #include "tcg/tcg.h"
 #include "exec/exec-all.h"
+#include "sysemu/tcg.h"
 
 void tb_flush(CPUState *cpu)
 {
 }
 
+void tb_cache_save(void)
+{
+}
+
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 {
 }
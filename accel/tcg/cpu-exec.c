@@ -40,6 +40,10 @@
 #include "exec/cpu-all.h"
 #include "sysemu/cpu-timers.h"
 #include "sysemu/replay.h"
+#ifdef CONFIG_SOFTMMU
+#include "tb-prefetch.h"
+#include "tb-hot.h"
+#endif
 
 /* -icount align implementation. */
 
@@ -347,6 +351,7 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
                                    uint32_t cheri_flags, uint32_t flags,
                                    uint32_t cf_mask)
 {
+    TranslationBlock *tb;
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
     uint32_t h;
@@ -365,7 +370,14 @@ TranslationBlock *tb_htable_lookup(CPUState *cpu, target_ulong pc,
     }
     desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
     h = tb_hash_func(phys_pc, pc, flags, cf_mask, *cpu->trace_dstate);
-    return qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+    tb = qht_lookup_custom(&tb_ctx.htable, &desc, h, tb_lookup_cmp);
+#ifdef CONFIG_SOFTMMU
+    /* The first lookup of a TB never hits in tb_jmp_cache */
+    if (tb && unlikely(qatomic_read(&tb->prefetched))) {
+        tb_prefetch_hit(tb);
+    }
+#endif
+    return tb;
 }
 
 void tb_set_jmp_target(TranslationBlock *tb, int n, uintptr_t addr)
@@ -431,8 +443,19 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
     uint32_t cheri_flags = 0;
     uint32_t flags;
 
+    qatomic_set(&cpu->tb_exit_lookups, cpu->tb_exit_lookups + 1);
     tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &cs_top, &cheri_flags, &flags,
                               cf_mask);
+#ifdef CONFIG_SOFTMMU
+    if (tb && unlikely(qatomic_read(&cpu->tb_hot_sample)) &&
+        tb_hot_sample(cpu, tb)) {
+        mmap_lock();
+        tb = tb_gen_code(cpu, pc, cs_base, cs_top, cheri_flags, flags,
+                         cf_mask | CF_HOT);
+        mmap_unlock();
+        qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+    }
+#endif
     if (tb == NULL) {
         mmap_lock();
         tb = tb_gen_code(cpu, pc, cs_base, cs_top, cheri_flags, flags, cf_mask);
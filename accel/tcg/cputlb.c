@@ -79,6 +79,12 @@ QEMU_BUILD_BUG_ON(sizeof(target_ulong) > sizeof(run_on_cpu_data));
 /* We currently can't handle more than 16 bits in the MMUIDX bitmask.
  */
 QEMU_BUILD_BUG_ON(NB_MMU_MODES > 16);
+#ifdef TARGET_CHERI
+/* TLB_CHERI_TAGS must be a page offset bit of its own, like the TLB_* flags */
+QEMU_BUILD_BUG_ON(TARGET_PAGE_BITS_MIN < 7);
+QEMU_BUILD_BUG_ON(TLB_CHERI_TAGS & TLB_FLAGS_MASK);
+#endif
+
 #define ALL_MMUIDX_BITS ((1 << NB_MMU_MODES) - 1)
 
 static inline size_t tlb_n_entries(CPUTLBDescFast *fast)
@@ -96,6 +102,7 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 {
     desc->window_begin_ns = ns;
     desc->window_max_entries = max_entries;
+    desc->window_fills = 0;
 }
 
 /**
@@ -137,6 +144,13 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
  * is direct mapped, so we want the use rate to be low (or at least not too
  * high), since otherwise we are likely to have a significant amount of
  * conflict misses.
+ *
+ * 4. Also increase the size when the TLB is refilled more than twice over
+ * per time window, and do not shrink it while that is the case. The use
+ * rate cannot show this: entries that are evicted while still in use are
+ * replaced by others, so a thrashing TLB may look no fuller than one that
+ * fits its working set. The refills are scaled to the window length, as
+ * a TLB that is rarely flushed may have been refilled for much longer.
  */
 static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
                                   int64_t now)
@@ -146,14 +160,18 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
     size_t new_size = old_size;
     int64_t window_len_ms = 100;
     int64_t window_len_ns = window_len_ms * 1000 * 1000;
-    bool window_expired = now > desc->window_begin_ns + window_len_ns;
+    int64_t elapsed_ns = now - desc->window_begin_ns;
+    bool window_expired = elapsed_ns > window_len_ns;
+    bool thrashing;
 
     if (desc->n_used_entries > desc->window_max_entries) {
         desc->window_max_entries = desc->n_used_entries;
     }
     rate = desc->window_max_entries * 100 / old_size;
+    thrashing = (double)desc->window_fills * window_len_ns /
+                MAX(elapsed_ns, window_len_ns) > 2 * old_size;
 
-    if (rate > 70) {
+    if (rate > 70 || thrashing) {
         new_size = MIN(old_size << 1, 1 << CPU_TLB_DYN_MAX_BITS);
     } else if (rate < 30 && window_expired) {
         size_t ceil = pow2ceil(desc->window_max_entries);
@@ -219,8 +237,10 @@ static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->ltlb_sizes = 0;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
+    memset(desc->ltable, 0, sizeof(desc->ltable));
 }
 
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
@@ -322,15 +342,29 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
-static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
+void tlb_fill_counts(size_t *pfill, size_t *pvictim, size_t *plarge)
+{
+    CPUState *cpu;
+    size_t fill = 0, victim = 0, large = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        fill += qatomic_read(&env_tlb(env)->c.fill_count);
+        victim += qatomic_read(&env_tlb(env)->c.victim_hit_count);
+        large += qatomic_read(&env_tlb(env)->c.large_hit_count);
+    }
+    *pfill = fill;
+    *pvictim = victim;
+    *plarge = large;
+}
+
+static void tlb_flush_by_mmuidx_work(CPUState *cpu, uint16_t asked)
 {
     CPUArchState *env = cpu->env_ptr;
-    uint16_t asked = data.host_int;
     uint16_t all_dirty, work, to_clean;
     int64_t now = get_clock_realtime();
 
-    assert_cpu_is_self(cpu);
-
     tlb_debug("mmu_idx:0x%04" PRIx16 "\n", asked);
 
     qemu_spin_lock(&env_tlb(env)->c.lock);
@@ -363,6 +397,18 @@ static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
     }
 }
 
+static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
+{
+    assert_cpu_is_self(cpu);
+    tlb_flush_by_mmuidx_work(cpu, data.host_int);
+}
+
+void tlb_flush_exclusive(CPUState *cpu)
+{
+    g_assert(current_cpu && cpu_in_exclusive_context(current_cpu));
+    tlb_flush_by_mmuidx_work(cpu, ALL_MMUIDX_BITS);
+}
+
 void tlb_flush_by_mmuidx(CPUState *cpu, uint16_t idxmap)
 {
     tlb_debug("mmu_idx: 0x%" PRIx16 "\n", idxmap);
@@ -1019,8 +1065,14 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
 static inline void tlb_set_dirty1_locked(CPUTLBEntry *tlb_entry,
                                          target_ulong vaddr)
 {
-    if (tlb_entry->addr_write == (vaddr | TLB_NOTDIRTY)) {
-        tlb_entry->addr_write = vaddr;
+#ifdef TARGET_CHERI
+    target_ulong keep = tlb_entry->addr_write & TLB_CHERI_TAGS;
+#else
+    target_ulong keep = 0;
+#endif
+
+    if (tlb_entry->addr_write == (vaddr | keep | TLB_NOTDIRTY)) {
+        tlb_entry->addr_write = vaddr | keep;
     }
 }
 
@@ -1048,7 +1100,7 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
     qemu_spin_unlock(&env_tlb(env)->c.lock);
 }
 
-/* Our TLB does not support large pages, so remember the area covered by
+/* Our main TLB does not support large pages, so remember the area covered by
    large pages and trigger a full TLB flush if these are invalidated.  */
 static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
                                target_ulong vaddr, target_ulong size)
@@ -1072,9 +1124,105 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
     env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
 }
 
+static inline size_t tlb_large_set(target_ulong addr, unsigned int bits)
+{
+    return (addr >> bits) & (CPU_LTLB_SETS - 1);
+}
+
+/*
+ * Remember a large mapping in the large page tlb. This is only done for
+ * targets that set CPUClass::tlb_fill_linear: others may pass the size of
+ * e.g. one stage of a nested translation. Its entries are only
+ * dropped when the whole mmu_idx is flushed, which tlb_add_large_page()
+ * ensures happens whenever any part of a large page is invalidated.
+ */
+static void tlb_large_add_locked(CPUTLBDesc *desc, target_ulong vaddr,
+                                 hwaddr paddr, MemTxAttrs attrs, int prot,
+                                 target_ulong size)
+{
+    unsigned int bits = ctz64(size);
+    target_ulong mask = ~(size - 1);
+    size_t s = tlb_large_set(vaddr, bits);
+    CPUTLBLargeEntry *le = NULL;
+    int i;
+
+    for (i = 0; i < CPU_LTLB_WAYS; i++) {
+        if (desc->ltable[s][i].mask == mask &&
+            desc->ltable[s][i].vaddr == (vaddr & mask)) {
+            le = &desc->ltable[s][i];
+            break;
+        }
+    }
+    if (!le) {
+        le = &desc->ltable[s][desc->lindex[s]++ % CPU_LTLB_WAYS];
+    }
+    le->vaddr = vaddr & mask;
+    le->mask = mask;
+    le->paddr = (paddr & TARGET_PAGE_MASK) -
+                (vaddr & (size - 1) & TARGET_PAGE_MASK);
+    le->attrs = attrs;
+    /* Refills are never for capability stores, see tlb_large_fill() */
+    le->attrs.tag_setting = 0;
+    le->prot = prot;
+    desc->ltlb_sizes |= 1ull << bits;
+}
+
+/*
+ * Refill the main tlb for ADDR from the large page tlb. Return false if
+ * no large mapping covers ADDR with the permissions ACCESS_TYPE needs,
+ * in which case the target has to walk the page tables.
+ */
+static bool tlb_large_fill(CPUState *cpu, target_ulong addr,
+                           MMUAccessType access_type, int mmu_idx)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    uint64_t sizes = desc->ltlb_sizes;
+    target_ulong page = addr & TARGET_PAGE_MASK;
+    int need;
+
+    switch (access_type) {
+    case MMU_DATA_LOAD:
+        need = PAGE_READ;
+        break;
+    case MMU_DATA_STORE:
+        need = PAGE_WRITE;
+        break;
+    case MMU_INST_FETCH:
+        need = PAGE_EXEC;
+        break;
+    default:
+        /* Capability accesses may need the target to set up tag memory. */
+        return false;
+    }
+
+    while (sizes) {
+        unsigned int bits = ctz64(sizes);
+        size_t s = tlb_large_set(addr, bits);
+        int i;
+
+        sizes &= sizes - 1;
+        for (i = 0; i < CPU_LTLB_WAYS; i++) {
+            CPUTLBLargeEntry le = desc->ltable[s][i];
+
+            if ((le.prot & need) && le.vaddr == (addr & le.mask)) {
+                tlb_set_page_with_attrs(cpu, page,
+                                        le.paddr + (page - le.vaddr),
+                                        le.attrs, le.prot, mmu_idx,
+                                        ~le.mask + 1);
+                qatomic_set(&env_tlb(env)->c.large_hit_count,
+                            env_tlb(env)->c.large_hit_count + 1);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 /* Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
- * supplied size is only used by tlb_flush_page.
+ * supplied size is used by tlb_flush_page and to remember the whole
+ * mapping in the large page tlb.
  *
  * Called from TCG-generated code, which is under an RCU read-side
  * critical section.
@@ -1096,6 +1244,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     target_ulong vaddr_page;
     int asidx = cpu_asidx_from_attrs(cpu, attrs);
     int wp_flags;
+    int large_prot = prot;
     bool is_ram, is_romd;
 
     assert_cpu_is_self(cpu);
@@ -1161,6 +1310,16 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
             } else if (cpu_physical_memory_is_clean(iotlb)) {
                 write_address |= TLB_NOTDIRTY;
             }
+#ifdef TARGET_CHERI
+            if (cheri_tagmem_atomic && tagmem != (uintptr_t)ALL_ZERO_TAGBLK) {
+                /*
+                 * The page may hold tags (untagged pages are mapped as
+                 * ALL_ZERO_TAGBLK), so plain stores must clear them under
+                 * the line lock.
+                 */
+                write_address |= TLB_CHERI_TAGS;
+            }
+#endif
         }
     } else {
         /* I/O or ROMD */
@@ -1194,6 +1353,11 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     /* Note that the tlb is no longer clean.  */
     tlb->c.dirty |= 1 << mmu_idx;
 
+    if (size > TARGET_PAGE_SIZE && CPU_GET_CLASS(cpu)->tlb_fill_linear) {
+        tlb_large_add_locked(desc, vaddr, paddr, attrs, large_prot, size);
+    }
+    desc->window_fills++;
+
     /* Make sure there's no cached translation for the new page.  */
     tlb_flush_vtlb_page_locked(env, mmu_idx, vaddr_page);
 
@@ -1232,6 +1396,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
      * looking up tag blocks for a given virtual address.
      */
     desc->iotlb[index].tagmem_write = desc->iotlb[index].tagmem_read = tagmem;
+    desc->iotlb[index].tag_ram = section->mr->ram_block;
 
     if (prot & PAGE_LC_CLEAR) {
         desc->iotlb[index].tagmem_read |= TLBENTRYCAP_FLAG_CLEAR;
@@ -1316,9 +1481,15 @@ static inline ram_addr_t qemu_ram_addr_from_host_nofail(void *ptr)
 static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
                      MMUAccessType access_type, int mmu_idx, uintptr_t retaddr)
 {
+    CPUArchState *env = cpu->env_ptr;
     CPUClass *cc = CPU_GET_CLASS(cpu);
     bool ok;
 
+    if (tlb_large_fill(cpu, addr, access_type, mmu_idx)) {
+        return;
+    }
+    qatomic_set(&env_tlb(env)->c.fill_count, env_tlb(env)->c.fill_count + 1);
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1477,6 +1648,8 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUIOTLBEntry tmpio, *io = &env_tlb(env)->d[mmu_idx].iotlb[index];
             CPUIOTLBEntry *vio = &env_tlb(env)->d[mmu_idx].viotlb[vidx];
             tmpio = *io; *io = *vio; *vio = tmpio;
+            qatomic_set(&env_tlb(env)->c.victim_hit_count,
+                        env_tlb(env)->c.victim_hit_count + 1);
             return true;
         }
     }
@@ -1543,6 +1716,23 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env, target_ulong addr)
     return get_page_addr_code_hostp(env, addr, NULL);
 }
 
+tb_page_addr_t get_page_addr_code_nofill(CPUArchState *env, target_ulong addr)
+{
+    uintptr_t mmu_idx = cpu_mmu_index(env, true);
+    uintptr_t index = tlb_index(env, mmu_idx, addr);
+    CPUTLBEntry *entry = tlb_entry(env, mmu_idx, addr);
+
+    if (!tlb_hit(entry->addr_code, addr) &&
+        !VICTIM_TLB_HIT(addr_code, addr)) {
+        return -1;
+    }
+    if (entry->addr_code & TLB_MMIO) {
+        return -1;
+    }
+    return qemu_ram_addr_from_host_nofail((void *)((uintptr_t)addr +
+                                                   entry->addend));
+}
+
 static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
                            CPUIOTLBEntry *iotlbentry, uintptr_t retaddr)
 {
@@ -1621,11 +1811,15 @@ probe_access_internal(CPUArchState *env, target_ulong addr, int fault_size,
             CPUState *cs = env_cpu(env);
             CPUClass *cc = CPU_GET_CLASS(cs);
 
-            if (!cc->tlb_fill(cs, addr, fault_size, access_type,
-                              mmu_idx, nonfault, retaddr)) {
-                /* Non-faulting page table read failed.  */
-                *phost = NULL;
-                return TLB_INVALID_MASK;
+            if (!tlb_large_fill(cs, addr, access_type, mmu_idx)) {
+                qatomic_set(&env_tlb(env)->c.fill_count,
+                            env_tlb(env)->c.fill_count + 1);
+                if (!cc->tlb_fill(cs, addr, fault_size, access_type,
+                                  mmu_idx, nonfault, retaddr)) {
+                    /* Non-faulting page table read failed.  */
+                    *phost = NULL;
+                    return TLB_INVALID_MASK;
+                }
             }
 
             /* TLB resize via tlb_fill may have moved the entry.  */
@@ -1823,7 +2017,12 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
     }
 
     /* Let the guest notice RMW on a write-only page.  */
+#ifdef TARGET_CHERI
+    if (unlikely(tlbe->addr_read !=
+                 (tlb_addr & ~(TLB_NOTDIRTY | TLB_CHERI_TAGS)))) {
+#else
     if (unlikely(tlbe->addr_read != (tlb_addr & ~TLB_NOTDIRTY))) {
+#endif
         tlb_fill(env_cpu(env), addr, 1 << s_bits, MMU_DATA_LOAD,
                  mmu_idx, retaddr);
         /* Since we don't support reads and writes to different addresses,
@@ -2538,6 +2737,15 @@ store_helper(CPUArchState *env, target_ulong addr, uint64_t val,
 
         haddr = (void *)((uintptr_t)addr + entry->addend);
 
+#ifdef TARGET_CHERI
+        /* Tagged page with atomic tag memory, clear the tag under its lock. */
+        if (tlb_addr & TLB_CHERI_TAGS) {
+            cheri_tag_store_data_locked(env, addr, haddr, val,
+                                        op ^ (need_swap * MO_BSWAP), mmu_idx);
+            return;
+        }
+#endif
+
         /*
          * Keep these two store_memop separate to ensure that the compiler
          * is able to fold the entire function to a single instruction.
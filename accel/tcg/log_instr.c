@@ -40,12 +40,27 @@
 #include "exec/exec-all.h"
 #include "exec/log.h"
 #include "exec/helper-proto.h"
+#include "exec/helper-gen.h"
 #include "exec/log_instr.h"
+#include "exec/log_instr-btrace.h"
+#include "exec/log_instr-cvtrace.h"
 #include "exec/memop.h"
 #include "disas/disas.h"
 #include "exec/translator.h"
 #include "tcg/tcg.h"
 #include "tcg/tcg-op.h"
+#include "qemu/error-report.h"
+#include "qemu/option.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#ifndef CONFIG_USER_ONLY
+#include "sysemu/cpus.h"
+#endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 
 /*
  * CHERI common instruction logging.
@@ -93,51 +108,10 @@
 
 /*
  * -dfilter ranges in common logging implementation.
+ * Sorted and non-overlapping, see qemu_log_in_addr_range().
  */
 extern GArray *debug_regions;
 
-/*
- * Instruction log info associated with each committed log entry.
- * This is stored in the per-cpu log cpustate.
- */
-typedef struct cpu_log_instr_info {
-#define cpu_log_iinfo_startzero asid
-    uint16_t asid;
-    int flags;
-/* Entry contains a synchronous exception */
-#define LI_FLAG_INTR_TRAP 1
-/* Entry contains an asynchronous exception */
-#define LI_FLAG_INTR_ASYNC (1 << 1)
-#define LI_FLAG_INTR_MASK 0x3
-/* Entry contains a CPU mode-switch and associated code */
-#define LI_FLAG_MODE_SWITCH (1 << 2)
-
-    qemu_log_instr_cpu_mode_t next_cpu_mode;
-    uint32_t intr_code;
-    target_ulong intr_vector;
-    target_ulong intr_faultaddr;
-
-    target_ulong pc;
-    /* Generic instruction opcode buffer */
-    int insn_size;
-    char insn_bytes[TARGET_MAX_INSN_SIZE];
-#define cpu_log_iinfo_endzero mem
-    /*
-     * For now we allow multiple accesses to be tied to one instruction.
-     * Some architectures may have multiple memory accesses
-     * in the same instruction (e.g. x86-64 pop r/m64,
-     * vector/matrix instructions, load/store pair). It is unclear
-     * whether we would treat these as multiple trace "entities".
-     *
-     * Array of log_meminfo_t
-     */
-    GArray *mem;
-    /* Register modifications. Array of log_reginfo_t */
-    GArray *regs;
-    /* Extra text-only log */
-    GString *txt_buffer;
-} cpu_log_instr_info_t;
-
 /*
  * Register update info.
  * This records a CPU register update occurred during an instruction.
@@ -178,6 +152,86 @@ typedef struct {
     };
 } log_meminfo_t;
 
+/* Number of register updates and memory accesses stored inline in an entry */
+#define LOG_INSTR_INLINE_REGS 2
+#define LOG_INSTR_INLINE_MEM 2
+/* Size of the per-CPU extra text arena */
+#define LOG_INSTR_TXT_ARENA_SIZE (64 * KiB)
+
+/*
+ * Instruction log info associated with each committed log entry.
+ * This is stored in the per-cpu log cpustate.
+ *
+ * Register updates, memory accesses and extra text are recorded without
+ * touching the heap in the common case: the first few register and memory
+ * entries are stored inline and the text is bump-allocated from the per-CPU
+ * text arena. Only entries that overflow these spill to heap buffers, which
+ * are kept around for reuse.
+ */
+typedef struct cpu_log_instr_info {
+#define cpu_log_iinfo_startzero asid
+    uint16_t asid;
+    int flags;
+/* Entry contains a synchronous exception */
+#define LI_FLAG_INTR_TRAP 1
+/* Entry contains an asynchronous exception */
+#define LI_FLAG_INTR_ASYNC (1 << 1)
+#define LI_FLAG_INTR_MASK 0x3
+/* Entry contains a CPU mode-switch and associated code */
+#define LI_FLAG_MODE_SWITCH (1 << 2)
+
+    qemu_log_instr_cpu_mode_t next_cpu_mode;
+    uint32_t intr_code;
+    target_ulong intr_vector;
+    target_ulong intr_faultaddr;
+
+    target_ulong pc;
+    /* Generic instruction opcode buffer */
+    int insn_size;
+    char insn_bytes[TARGET_MAX_INSN_SIZE];
+    /* Number of memory accesses and register modifications */
+    int n_mem;
+    int n_regs;
+    /* Extra text-only log, in the text arena or in txt_overflow */
+    const char *txt;
+    size_t txt_len;
+#define cpu_log_iinfo_endzero mem
+    /*
+     * For now we allow multiple accesses to be tied to one instruction.
+     * Some architectures may have multiple memory accesses
+     * in the same instruction (e.g. x86-64 pop r/m64,
+     * vector/matrix instructions, load/store pair). It is unclear
+     * whether we would treat these as multiple trace "entities".
+     *
+     * Use log_instr_mem() to access entry i of n_mem.
+     */
+    log_meminfo_t mem[LOG_INSTR_INLINE_MEM];
+    /* Register modifications. Use log_instr_reg() to access them. */
+    log_reginfo_t regs[LOG_INSTR_INLINE_REGS];
+    /* Entries beyond the inline ones, allocated on first overflow */
+    GArray *mem_overflow;
+    GArray *regs_overflow;
+    GString *txt_overflow;
+} cpu_log_instr_info_t;
+
+static inline log_meminfo_t *log_instr_mem(cpu_log_instr_info_t *iinfo, int i)
+{
+    if (likely(i < LOG_INSTR_INLINE_MEM)) {
+        return &iinfo->mem[i];
+    }
+    return &g_array_index(iinfo->mem_overflow, log_meminfo_t,
+                          i - LOG_INSTR_INLINE_MEM);
+}
+
+static inline log_reginfo_t *log_instr_reg(cpu_log_instr_info_t *iinfo, int i)
+{
+    if (likely(i < LOG_INSTR_INLINE_REGS)) {
+        return &iinfo->regs[i];
+    }
+    return &g_array_index(iinfo->regs_overflow, log_reginfo_t,
+                          i - LOG_INSTR_INLINE_REGS);
+}
+
 /*
  * Callbacks defined by a trace format implementation.
  * These are called to covert instruction tracing events to the corresponding
@@ -193,6 +247,7 @@ typedef struct trace_fmt_hooks trace_fmt_hooks_t;
 
 /* Global trace format selector. Defaults to text tracing */
 qemu_log_instr_fmt_t qemu_log_instr_format = QLI_FMT_TEXT;
+bool qemu_log_instr_dynamic = false;
 
 /* Current format callbacks. */
 static trace_fmt_hooks_t *trace_format = NULL;
@@ -200,41 +255,6 @@ static trace_fmt_hooks_t *trace_format = NULL;
 /* Existing format callbacks list, indexed by qemu_log_instr_fmt_t */
 static trace_fmt_hooks_t trace_formats[];
 
-/*
- * CHERI binary trace format, originally used for MIPS only.
- * The format is limited to one entry per instruction, each
- * entry can hold at most one register modification and one
- * memory address.
- * Note that the CHERI format is the legacy MIPS format and
- * assumes big-endian byte order.
- */
-typedef struct {
-    uint8_t entry_type;
-#define CTE_NO_REG  0   /* No register is changed. */
-#define CTE_GPR     1   /* GPR change (val2) */
-#define CTE_LD_GPR  2   /* Load into GPR (val2) from address (val1) */
-#define CTE_ST_GPR  3   /* Store from GPR (val2) to address (val1) */
-#define CTE_CAP     11  /* Cap change (val2,val3,val4,val5) */
-#define CTE_LD_CAP  12  /* Load Cap (val2,val3,val4,val5) from addr (val1) */
-#define CTE_ST_CAP  13  /* Store Cap (val2,val3,val4,val5) to addr (val1) */
-    uint8_t exception;  /* 0=none, 1=TLB Mod, 2=TLB Load, 3=TLB Store, etc. */
-#define CTE_EXCEPTION_NONE 31
-    uint16_t cycles;    /* Currently not used. */
-    uint32_t inst;      /* Encoded instruction. */
-    uint64_t pc;        /* PC value of instruction. */
-    uint64_t val1;      /* val1 is used for memory address. */
-    uint64_t val2;      /* val2, val3, val4, val5 are used for reg content. */
-    uint64_t val3;
-    uint64_t val4;
-    uint64_t val5;
-    uint8_t thread;     /* Hardware thread/CPU (i.e. cpu->cpu_index ) */
-    uint8_t asid;       /* Address Space ID */
-} __attribute__((packed)) cheri_trace_entry_t;
-
-/* Version 3 Cheri Stream Trace header info */
-#define CTE_QEMU_VERSION    (0x80U + 3)
-#define CTE_QEMU_MAGIC      "CheriTraceV03"
-
 /* Number of per-cpu ring buffer entries for ring-buffer tracing mode */
 #define MIN_ENTRY_BUFFER_SIZE (1 << 16)
 
@@ -379,8 +399,8 @@ static void emit_text_entry(CPUArchState *env, cpu_log_instr_info_t *iinfo)
     }
 
     /* Dump memory access */
-    for (i = 0; i < iinfo->mem->len; i++) {
-        log_meminfo_t *minfo = &g_array_index(iinfo->mem, log_meminfo_t, i);
+    for (i = 0; i < iinfo->n_mem; i++) {
+        log_meminfo_t *minfo = log_instr_mem(iinfo, i);
         if (minfo->flags & LMI_LD) {
             emit_text_ldst(minfo, "Read");
         } else if (minfo->flags & LMI_ST) {
@@ -389,14 +409,14 @@ static void emit_text_entry(CPUArchState *env, cpu_log_instr_info_t *iinfo)
     }
 
     /* Dump register changes and side-effects */
-    for (i = 0; i < iinfo->regs->len; i++) {
-        log_reginfo_t *rinfo = &g_array_index(iinfo->regs, log_reginfo_t, i);
+    for (i = 0; i < iinfo->n_regs; i++) {
+        log_reginfo_t *rinfo = log_instr_reg(iinfo, i);
         emit_text_reg(rinfo);
     }
 
     /* Dump extra logged messages, if any */
-    if (iinfo->txt_buffer->len > 0)
-        qemu_log("%s", iinfo->txt_buffer->str);
+    if (iinfo->txt_len > 0)
+        qemu_log("%.*s", (int)iinfo->txt_len, iinfo->txt);
 }
 
 /*
@@ -479,65 +499,1202 @@ static void emit_cvtrace_entry(CPUArchState *env, cpu_log_instr_info_t *iinfo)
         entry.exception = CTE_EXCEPTION_NONE;
     }
 
-    if (iinfo->regs->len) {
-        log_reginfo_t *rinfo = &g_array_index(iinfo->regs, log_reginfo_t, 0);
-#ifndef TARGET_CHERI
-        log_assert(!reginfo_is_cap(rinfo) && "Capability register access "
-                   "without CHERI support");
-#else
-        if (reginfo_is_cap(rinfo)) {
-            cap_register_t intcap;
-            cap_register_t *cr = &rinfo->cap;
+    if (iinfo->n_regs) {
+        log_reginfo_t *rinfo = log_instr_reg(iinfo, 0);
+#ifndef TARGET_CHERI
+        log_assert(!reginfo_is_cap(rinfo) && "Capability register access "
+                   "without CHERI support");
+#else
+        if (reginfo_is_cap(rinfo)) {
+            cap_register_t intcap;
+            cap_register_t *cr = &rinfo->cap;
+
+            if (!reginfo_has_cap(rinfo)) {
+                // cvtrace expects a null capability in the integer case
+                cr = null_capability(&intcap);
+            }
+            uint64_t metadata = (((uint64_t)cr->cr_tag << 63) |
+                                 ((uint64_t)cap_get_otype_signext(cr) << 32) |
+                                 ((uint64_t)COMBINED_PERMS_VALUE(cr) << 1) |
+                                 (uint64_t)(cap_is_unsealed(cr) ? 0 : 1));
+
+            entry.entry_type = CTE_CAP;
+            entry.val2 = cpu_to_be64(metadata);
+            entry.val3 = cpu_to_be64(cap_get_cursor(cr));
+            entry.val4 = cpu_to_be64(cap_get_base(cr));
+            entry.val5 = cpu_to_be64(cap_get_length_sat(cr));
+        } else
+#endif
+        {
+            entry.entry_type = CTE_GPR;
+            entry.val2 = cpu_to_be64(rinfo->gpr);
+        }
+    }
+
+    if (iinfo->n_mem) {
+        log_meminfo_t *minfo = log_instr_mem(iinfo, 0);
+#ifndef TARGET_CHERI
+        log_assert((minfo->flags & LMI_CAP) == 0 && "Capability memory access "
+                   "without CHERI support");
+#endif
+        entry.val1 = cpu_to_be64(minfo->addr);
+        // Hack to avoid checking for GPR or CAP
+        if (minfo->flags & LMI_LD)
+            entry.entry_type += 1;
+        else if (minfo->flags & LMI_ST)
+            entry.entry_type += 2;
+    }
+
+    logfile = qemu_log_lock();
+    fwrite(&entry, sizeof(entry), 1, logfile);
+    qemu_log_unlock(logfile);
+}
+
+static void emit_cvtrace_start(CPUArchState *env, target_ulong pc)
+{
+    // TODO(am2419) Emit an event for instruction logging start
+}
+
+static void emit_cvtrace_stop(CPUArchState *env, target_ulong pc)
+{
+    // TODO(am2419) Emit an event for instruction logging stop
+}
+
+/* Binary trace format emitters */
+
+/*
+ * Compact binary trace format.
+ *
+ * Entries are varint encoded directly into per-CPU single-producer/
+ * single-consumer rings of fixed size chunks on the vCPU thread. A single
+ * writer thread drains the published chunks of all CPUs, compresses them
+ * with zstd (if available) and writes them out as frames. The vCPU only
+ * blocks if the writer falls behind by a whole ring.
+ *
+ * File layout (all fixed-size integers are little-endian):
+ *   header: magic "QEMUBTRC", u8 version, u8 flags (BTRACE_HDR_ZSTD),
+ *           u8 TARGET_LONG_BITS, u8 capability size (0 without CHERI),
+ *           u8 name length, target name
+ *   frame:  u32 cpu index, u32 raw length, u32 stored length, payload
+ *
+ * Each frame payload is self-contained: delta-encoding state and interned
+ * register names are reset at every chunk boundary, so frames can be
+ * decoded independently. See scripts/qemu-btrace-decode.py for the record
+ * layout.
+ */
+#define BTRACE_CHUNK_SIZE (256 * KiB)
+#define BTRACE_RING_CHUNKS 16
+/* Extra text is truncated so that any entry fits in an empty chunk */
+#define BTRACE_MAX_TEXT (BTRACE_CHUNK_SIZE / 2)
+
+typedef struct btrace_cpu {
+    int cpu_index;
+    /* Producer side, only touched by the vCPU thread */
+    uint8_t *ring;
+    uint32_t fill;
+    GHashTable *names;
+    uint64_t last_pc;
+    uint64_t last_addr;
+    uint16_t last_asid;
+    /* Number of chunks published and consumed */
+    unsigned head;
+    unsigned tail;
+    uint32_t len[BTRACE_RING_CHUNKS];
+    /* Signalled by the writer when it has consumed a chunk */
+    QemuEvent space;
+} btrace_cpu_t;
+
+static struct {
+    /* Protects cpus, which only grows */
+    QemuMutex lock;
+    GPtrArray *cpus;
+    QemuThread thread;
+    /* Signalled by producers when they publish a chunk */
+    QemuEvent work;
+    bool stopping;
+} btrace;
+
+static inline uint8_t *btrace_chunk(btrace_cpu_t *bt, unsigned n)
+{
+    return bt->ring + (n % BTRACE_RING_CHUNKS) * BTRACE_CHUNK_SIZE;
+}
+
+static inline uint8_t *btrace_put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static inline uint8_t *btrace_put_svarint(uint8_t *p, int64_t v)
+{
+    return btrace_put_varint(p, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static inline uint8_t *btrace_put_bytes(uint8_t *p, const void *buf,
+                                        size_t len)
+{
+    p = btrace_put_varint(p, len);
+    memcpy(p, buf, len);
+    return p + len;
+}
+
+/*
+ * Compress @len bytes at @data for a frame. Returns the frame
+ * payload, which is either @data or a buffer owned by the writer thread.
+ */
+static const void *btrace_compress(const uint8_t *data, uint32_t len,
+                                   size_t *out_len)
+{
+#ifdef CONFIG_ZSTD
+    static void *zbuf;
+    static size_t zbuf_size;
+    static ZSTD_CCtx *zctx;
+
+    if (!zctx) {
+        zctx = ZSTD_createCCtx();
+        zbuf_size = ZSTD_compressBound(BTRACE_CHUNK_SIZE);
+        zbuf = g_malloc(zbuf_size);
+    }
+    *out_len = ZSTD_compressCCtx(zctx, zbuf, zbuf_size, data, len, 1);
+    if (ZSTD_isError(*out_len)) {
+        error_report("binary trace: zstd compression failed: %s",
+                     ZSTD_getErrorName(*out_len));
+        return NULL;
+    }
+    return zbuf;
+#else
+    *out_len = len;
+    return data;
+#endif
+}
+
+static void btrace_write_frame(btrace_cpu_t *bt, const uint8_t *data,
+                               uint32_t len)
+{
+    uint32_t hdr[3];
+    size_t out_len;
+    const void *out = btrace_compress(data, len, &out_len);
+    FILE *logfile;
+
+    if (!out) {
+        return;
+    }
+    hdr[0] = cpu_to_le32(bt->cpu_index);
+    hdr[1] = cpu_to_le32(len);
+    hdr[2] = cpu_to_le32(out_len);
+    logfile = qemu_log_lock();
+    if (logfile) {
+        fwrite(hdr, sizeof(hdr), 1, logfile);
+        fwrite(out, out_len, 1, logfile);
+    }
+    qemu_log_unlock(logfile);
+}
+
+/*
+ * Drain published chunks from all CPUs. Returns true if any chunk was
+ * written. Only btrace.cpus is read under the lock: the chunks between tail
+ * and head belong to the writer until it advances tail, so compression and
+ * I/O need no lock.
+ */
+static bool btrace_drain(void)
+{
+    static GPtrArray *cpus;
+    bool progress = false;
+    int i;
+
+    if (!cpus) {
+        cpus = g_ptr_array_new();
+    }
+    qemu_mutex_lock(&btrace.lock);
+    g_ptr_array_set_size(cpus, 0);
+    for (i = 0; i < btrace.cpus->len; i++) {
+        g_ptr_array_add(cpus, g_ptr_array_index(btrace.cpus, i));
+    }
+    qemu_mutex_unlock(&btrace.lock);
+
+    for (i = 0; i < cpus->len; i++) {
+        btrace_cpu_t *bt = g_ptr_array_index(cpus, i);
+        unsigned head = qatomic_load_acquire(&bt->head);
+
+        while (bt->tail != head) {
+            btrace_write_frame(bt, btrace_chunk(bt, bt->tail),
+                               bt->len[bt->tail % BTRACE_RING_CHUNKS]);
+            qatomic_store_release(&bt->tail, bt->tail + 1);
+            qemu_event_set(&bt->space);
+            progress = true;
+        }
+    }
+    return progress;
+}
+
+static void *btrace_writer_thread(void *opaque)
+{
+    rcu_register_thread();
+    for (;;) {
+        qemu_event_reset(&btrace.work);
+        if (btrace_drain()) {
+            continue;
+        }
+        if (qatomic_read(&btrace.stopping)) {
+            break;
+        }
+        qemu_event_wait(&btrace.work);
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/* Hand the current chunk to the writer, waiting for a free one if needed. */
+static void btrace_publish(btrace_cpu_t *bt)
+{
+    if (bt->fill == 0) {
+        return;
+    }
+    bt->len[bt->head % BTRACE_RING_CHUNKS] = bt->fill;
+    qatomic_store_release(&bt->head, bt->head + 1);
+    qemu_event_set(&btrace.work);
+
+    while (bt->head - qatomic_load_acquire(&bt->tail) >= BTRACE_RING_CHUNKS) {
+        qemu_event_reset(&bt->space);
+        if (bt->head - qatomic_load_acquire(&bt->tail) >= BTRACE_RING_CHUNKS) {
+            qemu_event_wait(&bt->space);
+        }
+    }
+    /* Every chunk can be decoded on its own. */
+    bt->fill = 0;
+    bt->last_pc = 0;
+    bt->last_addr = 0;
+    bt->last_asid = 0;
+    g_hash_table_remove_all(bt->names);
+}
+
+/*
+ * Keep the vCPUs out of their trace buffers while the shutdown path drains
+ * them. System emulation shuts down from the main thread once
+ * vm_shutdown() has paused every vCPU; there is no current_cpu to run an
+ * exclusive section on and none is needed. linux-user exits on the thread
+ * of the vCPU that called exit_group, while the others may still run.
+ */
+static bool log_instr_shutdown_begin(void)
+{
+#ifndef CONFIG_USER_ONLY
+    if (!qemu_in_vcpu_thread()) {
+        return false;
+    }
+#endif
+    start_exclusive();
+    return true;
+}
+
+static void log_instr_shutdown_end(bool exclusive)
+{
+    if (exclusive) {
+        end_exclusive();
+    }
+}
+
+/* Flush all CPUs and wait for the writer to finish. */
+static void btrace_shutdown(void)
+{
+    bool exclusive;
+    int i;
+
+    if (!btrace.cpus) {
+        return;
+    }
+    /*
+     * No vCPU may be inside generated code while we act as the producer of
+     * its partially filled chunk. A ring that is completely full cannot take
+     * the partial chunk; it is dropped.
+     */
+    exclusive = log_instr_shutdown_begin();
+    qemu_mutex_lock(&btrace.lock);
+    for (i = 0; i < btrace.cpus->len; i++) {
+        btrace_cpu_t *bt = g_ptr_array_index(btrace.cpus, i);
+
+        if (bt->fill &&
+            bt->head - qatomic_load_acquire(&bt->tail) < BTRACE_RING_CHUNKS) {
+            bt->len[bt->head % BTRACE_RING_CHUNKS] = bt->fill;
+            qatomic_store_release(&bt->head, bt->head + 1);
+            bt->fill = 0;
+        }
+    }
+    qemu_mutex_unlock(&btrace.lock);
+    log_instr_shutdown_end(exclusive);
+    qatomic_set(&btrace.stopping, true);
+    qemu_event_set(&btrace.work);
+    qemu_thread_join(&btrace.thread);
+    qemu_log_flush();
+}
+
+static btrace_cpu_t *btrace_get_cpu(CPUArchState *env)
+{
+    cpu_log_instr_state_t *cpulog = get_cpu_log_state(env);
+    btrace_cpu_t *bt = cpulog->fmt_data;
+
+    if (likely(bt)) {
+        return bt;
+    }
+    bt = g_new0(btrace_cpu_t, 1);
+    bt->cpu_index = env_cpu(env)->cpu_index;
+    bt->ring = qemu_memalign(qemu_real_host_page_size,
+                             BTRACE_CHUNK_SIZE * BTRACE_RING_CHUNKS);
+    bt->names = g_hash_table_new(NULL, NULL);
+    qemu_event_init(&bt->space, false);
+    qemu_mutex_lock(&btrace.lock);
+    g_ptr_array_add(btrace.cpus, bt);
+    qemu_mutex_unlock(&btrace.lock);
+    cpulog->fmt_data = bt;
+    return bt;
+}
+
+/*
+ * Make sure that @need bytes are available in the current chunk and return
+ * the write pointer.
+ */
+static inline uint8_t *btrace_reserve(btrace_cpu_t *bt, size_t need)
+{
+    log_assert(need <= BTRACE_CHUNK_SIZE);
+    if (bt->fill + need > BTRACE_CHUNK_SIZE) {
+        btrace_publish(bt);
+    }
+    return btrace_chunk(bt, bt->head) + bt->fill;
+}
+
+static inline void btrace_commit(btrace_cpu_t *bt, uint8_t *end)
+{
+    bt->fill = end - btrace_chunk(bt, bt->head);
+}
+
+/* Worst case size of a register name definition */
+#define BTRACE_NAME_MAX (1 + 2 * 10 + 256)
+
+/* Intern @name, emitting a BTR_NAME record on first use in this chunk. */
+static inline uint8_t *btrace_put_name(btrace_cpu_t *bt, uint8_t *p,
+                                       uint8_t *rec, const char *name)
+{
+    gpointer id;
+
+    if (!g_hash_table_lookup_extended(bt->names, name, NULL, &id)) {
+        size_t len = MIN(strlen(name), 255);
+        id = GUINT_TO_POINTER(g_hash_table_size(bt->names));
+        g_hash_table_insert(bt->names, (gpointer)name, id);
+        /* Name definitions go in front of the record that uses them. */
+        size_t rec_len = p - rec;
+        uint8_t def[BTRACE_NAME_MAX], *d = def;
+        *d++ = BTR_NAME;
+        d = btrace_put_varint(d, GPOINTER_TO_UINT(id));
+        d = btrace_put_bytes(d, name, len);
+        memmove(rec + (d - def), rec, rec_len);
+        memcpy(rec, def, d - def);
+        p += d - def;
+    }
+    return btrace_put_varint(p, GPOINTER_TO_UINT(id));
+}
+
+#ifdef TARGET_CHERI
+#define BTRACE_CAP_MAX (1 + 7 * 10)
+
+static inline uint8_t *btrace_put_cap(uint8_t *p, const cap_register_t *cr)
+{
+    uint64_t cursor = cap_get_cursor(cr);
+
+    *p++ = cr->cr_tag | (cap_is_unsealed(cr) ? 0 : 2);
+    p = btrace_put_varint(p, cursor);
+    p = btrace_put_svarint(p, (int64_t)(cap_get_base(cr) - cursor));
+    p = btrace_put_varint(p, cap_get_length_sat(cr));
+    p = btrace_put_varint(p, COMBINED_PERMS_VALUE(cr));
+    p = btrace_put_svarint(p, cap_get_otype_signext(cr));
+    p = btrace_put_varint(p, CAP_cc(compress_mem)(cr));
+    return p;
+}
+#else
+#define BTRACE_CAP_MAX 0
+#endif
+
+static void emit_binary_header(CPUArchState *env)
+{
+    FILE *logfile;
+    uint8_t hdr[sizeof(BTRACE_MAGIC) + 5 + 32], *p = hdr;
+    size_t name_len = MIN(strlen(TARGET_NAME), 32);
+
+    qemu_mutex_init(&btrace.lock);
+    qemu_event_init(&btrace.work, false);
+    btrace.cpus = g_ptr_array_new();
+    qemu_thread_create(&btrace.thread, "log-instr-writer",
+                       btrace_writer_thread, NULL, QEMU_THREAD_JOINABLE);
+
+    memcpy(p, BTRACE_MAGIC, strlen(BTRACE_MAGIC));
+    p += strlen(BTRACE_MAGIC);
+    *p++ = BTRACE_VERSION;
+#ifdef CONFIG_ZSTD
+    *p++ = BTRACE_HDR_ZSTD;
+#else
+    *p++ = 0;
+#endif
+    *p++ = TARGET_LONG_BITS;
+#ifdef TARGET_CHERI
+    *p++ = CHERI_CAP_SIZE;
+#else
+    *p++ = 0;
+#endif
+    *p++ = name_len;
+    memcpy(p, TARGET_NAME, name_len);
+    p += name_len;
+
+    logfile = qemu_log_lock();
+    if (logfile) {
+        fwrite(hdr, p - hdr, 1, logfile);
+    }
+    qemu_log_unlock(logfile);
+}
+
+static void emit_binary_entry(CPUArchState *env, cpu_log_instr_info_t *iinfo)
+{
+    btrace_cpu_t *bt = btrace_get_cpu(env);
+    size_t text_len = MIN(iinfo->txt_len, BTRACE_MAX_TEXT);
+    size_t need = 16 + 5 * 10 + TARGET_MAX_INSN_SIZE + 10 + text_len +
+        iinfo->n_regs * (BTRACE_NAME_MAX + 2 + 10 + BTRACE_CAP_MAX) +
+        iinfo->n_mem * (2 + 10 + 10 + BTRACE_CAP_MAX);
+    uint8_t *rec, *p;
+    uint8_t flags = 0;
+    int i;
+
+    if (need > BTRACE_CHUNK_SIZE) {
+        warn_report_once("binary trace: dropping oversized entry");
+        return;
+    }
+    rec = p = btrace_reserve(bt, need);
+
+    if (iinfo->asid != bt->last_asid) {
+        flags |= BTR_F_ASID;
+    }
+    if (iinfo->flags & LI_FLAG_INTR_TRAP) {
+        flags |= BTR_F_TRAP;
+    } else if (iinfo->flags & LI_FLAG_INTR_ASYNC) {
+        flags |= BTR_F_INTR;
+    }
+    if (iinfo->flags & LI_FLAG_MODE_SWITCH) {
+        flags |= BTR_F_MODE;
+    }
+    if (text_len) {
+        flags |= BTR_F_TEXT;
+    }
+
+    *p++ = BTR_INSN;
+    *p++ = flags;
+    p = btrace_put_svarint(p, (int64_t)(iinfo->pc - bt->last_pc));
+    bt->last_pc = iinfo->pc;
+    p = btrace_put_bytes(p, iinfo->insn_bytes, iinfo->insn_size);
+    if (flags & BTR_F_ASID) {
+        p = btrace_put_varint(p, iinfo->asid);
+        bt->last_asid = iinfo->asid;
+    }
+    if (flags & (BTR_F_TRAP | BTR_F_INTR)) {
+        p = btrace_put_varint(p, iinfo->intr_code);
+        p = btrace_put_varint(p, iinfo->intr_vector);
+        if (flags & BTR_F_TRAP) {
+            p = btrace_put_varint(p, iinfo->intr_faultaddr);
+        }
+    }
+    if (flags & BTR_F_MODE) {
+        *p++ = iinfo->next_cpu_mode;
+    }
+
+    p = btrace_put_varint(p, iinfo->n_regs);
+    for (i = 0; i < iinfo->n_regs; i++) {
+        log_reginfo_t *rinfo = log_instr_reg(iinfo, i);
+
+        uint8_t rflags = reginfo_is_cap(rinfo) ? BTR_R_CAP : 0;
+
+        /* New name definitions are inserted in front of the record. */
+        p = btrace_put_name(bt, p, rec, rinfo->name);
+#ifdef TARGET_CHERI
+        if (reginfo_has_cap(rinfo)) {
+            *p++ = rflags | BTR_R_HOLDS;
+            p = btrace_put_cap(p, &rinfo->cap);
+            continue;
+        }
+#endif
+        *p++ = rflags;
+        p = btrace_put_varint(p, rinfo->gpr);
+    }
+
+    p = btrace_put_varint(p, iinfo->n_mem);
+    for (i = 0; i < iinfo->n_mem; i++) {
+        log_meminfo_t *minfo = log_instr_mem(iinfo, i);
+
+        *p++ = minfo->flags;
+        *p++ = (minfo->flags & LMI_CAP) ? 0 : memop_size(minfo->op);
+        p = btrace_put_svarint(p, (int64_t)(minfo->addr - bt->last_addr));
+        bt->last_addr = minfo->addr;
+#ifdef TARGET_CHERI
+        if (minfo->flags & LMI_CAP) {
+            p = btrace_put_cap(p, &minfo->cap);
+            continue;
+        }
+#endif
+        p = btrace_put_varint(p, minfo->value);
+    }
+
+    if (flags & BTR_F_TEXT) {
+        p = btrace_put_bytes(p, iinfo->txt, text_len);
+    }
+    btrace_commit(bt, p);
+}
+
+static void emit_binary_event(CPUArchState *env, uint8_t type,
+                              target_ulong pc)
+{
+    btrace_cpu_t *bt = btrace_get_cpu(env);
+    uint8_t *p = btrace_reserve(bt, 2 + 10);
+
+    *p++ = type;
+    *p++ = get_cpu_log_state(env)->loglevel;
+    p = btrace_put_varint(p, pc);
+    btrace_commit(bt, p);
+}
+
+static void emit_binary_start(CPUArchState *env, target_ulong pc)
+{
+    emit_binary_event(env, BTR_START, pc);
+}
+
+static void emit_binary_stop(CPUArchState *env, target_ulong pc)
+{
+    emit_binary_event(env, BTR_STOP, pc);
+    /* Make the trace up to here visible without waiting for a full chunk. */
+    btrace_publish(btrace_get_cpu(env));
+}
+
+/* Perfetto trace format emitters */
+
+/*
+ * Streaming protobuf trace format that can be opened directly by the
+ * Perfetto UI and trace processor.
+ *
+ * The output is a perfetto.protos.Trace message, which is simply a
+ * concatenation of TracePacket records. Each CPU is a separate packet
+ * sequence with a track of its own. Instructions are instant events named
+ * after their disassembly, register and memory updates are attached as
+ * debug annotations. Logging start/stop open and close a slice on the CPU
+ * track and CPU mode switches are slices on a child "mode" track.
+ *
+ * Disassembly and annotation names are interned per sequence. Packets are
+ * encoded into a per-CPU buffer that is written out when full, when
+ * logging stops and at exit, so packets from different CPUs interleave
+ * but are never split.
+ */
+
+/* Trace */
+#define PFT_TRACE_PACKET        1
+/* TracePacket */
+#define PFT_PKT_TIMESTAMP       8
+#define PFT_PKT_SEQ_ID          10
+#define PFT_PKT_TRACK_EVENT     11
+#define PFT_PKT_INTERNED_DATA   12
+#define PFT_PKT_SEQ_FLAGS       13
+#define PFT_PKT_TRACK_DESC      60
+#define PFT_SEQ_INCREMENTAL_STATE_CLEARED 1
+#define PFT_SEQ_NEEDS_INCREMENTAL_STATE   2
+/* TrackDescriptor */
+#define PFT_TD_UUID             1
+#define PFT_TD_NAME             2
+#define PFT_TD_PARENT_UUID      5
+/* TrackEvent */
+#define PFT_TE_ANNOTATION       4
+#define PFT_TE_TYPE             9
+#define PFT_TE_NAME_IID         10
+#define PFT_TE_TRACK_UUID       11
+#define PFT_TE_SLICE_BEGIN      1
+#define PFT_TE_SLICE_END        2
+#define PFT_TE_INSTANT          3
+/* DebugAnnotation */
+#define PFT_DA_NAME_IID         1
+#define PFT_DA_BOOL             2
+#define PFT_DA_UINT             3
+#define PFT_DA_INT              4
+#define PFT_DA_STRING           6
+#define PFT_DA_POINTER          7
+#define PFT_DA_DICT             11
+#define PFT_DA_ARRAY            12
+/* InternedData */
+#define PFT_ID_EVENT_NAMES      2
+#define PFT_ID_ANNOTATION_NAMES 3
+/* EventName, DebugAnnotationName */
+#define PFT_IN_IID              1
+#define PFT_IN_NAME             2
+
+#define PFT_BUF_SIZE (1 * MiB)
+#define PFT_MAX_STR 255
+#define PFT_MAX_TEXT (PFT_BUF_SIZE / 4)
+/* Drop interned state when this many instructions have been interned */
+#define PFT_MAX_INTERNED (1 << 20)
+/* Worst case packet sizes, including interned names defined on first use */
+#define PFT_ENTRY_MAX 1024
+#define PFT_REG_MAX 768
+#define PFT_MEM_MAX 768
+
+typedef struct pftrace_insn_key {
+    target_ulong pc;
+    int insn_size;
+    char insn_bytes[TARGET_MAX_INSN_SIZE];
+} pftrace_insn_key_t;
+
+typedef struct pftrace_cpu {
+    uint32_t seq_id;
+    uint64_t track_uuid;
+    uint64_t mode_track_uuid;
+    uint64_t last_ts;
+    uint8_t *buf;
+    uint32_t fill;
+    /* Interned data defined by the packet being encoded */
+    uint8_t *intern;
+    uint32_t intern_fill;
+    /* Static event name -> iid */
+    GHashTable *names;
+    /* Instruction (pftrace_insn_key_t) -> disassembly iid */
+    GHashTable *insn_names;
+    /* Static annotation name -> iid */
+    GHashTable *annotation_names;
+    uint64_t next_name_iid;
+    uint64_t next_annotation_iid;
+    /* The next packet starts with fresh incremental state */
+    bool state_cleared;
+    bool mode_open;
+} pftrace_cpu_t;
+
+static struct {
+    QemuMutex lock;
+    GPtrArray *cpus;
+} pftrace;
+
+static inline uint8_t *pft_put_tag(uint8_t *p, unsigned field, unsigned wt)
+{
+    return btrace_put_varint(p, (field << 3) | wt);
+}
+
+static inline uint8_t *pft_put_uint(uint8_t *p, unsigned field, uint64_t v)
+{
+    p = pft_put_tag(p, field, 0);
+    return btrace_put_varint(p, v);
+}
+
+static inline uint8_t *pft_put_str(uint8_t *p, unsigned field,
+                                   const char *str, size_t len)
+{
+    p = pft_put_tag(p, field, 2);
+    return btrace_put_bytes(p, str, len);
+}
+
+/*
+ * Open a nested message. The length is reserved as a fixed-size 4 byte
+ * varint and filled in by pft_end().
+ */
+static inline uint8_t *pft_begin(uint8_t *p, unsigned field, uint8_t **len)
+{
+    p = pft_put_tag(p, field, 2);
+    *len = p;
+    return p + 4;
+}
+
+static inline void pft_end(uint8_t *len, uint8_t *end)
+{
+    size_t n = end - len - 4;
+
+    log_assert(n < (1 << 28));
+    len[0] = (n & 0x7f) | 0x80;
+    len[1] = ((n >> 7) & 0x7f) | 0x80;
+    len[2] = ((n >> 14) & 0x7f) | 0x80;
+    len[3] = (n >> 21) & 0x7f;
+}
+
+static void pftrace_flush(pftrace_cpu_t *pt)
+{
+    FILE *logfile;
+
+    if (pt->fill == 0) {
+        return;
+    }
+    logfile = qemu_log_lock();
+    if (logfile) {
+        fwrite(pt->buf, pt->fill, 1, logfile);
+    }
+    qemu_log_unlock(logfile);
+    pt->fill = 0;
+}
+
+static void pftrace_shutdown(void)
+{
+    bool exclusive;
+    int i;
+
+    if (!pftrace.cpus) {
+        return;
+    }
+    /* The buffers belong to their vCPUs, which must not run meanwhile. */
+    exclusive = log_instr_shutdown_begin();
+    qemu_mutex_lock(&pftrace.lock);
+    for (i = 0; i < pftrace.cpus->len; i++) {
+        pftrace_flush(g_ptr_array_index(pftrace.cpus, i));
+    }
+    qemu_mutex_unlock(&pftrace.lock);
+    log_instr_shutdown_end(exclusive);
+    qemu_log_flush();
+}
+
+static guint pftrace_insn_hash(gconstpointer v)
+{
+    const pftrace_insn_key_t *key = v;
+    guint h = key->pc ^ ((uint64_t)key->pc >> 32);
+    int i;
+
+    for (i = 0; i < key->insn_size; i++) {
+        h = h * 31 + (uint8_t)key->insn_bytes[i];
+    }
+    return h;
+}
+
+static gboolean pftrace_insn_equal(gconstpointer a, gconstpointer b)
+{
+    return memcmp(a, b, sizeof(pftrace_insn_key_t)) == 0;
+}
+
+/* Append an interned string definition to the current packet. */
+static void pftrace_define(pftrace_cpu_t *pt, unsigned field, uint64_t iid,
+                           const char *str)
+{
+    uint8_t *len, *p = pt->intern + pt->intern_fill;
+
+    p = pft_begin(p, field, &len);
+    p = pft_put_uint(p, PFT_IN_IID, iid);
+    p = pft_put_str(p, PFT_IN_NAME, str, MIN(strlen(str), PFT_MAX_STR));
+    pft_end(len, p);
+    pt->intern_fill = p - pt->intern;
+}
+
+/* Intern a static string, defining it in the current packet if new. */
+static uint64_t pftrace_intern(pftrace_cpu_t *pt, GHashTable *table,
+                               uint64_t *next_iid, unsigned field,
+                               const char *str)
+{
+    gpointer iid;
+
+    if (!g_hash_table_lookup_extended(table, str, NULL, &iid)) {
+        iid = GUINT_TO_POINTER((*next_iid)++);
+        g_hash_table_insert(table, (gpointer)str, iid);
+        pftrace_define(pt, field, GPOINTER_TO_UINT(iid), str);
+    }
+    return GPOINTER_TO_UINT(iid);
+}
+
+/* Intern the disassembly of an instruction as its event name. */
+static uint64_t pftrace_insn_name(CPUArchState *env, pftrace_cpu_t *pt,
+                                  cpu_log_instr_info_t *iinfo)
+{
+    pftrace_insn_key_t key;
+    gpointer iid;
+    char *disas;
+
+    memset(&key, 0, sizeof(key));
+    key.pc = iinfo->pc;
+    key.insn_size = MIN(iinfo->insn_size, TARGET_MAX_INSN_SIZE);
+    memcpy(key.insn_bytes, iinfo->insn_bytes, key.insn_size);
+    if (g_hash_table_lookup_extended(pt->insn_names, &key, NULL, &iid)) {
+        return GPOINTER_TO_UINT(iid);
+    }
+
+    disas = target_disas_buf_str(env_cpu(env), iinfo->insn_bytes,
+                                 key.insn_size, iinfo->pc);
+    g_strstrip(disas);
+    if (*disas == '\0') {
+        /* No disassembler for this target, use the opcode bytes. */
+        GString *hex = g_string_new(".insn 0x");
+        int i;
+
+        for (i = 0; i < key.insn_size; i++) {
+            g_string_append_printf(hex, "%02x", (uint8_t)key.insn_bytes[i]);
+        }
+        g_free(disas);
+        disas = g_string_free(hex, false);
+    }
+    iid = GUINT_TO_POINTER(pt->next_name_iid++);
+    g_hash_table_insert(pt->insn_names, g_memdup(&key, sizeof(key)), iid);
+    pftrace_define(pt, PFT_ID_EVENT_NAMES, GPOINTER_TO_UINT(iid), disas);
+    g_free(disas);
+    return GPOINTER_TO_UINT(iid);
+}
+
+/* Forget all interned strings, bounding memory use on long traces. */
+static void pftrace_reset_interning(pftrace_cpu_t *pt)
+{
+    g_hash_table_remove_all(pt->names);
+    g_hash_table_remove_all(pt->insn_names);
+    g_hash_table_remove_all(pt->annotation_names);
+    pt->next_name_iid = 1;
+    pt->next_annotation_iid = 1;
+    pt->state_cleared = true;
+}
+
+/*
+ * Start a new packet with room for @need bytes, including interned data.
+ * Returns the write pointer, @len is used to close the packet.
+ */
+static uint8_t *pftrace_begin_packet(pftrace_cpu_t *pt, size_t need,
+                                     uint8_t **len)
+{
+    uint64_t ts = get_clock();
+    uint8_t *p;
+
+    if (pt->fill + need > PFT_BUF_SIZE) {
+        pftrace_flush(pt);
+    }
+    /* Events in a sequence must have distinct, increasing timestamps */
+    if (ts <= pt->last_ts) {
+        ts = pt->last_ts + 1;
+    }
+    pt->last_ts = ts;
+    pt->intern_fill = 0;
+
+    p = pft_begin(pt->buf + pt->fill, PFT_TRACE_PACKET, len);
+    p = pft_put_uint(p, PFT_PKT_TIMESTAMP, ts);
+    p = pft_put_uint(p, PFT_PKT_SEQ_ID, pt->seq_id);
+    if (pt->state_cleared) {
+        p = pft_put_uint(p, PFT_PKT_SEQ_FLAGS,
+                         PFT_SEQ_INCREMENTAL_STATE_CLEARED |
+                         PFT_SEQ_NEEDS_INCREMENTAL_STATE);
+        pt->state_cleared = false;
+    } else {
+        p = pft_put_uint(p, PFT_PKT_SEQ_FLAGS,
+                         PFT_SEQ_NEEDS_INCREMENTAL_STATE);
+    }
+    return p;
+}
+
+static void pftrace_end_packet(pftrace_cpu_t *pt, uint8_t *p, uint8_t *len)
+{
+    uint8_t *ilen;
+
+    if (pt->intern_fill) {
+        p = pft_begin(p, PFT_PKT_INTERNED_DATA, &ilen);
+        memcpy(p, pt->intern, pt->intern_fill);
+        p += pt->intern_fill;
+        pft_end(ilen, p);
+    }
+    pft_end(len, p);
+    pt->fill = p - pt->buf;
+    log_assert(pt->fill <= PFT_BUF_SIZE);
+}
+
+static void pftrace_track_descriptor(pftrace_cpu_t *pt, uint64_t uuid,
+                                     uint64_t parent, const char *name)
+{
+    uint8_t *pkt, *td, *p = pt->buf + pt->fill;
+
+    p = pft_begin(p, PFT_TRACE_PACKET, &pkt);
+    p = pft_put_uint(p, PFT_PKT_SEQ_ID, pt->seq_id);
+    p = pft_begin(p, PFT_PKT_TRACK_DESC, &td);
+    p = pft_put_uint(p, PFT_TD_UUID, uuid);
+    p = pft_put_str(p, PFT_TD_NAME, name, strlen(name));
+    if (parent) {
+        p = pft_put_uint(p, PFT_TD_PARENT_UUID, parent);
+    }
+    pft_end(td, p);
+    pft_end(pkt, p);
+    pt->fill = p - pt->buf;
+}
+
+static pftrace_cpu_t *pftrace_get_cpu(CPUArchState *env)
+{
+    cpu_log_instr_state_t *cpulog = get_cpu_log_state(env);
+    pftrace_cpu_t *pt = cpulog->fmt_data;
+    int cpu_index = env_cpu(env)->cpu_index;
+    char name[32];
+
+    if (likely(pt)) {
+        return pt;
+    }
+    pt = g_new0(pftrace_cpu_t, 1);
+    pt->seq_id = cpu_index + 1;
+    pt->track_uuid = (uint64_t)pt->seq_id << 1;
+    pt->mode_track_uuid = pt->track_uuid | 1;
+    pt->buf = g_malloc(PFT_BUF_SIZE);
+    pt->intern = g_malloc(PFT_BUF_SIZE);
+    pt->names = g_hash_table_new(NULL, NULL);
+    pt->insn_names = g_hash_table_new_full(pftrace_insn_hash,
+                                           pftrace_insn_equal, g_free, NULL);
+    pt->annotation_names = g_hash_table_new(NULL, NULL);
+    pftrace_reset_interning(pt);
+
+    snprintf(name, sizeof(name), "CPU %d", cpu_index);
+    pftrace_track_descriptor(pt, pt->track_uuid, 0, name);
+    snprintf(name, sizeof(name), "CPU %d mode", cpu_index);
+    pftrace_track_descriptor(pt, pt->mode_track_uuid, pt->track_uuid, name);
+
+    qemu_mutex_lock(&pftrace.lock);
+    g_ptr_array_add(pftrace.cpus, pt);
+    qemu_mutex_unlock(&pftrace.lock);
+    cpulog->fmt_data = pt;
+    return pt;
+}
+
+static inline uint8_t *pftrace_begin_event(uint8_t *p, uint64_t track,
+                                           int type, uint64_t name_iid,
+                                           uint8_t **len)
+{
+    p = pft_begin(p, PFT_PKT_TRACK_EVENT, len);
+    p = pft_put_uint(p, PFT_TE_TYPE, type);
+    p = pft_put_uint(p, PFT_TE_TRACK_UUID, track);
+    if (name_iid) {
+        p = pft_put_uint(p, PFT_TE_NAME_IID, name_iid);
+    }
+    return p;
+}
+
+/* Open a named debug annotation, or an unnamed one if @name is NULL. */
+static inline uint8_t *pftrace_begin_annotation(pftrace_cpu_t *pt,
+                                                uint8_t *p, unsigned field,
+                                                const char *name,
+                                                uint8_t **len)
+{
+    p = pft_begin(p, field, len);
+    if (name) {
+        p = pft_put_uint(p, PFT_DA_NAME_IID,
+                         pftrace_intern(pt, pt->annotation_names,
+                                        &pt->next_annotation_iid,
+                                        PFT_ID_ANNOTATION_NAMES, name));
+    }
+    return p;
+}
+
+/* Emit a debug annotation with an integer value of the given @type */
+static inline uint8_t *pftrace_put_annotation(pftrace_cpu_t *pt, uint8_t *p,
+                                              unsigned field, const char *name,
+                                              unsigned type, uint64_t value)
+{
+    uint8_t *len;
+
+    p = pftrace_begin_annotation(pt, p, field, name, &len);
+    p = pft_put_uint(p, type, value);
+    pft_end(len, p);
+    return p;
+}
+
+static inline uint8_t *pftrace_put_str_annotation(pftrace_cpu_t *pt,
+                                                  uint8_t *p, unsigned field,
+                                                  const char *name,
+                                                  const char *str, size_t n)
+{
+    uint8_t *len;
+
+    p = pftrace_begin_annotation(pt, p, field, name, &len);
+    p = pft_put_str(p, PFT_DA_STRING, str, n);
+    pft_end(len, p);
+    return p;
+}
+
+#ifdef TARGET_CHERI
+static uint8_t *pftrace_put_cap(pftrace_cpu_t *pt, uint8_t *p, unsigned field,
+                                const char *name, const cap_register_t *cr)
+{
+    uint8_t *len;
+
+    p = pftrace_begin_annotation(pt, p, field, name, &len);
+    p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "tag", PFT_DA_BOOL,
+                               cr->cr_tag);
+    p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "sealed", PFT_DA_BOOL,
+                               !cap_is_unsealed(cr));
+    p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "perms", PFT_DA_UINT,
+                               COMBINED_PERMS_VALUE(cr));
+    p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "otype", PFT_DA_INT,
+                               (uint64_t)cap_get_otype_signext(cr));
+    p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "base", PFT_DA_POINTER,
+                               cap_get_base(cr));
+    p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "length", PFT_DA_UINT,
+                               cap_get_length_sat(cr));
+    p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "cursor", PFT_DA_POINTER,
+                               cap_get_cursor(cr));
+    pft_end(len, p);
+    return p;
+}
+#endif
+
+/* Emit a slice begin/end event on the given track */
+static void pftrace_slice(pftrace_cpu_t *pt, uint64_t track, int type,
+                          const char *name)
+{
+    uint8_t *pkt, *ev, *p;
+    uint64_t iid = 0;
+
+    p = pftrace_begin_packet(pt, PFT_ENTRY_MAX, &pkt);
+    if (name) {
+        iid = pftrace_intern(pt, pt->names, &pt->next_name_iid,
+                             PFT_ID_EVENT_NAMES, name);
+    }
+    p = pftrace_begin_event(p, track, type, iid, &ev);
+    pft_end(ev, p);
+    pftrace_end_packet(pt, p, pkt);
+}
+
+/* Close the current mode slice and open one for @mode, if not NULL */
+static void pftrace_mode_slice(pftrace_cpu_t *pt, const char *mode)
+{
+    if (pt->mode_open) {
+        pftrace_slice(pt, pt->mode_track_uuid, PFT_TE_SLICE_END, NULL);
+    }
+    pt->mode_open = (mode != NULL);
+    if (mode) {
+        pftrace_slice(pt, pt->mode_track_uuid, PFT_TE_SLICE_BEGIN, mode);
+    }
+}
+
+static inline const char *pftrace_mode_name(qemu_log_instr_cpu_mode_t mode)
+{
+    const char *name = cpu_get_mode_name(mode);
+
+    return name ? name : "Unknown";
+}
+
+static void emit_perfetto_header(CPUArchState *env)
+{
+    qemu_mutex_init(&pftrace.lock);
+    pftrace.cpus = g_ptr_array_new();
+}
+
+static void emit_perfetto_entry(CPUArchState *env, cpu_log_instr_info_t *iinfo)
+{
+    pftrace_cpu_t *pt = pftrace_get_cpu(env);
+    size_t text_len = MIN(iinfo->txt_len, PFT_MAX_TEXT);
+    size_t need = PFT_ENTRY_MAX + text_len + iinfo->n_regs * PFT_REG_MAX +
+        iinfo->n_mem * PFT_MEM_MAX;
+    uint8_t *pkt, *ev, *len, *p;
+    int i;
+
+    if (need > PFT_BUF_SIZE) {
+        warn_report_once("perfetto trace: dropping oversized entry");
+        return;
+    }
+    if (g_hash_table_size(pt->insn_names) >= PFT_MAX_INTERNED) {
+        pftrace_reset_interning(pt);
+    }
+
+    p = pftrace_begin_packet(pt, need, &pkt);
+    p = pftrace_begin_event(p, pt->track_uuid, PFT_TE_INSTANT,
+                            pftrace_insn_name(env, pt, iinfo), &ev);
+    p = pftrace_put_annotation(pt, p, PFT_TE_ANNOTATION, "pc", PFT_DA_POINTER,
+                               iinfo->pc);
+    p = pftrace_put_annotation(pt, p, PFT_TE_ANNOTATION, "asid", PFT_DA_UINT,
+                               iinfo->asid);
+
+    switch (iinfo->flags & LI_FLAG_INTR_MASK) {
+    case LI_FLAG_INTR_TRAP:
+        p = pftrace_begin_annotation(pt, p, PFT_TE_ANNOTATION, "exception",
+                                     &len);
+        p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "code", PFT_DA_UINT,
+                                   iinfo->intr_code);
+        p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "vector",
+                                   PFT_DA_POINTER, iinfo->intr_vector);
+        p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "fault-addr",
+                                   PFT_DA_POINTER, iinfo->intr_faultaddr);
+        pft_end(len, p);
+        break;
+    case LI_FLAG_INTR_ASYNC:
+        p = pftrace_begin_annotation(pt, p, PFT_TE_ANNOTATION, "interrupt",
+                                     &len);
+        p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "code", PFT_DA_UINT,
+                                   iinfo->intr_code);
+        p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "vector",
+                                   PFT_DA_POINTER, iinfo->intr_vector);
+        pft_end(len, p);
+        break;
+    default:
+        /* No interrupt */
+        break;
+    }
+
+    for (i = 0; i < iinfo->n_regs; i++) {
+        log_reginfo_t *rinfo = log_instr_reg(iinfo, i);
 
-            if (!reginfo_has_cap(rinfo)) {
-                // cvtrace expects a null capability in the integer case
-                cr = null_capability(&intcap);
-            }
-            uint64_t metadata = (((uint64_t)cr->cr_tag << 63) |
-                                 ((uint64_t)cap_get_otype_signext(cr) << 32) |
-                                 ((uint64_t)COMBINED_PERMS_VALUE(cr) << 1) |
-                                 (uint64_t)(cap_is_unsealed(cr) ? 0 : 1));
+#ifdef TARGET_CHERI
+        if (reginfo_has_cap(rinfo)) {
+            p = pftrace_put_cap(pt, p, PFT_TE_ANNOTATION, rinfo->name,
+                                &rinfo->cap);
+            continue;
+        }
+#endif
+        p = pftrace_put_annotation(pt, p, PFT_TE_ANNOTATION, rinfo->name,
+                                   PFT_DA_UINT, rinfo->gpr);
+    }
 
-            entry.entry_type = CTE_CAP;
-            entry.val2 = cpu_to_be64(metadata);
-            entry.val3 = cpu_to_be64(cap_get_cursor(cr));
-            entry.val4 = cpu_to_be64(cap_get_base(cr));
-            entry.val5 = cpu_to_be64(cap_get_length_sat(cr));
-        } else
+    if (iinfo->n_mem) {
+        p = pftrace_begin_annotation(pt, p, PFT_TE_ANNOTATION, "mem", &len);
+        for (i = 0; i < iinfo->n_mem; i++) {
+            log_meminfo_t *minfo = log_instr_mem(iinfo, i);
+            const char *op = (minfo->flags & LMI_LD) ? "load" : "store";
+            uint8_t *elen;
+
+            p = pftrace_begin_annotation(pt, p, PFT_DA_ARRAY, NULL, &elen);
+            p = pftrace_put_str_annotation(pt, p, PFT_DA_DICT, "op", op,
+                                           strlen(op));
+            p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "addr",
+                                       PFT_DA_POINTER, minfo->addr);
+#ifdef TARGET_CHERI
+            if (minfo->flags & LMI_CAP) {
+                p = pftrace_put_cap(pt, p, PFT_DA_DICT, "cap", &minfo->cap);
+            } else
 #endif
-        {
-            entry.entry_type = CTE_GPR;
-            entry.val2 = cpu_to_be64(rinfo->gpr);
+            {
+                p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "size",
+                                           PFT_DA_UINT, memop_size(minfo->op));
+                p = pftrace_put_annotation(pt, p, PFT_DA_DICT, "value",
+                                           PFT_DA_UINT, minfo->value);
+            }
+            pft_end(elen, p);
         }
+        pft_end(len, p);
     }
 
-    if (iinfo->mem->len) {
-        log_meminfo_t *minfo = &g_array_index(iinfo->mem, log_meminfo_t, 0);
-#ifndef TARGET_CHERI
-        log_assert((minfo->flags & LMI_CAP) == 0 && "Capability memory access "
-                   "without CHERI support");
-#endif
-        entry.val1 = cpu_to_be64(minfo->addr);
-        // Hack to avoid checking for GPR or CAP
-        if (minfo->flags & LMI_LD)
-            entry.entry_type += 1;
-        else if (minfo->flags & LMI_ST)
-            entry.entry_type += 2;
+    if (text_len) {
+        p = pftrace_put_str_annotation(pt, p, PFT_TE_ANNOTATION, "text",
+                                       iinfo->txt, text_len);
     }
+    pft_end(ev, p);
+    pftrace_end_packet(pt, p, pkt);
 
-    logfile = qemu_log_lock();
-    fwrite(&entry, sizeof(entry), 1, logfile);
-    qemu_log_unlock(logfile);
+    if (iinfo->flags & LI_FLAG_MODE_SWITCH) {
+        pftrace_mode_slice(pt, pftrace_mode_name(iinfo->next_cpu_mode));
+    }
 }
 
-static void emit_cvtrace_start(CPUArchState *env, target_ulong pc)
+static void emit_perfetto_start(CPUArchState *env, target_ulong pc)
 {
-    // TODO(am2419) Emit an event for instruction logging start
+    pftrace_cpu_t *pt = pftrace_get_cpu(env);
+    cpu_log_instr_state_t *cpulog = get_cpu_log_state(env);
+
+    if (cpulog->loglevel == QEMU_LOG_INSTR_LOGLEVEL_USER) {
+        pftrace_slice(pt, pt->track_uuid, PFT_TE_SLICE_BEGIN,
+                      "User-mode only instruction logging");
+    } else {
+        pftrace_slice(pt, pt->track_uuid, PFT_TE_SLICE_BEGIN,
+                      "Instruction logging");
+    }
+    /* We only know whether we start in user mode or not. */
+    pftrace_mode_slice(pt, cpu_in_user_mode(env) ?
+                       pftrace_mode_name(QEMU_LOG_INSTR_CPU_USER) :
+                       "Privileged");
 }
 
-static void emit_cvtrace_stop(CPUArchState *env, target_ulong pc)
+static void emit_perfetto_stop(CPUArchState *env, target_ulong pc)
 {
-    // TODO(am2419) Emit an event for instruction logging stop
+    pftrace_cpu_t *pt = pftrace_get_cpu(env);
+
+    pftrace_mode_slice(pt, NULL);
+    pftrace_slice(pt, pt->track_uuid, PFT_TE_SLICE_END, NULL);
+    pftrace_flush(pt);
 }
 
 /* Core instruction logging implementation */
@@ -575,13 +1732,124 @@ static void reset_log_buffer(cpu_log_instr_state_t *cpulog,
     memset(&iinfo->cpu_log_iinfo_startzero, 0,
            ((char *)&iinfo->cpu_log_iinfo_endzero -
             (char *)&iinfo->cpu_log_iinfo_startzero));
-    g_array_remove_range(iinfo->regs, 0, iinfo->regs->len);
-    g_array_remove_range(iinfo->mem, 0, iinfo->mem->len);
-    g_string_erase(iinfo->txt_buffer, 0, -1);
+    /*
+     * Unless we are buffering, the previous entries have been emitted and
+     * their text can be discarded.
+     */
+    if ((cpulog->flags & QEMU_LOG_INSTR_FLAG_BUFFERED) == 0) {
+        cpulog->txt_arena_used = 0;
+    }
     cpulog->force_drop = false;
     cpulog->starting = false;
 }
 
+/*
+ * Trace trigger rules from -cheri-trace-trigger.
+ * A rule matches when all of its constraints hold, logging is active on a CPU
+ * when its log level allows it and any rule matches. The rules are fixed at
+ * startup so translated code can depend on the PC ranges.
+ */
+#define LOG_INSTR_MAX_TRIGGERS 16
+
+typedef enum {
+    TRIGGER_MODE_ANY = 0,
+    TRIGGER_MODE_USER,
+    TRIGGER_MODE_KERNEL,
+} log_instr_trigger_mode_t;
+
+typedef struct {
+    bool has_asid;
+    bool has_range;
+    uint16_t asid;
+    log_instr_trigger_mode_t mode;
+    /* PC range [start, end) */
+    target_ulong start;
+    target_ulong end;
+} log_instr_trigger_t;
+
+static struct {
+    int count;
+    bool has_asid;
+    bool has_range;
+    log_instr_trigger_t rules[LOG_INSTR_MAX_TRIGGERS];
+} log_instr_triggers;
+
+/* Mask of the trigger rules whose PC range contains @pc */
+static uint16_t log_instr_trigger_pc_hits(target_ulong pc)
+{
+    uint16_t hits = 0;
+    int i;
+
+    for (i = 0; i < log_instr_triggers.count; i++) {
+        log_instr_trigger_t *rule = &log_instr_triggers.rules[i];
+
+        if (rule->has_range && pc >= rule->start && pc < rule->end) {
+            hits |= 1 << i;
+        }
+    }
+    return hits;
+}
+
+/*
+ * Whether the CPU is (about to be) in user mode.
+ * Assume iinfo holds the mode switch that caused the log level switch.
+ */
+static bool log_instr_cpu_user(CPUArchState *env)
+{
+    cpu_log_instr_info_t *iinfo = get_cpu_log_instr_info(env);
+
+    if (iinfo->flags & LI_FLAG_MODE_SWITCH)
+        return iinfo->next_cpu_mode == QEMU_LOG_INSTR_CPU_USER;
+    return cpu_in_user_mode(env);
+}
+
+static bool log_instr_trigger_match(CPUArchState *env)
+{
+    cpu_log_instr_state_t *cpulog = get_cpu_log_state(env);
+    bool user = log_instr_cpu_user(env);
+    uint16_t asid = 0;
+    int i;
+
+    if (log_instr_triggers.count == 0)
+        return true;
+
+    if (log_instr_triggers.has_asid)
+        asid = cpu_get_asid(env, cpu_get_recent_pc(env));
+
+    for (i = 0; i < log_instr_triggers.count; i++) {
+        log_instr_trigger_t *rule = &log_instr_triggers.rules[i];
+
+        if (rule->has_range && (cpulog->trigger_pc_hits & (1 << i)) == 0)
+            continue;
+        if (rule->has_asid && rule->asid != asid)
+            continue;
+        if ((rule->mode == TRIGGER_MODE_USER && !user) ||
+            (rule->mode == TRIGGER_MODE_KERNEL && user))
+            continue;
+        return true;
+    }
+    return false;
+}
+
+/* Decide whether logging should be active on this CPU at @level */
+static bool log_instr_level_active(CPUArchState *env,
+                                   qemu_log_instr_loglevel_t level)
+{
+    switch (level) {
+    case QEMU_LOG_INSTR_LOGLEVEL_NONE:
+        return false;
+    case QEMU_LOG_INSTR_LOGLEVEL_ALL:
+        return log_instr_trigger_match(env);
+    case QEMU_LOG_INSTR_LOGLEVEL_USER:
+        return log_instr_cpu_user(env) && log_instr_trigger_match(env);
+    default:
+        log_assert(false && "Invalid cpu instruction log level");
+        warn_report("Invalid cpu %d instruction log level\r",
+                    env_cpu(env)->cpu_index);
+        return false;
+    }
+}
+
 /* Common instruction commit implementation */
 static void do_instr_commit(CPUArchState *env)
 {
@@ -602,20 +1870,11 @@ static void do_instr_commit(CPUArchState *env)
 
     /* Check for dfilter matches in this instruction */
     if (debug_regions) {
-        int i, j;
-        bool match = false;
-        for (i = 0; !match && i < debug_regions->len; i++) {
-            Range *range = &g_array_index(debug_regions, Range, i);
-            match = range_contains(range, iinfo->pc);
-            if (match)
-                break;
+        bool match = qemu_log_in_addr_range(iinfo->pc);
+        int i;
 
-            for (j = 0; j < iinfo->mem->len; j++) {
-                log_meminfo_t *minfo = &g_array_index(iinfo->mem, log_meminfo_t, j);
-                match = range_contains(range, minfo->addr);
-                if (match)
-                    break;
-            }
+        for (i = 0; !match && i < iinfo->n_mem; i++) {
+            match = qemu_log_in_addr_range(log_instr_mem(iinfo, i)->addr);
         }
         if (match)
             emit_entry_event(env, iinfo);
@@ -627,7 +1886,8 @@ static void do_instr_commit(CPUArchState *env)
 
 /*
  * Perform the actual work to change per-CPU log level.
- * This runs in the CPU exclusive context.
+ * This runs in the CPU exclusive context, or on the CPU itself with
+ * -cheri-trace-trigger since translated code does not depend on the level.
  *
  * Note:
  * If we start logging, we delay emitting the start event until the next commit.
@@ -644,31 +1904,8 @@ static void do_cpu_loglevel_switch(CPUState *cpu, run_on_cpu_data data)
     qemu_log_instr_loglevel_t prev_level = cpulog->loglevel;
     bool prev_level_active = cpulog->loglevel_active;
     qemu_log_instr_loglevel_t next_level = data.host_int;
-    bool next_level_active;
-
     /* Decide whether we have to pause/resume logging */
-    switch (next_level) {
-    case QEMU_LOG_INSTR_LOGLEVEL_NONE:
-        next_level_active = false;
-        break;
-    case QEMU_LOG_INSTR_LOGLEVEL_ALL:
-        next_level_active = true;
-        break;
-    case QEMU_LOG_INSTR_LOGLEVEL_USER:
-        /*
-         * Assume iinfo holds the mode switch that caused cpu_loglevel_switch
-         * to be called
-         */
-        if (iinfo->flags & LI_FLAG_MODE_SWITCH)
-            next_level_active = (iinfo->next_cpu_mode == QEMU_LOG_INSTR_CPU_USER);
-        else
-            next_level_active = cpu_in_user_mode(env);
-        break;
-    default:
-        log_assert(false && "Invalid cpu instruction log level");
-        warn_report("Invalid cpu %d instruction log level\r",
-                    cpu->cpu_index);
-    }
+    bool next_level_active = log_instr_level_active(env, next_level);
 
     /* Update level */
     cpulog->loglevel = next_level;
@@ -701,7 +1938,22 @@ static void do_cpu_loglevel_switch(CPUState *cpu, run_on_cpu_data data)
 static void cpu_loglevel_switch(CPUArchState *env,
     qemu_log_instr_loglevel_t level)
 {
-    async_safe_run_on_cpu(env_cpu(env), do_cpu_loglevel_switch,
+    CPUState *cpu = env_cpu(env);
+
+    if (qemu_log_instr_dynamic) {
+        /*
+         * The generated code checks loglevel_active itself, there is no need
+         * to wait for the CPU to leave its TB or for the other CPUs to stop.
+         */
+        if (qemu_cpu_is_self(cpu)) {
+            do_cpu_loglevel_switch(cpu, RUN_ON_CPU_HOST_INT(level));
+        } else {
+            async_run_on_cpu(cpu, do_cpu_loglevel_switch,
+                             RUN_ON_CPU_HOST_INT(level));
+        }
+        return;
+    }
+    async_safe_run_on_cpu(cpu, do_cpu_loglevel_switch,
         RUN_ON_CPU_HOST_INT(level));
 }
 
@@ -754,6 +2006,17 @@ int qemu_log_instr_global_switch(int log_flags)
         level = QEMU_LOG_INSTR_LOGLEVEL_NONE;
     }
 
+    if (qemu_log_instr_dynamic) {
+        /* Set the global flag once, the CPUs switch without exclusion */
+        if (level != QEMU_LOG_INSTR_LOGLEVEL_NONE)
+            global_loglevel_enable();
+        CPU_FOREACH(cpu) {
+            async_run_on_cpu(cpu, do_cpu_loglevel_switch,
+                             RUN_ON_CPU_HOST_INT(level));
+        }
+        return log_flags;
+    }
+
     CPU_FOREACH(cpu) {
         async_safe_run_on_cpu(cpu, do_global_loglevel_switch,
             RUN_ON_CPU_HOST_INT(level));
@@ -762,19 +2025,6 @@ int qemu_log_instr_global_switch(int log_flags)
     return log_flags;
 }
 
-/*
- * Initialize instruction info entry from the ring buffer.
- */
-static void qemu_log_instr_info_init(cpu_log_instr_info_t *iinfo)
-{
-    if (iinfo->txt_buffer == NULL)
-        iinfo->txt_buffer = g_string_new(NULL);
-    if (iinfo->regs == NULL)
-        iinfo->regs = g_array_new(false, true, sizeof(log_reginfo_t));
-    if (iinfo->mem == NULL)
-        iinfo->mem = g_array_new(false, true, sizeof(log_meminfo_t));
-}
-
 /*
  * Clear an instruction info entry from the ring buffer.
  */
@@ -782,9 +2032,15 @@ static void qemu_log_instr_info_destroy(gpointer data)
 {
     cpu_log_instr_info_t *iinfo = data;
 
-    g_string_free(iinfo->txt_buffer, TRUE);
-    g_array_free(iinfo->regs, TRUE);
-    g_array_free(iinfo->mem, TRUE);
+    if (iinfo->txt_overflow) {
+        g_string_free(iinfo->txt_overflow, TRUE);
+    }
+    if (iinfo->regs_overflow) {
+        g_array_free(iinfo->regs_overflow, TRUE);
+    }
+    if (iinfo->mem_overflow) {
+        g_array_free(iinfo->mem_overflow, TRUE);
+    }
 }
 
 /*
@@ -799,23 +2055,18 @@ void qemu_log_instr_init(CPUState *cpu)
     cpu_log_instr_state_t *cpulog = &cpu->log_state;
     GArray *iinfo_ring = g_array_sized_new(FALSE, TRUE,
         sizeof(cpu_log_instr_info_t), reset_entry_buffer_size);
-    cpu_log_instr_info_t *iinfo;
-    int i;
 
+    /* Entries are zero-initialized, overflow buffers are allocated lazily */
     g_array_set_size(iinfo_ring, reset_entry_buffer_size);
     g_array_set_clear_func(iinfo_ring, qemu_log_instr_info_destroy);
 
-    for (i = 0; i < iinfo_ring->len; i++) {
-        iinfo = &g_array_index(iinfo_ring, cpu_log_instr_info_t, i);
-        qemu_log_instr_info_init(iinfo);
-    }
-
     cpulog->loglevel = QEMU_LOG_INSTR_LOGLEVEL_NONE;
     cpulog->loglevel_active = false;
     cpulog->instr_info = iinfo_ring;
     cpulog->ring_head = 0;
     cpulog->ring_tail = 0;
-    reset_log_buffer(cpulog, iinfo);
+    cpulog->txt_arena = g_malloc(LOG_INSTR_TXT_ARENA_SIZE);
+    reset_log_buffer(cpulog, get_cpu_log_instr_info(cpu->env_ptr));
 
     // Make sure we are using the correct trace format.
     if (trace_format == NULL) {
@@ -845,13 +2096,13 @@ do_log_buffer_resize(CPUState *cpu, run_on_cpu_data data)
     g_array_set_size(cpulog->instr_info, new_size);
     cpulog->ring_head = 0;
     cpulog->ring_tail = 0;
+    cpulog->txt_arena_used = 0;
     for (i = 0; i < cpulog->instr_info->len; i++) {
         /*
-         * Clear and reinitialize all the entries,
+         * Clear all the entries,
          * a bit overkill but should not be a frequent operation.
          */
         iinfo = &g_array_index(cpulog->instr_info, cpu_log_instr_info_t, i);
-        qemu_log_instr_info_init(iinfo);
         reset_log_buffer(cpulog, iinfo);
     }
 }
@@ -874,6 +2125,12 @@ void qemu_log_instr_set_buffer_size(unsigned long new_size)
     }
 }
 
+void qemu_log_instr_shutdown(void)
+{
+    btrace_shutdown();
+    pftrace_shutdown();
+}
+
 /*
  * Check whether instruction logging is enabled on this CPU.
  */
@@ -905,17 +2162,112 @@ void qemu_log_instr_mode_switch(CPUArchState *env,
     iinfo->flags |= LI_FLAG_MODE_SWITCH;
     iinfo->next_cpu_mode = mode;
 
-    /* If we are not logging in user-only mode, bail */
+    /*
+     * If we are not logging in user-only mode and no trigger rule may
+     * depend on the mode, bail
+     */
     if (!qemu_loglevel_mask(CPU_LOG_INSTR) ||
-        cpulog->loglevel != QEMU_LOG_INSTR_LOGLEVEL_USER)
+        cpulog->loglevel == QEMU_LOG_INSTR_LOGLEVEL_NONE ||
+        (cpulog->loglevel == QEMU_LOG_INSTR_LOGLEVEL_ALL &&
+         log_instr_triggers.count == 0))
         return;
 
     /* Check if we are switching to an interesting mode */
-    if ((mode == QEMU_LOG_INSTR_CPU_USER) != cpulog->loglevel_active) {
+    if (log_instr_level_active(env, cpulog->loglevel) !=
+        cpulog->loglevel_active) {
+        cpu_loglevel_switch(env, cpulog->loglevel);
+    }
+}
+
+void qemu_log_instr_trigger_update(CPUArchState *env)
+{
+    cpu_log_instr_state_t *cpulog = get_cpu_log_state(env);
+
+    if (!log_instr_triggers.has_asid || !qemu_loglevel_mask(CPU_LOG_INSTR) ||
+        cpulog->loglevel == QEMU_LOG_INSTR_LOGLEVEL_NONE)
+        return;
+
+    if (log_instr_level_active(env, cpulog->loglevel) !=
+        cpulog->loglevel_active) {
         cpu_loglevel_switch(env, cpulog->loglevel);
     }
 }
 
+static QemuOptsList qemu_log_instr_trigger_opts = {
+    .name = "cheri-trace-trigger",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_log_instr_trigger_opts.head),
+    .desc = {
+        {
+            .name = "asid",
+            .type = QEMU_OPT_NUMBER,
+            .help = "only log while the CPU runs with this ASID",
+        }, {
+            .name = "start",
+            .type = QEMU_OPT_NUMBER,
+            .help = "only log instructions at or above this PC",
+        }, {
+            .name = "end",
+            .type = QEMU_OPT_NUMBER,
+            .help = "only log instructions below this PC",
+        }, {
+            .name = "mode",
+            .type = QEMU_OPT_STRING,
+            .help = "user, kernel or any",
+        },
+        { /* end of list */ }
+    },
+};
+
+void qemu_log_instr_trigger_parse_opts(const char *optarg)
+{
+    QemuOpts *opts =
+        qemu_opts_parse_noisily(&qemu_log_instr_trigger_opts, optarg, false);
+    log_instr_trigger_t *rule;
+    const char *mode;
+
+    if (!opts) {
+        exit(1);
+    }
+    if (log_instr_triggers.count == LOG_INSTR_MAX_TRIGGERS) {
+        error_report("cheri-trace-trigger: at most %d rules are supported",
+                     LOG_INSTR_MAX_TRIGGERS);
+        exit(1);
+    }
+    rule = &log_instr_triggers.rules[log_instr_triggers.count];
+
+    if (qemu_opt_get(opts, "asid")) {
+        rule->has_asid = true;
+        rule->asid = qemu_opt_get_number(opts, "asid", 0);
+        log_instr_triggers.has_asid = true;
+    }
+    if (qemu_opt_get(opts, "start") || qemu_opt_get(opts, "end")) {
+        rule->has_range = true;
+        rule->start = qemu_opt_get_number(opts, "start", 0);
+        rule->end = qemu_opt_get_number(opts, "end", (target_ulong)-1);
+        if (rule->end <= rule->start) {
+            error_report("cheri-trace-trigger: empty PC range");
+            exit(1);
+        }
+        log_instr_triggers.has_range = true;
+    }
+    mode = qemu_opt_get(opts, "mode");
+    if (mode == NULL || strcmp(mode, "any") == 0) {
+        rule->mode = TRIGGER_MODE_ANY;
+    } else if (strcmp(mode, "user") == 0) {
+        rule->mode = TRIGGER_MODE_USER;
+    } else if (strcmp(mode, "kernel") == 0) {
+        rule->mode = TRIGGER_MODE_KERNEL;
+    } else {
+        error_report("Invalid choice for cheri-trace-trigger mode: '%s'",
+                     mode);
+        exit(1);
+    }
+    log_instr_triggers.count++;
+    qemu_opts_del(opts);
+
+    qemu_log_instr_dynamic = true;
+}
+
 void qemu_log_instr_drop(CPUArchState *env)
 {
     cpu_log_instr_state_t *cpulog = get_cpu_log_state(env);
@@ -925,6 +2277,23 @@ void qemu_log_instr_drop(CPUArchState *env)
     cpulog->force_drop = true;
 }
 
+/*
+ * TBs never span more than two pages, so a TB starting at @pc can only
+ * contain instructions logged under -dfilter if the filter intersects the
+ * page of @pc or the next one. Since the filter is only set at startup,
+ * this can be decided once at translation time.
+ */
+bool qemu_log_instr_tb_in_filter(target_ulong pc)
+{
+    uint64_t lob = pc & TARGET_PAGE_MASK;
+    uint64_t upb = lob + 2 * TARGET_PAGE_SIZE - 1;
+
+    if (upb < lob) {
+        upb = UINT64_MAX;
+    }
+    return qemu_log_any_in_addr_range(lob, upb);
+}
+
 void qemu_log_instr_commit(CPUArchState *env)
 {
     cpu_log_instr_state_t *cpulog = get_cpu_log_state(env);
@@ -939,15 +2308,48 @@ void qemu_log_instr_commit(CPUArchState *env)
     reset_log_buffer(cpulog, iinfo);
 }
 
+/*
+ * Reserve the next register update or memory access slot of an entry,
+ * spilling to the overflow arrays once the inline slots are used up.
+ */
+static inline log_reginfo_t *log_instr_new_reg(cpu_log_instr_info_t *iinfo)
+{
+    int i = iinfo->n_regs++;
+
+    if (likely(i < LOG_INSTR_INLINE_REGS)) {
+        return &iinfo->regs[i];
+    }
+    if (iinfo->regs_overflow == NULL) {
+        iinfo->regs_overflow = g_array_new(false, false,
+                                           sizeof(log_reginfo_t));
+    }
+    g_array_set_size(iinfo->regs_overflow, i - LOG_INSTR_INLINE_REGS + 1);
+    return log_instr_reg(iinfo, i);
+}
+
+static inline log_meminfo_t *log_instr_new_mem(cpu_log_instr_info_t *iinfo)
+{
+    int i = iinfo->n_mem++;
+
+    if (likely(i < LOG_INSTR_INLINE_MEM)) {
+        return &iinfo->mem[i];
+    }
+    if (iinfo->mem_overflow == NULL) {
+        iinfo->mem_overflow = g_array_new(false, false,
+                                          sizeof(log_meminfo_t));
+    }
+    g_array_set_size(iinfo->mem_overflow, i - LOG_INSTR_INLINE_MEM + 1);
+    return log_instr_mem(iinfo, i);
+}
+
 void qemu_log_instr_reg(CPUArchState *env, const char *reg_name, target_ulong value)
 {
     cpu_log_instr_info_t *iinfo = get_cpu_log_instr_info(env);
-    log_reginfo_t r;
+    log_reginfo_t *r = log_instr_new_reg(iinfo);
 
-    r.flags = 0;
-    r.name = reg_name;
-    r.gpr = value;
-    g_array_append_val(iinfo->regs, r);
+    r->flags = 0;
+    r->name = reg_name;
+    r->gpr = value;
 }
 
 void helper_qemu_log_instr_reg(CPUArchState *env, const void *reg_name,
@@ -962,12 +2364,11 @@ void qemu_log_instr_cap(CPUArchState *env, const char *reg_name,
                          const cap_register_t *cr)
 {
     cpu_log_instr_info_t *iinfo = get_cpu_log_instr_info(env);
-    log_reginfo_t r;
+    log_reginfo_t *r = log_instr_new_reg(iinfo);
 
-    r.flags = LRI_CAP_REG | LRI_HOLDS_CAP;
-    r.name = reg_name;
-    r.cap = *cr;
-    g_array_append_val(iinfo->regs, r);
+    r->flags = LRI_CAP_REG | LRI_HOLDS_CAP;
+    r->name = reg_name;
+    r->cap = *cr;
 }
 
 void helper_qemu_log_instr_cap(CPUArchState *env, const void *reg_name,
@@ -981,12 +2382,11 @@ void qemu_log_instr_cap_int(CPUArchState *env, const char *reg_name,
                              target_ulong value)
 {
     cpu_log_instr_info_t *iinfo = get_cpu_log_instr_info(env);
-    log_reginfo_t r;
+    log_reginfo_t *r = log_instr_new_reg(iinfo);
 
-    r.flags = LRI_CAP_REG;
-    r.name = reg_name;
-    r.gpr = value;
-    g_array_append_val(iinfo->regs, r);
+    r->flags = LRI_CAP_REG;
+    r->name = reg_name;
+    r->gpr = value;
 }
 #endif
 
@@ -995,13 +2395,12 @@ static inline void qemu_log_instr_mem_int(CPUArchState *env, target_ulong addr,
                                           target_ulong value)
 {
     cpu_log_instr_info_t *iinfo = get_cpu_log_instr_info(env);
-    log_meminfo_t m;
+    log_meminfo_t *m = log_instr_new_mem(iinfo);
 
-    m.flags = flags;
-    m.op = get_memop(oi);
-    m.addr = addr;
-    m.value = value;
-    g_array_append_val(iinfo->mem, m);
+    m->flags = flags;
+    m->op = get_memop(oi);
+    m->addr = addr;
+    m->value = value;
 }
 
 void qemu_log_instr_ld_int(CPUArchState *env, target_ulong addr, TCGMemOpIdx oi,
@@ -1028,13 +2427,12 @@ static inline void qemu_log_instr_mem_cap(
     const cap_register_t *value)
 {
     cpu_log_instr_info_t *iinfo = get_cpu_log_instr_info(env);
-    log_meminfo_t m;
+    log_meminfo_t *m = log_instr_new_mem(iinfo);
 
-    m.flags = flags;
-    m.op = 0;
-    m.addr = addr;
-    m.cap = *value;
-    g_array_append_val(iinfo->mem, m);
+    m->flags = flags;
+    m->op = 0;
+    m->addr = addr;
+    m->cap = *value;
 }
 
 void qemu_log_instr_ld_cap(CPUArchState *env, target_ulong addr,
@@ -1099,13 +2497,68 @@ void qemu_log_instr_evt(CPUArchState *env, uint16_t fn, target_ulong arg0,
     /* iinfo->cv_buffer.val4 = arg3; */
 }
 
+/*
+ * Append formatted text to the extra text of the current entry.
+ * The text is bump-allocated from the per-CPU arena, which is reset once
+ * the entries using it have been emitted. When the arena is full, or
+ * buffered mode left the entry text in the middle of the arena, the
+ * entry text moves to its own heap buffer.
+ */
+static void GCC_FMT_ATTR(3, 0)
+log_text_vappend(cpu_log_instr_state_t *cpulog, cpu_log_instr_info_t *iinfo,
+                 const char *fmt, va_list va)
+{
+    char *end = cpulog->txt_arena + cpulog->txt_arena_used;
+    size_t avail = LOG_INSTR_TXT_ARENA_SIZE - cpulog->txt_arena_used;
+    GString *ovf;
+    va_list va2;
+    int n;
+
+    if (likely(iinfo->txt_len == 0 || iinfo->txt + iinfo->txt_len == end)) {
+        va_copy(va2, va);
+        n = vsnprintf(end, avail, fmt, va2);
+        va_end(va2);
+        if (likely(n >= 0 && n < avail)) {
+            if (iinfo->txt_len == 0) {
+                iinfo->txt = end;
+            }
+            iinfo->txt_len += n;
+            cpulog->txt_arena_used += n;
+            return;
+        }
+    }
+
+    ovf = iinfo->txt_overflow;
+    if (ovf == NULL) {
+        ovf = iinfo->txt_overflow = g_string_new(NULL);
+    }
+    if (iinfo->txt != ovf->str) {
+        g_string_truncate(ovf, 0);
+        g_string_append_len(ovf, iinfo->txt, iinfo->txt_len);
+    }
+    g_string_append_vprintf(ovf, fmt, va);
+    iinfo->txt = ovf->str;
+    iinfo->txt_len = ovf->len;
+}
+
+static void GCC_FMT_ATTR(3, 4)
+log_text_append(cpu_log_instr_state_t *cpulog, cpu_log_instr_info_t *iinfo,
+                const char *fmt, ...)
+{
+    va_list va;
+
+    va_start(va, fmt);
+    log_text_vappend(cpulog, iinfo, fmt, va);
+    va_end(va);
+}
+
 void qemu_log_instr_extra(CPUArchState *env, const char *msg, ...)
 {
     cpu_log_instr_info_t *iinfo = get_cpu_log_instr_info(env);
     va_list va;
 
     va_start(va, msg);
-    g_string_append_vprintf(iinfo->txt_buffer, msg, va);
+    log_text_vappend(get_cpu_log_state(env), iinfo, msg, va);
     va_end(va);
 }
 
@@ -1116,8 +2569,9 @@ void qemu_log_instr_extra(CPUArchState *env, const char *msg, ...)
  * sections split in the fmt string to another buffer, then switch on all
  * possible types.
  */
-static void g_string_append_printf_union_args(GString *string, const char *fmt,
-                                              qemu_log_arg_t *args)
+static void log_text_append_union_args(cpu_log_instr_state_t *cpulog,
+                                       cpu_log_instr_info_t *iinfo,
+                                       const char *fmt, qemu_log_arg_t *args)
 {
 
 /* So Clang will not complain about the non-literal format. */
@@ -1141,7 +2595,7 @@ static void g_string_append_printf_union_args(GString *string, const char *fmt,
              */
             if (i >= (sizeof(bounce_buf) - 10)) {
                 bounce_buf[i] = '\0';
-                g_string_append_printf(string, bounce_buf);
+                log_text_append(cpulog, iinfo, bounce_buf);
                 i = 0;
             }
             format = c == '%';
@@ -1151,20 +2605,24 @@ static void g_string_append_printf_union_args(GString *string, const char *fmt,
         bounce_buf[i] = '\0';
         switch (c) {
         case 'c':
-            g_string_append_printf(string, bounce_buf, (args++)->charv);
+            log_text_append(cpulog, iinfo, bounce_buf, (args++)->charv);
             format = false;
             i = 0;
             break;
         case 'd':
         case 'i':
             if (is_long_long) {
-                g_string_append_printf(string, bounce_buf, (args++)->longlongv);
+                log_text_append(cpulog, iinfo, bounce_buf,
+                                (args++)->longlongv);
             } else if (is_long) {
-                g_string_append_printf(string, bounce_buf, (args++)->longv);
+                log_text_append(cpulog, iinfo, bounce_buf,
+                                (args++)->longv);
             } else if (is_short) {
-                g_string_append_printf(string, bounce_buf, (args++)->shortv);
+                log_text_append(cpulog, iinfo, bounce_buf,
+                                (args++)->shortv);
             } else {
-                g_string_append_printf(string, bounce_buf, (args++)->intv);
+                log_text_append(cpulog, iinfo, bounce_buf,
+                                (args++)->intv);
             }
             format = false;
             i = 0;
@@ -1174,14 +2632,17 @@ static void g_string_append_printf_union_args(GString *string, const char *fmt,
         case 'X':
         case 'o':
             if (is_long_long) {
-                g_string_append_printf(string, bounce_buf,
+                log_text_append(cpulog, iinfo, bounce_buf,
                                        (args++)->ulonglongv);
             } else if (is_long) {
-                g_string_append_printf(string, bounce_buf, (args++)->ulongv);
+                log_text_append(cpulog, iinfo, bounce_buf,
+                                (args++)->ulongv);
             } else if (is_short) {
-                g_string_append_printf(string, bounce_buf, (args++)->ushortv);
+                log_text_append(cpulog, iinfo, bounce_buf,
+                                (args++)->ushortv);
             } else {
-                g_string_append_printf(string, bounce_buf, (args++)->uintv);
+                log_text_append(cpulog, iinfo, bounce_buf,
+                                (args++)->uintv);
             }
             format = false;
             i = 0;
@@ -1192,16 +2653,18 @@ static void g_string_append_printf_union_args(GString *string, const char *fmt,
         case 'g':
         case 'G':
             if (is_long) {
-                g_string_append_printf(string, bounce_buf, (args++)->doublev);
+                log_text_append(cpulog, iinfo, bounce_buf,
+                                (args++)->doublev);
             } else {
-                g_string_append_printf(string, bounce_buf, (args++)->floatv);
+                log_text_append(cpulog, iinfo, bounce_buf,
+                                (args++)->floatv);
             }
             format = false;
             i = 0;
             break;
         case 's':
         case 'p':
-            g_string_append_printf(string, bounce_buf, (args++)->ptrv);
+            log_text_append(cpulog, iinfo, bounce_buf, (args++)->ptrv);
             format = false;
             i = 0;
             break;
@@ -1222,7 +2685,7 @@ static void g_string_append_printf_union_args(GString *string, const char *fmt,
         }
     }
 
-    g_string_append_printf(string, bounce_buf);
+    log_text_append(cpulog, iinfo, bounce_buf);
 
 #pragma clang diagnostic pop
 }
@@ -1241,6 +2704,56 @@ void qemu_log_printf_create_globals(void)
         "log_valids");
 }
 
+#define LOG_INSTR_STATE_OFFSET(field)                                          \
+    ((offsetof(ArchCPU, parent_obj) - offsetof(ArchCPU, env)) +                \
+     offsetof(struct CPUState, log_state.field))
+
+void qemu_log_instr_gen_commit(DisasContextBase *base)
+{
+    TCGLabel *skip;
+    TCGv_i32 tmp;
+    uint16_t hits;
+
+    if (!qemu_log_instr_dynamic) {
+        gen_helper_qemu_log_instr_commit(cpu_env);
+        return;
+    }
+
+    /* Only commit if logging is active on this CPU */
+    skip = gen_new_label();
+    tmp = tcg_temp_new_i32();
+    tcg_gen_ld8u_i32(tmp, cpu_env, LOG_INSTR_STATE_OFFSET(loglevel_active));
+    tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, 0, skip);
+    gen_helper_qemu_log_instr_commit(cpu_env);
+    gen_set_label(skip);
+
+    /*
+     * Update the trigger PC range hits when entering the TB and whenever
+     * they differ from the previous instruction. On TB entry the hits may
+     * be stale, so compare them at run time.
+     */
+    if (log_instr_triggers.has_range) {
+        hits = log_instr_trigger_pc_hits(base->pc_next);
+        if (base->num_insns == 1 || hits != base->log_instr_trigger_pc_hits) {
+            TCGv_i32 thits;
+            TCGv tpc;
+
+            skip = gen_new_label();
+            tcg_gen_ld16u_i32(tmp, cpu_env,
+                              LOG_INSTR_STATE_OFFSET(trigger_pc_hits));
+            tcg_gen_brcondi_i32(TCG_COND_EQ, tmp, hits, skip);
+            thits = tcg_const_i32(hits);
+            tpc = tcg_const_tl(base->pc_next);
+            gen_helper_qemu_log_instr_trigger_pc(cpu_env, thits, tpc);
+            tcg_temp_free(tpc);
+            tcg_temp_free_i32(thits);
+            gen_set_label(skip);
+        }
+        base->log_instr_trigger_pc_hits = hits;
+    }
+    tcg_temp_free_i32(tmp);
+}
+
 void qemu_log_gen_printf(DisasContextBase *base, const char *qemu_format,
                          const char *fmt, ...)
 {
@@ -1477,6 +2990,20 @@ void qemu_log_instr_flush(CPUArchState *env)
         curr = (curr + 1) % cpulog->instr_info->len;
     }
     cpulog->ring_tail = cpulog->ring_head;
+
+    /*
+     * Only the entry being recorded may still reference the text arena,
+     * move its text to the front and reclaim the rest.
+     */
+    iinfo = get_cpu_log_instr_info(env);
+    if (iinfo->txt_len && iinfo->txt >= cpulog->txt_arena &&
+        iinfo->txt < cpulog->txt_arena + LOG_INSTR_TXT_ARENA_SIZE) {
+        memmove(cpulog->txt_arena, iinfo->txt, iinfo->txt_len);
+        iinfo->txt = cpulog->txt_arena;
+        cpulog->txt_arena_used = iinfo->txt_len;
+    } else {
+        cpulog->txt_arena_used = 0;
+    }
 }
 
 /* Instruction logging helpers */
@@ -1503,7 +3030,7 @@ void helper_qemu_log_printf_dump(CPUArchState *env)
             get_cpu_log_state(env)->qemu_log_printf_buf.args +
             (ndx * QEMU_LOG_PRINTF_ARG_MAX);
         const char *fmt = get_cpu_log_state(env)->qemu_log_printf_buf.fmts[ndx];
-        g_string_append_printf_union_args(iinfo->txt_buffer, fmt, args);
+        log_text_append_union_args(get_cpu_log_state(env), iinfo, fmt, args);
     }
 }
 
@@ -1601,6 +3128,50 @@ void helper_qemu_log_instr_commit(CPUArchState *env)
     qemu_log_instr_commit(env);
 }
 
+/*
+ * The trigger PC range hits changed between the previous instruction and
+ * the one at @pc. The previous instruction has been committed already, so
+ * start and stop right here without going through the delayed start of
+ * do_cpu_loglevel_switch.
+ */
+void helper_qemu_log_instr_trigger_pc(CPUArchState *env, uint32_t hits,
+                                      target_ulong pc)
+{
+    cpu_log_instr_state_t *cpulog = get_cpu_log_state(env);
+    bool active;
+
+    cpulog->trigger_pc_hits = hits;
+    if (!qemu_loglevel_mask(CPU_LOG_INSTR) ||
+        cpulog->loglevel == QEMU_LOG_INSTR_LOGLEVEL_NONE)
+        return;
+
+    active = log_instr_level_active(env, cpulog->loglevel);
+    if (active == cpulog->loglevel_active)
+        return;
+
+    cpulog->loglevel_active = active;
+    if (active) {
+        emit_start_event(env, pc);
+    } else if (!cpulog->starting) {
+        emit_stop_event(env, pc);
+    }
+    reset_log_buffer(cpulog, get_cpu_log_instr_info(env));
+}
+
+/*
+ * Entry to a TB translated without logging because it is outside -dfilter.
+ * Commit the last instruction of the previous TB and drop anything logged
+ * outside of TCG code (e.g. by helpers) until the next commit.
+ */
+void helper_qemu_log_instr_filtered_tb(CPUArchState *env)
+{
+    /* With -cheri-trace-trigger this also runs while logging is paused */
+    if (!qemu_log_instr_enabled(env))
+        return;
+    qemu_log_instr_commit(env);
+    qemu_log_instr_drop(env);
+}
+
 void helper_qemu_log_instr_load64(CPUArchState *env, target_ulong addr,
                                   uint64_t value, TCGMemOpIdx oi)
 {
@@ -1659,6 +3230,18 @@ static trace_fmt_hooks_t trace_formats[] = {
         .emit_start = emit_nop_start,
         .emit_stop = emit_nop_stop,
         .emit_entry = emit_nop_entry
+    },
+    {
+        .emit_header = emit_binary_header,
+        .emit_start = emit_binary_start,
+        .emit_stop = emit_binary_stop,
+        .emit_entry = emit_binary_entry
+    },
+    {
+        .emit_header = emit_perfetto_header,
+        .emit_start = emit_perfetto_start,
+        .emit_stop = emit_perfetto_stop,
+        .emit_entry = emit_perfetto_entry
     }
 };
 
@@ -0,0 +1,385 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Sampling profiler for guest PCs.
+ *
+ * Instead of logging every instruction, a timer periodically asks each vCPU
+ * to record its current PC, ASID, privilege mode and (on CHERI targets) the
+ * bounds of PCC. The request is queued with async_run_on_cpu(), which kicks
+ * the vCPU out of generated code, so the sample is taken at a TB boundary
+ * where the architectural state is up to date and the cost is a single
+ * return to the main loop per sample. No samples are requested while the VM
+ * is stopped, and at most one request per vCPU is queued at a time, so that
+ * a vCPU that does not run does not accumulate queued work.
+ *
+ * The timer runs either on the host realtime clock (period=<us>) or, with
+ * -icount, on the virtual clock so that samples are taken every insns=<n>
+ * guest instructions.
+ *
+ * Each vCPU appends its samples to its own single-producer, single-consumer
+ * ring without taking any lock. The timer callback, which runs in the main
+ * loop, drains the rings and does the symbol lookups and file output, so the
+ * vCPU threads never block on either. If a ring is full when a sample is
+ * taken, the sample is dropped and counted.
+ *
+ * Output is either perf-script compatible text (format=perf, usable with
+ * stackcollapse-perf.pl) or folded stacks (format=folded, aggregated until
+ * shutdown) for flamegraph.pl. The timer is stopped and the remaining
+ * samples are written in qemu_cleanup(), once the vCPUs have been paused.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/notify.h"
+#include "qemu/option.h"
+#include "qemu/stats64.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "cpu.h"
+#include "disas/disas.h"
+#include "exec/log_instr.h"
+#include "hw/core/cpu.h"
+#include "sysemu/cpu-timers.h"
+#include "sysemu/runstate.h"
+#include "sysemu/sysemu.h"
+
+#define LOG_INSTR_SAMPLE_DEFAULT_PERIOD_US 1000
+#define LOG_INSTR_SAMPLE_DEFAULT_RING_SIZE 4096
+
+typedef struct log_instr_sample {
+    int64_t time_ns;
+    target_ulong pc;
+#ifdef TARGET_CHERI
+    target_ulong pcc_base;
+    target_ulong pcc_top;
+#endif
+    uint16_t asid;
+    bool user;
+    bool halted;
+} log_instr_sample_t;
+
+/*
+ * head and tail count samples since the ring was created, the slot of a
+ * sample is its count modulo sampler.ring_size (a power of two, so that the
+ * counters may wrap).
+ */
+struct log_instr_sample_ring {
+    /* Only written by the vCPU */
+    size_t head;
+    Stat64 dropped;
+    /* Only written by the main loop */
+    size_t tail;
+    /* Set while a sample request is queued, cleared by the vCPU */
+    bool pending;
+    log_instr_sample_t samples[];
+};
+
+typedef enum {
+    SAMPLE_FMT_FOLDED = 0,
+    SAMPLE_FMT_PERF = 1,
+} sample_fmt_t;
+
+static struct {
+    bool enabled;
+    /* Cleared at shutdown, after which samples are no longer taken */
+    bool running;
+    char *path;
+    FILE *out;
+    sample_fmt_t format;
+    QEMUClockType clock;
+    uint64_t period;     /* in us, or in instructions with icount */
+    int64_t period_ns;
+    int64_t start_ns;
+    size_t ring_size;
+    QEMUTimer *timer;
+    /* Folded stack -> number of samples, only for SAMPLE_FMT_FOLDED */
+    GHashTable *folded;
+    Notifier machine_ready;
+} sampler;
+
+static QemuOptsList qemu_log_instr_sample_opts = {
+    .name = "cheri-profile",
+    .implied_opt_name = "file",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_log_instr_sample_opts.head),
+    .desc = {
+        {
+            .name = "file",
+            .type = QEMU_OPT_STRING,
+            .help = "output file",
+        }, {
+            .name = "format",
+            .type = QEMU_OPT_STRING,
+            .help = "folded or perf",
+        }, {
+            .name = "period",
+            .type = QEMU_OPT_NUMBER,
+            .help = "sampling period in microseconds of host time",
+        }, {
+            .name = "insns",
+            .type = QEMU_OPT_NUMBER,
+            .help = "sampling period in guest instructions (needs -icount)",
+        }, {
+            .name = "ring",
+            .type = QEMU_OPT_NUMBER,
+            .help = "number of samples buffered per CPU",
+        },
+        { /* end of list */ }
+    },
+};
+
+static const char *sample_mode_name(const log_instr_sample_t *s)
+{
+    if (s->halted) {
+        return "idle";
+    }
+    return s->user ? "user" : "kernel";
+}
+
+static char *sample_pc_name(target_ulong pc)
+{
+    const char *sym = lookup_symbol(pc);
+
+    if (sym[0] != '\0') {
+        return g_strdup(sym);
+    }
+    return g_strdup_printf("0x" TARGET_FMT_lx, pc);
+}
+
+static void sample_emit_perf(int cpu_index, const log_instr_sample_t *s)
+{
+    int64_t t = s->time_ns - sampler.start_ns;
+    g_autofree char *sym = sample_pc_name(s->pc);
+
+    /* One perf-script record: header line, then the stack leaf first. */
+    fprintf(sampler.out, "cpu%d %u/%u [%03d] %" PRId64 ".%06" PRId64
+            ": 1 cpu-clock:\n", cpu_index, s->asid, s->asid, cpu_index,
+            t / NANOSECONDS_PER_SECOND,
+            (t % NANOSECONDS_PER_SECOND) / 1000);
+    fprintf(sampler.out, "\t" TARGET_FMT_lx " %s ([%s])\n", s->pc, sym,
+            sample_mode_name(s));
+#ifdef TARGET_CHERI
+    fprintf(sampler.out, "\t" TARGET_FMT_lx " pcc[" TARGET_FMT_lx "-"
+            TARGET_FMT_lx "] ([pcc])\n", s->pcc_base, s->pcc_base,
+            s->pcc_top);
+#endif
+    fputc('\n', sampler.out);
+}
+
+static void sample_add_folded(int cpu_index, const log_instr_sample_t *s)
+{
+    g_autofree char *sym = sample_pc_name(s->pc);
+    char *stack;
+    gpointer count;
+
+    /* Outermost frame first: cpu;mode;asid;[pcc;]function */
+#ifdef TARGET_CHERI
+    stack = g_strdup_printf("cpu%d;%s;asid %u;pcc[" TARGET_FMT_lx "-"
+                            TARGET_FMT_lx "];%s", cpu_index,
+                            sample_mode_name(s), s->asid, s->pcc_base,
+                            s->pcc_top, sym);
+#else
+    stack = g_strdup_printf("cpu%d;%s;asid %u;%s", cpu_index,
+                            sample_mode_name(s), s->asid, sym);
+#endif
+    count = g_hash_table_lookup(sampler.folded, stack);
+    g_hash_table_replace(sampler.folded, stack,
+                         GSIZE_TO_POINTER(GPOINTER_TO_SIZE(count) + 1));
+}
+
+/* Write out the samples published by the vCPU so far. */
+static void sample_ring_drain(CPUState *cpu)
+{
+    struct log_instr_sample_ring *ring = cpu->log_state.sample_ring;
+    size_t head = qatomic_load_acquire(&ring->head);
+    size_t tail;
+
+    for (tail = ring->tail; tail != head; tail++) {
+        const log_instr_sample_t *s = &ring->samples[tail % sampler.ring_size];
+
+        if (sampler.format == SAMPLE_FMT_PERF) {
+            sample_emit_perf(cpu->cpu_index, s);
+        } else {
+            sample_add_folded(cpu->cpu_index, s);
+        }
+    }
+    /* Hand the slots back to the vCPU only once they have been read */
+    qatomic_store_release(&ring->tail, tail);
+}
+
+static void do_log_instr_sample(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUArchState *env = cpu->env_ptr;
+    struct log_instr_sample_ring *ring = data.host_ptr;
+    size_t head = ring->head;
+    log_instr_sample_t *s;
+
+    qatomic_set(&ring->pending, false);
+    if (!qatomic_read(&sampler.running)) {
+        return;
+    }
+    if (head - qatomic_load_acquire(&ring->tail) == sampler.ring_size) {
+        stat64_add(&ring->dropped, 1);
+        return;
+    }
+    s = &ring->samples[head % sampler.ring_size];
+    s->time_ns = qemu_clock_get_ns(sampler.clock);
+    s->pc = cpu_get_recent_pc(env);
+#ifdef TARGET_CHERI
+    s->pcc_base = cap_get_base(cheri_get_recent_pcc(env));
+    s->pcc_top = cap_get_top(cheri_get_recent_pcc(env));
+#endif
+    s->asid = cpu_get_asid(env, s->pc);
+    s->user = cpu_in_user_mode(env);
+    s->halted = cpu->halted;
+    qatomic_store_release(&ring->head, head + 1);
+}
+
+static void log_instr_sample_tick(void *opaque)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        struct log_instr_sample_ring *ring = cpu->log_state.sample_ring;
+
+        if (unlikely(ring == NULL)) {
+            /* Allocated on first use so that hotplugged CPUs are sampled too */
+            ring = g_malloc0(sizeof(struct log_instr_sample_ring) +
+                             sampler.ring_size * sizeof(log_instr_sample_t));
+            cpu->log_state.sample_ring = ring;
+        } else {
+            sample_ring_drain(cpu);
+        }
+        if (runstate_is_running() && !qatomic_read(&ring->pending)) {
+            qatomic_set(&ring->pending, true);
+            async_run_on_cpu(cpu, do_log_instr_sample,
+                             RUN_ON_CPU_HOST_PTR(ring));
+        }
+    }
+    timer_mod(sampler.timer,
+              qemu_clock_get_ns(sampler.clock) + sampler.period_ns);
+}
+
+void qemu_log_instr_sample_shutdown(void)
+{
+    CPUState *cpu;
+    GHashTableIter iter;
+    gpointer stack, count;
+    uint64_t dropped = 0;
+
+    if (!sampler.out) {
+        return;
+    }
+    /*
+     * The vCPUs are paused, but may still run queued sampling work. That
+     * returns early from now on and the rings are never freed, so it is
+     * harmless.
+     */
+    qatomic_set(&sampler.running, false);
+    timer_del(sampler.timer);
+    CPU_FOREACH(cpu) {
+        if (cpu->log_state.sample_ring) {
+            sample_ring_drain(cpu);
+            dropped += stat64_get(&cpu->log_state.sample_ring->dropped);
+        }
+    }
+    if (sampler.format == SAMPLE_FMT_FOLDED) {
+        g_hash_table_iter_init(&iter, sampler.folded);
+        while (g_hash_table_iter_next(&iter, &stack, &count)) {
+            fprintf(sampler.out, "%s %zu\n", (const char *)stack,
+                    (size_t)GPOINTER_TO_SIZE(count));
+        }
+    }
+    fclose(sampler.out);
+    sampler.out = NULL;
+    if (dropped) {
+        warn_report("cheri-profile: %" PRIu64 " samples were dropped "
+                    "because a ring was full, consider a larger ring=<n>",
+                    dropped);
+    }
+}
+
+static void log_instr_sample_start(Notifier *notifier, void *data)
+{
+    if (sampler.clock == QEMU_CLOCK_VIRTUAL) {
+        if (!icount_enabled()) {
+            error_report("cheri-profile: insns=<n> requires -icount");
+            exit(1);
+        }
+        sampler.period_ns = icount_to_ns(sampler.period);
+    } else {
+        sampler.period_ns = sampler.period * SCALE_US;
+    }
+
+    sampler.out = fopen(sampler.path, "w");
+    if (sampler.out == NULL) {
+        error_report("cheri-profile: could not open '%s': %s", sampler.path,
+                     strerror(errno));
+        exit(1);
+    }
+    if (sampler.format == SAMPLE_FMT_FOLDED) {
+        sampler.folded = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               g_free, NULL);
+    }
+    qatomic_set(&sampler.running, true);
+
+    sampler.start_ns = qemu_clock_get_ns(sampler.clock);
+    sampler.timer = timer_new_ns(sampler.clock, log_instr_sample_tick, NULL);
+    timer_mod(sampler.timer, sampler.start_ns + sampler.period_ns);
+}
+
+void qemu_log_instr_sample_parse_opts(const char *optarg)
+{
+    QemuOpts *opts =
+        qemu_opts_parse_noisily(&qemu_log_instr_sample_opts, optarg, true);
+    const char *path, *format;
+    uint64_t period, insns;
+
+    if (!opts) {
+        exit(1);
+    }
+    if (sampler.enabled) {
+        error_report("cheri-profile: can only be specified once");
+        exit(1);
+    }
+    path = qemu_opt_get(opts, "file");
+    if (!path) {
+        error_report("cheri-profile: an output file is required");
+        exit(1);
+    }
+    format = qemu_opt_get(opts, "format");
+    if (format == NULL || strcmp(format, "folded") == 0) {
+        sampler.format = SAMPLE_FMT_FOLDED;
+    } else if (strcmp(format, "perf") == 0) {
+        sampler.format = SAMPLE_FMT_PERF;
+    } else {
+        error_report("Invalid choice for cheri-profile format: '%s'", format);
+        exit(1);
+    }
+    period = qemu_opt_get_number(opts, "period", 0);
+    insns = qemu_opt_get_number(opts, "insns", 0);
+    if (period && insns) {
+        error_report("cheri-profile: period and insns are mutually exclusive");
+        exit(1);
+    }
+    if (insns) {
+        sampler.clock = QEMU_CLOCK_VIRTUAL;
+        sampler.period = insns;
+    } else {
+        sampler.clock = QEMU_CLOCK_REALTIME;
+        sampler.period = period ? period : LOG_INSTR_SAMPLE_DEFAULT_PERIOD_US;
+    }
+    sampler.ring_size = qemu_opt_get_number(
+        opts, "ring", LOG_INSTR_SAMPLE_DEFAULT_RING_SIZE);
+    if (sampler.ring_size == 0 || sampler.ring_size > (1 << 24)) {
+        error_report("cheri-profile: ring must be between 1 and %d",
+                     1 << 24);
+        exit(1);
+    }
+    sampler.ring_size = pow2ceil(sampler.ring_size);
+    sampler.path = g_strdup(path);
+    sampler.enabled = true;
+    qemu_opts_del(opts);
+
+    sampler.machine_ready.notify = log_instr_sample_start;
+    qemu_add_machine_init_done_notifier(&sampler.machine_ready);
+}
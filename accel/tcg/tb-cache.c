@@ -0,0 +1,626 @@
+/*
+ * Persistent translation block cache
+ *
+ * With -accel tcg,tb-cache=<file>, the code regions handed out since the
+ * last TB flush are written to <file> on shutdown together with an index
+ * of the TBs they contain. A later run maps these regions back into
+ * code_gen_buffer and, instead of translating a block again, links the
+ * cached TB once the guest code it was translated from is found unchanged.
+ *
+ * TBs are keyed like tb_htable: physical and virtual PC, cs_base/cs_top,
+ * flags, cheri_flags, the hashed cflags and the trace state. On top of that
+ * every entry records a hash of the guest code bytes, checked before the TB
+ * is linked, so a changed disk image or a relocated kernel just misses.
+ *
+ * Generated code refers to helpers, to the prologue and to its own
+ * TranslationBlock by absolute or PC-relative address and there is no
+ * relocation information for it. The cache is therefore only used when
+ * the QEMU executable and code_gen_buffer are mapped at the same
+ * addresses as in the run that wrote it: with a non-PIE build or with
+ * ASLR disabled (e.g. setarch -R), the same executable, machine and
+ * -smp. The file header records all of these and a mismatching file is
+ * ignored. Translators also read CPU state that is not part of the TB
+ * flags, such as the Arm ID registers, and the accelerator options change
+ * the generated code, so the header also records a hash of the CPU state
+ * the target reports through cpu_tb_cache_key() and the codegen options. The file contains host code that is executed as is, only
+ * point this at files written by a trusted QEMU.
+ *
+ * TBs may also embed pointers to data that QEMU allocated at startup, such
+ * as the Arm ARMCPRegInfo of a system register access. Targets mark these
+ * with tcg_const_heap_ptr() and such TBs are not written to the cache. The
+ * cache is only enabled for targets that have been audited for this and
+ * set TARGET_SUPPORTS_TB_CACHE in their default-configs/targets file.
+ *
+ * Plugins instrument TBs with pointers to their own state, so no cache is
+ * written while plugins are loaded and cached TBs are not used for vCPUs
+ * that have TB translation callbacks.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/qemu-print.h"
+#include "qemu/thread.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "exec/ram_addr.h"
+#include "exec/tb-hash.h"
+#include "hw/boards.h"
+#include "sysemu/tcg.h"
+#include "tcg/tcg.h"
+#include "trace.h"
+#include "tb-cache.h"
+
+#define TB_CACHE_MAGIC "QEMUTBC1"
+#define TB_CACHE_VERSION 3
+
+/* Where to ask for code_gen_buffer, away from the usual mmap area */
+#define TB_CACHE_BUFFER_ADDR 0x200000000000ULL
+
+#define TB_CACHE_HASH_BASIS 0xcbf29ce484222325ULL
+#define TB_CACHE_HASH_PRIME 0x100000001b3ULL
+
+/*
+ * File layout: header, one range per region, the TB entries, then from
+ * data_offset (host page aligned) an image of code_gen_buffer starting at
+ * base, of which only the ranges are written.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_ranges;
+    uint64_t n_entries;
+    uint64_t data_offset;
+    /* Everything below must match the current run */
+    char target[32];
+    char machine[64];
+    char cpu_type[64];
+    uint64_t cpu_key;
+    uint32_t codegen_flags;
+    uint32_t pad;
+    uint64_t exe_dev;
+    uint64_t exe_ino;
+    uint64_t exe_size;
+    uint64_t exe_mtime;
+    uint64_t anchor;
+    uint64_t base;
+    uint64_t n_regions;
+    uint64_t page_size;
+} TBCacheHeader;
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+} TBCacheRange;
+
+typedef struct {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t cs_top;
+    uint64_t phys_pc;
+    uint64_t phys_page2;
+    uint64_t guest_hash;
+    uint64_t tb_offset;     /* of the TranslationBlock from base */
+    uint32_t flags;
+    uint32_t cheri_flags;
+    uint32_t cflags;
+    uint32_t trace_vcpu_dstate;
+    uint32_t size;
+    uint32_t pad;
+} TBCacheEntry;
+
+/* TBCacheHeader.codegen_flags */
+#define TB_CACHE_GVN 1
+
+bool tb_cache_enabled;
+
+static struct {
+    char *path;
+    uintptr_t base;
+    /* Protects index */
+    QemuMutex lock;
+    /* Cached TBs that have not been looked up yet */
+    GHashTable *index;
+    TBCacheEntry *entries;
+    size_t loaded;
+    size_t hits;
+    size_t misses;
+    size_t stale;
+} tb_cache;
+
+static guint tb_cache_entry_hash(gconstpointer p)
+{
+    const TBCacheEntry *e = p;
+
+    return tb_hash_func(e->phys_pc, e->pc, e->flags, e->cflags & CF_HASH_MASK,
+                        e->trace_vcpu_dstate);
+}
+
+static gboolean tb_cache_entry_equal(gconstpointer ap, gconstpointer bp)
+{
+    const TBCacheEntry *a = ap;
+    const TBCacheEntry *b = bp;
+
+    return a->pc == b->pc && a->cs_base == b->cs_base &&
+           a->cs_top == b->cs_top && a->phys_pc == b->phys_pc &&
+           a->flags == b->flags && a->cheri_flags == b->cheri_flags &&
+           (a->cflags & CF_HASH_MASK) == (b->cflags & CF_HASH_MASK) &&
+           a->trace_vcpu_dstate == b->trace_vcpu_dstate;
+}
+
+static uint64_t tb_cache_hash_bytes(const uint8_t *p, size_t len, uint64_t h)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ p[i]) * TB_CACHE_HASH_PRIME;
+    }
+    return h;
+}
+
+uint64_t tb_cache_guest_hash(target_ulong pc, uint32_t size,
+                             tb_page_addr_t phys_pc, tb_page_addr_t phys_page2)
+{
+    uint32_t len = MIN(size, TARGET_PAGE_SIZE - (pc & ~TARGET_PAGE_MASK));
+    uint64_t h;
+
+    h = tb_cache_hash_bytes(qemu_map_ram_ptr(NULL, phys_pc), len,
+                            TB_CACHE_HASH_BASIS);
+    if (len < size) {
+        h = tb_cache_hash_bytes(qemu_map_ram_ptr(NULL, phys_page2),
+                                size - len, h);
+    }
+    return h;
+}
+
+static uint64_t tb_cache_cpu_key(void)
+{
+    uint64_t h = TB_CACHE_HASH_BASIS;
+#ifdef TARGET_SUPPORTS_TB_CACHE
+    g_autoptr(GByteArray) key = g_byte_array_new();
+
+    cpu_tb_cache_key(first_cpu->env_ptr, key);
+    h = tb_cache_hash_bytes(key->data, key->len, h);
+#endif
+    return h;
+}
+
+static void tb_cache_fill_header(TBCacheHeader *h)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    void *start, *end;
+    struct stat st;
+
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, TB_CACHE_MAGIC, sizeof(h->magic));
+    h->version = TB_CACHE_VERSION;
+    pstrcpy(h->target, sizeof(h->target), TARGET_NAME);
+    pstrcpy(h->machine, sizeof(h->machine), MACHINE_GET_CLASS(ms)->name);
+    pstrcpy(h->cpu_type, sizeof(h->cpu_type), ms->cpu_type ?: "");
+    h->cpu_key = tb_cache_cpu_key();
+    h->codegen_flags = tcg_gvn_enabled ? TB_CACHE_GVN : 0;
+#ifdef CONFIG_LINUX
+    if (stat("/proc/self/exe", &st) == 0) {
+        h->exe_dev = st.st_dev;
+        h->exe_ino = st.st_ino;
+        h->exe_size = st.st_size;
+        h->exe_mtime = st.st_mtime;
+    }
+#endif
+    h->anchor = (uintptr_t)tcg_exec_init;
+    h->n_regions = tcg_region_get_bounds(0, &start, &end);
+    h->base = QEMU_ALIGN_DOWN((uintptr_t)start, qemu_real_host_page_size);
+    h->page_size = qemu_real_host_page_size;
+}
+
+static const char *tb_cache_check_header(const TBCacheHeader *h,
+                                         const TBCacheHeader *want)
+{
+    if (memcmp(h->magic, want->magic, sizeof(h->magic)) != 0 ||
+        h->version != want->version) {
+        return "not a TB cache of this version";
+    }
+    if (memcmp(h->target, want->target, sizeof(h->target)) != 0 ||
+        memcmp(h->machine, want->machine, sizeof(h->machine)) != 0 ||
+        memcmp(h->cpu_type, want->cpu_type, sizeof(h->cpu_type)) != 0) {
+        return "written for another target, machine or CPU";
+    }
+    if (h->cpu_key != want->cpu_key) {
+        return "written for another CPU configuration";
+    }
+    if (h->codegen_flags != want->codegen_flags) {
+        return "written with other -accel tcg code generation options";
+    }
+    if (h->exe_dev != want->exe_dev || h->exe_ino != want->exe_ino ||
+        h->exe_size != want->exe_size || h->exe_mtime != want->exe_mtime) {
+        return "written by another QEMU executable";
+    }
+    if (h->anchor != want->anchor || h->base != want->base ||
+        h->n_regions != want->n_regions || h->page_size != want->page_size) {
+        return "QEMU or its code buffer is mapped at another address "
+               "(is ASLR enabled?)";
+    }
+    if (h->n_ranges == 0 || h->n_ranges > h->n_regions ||
+        h->data_offset % h->page_size != 0) {
+        return "corrupt header";
+    }
+    return NULL;
+}
+
+static const char *tb_cache_map(int fd, const TBCacheHeader *h,
+                                const TBCacheRange *ranges,
+                                const TBCacheEntry *entries)
+{
+    size_t page_size = qemu_real_host_page_size;
+    uint64_t i, j;
+    struct stat st;
+
+    if (fstat(fd, &st) < 0) {
+        return strerror(errno);
+    }
+    for (i = 0; i < h->n_ranges; i++) {
+        void *start, *end;
+
+        tcg_region_get_bounds(i, &start, &end);
+        if (ranges[i].start != (uintptr_t)start ||
+            ranges[i].end < ranges[i].start ||
+            ranges[i].end > (uintptr_t)end ||
+            h->data_offset + ROUND_UP(ranges[i].end, page_size) - h->base >
+            st.st_size) {
+            return "corrupt range";
+        }
+    }
+    if (ranges[h->n_ranges - 1].end == ranges[h->n_ranges - 1].start) {
+        return "corrupt range";
+    }
+    for (i = 0; i < h->n_entries; i++) {
+        uint64_t tb = h->base + entries[i].tb_offset;
+
+        for (j = 0; j < h->n_ranges; j++) {
+            if (tb >= ranges[j].start &&
+                tb + sizeof(TranslationBlock) <= ranges[j].end) {
+                break;
+            }
+        }
+        if (j == h->n_ranges) {
+            return "corrupt entry";
+        }
+    }
+
+    for (i = 0; i < h->n_ranges; i++) {
+        uintptr_t start = QEMU_ALIGN_DOWN(ranges[i].start, page_size);
+        uintptr_t end = ROUND_UP(ranges[i].end, page_size);
+        void *p;
+
+        p = mmap((void *)start, end - start, PROT_READ | PROT_WRITE | PROT_EXEC,
+                 MAP_PRIVATE | MAP_FIXED, fd, h->data_offset + start - h->base);
+        if (p == MAP_FAILED) {
+            /* Nothing has been claimed, the regions will just be overwritten */
+            return strerror(errno);
+        }
+    }
+    return NULL;
+}
+
+void tb_cache_load(void)
+{
+    g_autofree TBCacheRange *ranges = NULL;
+    TBCacheHeader h, want;
+    const char *err;
+    uint64_t i;
+    int fd;
+
+    if (!tb_cache_enabled) {
+        return;
+    }
+    if (tcg_splitwx_diff) {
+        warn_report("tb-cache: not supported with split-wx, disabled");
+        tb_cache_enabled = false;
+        return;
+    }
+    qemu_mutex_init(&tb_cache.lock);
+    tb_cache.index = g_hash_table_new(tb_cache_entry_hash,
+                                      tb_cache_entry_equal);
+
+    tb_cache_fill_header(&want);
+    tb_cache.base = want.base;
+    fd = open(tb_cache.path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            warn_report("tb-cache: could not open '%s': %s", tb_cache.path,
+                        strerror(errno));
+        }
+        trace_tb_cache_load(tb_cache.path, 0);
+        return;
+    }
+
+    if (read(fd, &h, sizeof(h)) != sizeof(h)) {
+        err = "truncated header";
+        goto fail;
+    }
+    err = tb_cache_check_header(&h, &want);
+    if (err) {
+        goto fail;
+    }
+    ranges = g_new(TBCacheRange, h.n_ranges);
+    tb_cache.entries = g_new(TBCacheEntry, h.n_entries);
+    if (read(fd, ranges, h.n_ranges * sizeof(*ranges)) !=
+        h.n_ranges * sizeof(*ranges) ||
+        read(fd, tb_cache.entries, h.n_entries * sizeof(TBCacheEntry)) !=
+        h.n_entries * sizeof(TBCacheEntry)) {
+        err = "truncated index";
+        goto fail;
+    }
+    err = tb_cache_map(fd, &h, ranges, tb_cache.entries);
+    if (err) {
+        goto fail;
+    }
+    close(fd);
+
+    tcg_region_claim(h.n_ranges, (void *)(uintptr_t)ranges[h.n_ranges - 1].end);
+    for (i = 0; i < h.n_entries; i++) {
+        g_hash_table_add(tb_cache.index, &tb_cache.entries[i]);
+    }
+    tb_cache.loaded = h.n_entries;
+    trace_tb_cache_load(tb_cache.path, h.n_entries);
+    return;
+
+fail:
+    warn_report("tb-cache: ignoring '%s': %s", tb_cache.path, err);
+    g_free(tb_cache.entries);
+    tb_cache.entries = NULL;
+    close(fd);
+}
+
+TranslationBlock *tb_cache_lookup(CPUState *cpu, target_ulong pc,
+                                  target_ulong cs_base, target_ulong cs_top,
+                                  uint32_t cheri_flags, uint32_t flags,
+                                  uint32_t cflags, tb_page_addr_t phys_pc,
+                                  tb_page_addr_t *phys_page2)
+{
+    TBCacheEntry key = {
+        .pc = pc,
+        .cs_base = cs_base,
+        .cs_top = cs_top,
+        .phys_pc = phys_pc,
+        .flags = flags,
+        .cheri_flags = cheri_flags,
+        .cflags = cflags,
+        .trace_vcpu_dstate = *cpu->trace_dstate,
+    };
+    TBCacheEntry *e;
+    TranslationBlock *tb;
+    tb_page_addr_t page2 = -1;
+
+#ifdef CONFIG_PLUGIN
+    /* Cached TBs carry no plugin instrumentation */
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return NULL;
+    }
+#endif
+
+    /* Each entry gets a single chance, it is either linked or stale */
+    qemu_mutex_lock(&tb_cache.lock);
+    e = g_hash_table_lookup(tb_cache.index, &key);
+    if (e) {
+        g_hash_table_remove(tb_cache.index, e);
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+    if (!e) {
+        qatomic_inc(&tb_cache.misses);
+        return NULL;
+    }
+
+    if (e->phys_page2 != (uint64_t)-1) {
+        page2 = get_page_addr_code(cpu->env_ptr,
+                                   (pc + e->size - 1) & TARGET_PAGE_MASK);
+    }
+    tb = (TranslationBlock *)(tb_cache.base + e->tb_offset);
+    if (page2 != e->phys_page2 ||
+        tb_cache_guest_hash(pc, e->size, phys_pc, page2) != e->guest_hash ||
+        tb->pc != pc || tb->size != e->size) {
+        qatomic_inc(&tb_cache.stale);
+        return NULL;
+    }
+    qatomic_inc(&tb_cache.hits);
+    *phys_page2 = page2;
+    return tb;
+}
+
+void tb_cache_reset(void)
+{
+    if (!tb_cache_enabled) {
+        return;
+    }
+    qemu_mutex_lock(&tb_cache.lock);
+    g_hash_table_remove_all(tb_cache.index);
+    qemu_mutex_unlock(&tb_cache.lock);
+}
+
+static void tb_cache_add_range(size_t i, void *start, void *end, void *opaque)
+{
+    GArray *ranges = opaque;
+    TBCacheRange r = { .start = (uintptr_t)start, .end = (uintptr_t)end };
+
+    g_array_append_val(ranges, r);
+}
+
+static gboolean tb_cache_add_tb(gpointer key, gpointer value, gpointer data)
+{
+    const TranslationBlock *tb = value;
+    GArray *entries = data;
+    TBCacheEntry e;
+
+    if ((tb_cflags(tb) & (CF_INVALID | CF_NOCACHE)) ||
+        tb->page_addr[0] == -1 || tb->heap_ptrs) {
+        return false;
+    }
+    memset(&e, 0, sizeof(e));
+    e.pc = tb->pc;
+    e.cs_base = tb->cs_base;
+    e.cs_top = tb->cs_top;
+    e.phys_pc = tb->page_addr[0] | (tb->pc & ~TARGET_PAGE_MASK);
+    e.phys_page2 = tb->page_addr[1];
+    e.guest_hash = tb->guest_hash;
+    e.tb_offset = (uintptr_t)tb - tb_cache.base;
+    e.flags = tb->flags;
+    e.cheri_flags = tb->cheri_flags;
+    e.cflags = tb_cflags(tb);
+    e.trace_vcpu_dstate = tb->trace_vcpu_dstate;
+    e.size = tb->size;
+    g_array_append_val(entries, e);
+    return false;
+}
+
+static bool tb_cache_write(int fd, const void *buf, size_t len, off_t offset)
+{
+    ssize_t n;
+
+    while (len) {
+        n = pwrite(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/*
+ * The file is written under a temporary name and renamed, so that
+ * concurrent runs sharing a cache never see a partial file.
+ */
+static void tb_cache_do_save(void)
+{
+    g_autoptr(GArray) ranges = g_array_new(false, false, sizeof(TBCacheRange));
+    g_autoptr(GArray) entries = g_array_new(false, false, sizeof(TBCacheEntry));
+    g_autofree char *tmp = NULL;
+    size_t page_size = qemu_real_host_page_size;
+    TBCacheRange *last;
+    GHashTableIter iter;
+    gpointer e;
+    TBCacheHeader h;
+    uint64_t i, bytes = 0;
+    bool ok;
+    int fd;
+
+#ifdef CONFIG_PLUGIN
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (!bitmap_empty(cpu->plugin_mask, QEMU_PLUGIN_EV_MAX)) {
+            warn_report("tb-cache: not written while plugins are loaded");
+            return;
+        }
+    }
+#endif
+
+    tcg_region_foreach_used(tb_cache_add_range, ranges);
+    while (ranges->len) {
+        last = &g_array_index(ranges, TBCacheRange, ranges->len - 1);
+        if (last->end > last->start) {
+            break;
+        }
+        g_array_set_size(ranges, ranges->len - 1);
+    }
+    if (ranges->len == 0) {
+        return;
+    }
+
+    /* TBs linked in this run, then the cached ones never looked up */
+    tcg_tb_foreach(tb_cache_add_tb, entries);
+    qemu_mutex_lock(&tb_cache.lock);
+    g_hash_table_iter_init(&iter, tb_cache.index);
+    while (g_hash_table_iter_next(&iter, &e, NULL)) {
+        g_array_append_vals(entries, e, 1);
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+
+    tb_cache_fill_header(&h);
+    h.n_ranges = ranges->len;
+    h.n_entries = entries->len;
+    h.data_offset = ROUND_UP(sizeof(h) + ranges->len * sizeof(TBCacheRange) +
+                             entries->len * sizeof(TBCacheEntry), page_size);
+
+    tmp = g_strdup_printf("%s.XXXXXX", tb_cache.path);
+    fd = mkstemp(tmp);
+    if (fd < 0) {
+        warn_report("tb-cache: could not create '%s': %s", tmp,
+                    strerror(errno));
+        return;
+    }
+    ok = tb_cache_write(fd, &h, sizeof(h), 0) &&
+         tb_cache_write(fd, ranges->data,
+                        ranges->len * sizeof(TBCacheRange), sizeof(h)) &&
+         tb_cache_write(fd, entries->data,
+                        entries->len * sizeof(TBCacheEntry),
+                        sizeof(h) + ranges->len * sizeof(TBCacheRange));
+    for (i = 0; ok && i < ranges->len; i++) {
+        TBCacheRange *r = &g_array_index(ranges, TBCacheRange, i);
+        uintptr_t start = QEMU_ALIGN_DOWN(r->start, page_size);
+        uintptr_t end = ROUND_UP(r->end, page_size);
+
+        ok = tb_cache_write(fd, (void *)start, end - start,
+                            h.data_offset + start - h.base);
+        bytes += end - start;
+    }
+    close(fd);
+    if (!ok || rename(tmp, tb_cache.path) < 0) {
+        warn_report("tb-cache: could not write '%s': %s", tb_cache.path,
+                    strerror(errno));
+        unlink(tmp);
+        return;
+    }
+    trace_tb_cache_save(tb_cache.path, h.n_entries, bytes);
+}
+
+/*
+ * Called by qemu_cleanup() on the main thread once vm_shutdown() has
+ * stopped the vCPUs, so nothing translates or invalidates TBs anymore.
+ * There is no current_cpu to enter an exclusive section with. Exits that
+ * bypass the orderly shutdown, e.g. a guest exit through semihosting, do
+ * not write the cache.
+ */
+void tb_cache_save(void)
+{
+    if (!tb_cache_enabled || !tb_cache.index) {
+        return;
+    }
+    tb_cache_do_save();
+}
+
+void *tb_cache_buffer_hint(void)
+{
+#if HOST_LONG_BITS == 64
+    if (tb_cache_enabled) {
+        return (void *)TB_CACHE_BUFFER_ADDR;
+    }
+#endif
+    return NULL;
+}
+
+void tb_cache_init(const char *path)
+{
+#ifdef TARGET_SUPPORTS_TB_CACHE
+    tb_cache.path = g_strdup(path);
+    tb_cache_enabled = true;
+#else
+    warn_report("tb-cache: not supported for this target, disabled");
+#endif
+}
+
+void tb_cache_dump_info(void)
+{
+    if (!tb_cache_enabled) {
+        return;
+    }
+    qemu_printf("TB cache            %zu loaded, %zu hits, %zu misses, "
+                "%zu stale\n", tb_cache.loaded,
+                qatomic_read(&tb_cache.hits), qatomic_read(&tb_cache.misses),
+                qatomic_read(&tb_cache.stale));
+}
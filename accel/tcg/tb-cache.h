@@ -0,0 +1,47 @@
+/*
+ * Persistent translation block cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef TB_CACHE_H
+#define TB_CACHE_H
+
+#include "exec/exec-all.h"
+
+extern bool tb_cache_enabled;
+
+/* Select the cache file, must be called before tcg_exec_init(). */
+void tb_cache_init(const char *path);
+
+/* Address to place code_gen_buffer at so that cached code stays valid. */
+void *tb_cache_buffer_hint(void);
+
+/*
+ * Map the cached code into code_gen_buffer and load the index.
+ * Called once after tcg_region_init() and before any vCPU thread starts.
+ */
+void tb_cache_load(void);
+
+/*
+ * Look up a cached TB for the given lookup key and check that the guest
+ * code it was translated from is unchanged. On success the TB still has
+ * to be linked and *@phys_page2 is set to its second page (or -1).
+ */
+TranslationBlock *tb_cache_lookup(CPUState *cpu, target_ulong pc,
+                                  target_ulong cs_base, target_ulong cs_top,
+                                  uint32_t cheri_flags, uint32_t flags,
+                                  uint32_t cflags, tb_page_addr_t phys_pc,
+                                  tb_page_addr_t *phys_page2);
+
+/* Hash of the @size bytes of guest code at @pc */
+uint64_t tb_cache_guest_hash(target_ulong pc, uint32_t size,
+                             tb_page_addr_t phys_pc, tb_page_addr_t phys_page2);
+
+/* Forget the cached TBs not linked yet, their regions are being reused. */
+void tb_cache_reset(void);
+
+void tb_cache_dump_info(void);
+
+#endif /* TB_CACHE_H */
@@ -0,0 +1,101 @@
+/*
+ * Retranslation of hot translation blocks
+ *
+ * With -accel tcg,hot-threshold=N, a timer on the virtual clock interrupts
+ * every vCPU once per millisecond of guest time. The vCPU leaves generated
+ * code at the start of its next TB and looks that TB up in tb_find(),
+ * which counts a sample for it. A TB that has been sampled N times is
+ * invalidated and translated again with CF_HOT, which makes tcg_gen_code()
+ * run the value numbering and dead env store passes on it even without
+ * gvn=on. Only the code the guest spends its time in pays for the slower
+ * translation.
+ *
+ * Hotness is sampled rather than counted so that generated code does not
+ * change: chained TBs run no counter updates, and the cost is one exit
+ * from generated code per vCPU and period whatever the guest does. TBs
+ * are not merged into superblocks; every target's translator decides
+ * where a TB ends, so that would need per-target changes.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/qemu-print.h"
+#include "qemu/timer.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "trace.h"
+#include "tb-hot.h"
+
+#define TB_HOT_PERIOD_NS SCALE_MS
+
+unsigned int tb_hot_threshold;
+
+static struct {
+    QEMUTimer *timer;
+    /* statistics */
+    size_t samples;
+    size_t retranslated;
+} tb_hot;
+
+static void tb_hot_tick(void *opaque)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        qatomic_set(&cpu->tb_hot_sample, true);
+        /*
+         * Like cpu_exit(), but without exit_request: the vCPU only goes
+         * back to tb_find() and stays in cpu_exec().
+         */
+        smp_wmb();
+        qatomic_set(&cpu->icount_decr_ptr->u16.high, -1);
+    }
+    timer_mod(tb_hot.timer,
+              qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + TB_HOT_PERIOD_NS);
+}
+
+void tb_hot_init(unsigned int threshold)
+{
+    tb_hot_threshold = threshold;
+    /* The virtual clock stands still while the VM is stopped */
+    tb_hot.timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, tb_hot_tick, NULL);
+    timer_mod(tb_hot.timer,
+              qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + TB_HOT_PERIOD_NS);
+}
+
+bool tb_hot_sample(CPUState *cpu, TranslationBlock *tb)
+{
+    uint32_t samples;
+
+    qatomic_set(&cpu->tb_hot_sample, false);
+    if (tb_cflags(tb) & (CF_HOT | CF_NOCACHE)) {
+        return false;
+    }
+    qatomic_inc(&tb_hot.samples);
+    /* Only lookups race here; a lost sample just delays retranslation */
+    samples = qatomic_read(&tb->hot_samples) + 1;
+    qatomic_set(&tb->hot_samples, samples);
+    if (samples != tb_hot_threshold) {
+        return false;
+    }
+    trace_tb_hot(tb, tb->pc);
+    qatomic_inc(&tb_hot.retranslated);
+    /*
+     * Unlinks the TB and drops it from the lookup tables. Its code stays
+     * valid until the next flush for vCPUs that are still running it.
+     */
+    tb_phys_invalidate(tb, -1);
+    return true;
+}
+
+void tb_hot_dump_info(void)
+{
+    if (!tb_hot_threshold) {
+        return;
+    }
+    qemu_printf("TB hot samples      %zu (%zu retranslated)\n",
+                qatomic_read(&tb_hot.samples),
+                qatomic_read(&tb_hot.retranslated));
+}
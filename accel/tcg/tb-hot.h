@@ -0,0 +1,27 @@
+/*
+ * Retranslation of hot translation blocks
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef TB_HOT_H
+#define TB_HOT_H
+
+#include "exec/exec-all.h"
+
+/* Samples after which a TB is retranslated with CF_HOT, 0 when disabled */
+extern unsigned int tb_hot_threshold;
+
+void tb_hot_init(unsigned int threshold);
+
+/*
+ * Count a sample for @tb, the TB that @cpu looked up after the sampling
+ * timer interrupted it. Returns true if @tb has just become hot and has
+ * been invalidated; the caller then translates it again with CF_HOT.
+ */
+bool tb_hot_sample(CPUState *cpu, TranslationBlock *tb);
+
+void tb_hot_dump_info(void);
+
+#endif /* TB_HOT_H */
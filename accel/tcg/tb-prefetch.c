@@ -0,0 +1,197 @@
+/*
+ * Speculative translation of predicted successor TBs
+ *
+ * With -accel tcg,thread=multi,prefetch=on, translator_loop() queues the
+ * static successors of every TB it translates (the direct branch targets
+ * the target passes to translator_note_successor()). A vCPU thread that
+ * is about to sleep because its vCPU is halted first translates queued
+ * successors into its own TCGContext region, so that the vCPUs that are
+ * running find them in the QHT instead of translating them on a miss.
+ *
+ * Translation is not done on a separate pool of threads: the translator
+ * reads guest code through the softmmu TLB of the translating vCPU and a
+ * TLB fill may raise a guest exception, neither of which may happen on
+ * behalf of a vCPU from another thread. A successor is therefore only
+ * translated when the idle vCPU is in the same state as the TB that
+ * predicted it (same TB flags, PCC and cflags, hence the same MMU index)
+ * and its code is already mapped by the TLB, so translation never fills
+ * the TLB. The resulting TB is exactly what a miss at that PC would have
+ * generated on this vCPU, so a wrong prediction only wastes work.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/main-loop.h"
+#include "qemu/qemu-print.h"
+#include "qemu/rcu.h"
+#include "cpu.h"
+#include "exec/exec-all.h"
+#include "tb-prefetch.h"
+
+#define TB_PREFETCH_QUEUE 256
+/* Limits how long a vCPU that has just been woken up may be delayed */
+#define TB_PREFETCH_BATCH 32
+
+typedef struct {
+    target_ulong pc;
+    target_ulong cs_base;
+    target_ulong cs_top;
+    uint32_t cheri_flags;
+    uint32_t flags;
+    uint32_t cflags;
+} TBPrefetch;
+
+bool tb_prefetch_enabled;
+__thread bool tb_prefetching;
+
+static struct {
+    QemuSpin lock;
+    /* Free running indexes into queue, the oldest entries are dropped */
+    unsigned int head;
+    unsigned int tail;
+    TBPrefetch queue[TB_PREFETCH_QUEUE];
+    /* statistics */
+    size_t queued;
+    size_t dropped;
+    size_t skipped;
+    size_t present;
+    size_t translated;
+    size_t used;
+} tb_prefetch;
+
+void tb_prefetch_note(const TranslationBlock *tb, const target_ulong *pcs,
+                      int n)
+{
+    int i;
+
+    if (tb_prefetching ||
+        (tb_cflags(tb) & (CF_COUNT_MASK | CF_LAST_IO | CF_NOCACHE))) {
+        return;
+    }
+    qemu_spin_lock(&tb_prefetch.lock);
+    for (i = 0; i < n; i++) {
+        TBPrefetch *p;
+
+        if (tb_prefetch.head - tb_prefetch.tail == TB_PREFETCH_QUEUE) {
+            tb_prefetch.tail++;
+            tb_prefetch.dropped++;
+        }
+        p = &tb_prefetch.queue[tb_prefetch.head++ % TB_PREFETCH_QUEUE];
+        p->pc = pcs[i];
+        p->cs_base = tb->cs_base;
+        p->cs_top = tb->cs_top;
+        p->cheri_flags = tb->cheri_flags;
+        p->flags = tb->flags;
+        p->cflags = tb_cflags(tb);
+        tb_prefetch.queued++;
+    }
+    qemu_spin_unlock(&tb_prefetch.lock);
+}
+
+static bool tb_prefetch_pop(TBPrefetch *p)
+{
+    bool found = false;
+
+    qemu_spin_lock(&tb_prefetch.lock);
+    if (tb_prefetch.head != tb_prefetch.tail) {
+        /* Most recent first, older predictions are more likely stale */
+        *p = tb_prefetch.queue[--tb_prefetch.head % TB_PREFETCH_QUEUE];
+        found = true;
+    }
+    qemu_spin_unlock(&tb_prefetch.lock);
+    return found;
+}
+
+static void tb_prefetch_one(CPUState *cpu, const TBPrefetch *p)
+{
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong pc, cs_base, cs_top = 0;
+    uint32_t cheri_flags = 0, flags;
+    uint32_t cflags = curr_cflags(cpu);
+    uint32_t cf_mask;
+    target_ulong page = p->pc & TARGET_PAGE_MASK;
+
+    cpu_get_tb_cpu_state_6(env, &pc, &cs_base, &cs_top, &cheri_flags,
+                           &flags);
+    /* The TB may extend into the next page, both must be in the TLB */
+    if (p->cs_base != cs_base || p->cs_top != cs_top ||
+        p->cheri_flags != cheri_flags || p->flags != flags ||
+        (p->cflags & CF_HASH_MASK & ~CF_CLUSTER_MASK) != cflags ||
+        get_page_addr_code_nofill(env, p->pc) == -1 ||
+        get_page_addr_code_nofill(env, page + TARGET_PAGE_SIZE) == -1) {
+        qatomic_inc(&tb_prefetch.skipped);
+        return;
+    }
+
+    cf_mask = cflags | cpu->cluster_index << CF_CLUSTER_SHIFT;
+    if (tb_htable_lookup(cpu, p->pc, cs_base, cs_top, cheri_flags, flags,
+                         cf_mask)) {
+        qatomic_inc(&tb_prefetch.present);
+        return;
+    }
+    mmap_lock();
+    tb_gen_code(cpu, p->pc, cs_base, cs_top, cheri_flags, flags, cflags);
+    mmap_unlock();
+    qatomic_inc(&tb_prefetch.translated);
+}
+
+void tb_prefetch_run(CPUState *cpu)
+{
+    TBPrefetch p;
+    int n;
+
+    if (!tb_prefetch_enabled || cpu->singlestep_enabled || singlestep) {
+        return;
+    }
+
+    qemu_mutex_unlock_iothread();
+    /* Keep tb_flush() from running while we translate */
+    cpu_exec_start(cpu);
+    rcu_read_lock();
+    tb_prefetching = true;
+    if (sigsetjmp(cpu->jmp_env, 0) == 0) {
+        for (n = 0; n < TB_PREFETCH_BATCH; n++) {
+            if (qatomic_read(&cpu->exit_request) || !tb_prefetch_pop(&p)) {
+                break;
+            }
+            tb_prefetch_one(cpu, &p);
+        }
+    } else {
+        /* tb_gen_code() ran out of space and has queued a tb_flush() */
+        cpu->exception_index = -1;
+    }
+    tb_prefetching = false;
+    rcu_read_unlock();
+    cpu_exec_end(cpu);
+    qemu_mutex_lock_iothread();
+}
+
+void tb_prefetch_hit(TranslationBlock *tb)
+{
+    if (!tb_prefetching && qatomic_xchg(&tb->prefetched, false)) {
+        qatomic_inc(&tb_prefetch.used);
+    }
+}
+
+void tb_prefetch_init(void)
+{
+    qemu_spin_init(&tb_prefetch.lock);
+    tb_prefetch_enabled = true;
+}
+
+void tb_prefetch_dump_info(void)
+{
+    size_t translated, used;
+
+    if (!tb_prefetch_enabled) {
+        return;
+    }
+    translated = qatomic_read(&tb_prefetch.translated);
+    used = qatomic_read(&tb_prefetch.used);
+    qemu_printf("TB prefetch queued  %zu (%zu dropped, %zu skipped, "
+                "%zu already translated)\n",
+                tb_prefetch.queued, tb_prefetch.dropped,
+                qatomic_read(&tb_prefetch.skipped),
+                qatomic_read(&tb_prefetch.present));
+    qemu_printf("TB prefetched       %zu (%zu used, %zu unused)\n",
+                translated, used, translated - used);
+}
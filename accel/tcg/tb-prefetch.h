@@ -0,0 +1,34 @@
+/*
+ * Speculative translation of predicted successor TBs
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef TB_PREFETCH_H
+#define TB_PREFETCH_H
+
+#include "exec/exec-all.h"
+
+extern bool tb_prefetch_enabled;
+/* Set while this thread translates predicted successors */
+extern __thread bool tb_prefetching;
+
+void tb_prefetch_init(void);
+
+/* Queue the static successors @pcs found while translating @tb */
+void tb_prefetch_note(const TranslationBlock *tb, const target_ulong *pcs,
+                      int n);
+
+/*
+ * Translate queued successors on the thread of @cpu while it is idle.
+ * Called from the MTTCG vCPU thread with the BQL held.
+ */
+void tb_prefetch_run(CPUState *cpu);
+
+/* Called on the first lookup of a TB with tb->prefetched set */
+void tb_prefetch_hit(TranslationBlock *tb);
+
+void tb_prefetch_dump_info(void);
+
+#endif /* TB_PREFETCH_H */
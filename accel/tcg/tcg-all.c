@@ -33,6 +33,9 @@
 #include "hw/boards.h"
 #include "qapi/qapi-builtin-visit.h"
 #include "tcg-cpus.h"
+#include "tb-cache.h"
+#include "tb-prefetch.h"
+#include "tb-hot.h"
 
 struct TCGState {
     AccelState parent_obj;
@@ -40,6 +43,10 @@ struct TCGState {
     bool mttcg_enabled;
     int splitwx_enabled;
     unsigned long tb_size;
+    char *tb_cache;
+    bool prefetch;
+    bool gvn;
+    uint32_t hot_threshold;
 };
 typedef struct TCGState TCGState;
 
@@ -110,6 +117,20 @@ static int tcg_init(MachineState *ms)
 {
     TCGState *s = TCG_STATE(current_accel());
 
+    if (s->tb_cache) {
+        tb_cache_init(s->tb_cache);
+    }
+    tcg_gvn_enabled = s->gvn;
+    if (s->hot_threshold) {
+        tb_hot_init(s->hot_threshold);
+    }
+    if (s->prefetch) {
+        if (s->mttcg_enabled) {
+            tb_prefetch_init();
+        } else {
+            warn_report("TCG prefetch is only supported with thread=multi");
+        }
+    }
     tcg_exec_init(s->tb_size * 1024 * 1024, s->splitwx_enabled);
     mttcg_enabled = s->mttcg_enabled;
     cpus_register_accel(&tcg_cpus);
@@ -176,6 +197,69 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static char *tcg_get_tb_cache(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    return g_strdup(s->tb_cache);
+}
+
+static void tcg_set_tb_cache(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+
+    g_free(s->tb_cache);
+    s->tb_cache = g_strdup(value);
+}
+
+static bool tcg_get_prefetch(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->prefetch;
+}
+
+static void tcg_set_prefetch(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->prefetch = value;
+}
+
+static bool tcg_get_gvn(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->gvn;
+}
+
+static void tcg_set_gvn(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->gvn = value;
+}
+
+static void tcg_get_hot_threshold(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->hot_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_hot_threshold(Object *obj, Visitor *v,
+                                  const char *name, void *opaque,
+                                  Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->hot_threshold = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -205,6 +289,27 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add_str(oc, "tb-cache",
+                                  tcg_get_tb_cache, tcg_set_tb_cache);
+    object_class_property_set_description(oc, "tb-cache",
+        "File to keep translated code in across runs");
+
+    object_class_property_add_bool(oc, "prefetch",
+        tcg_get_prefetch, tcg_set_prefetch);
+    object_class_property_set_description(oc, "prefetch",
+        "Translate predicted TBs on idle vCPU threads");
+
+    object_class_property_add_bool(oc, "gvn",
+        tcg_get_gvn, tcg_set_gvn);
+    object_class_property_set_description(oc, "gvn",
+        "Run the TCG value numbering pass");
+
+    object_class_property_add(oc, "hot-threshold", "int",
+        tcg_get_hot_threshold, tcg_set_hot_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "hot-threshold",
+        "Samples after which a TB is retranslated as hot (0: never)");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
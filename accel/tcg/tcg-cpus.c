@@ -33,6 +33,8 @@
 #include "hw/boards.h"
 
 #include "tcg-cpus.h"
+#include "tb-cache.h"
+#include "tb-prefetch.h"
 
 /* Kick all RR vCPUs */
 static void qemu_cpu_kick_rr_cpus(void)
@@ -452,6 +454,10 @@ static void *tcg_cpu_thread_fn(void *arg)
         }
 
         qatomic_mb_set(&cpu->exit_request, 0);
+        /* Only while halted, nothing may translate while the VM is stopped */
+        if (cpu_thread_is_idle(cpu) && !cpu_is_stopped(cpu)) {
+            tb_prefetch_run(cpu);
+        }
         qemu_wait_io_event(cpu);
     } while (!cpu->unplug || cpu_can_run(cpu));
 
@@ -479,6 +485,7 @@ static void tcg_start_vcpu_thread(CPUState *cpu)
     if (!tcg_region_inited) {
         tcg_region_inited = 1;
         tcg_region_init();
+        tb_cache_load();
         parallel_cpus = qemu_tcg_mttcg_enabled() && current_machine->smp.max_cpus > 1;
     }
 
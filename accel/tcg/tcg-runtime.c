@@ -160,8 +160,10 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &cs_top, &cheri_flags, &flags,
                               curr_cflags(cpu));
     if (tb == NULL) {
+        qatomic_set(&cpu->tb_ptr_misses, cpu->tb_ptr_misses + 1);
         return tcg_code_gen_epilogue;
     }
+    qatomic_set(&cpu->tb_ptr_lookups, cpu->tb_ptr_lookups + 1);
     qemu_log_mask_and_addr(CPU_LOG_EXEC, pc,
                            "Chain %d: %p [" TARGET_FMT_lx "/" TARGET_FMT_lx
                            "/" TARGET_FMT_lx "/%#x/%#x] %s\n",
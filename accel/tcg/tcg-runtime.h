@@ -158,6 +158,20 @@ DEF_HELPER_3(cheri_invalidate_tags, void, env, cap_checked_ptr, memop_idx)
 /* Clear tags due to a store, last argument is whether the store succeeded. */
 DEF_HELPER_4(cheri_invalidate_tags_condition, void, env, cap_checked_ptr,
              memop_idx, i32)
+/*
+ * Store + clear tags under the tag line lock. Replaces the inline store and
+ * cheri_invalidate_tags for stores that cannot use the inline fast path when
+ * running with atomic tag memory (MTTCG).
+ */
+DEF_HELPER_4(cheri_atomic_tags_st_i32, void, env, cap_checked_ptr, i32,
+             memop_idx)
+DEF_HELPER_4(cheri_atomic_tags_st_i64, void, env, cap_checked_ptr, i64,
+             memop_idx)
+/* Store under the tag line lock without clearing tags (atomic tag memory). */
+DEF_HELPER_4(cheri_keep_tags_st_i32, void, env, cap_checked_ptr, i32,
+             memop_idx)
+DEF_HELPER_4(cheri_keep_tags_st_i64, void, env, cap_checked_ptr, i64,
+             memop_idx)
 
 #endif
 
@@ -350,6 +364,8 @@ DEF_HELPER_FLAGS_0(qemu_log_instr_allcpu_start, TCG_CALL_NO_WG, void)
 DEF_HELPER_FLAGS_0(qemu_log_instr_allcpu_user_start, TCG_CALL_NO_WG, void)
 DEF_HELPER_FLAGS_0(qemu_log_instr_allcpu_stop, TCG_CALL_NO_WG, void)
 DEF_HELPER_FLAGS_1(qemu_log_instr_commit, TCG_CALL_NO_WG, void, env)
+DEF_HELPER_FLAGS_1(qemu_log_instr_filtered_tb, TCG_CALL_NO_WG, void, env)
+DEF_HELPER_FLAGS_3(qemu_log_instr_trigger_pc, TCG_CALL_NO_WG, void, env, i32, tl)
 DEF_HELPER_FLAGS_4(qemu_log_instr_load64, TCG_CALL_NO_WG, void, env,
                    cap_checked_ptr, i64, memop_idx)
 DEF_HELPER_FLAGS_4(qemu_log_instr_store64, TCG_CALL_NO_WG, void, env,
@@ -50,6 +50,11 @@
 #include "exec/cputlb.h"
 #include "exec/tb-hash.h"
 #include "translate-all.h"
+#ifdef CONFIG_SOFTMMU
+#include "tb-cache.h"
+#include "tb-prefetch.h"
+#include "tb-hot.h"
+#endif
 #include "qemu/bitmap.h"
 #include "qemu/error-report.h"
 #include "qemu/qemu-print.h"
@@ -1081,9 +1086,13 @@ static bool alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
 static bool alloc_code_gen_buffer_anon(size_t size, int prot,
                                        int flags, Error **errp)
 {
-    void *buf;
+    void *buf, *hint = NULL;
 
-    buf = mmap(NULL, size, prot, flags, -1, 0);
+#ifdef CONFIG_SOFTMMU
+    /* Cached code is only valid at the address it was generated at */
+    hint = tb_cache_buffer_hint();
+#endif
+    buf = mmap(hint, size, prot, flags, -1, 0);
     if (buf == MAP_FAILED) {
         error_setg_errno(errp, errno,
                          "allocate %zu bytes for jit buffer", size);
@@ -1435,6 +1444,9 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     page_flush_tb();
 
+#ifdef CONFIG_SOFTMMU
+    tb_cache_reset();
+#endif
     tcg_region_reset_all();
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
@@ -1856,6 +1868,42 @@ tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
     return tb;
 }
 
+#ifdef CONFIG_SOFTMMU
+/*
+ * Link a TB mapped from the persistent TB cache like a freshly translated
+ * one. Its jumps may have been chained in the run that generated it.
+ */
+static TranslationBlock *tb_cache_link(TranslationBlock *tb,
+                                       tb_page_addr_t phys_pc,
+                                       tb_page_addr_t phys_page2)
+{
+    TranslationBlock *existing_tb;
+
+    tb->orig_tb = NULL;
+    tb->prefetched = false;
+    tb->hot_samples = 0;
+    qemu_spin_init(&tb->jmp_lock);
+    tb->jmp_list_head = (uintptr_t)NULL;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+    tb->jmp_dest[0] = (uintptr_t)NULL;
+    tb->jmp_dest[1] = (uintptr_t)NULL;
+    if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+
+    existing_tb = tb_link_page(tb, phys_pc, phys_page2);
+    if (unlikely(existing_tb != tb)) {
+        return existing_tb;
+    }
+    tcg_tb_insert(tb);
+    return tb;
+}
+#endif
+
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
                               target_ulong cs_base, target_ulong cs_top,
@@ -1897,6 +1945,17 @@ TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
         max_insns = 1;
     }
 
+#ifdef CONFIG_SOFTMMU
+    if (tb_cache_enabled && phys_pc != -1 && max_insns != 1 &&
+        !(cflags & CF_HOT)) {
+        tb = tb_cache_lookup(cpu, pc, cs_base, cs_top, cheri_flags, flags,
+                             cflags, phys_pc, &phys_page2);
+        if (tb) {
+            return tb_cache_link(tb, phys_pc, phys_page2);
+        }
+    }
+#endif
+
  buffer_overflow:
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
@@ -1918,6 +1977,10 @@ TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
     tb->cflags = cflags;
     tb->orig_tb = NULL;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+#ifdef CONFIG_SOFTMMU
+    tb->prefetched = tb_prefetching;
+#endif
+    tb->hot_samples = 0;
     tcg_ctx->tb_cflags = cflags;
  tb_overflow:
 
@@ -1932,6 +1995,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
     tcg_ctx->cpu = env_cpu(env);
     gen_intermediate_code(cpu, tb, max_insns);
     tcg_ctx->cpu = NULL;
+    tb->heap_ptrs = tcg_ctx->tb_heap_ptrs;
 
     trace_translate_block(tb, tb->pc, tb->tc.ptr);
 
@@ -1997,6 +2061,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
 #ifdef CONFIG_PROFILER
     qatomic_set(&prof->code_time, prof->code_time + profile_getclock() - ti);
     qatomic_set(&prof->code_in_len, prof->code_in_len + tb->size);
+    qatomic_set(&prof->insn_count, prof->insn_count + tb->icount);
     qatomic_set(&prof->code_out_len, prof->code_out_len + gen_code_size);
     qatomic_set(&prof->search_out_len, prof->search_out_len + search_size);
 #endif
@@ -2093,6 +2158,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu, target_ulong pc,
      * No explicit memory barrier is required -- tb_link_page() makes the
      * TB visible in a consistent state.
      */
+#ifdef CONFIG_SOFTMMU
+    if (tb_cache_enabled && phys_pc != -1) {
+        tb->guest_hash = tb_cache_guest_hash(pc, tb->size, phys_pc,
+                                             phys_page2);
+    }
+#endif
     existing_tb = tb_link_page(tb, phys_pc, phys_page2);
     /* if the TB already exists, discard what we just translated */
     if (unlikely(existing_tb != tb)) {
@@ -2571,6 +2642,9 @@ void dump_exec_info(void)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t fill, fill_victim, fill_large;
+    size_t exit_lookups = 0, ptr_lookups = 0, ptr_misses = 0;
+    CPUState *cpu;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2612,6 +2686,22 @@ void dump_exec_info(void)
     qemu_printf("TLB full flushes    %zu\n", flush_full);
     qemu_printf("TLB partial flushes %zu\n", flush_part);
     qemu_printf("TLB elided flushes  %zu\n", flush_elide);
+    tlb_fill_counts(&fill, &fill_victim, &fill_large);
+    qemu_printf("TLB refills         %zu (%zu from victim TLB, "
+                "%zu from large page TLB)\n",
+                fill + fill_victim + fill_large, fill_victim, fill_large);
+
+    CPU_FOREACH(cpu) {
+        exit_lookups += qatomic_read(&cpu->tb_exit_lookups);
+        ptr_lookups += qatomic_read(&cpu->tb_ptr_lookups);
+        ptr_misses += qatomic_read(&cpu->tb_ptr_misses);
+    }
+    qemu_printf("TB lookups on exit  %zu\n", exit_lookups);
+    qemu_printf("TB goto_ptr lookups %zu (%zu missed)\n",
+                ptr_lookups + ptr_misses, ptr_misses);
+    tb_cache_dump_info();
+    tb_prefetch_dump_info();
+    tb_hot_dump_info();
     tcg_dump_info();
 }
 
@@ -21,6 +21,9 @@
 #include "sysemu/replay.h"
 
 #include "cheri-translate-utils-base.h"
+#ifdef CONFIG_SOFTMMU
+#include "tb-prefetch.h"
+#endif
 
 /* Pairs with tcg_clear_temp_count.
    To be called by #TranslatorOps.{translate_insn,tb_stop} if
@@ -57,6 +60,20 @@ static void qemu_log_gen_printf_flush(DisasContextBase *base, bool flush_early,
 #endif
 }
 
+void translator_note_successor(DisasContextBase *db, target_ulong dest)
+{
+    int i;
+
+    for (i = 0; i < db->num_successors; i++) {
+        if (db->successors[i] == dest) {
+            return;
+        }
+    }
+    if (db->num_successors < ARRAY_SIZE(db->successors)) {
+        db->successors[db->num_successors++] = dest;
+    }
+}
+
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb, int max_insns)
 {
@@ -64,11 +81,26 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     bool plugin_enabled;
 #ifdef CONFIG_TCG_LOG_INSTR
     /*
-     * Cache whether we are logging instructions in this tb
-     * This assumes that the TCG buffer will be flushed on instruction
-     * log level changes.
+     * Cache whether we are logging instructions in this tb.
+     * CF_LOG_INSTR is part of the TB lookup key, so TBs translated while
+     * logging is off are never executed while it is on and vice versa.
+     * With -cheri-trace-trigger every TB is instrumented and the generated
+     * code checks whether logging is active on the CPU.
+     */
+    bool log_instr_enabled = qemu_log_instr_dynamic ||
+        qemu_log_instr_enabled(cpu->env_ptr);
+    /*
+     * Logging is enabled but no instruction in this tb can match -dfilter,
+     * translate it without logging.
      */
-    const bool log_instr_enabled = qemu_log_instr_enabled(cpu->env_ptr);
+    bool log_instr_filtered = false;
+
+    if (log_instr_enabled && !qemu_log_instr_tb_in_filter(tb->pc)) {
+        log_instr_enabled = false;
+        log_instr_filtered = true;
+        /* Also skip memory access logging in tcg-op.c */
+        tcg_ctx->tb_cflags &= ~CF_LOG_INSTR;
+    }
 #endif
 
     /* Initialize DisasContext */
@@ -79,6 +111,7 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     db->num_insns = 0;
     db->max_insns = max_insns;
     db->singlestep_enabled = cpu->singlestep_enabled;
+    db->num_successors = 0;
 #ifdef TARGET_CHERI
     db->pcc_base = tb->cs_base;
     db->pcc_top = tb->cs_top;
@@ -88,16 +121,13 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                        cap_get_top(cheri_get_recent_pcc(cpu->env_ptr)));
     db->cheri_flags = tb->cheri_flags;
     disas_capreg_reset_all(db);
+    disas_capreg_checks_reset_all(db);
     // TODO: verify cheri_flags are correct?
 #endif
     ops->init_disas_context(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 #ifdef CONFIG_TCG_LOG_INSTR
-    /*
-     * Propagate cached log enabled check to disas context.
-     * This assumes that the TCG buffer will be flushed on instruction
-     * log level changes.
-     */
+    /* Propagate cached log enabled check to disas context. */
     db->log_instr_enabled = log_instr_enabled;
 #endif /* CONFIG_TCG_LOG_INSTR */
 
@@ -144,7 +174,9 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
              * till the end of a BB.
              */
             qemu_log_gen_printf_flush(db, true, db->num_insns == 1);
-            gen_helper_qemu_log_instr_commit(cpu_env);
+            qemu_log_instr_gen_commit(db);
+        } else if (unlikely(log_instr_filtered) && db->num_insns == 1) {
+            gen_helper_qemu_log_instr_filtered_tb(cpu_env);
         }
 #endif
         tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
@@ -178,6 +210,9 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
            update db->pc_next and db->is_jmp to indicate what should be
            done next -- either exiting this loop or locate the start of
            the next instruction.  */
+#ifdef TARGET_CHERI
+        db->cap_checks_preserved = false;
+#endif
         if (db->num_insns == db->max_insns
             && (tb_cflags(db->tb) & CF_LAST_IO)) {
             /* Accept I/O on the last instruction.  */
@@ -186,6 +221,11 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
         } else {
             ops->translate_insn(db, cpu);
         }
+#ifdef TARGET_CHERI
+        if (!db->cap_checks_preserved) {
+            disas_capreg_checks_reset_all(db);
+        }
+#endif
 
         /* Stop translation if translate_insn so indicated.  */
         if (db->is_jmp != DISAS_NEXT) {
@@ -213,6 +253,9 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     if (unlikely(log_instr_enabled)) {
         qemu_log_gen_printf_flush(db, true, db->num_insns == 1);
     }
+    if (unlikely(log_instr_filtered)) {
+        tcg_ctx->tb_cflags |= CF_LOG_INSTR;
+    }
 #endif
 
     /* Emit code to exit the TB, as indicated by db->is_jmp.  */
@@ -227,6 +270,12 @@ void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
     tb->size = db->pc_next - db->pc_first;
     tb->icount = db->num_insns;
 
+#ifdef CONFIG_SOFTMMU
+    if (tb_prefetch_enabled && db->num_successors) {
+        tb_prefetch_note(tb, db->successors, db->num_successors);
+    }
+#endif
+
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)
         && qemu_log_in_addr_range(db->pc_first)) {
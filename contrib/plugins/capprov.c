@@ -0,0 +1,214 @@
+/*
+ * Capability provenance - follow tagged capabilities through memory.
+ *
+ * Every tagged capability store records the capability cursor together
+ * with its "hop count": the number of times the value has travelled
+ * through memory since it was last derived in a register. A tagged load
+ * from an address whose recorded cursor matches inherits the hop count,
+ * and if the same vCPU later stores that cursor again the count is bumped.
+ * Tagged loads from addresses that were never written with a tagged store
+ * while the plugin was active (boot images, DMA, ...) are reported as
+ * having unknown provenance.
+ *
+ * Capability loads, stores and the setbounds/seal/unseal operations are
+ * also counted with inline ops, which never call back into the plugin.
+ * Passing "counters" disables the provenance tracking, which makes it easy
+ * to measure what the callbacks cost on top of the inline counters:
+ *
+ *   time qemu-system-riscv64cheri ... (no plugin)
+ *   time qemu-system-riscv64cheri ... -plugin libcapprov.so,arg=counters
+ *   time qemu-system-riscv64cheri ... -plugin libcapprov.so
+ *
+ * The plugin reports the time spent in the provenance callbacks at exit so
+ * that the overhead can be attributed without a separate profiler.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <glib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+#define MAX_HOPS 16
+
+static const char *cap_op_names[QEMU_PLUGIN_CAP_OP_MAX] = {
+    [QEMU_PLUGIN_CAP_LOAD]         = "loads",
+    [QEMU_PLUGIN_CAP_LOAD_TAGGED]  = "tagged loads",
+    [QEMU_PLUGIN_CAP_STORE]        = "stores",
+    [QEMU_PLUGIN_CAP_STORE_TAGGED] = "tagged stores",
+    [QEMU_PLUGIN_CAP_SETBOUNDS]    = "setbounds",
+    [QEMU_PLUGIN_CAP_SEAL]         = "seals",
+    [QEMU_PLUGIN_CAP_UNSEAL]       = "unseals",
+};
+static uint64_t cap_op_count[QEMU_PLUGIN_CAP_OP_MAX];
+
+typedef struct {
+    uint64_t cursor;
+    unsigned hops;
+} CapOrigin;
+
+static bool track = true;
+static int limit = 20;
+
+static GMutex lock;
+/* vaddr -> CapOrigin of the tagged capability currently stored there */
+static GHashTable *memory;
+/* vcpu index -> CapOrigin of the last tagged capability it loaded */
+static GHashTable *last_load;
+/* vaddr -> number of tagged loads with unknown provenance */
+static GHashTable *unknown;
+static uint64_t hops_hist[MAX_HOPS + 1];
+static uint64_t unknown_loads;
+static gint64 cb_time_us;
+
+/* Guest addresses are 64-bit even on 32-bit hosts, so they can't be pointers */
+static gpointer addr_key(uint64_t vaddr)
+{
+    uint64_t *key = g_new(uint64_t, 1);
+
+    *key = vaddr;
+    return key;
+}
+
+static CapOrigin *vcpu_last_load(unsigned int vcpu_index)
+{
+    CapOrigin *o = g_hash_table_lookup(last_load,
+                                       GUINT_TO_POINTER(vcpu_index));
+
+    if (!o) {
+        o = g_new0(CapOrigin, 1);
+        g_hash_table_insert(last_load, GUINT_TO_POINTER(vcpu_index), o);
+    }
+    return o;
+}
+
+static void vcpu_cap_mem(qemu_plugin_id_t id, unsigned int vcpu_index,
+                         uint64_t vaddr, uint64_t cursor, bool tag,
+                         bool is_store)
+{
+    gint64 start = g_get_monotonic_time();
+    CapOrigin *last, *o;
+
+    g_mutex_lock(&lock);
+    last = vcpu_last_load(vcpu_index);
+    if (is_store) {
+        if (!tag) {
+            /* The tag in memory has been cleared, forget the capability */
+            g_hash_table_remove(memory, &vaddr);
+        } else {
+            o = g_new(CapOrigin, 1);
+            o->cursor = cursor;
+            o->hops = last->cursor == cursor ? last->hops + 1 : 1;
+            g_hash_table_replace(memory, addr_key(vaddr), o);
+        }
+    } else if (tag) {
+        o = g_hash_table_lookup(memory, &vaddr);
+        if (o && o->cursor == cursor) {
+            *last = *o;
+            hops_hist[MIN(o->hops, MAX_HOPS)]++;
+        } else {
+            gpointer count = g_hash_table_lookup(unknown, &vaddr);
+
+            g_hash_table_replace(unknown, addr_key(vaddr),
+                                 GSIZE_TO_POINTER(GPOINTER_TO_SIZE(count) + 1));
+            last->cursor = cursor;
+            last->hops = 0;
+            unknown_loads++;
+        }
+    }
+    cb_time_us += g_get_monotonic_time() - start;
+    g_mutex_unlock(&lock);
+}
+
+static gint cmp_unknown_count(gconstpointer a, gconstpointer b, gpointer d)
+{
+    GHashTable *ht = d;
+    size_t ca = GPOINTER_TO_SIZE(g_hash_table_lookup(ht, a));
+    size_t cb = GPOINTER_TO_SIZE(g_hash_table_lookup(ht, b));
+
+    return ca > cb ? -1 : (ca < cb ? 1 : 0);
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = g_string_new("capability operations:\n");
+    GList *addrs, *it;
+    int i;
+
+    for (i = 0; i < QEMU_PLUGIN_CAP_OP_MAX; i++) {
+        g_string_append_printf(report, "  %-14s %" PRIu64 "\n",
+                               cap_op_names[i], cap_op_count[i]);
+    }
+
+    if (track) {
+        g_mutex_lock(&lock);
+        g_string_append(report, "tagged loads by hops through memory:\n");
+        for (i = 1; i <= MAX_HOPS; i++) {
+            if (hops_hist[i]) {
+                g_string_append_printf(report, "  %s%-2d %" PRIu64 "\n",
+                                       i == MAX_HOPS ? ">=" : "  ", i,
+                                       hops_hist[i]);
+            }
+        }
+        g_string_append_printf(report, "  unknown %" PRIu64 "\n",
+                               unknown_loads);
+
+        addrs = g_hash_table_get_keys(unknown);
+        addrs = g_list_sort_with_data(addrs, cmp_unknown_count, unknown);
+        g_string_append(report, "addresses with unknown provenance:\n");
+        for (it = addrs, i = 0; it && i < limit; it = it->next, i++) {
+            g_string_append_printf(
+                report, "  %#016" PRIx64 " %zu\n",
+                *(uint64_t *)it->data,
+                (size_t)GPOINTER_TO_SIZE(g_hash_table_lookup(unknown,
+                                                             it->data)));
+        }
+        g_list_free(addrs);
+        g_string_append_printf(report, "time in callbacks: %" PRId64
+                               " us\n", (int64_t)cb_time_us);
+        g_mutex_unlock(&lock);
+    }
+
+    qemu_plugin_outs(report->str);
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    int i;
+
+    for (i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        if (g_strcmp0(opt, "counters") == 0) {
+            track = false;
+        } else if (g_str_has_prefix(opt, "limit=")) {
+            limit = g_ascii_strtoull(opt + 6, NULL, 10);
+        } else {
+            fprintf(stderr, "option parsing failed: %s\n", opt);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < QEMU_PLUGIN_CAP_OP_MAX; i++) {
+        qemu_plugin_register_vcpu_cap_inline(id, i, QEMU_PLUGIN_INLINE_ADD_U64,
+                                             &cap_op_count[i], 1);
+    }
+    if (track) {
+        memory = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free,
+                                       g_free);
+        last_load = g_hash_table_new_full(NULL, g_direct_equal, NULL, g_free);
+        unknown = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free,
+                                        NULL);
+        qemu_plugin_register_vcpu_cap_mem_cb(id, vcpu_cap_mem);
+    }
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
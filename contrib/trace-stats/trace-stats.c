@@ -0,0 +1,884 @@
+/*
+ * Parallel summary of instruction traces written with -cheri-trace-format.
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * The trace file is memory-mapped and split into independent work items:
+ * the frames of a binary trace (every frame resets the delta-encoding
+ * state and ends at a trace stop marker or a full chunk), or fixed-size
+ * runs of cvtrace entries. Worker threads pick up work items dynamically,
+ * accumulate private statistics and the results are merged at the end, so
+ * the tool scales with the number of host cores and never holds more than
+ * one decompressed frame per thread in memory.
+ *
+ * The binary format is described in accel/tcg/log_instr.c and
+ * scripts/qemu-btrace-decode.py. Both formats' constants and layouts come
+ * from the headers shared with the emitter.
+ */
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/thread.h"
+#include "exec/log_instr-btrace.h"
+#include "exec/log_instr-cvtrace.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
+
+/* Default number of cvtrace entries handed to a worker at once */
+#define CVTRACE_SHARD_ENTRIES (1 << 20)
+
+typedef enum {
+    TRACE_BINARY,
+    TRACE_CVTRACE,
+} TraceFormat;
+
+typedef enum {
+    ARCH_UNKNOWN,
+    ARCH_RISCV,
+    ARCH_MIPS,
+    ARCH_AARCH64,
+} TraceArch;
+
+/* Open-addressing u64 -> u64 histogram, a zero count marks a free slot. */
+typedef struct {
+    uint64_t *keys;
+    uint64_t *counts;
+    size_t mask;
+    size_t used;
+} CounterTable;
+
+typedef struct {
+    uint64_t insns;
+    uint64_t traps;
+    uint64_t interrupts;
+    uint64_t mode_switches;
+    uint64_t starts;
+    uint64_t stops;
+    uint64_t loads;
+    uint64_t stores;
+    /* Indexed by the tag bit */
+    uint64_t cap_reg_writes[2];
+    uint64_t cap_loads[2];
+    uint64_t cap_stores[2];
+    uint64_t sealed_reg_writes;
+    uint64_t bad_items;
+    CounterTable pcs;
+    CounterTable opclass;
+    CounterTable asid_insns;
+    CounterTable asid_cap_mem;
+} TraceStats;
+
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+    uint32_t raw_len;
+} TraceWork;
+
+static struct {
+    TraceFormat format;
+    TraceArch arch;
+    const uint8_t *map;
+    size_t size;
+    /* Binary trace header */
+    bool zstd;
+    unsigned long_bits;
+    unsigned cap_size;
+    char target[33];
+    GArray *work;
+    unsigned next;
+    uint32_t max_raw_len;
+    unsigned shard_entries;
+} trace = {
+    .shard_entries = CVTRACE_SHARD_ENTRIES,
+};
+
+static void counter_init(CounterTable *t, size_t size)
+{
+    t->keys = g_new(uint64_t, size);
+    t->counts = g_new0(uint64_t, size);
+    t->mask = size - 1;
+    t->used = 0;
+}
+
+static void counter_free(CounterTable *t)
+{
+    g_free(t->keys);
+    g_free(t->counts);
+}
+
+static inline size_t counter_slot(const CounterTable *t, uint64_t key)
+{
+    size_t i = (key * 0x9e3779b97f4a7c15ULL) >> 20;
+
+    for (i &= t->mask; t->counts[i] && t->keys[i] != key;
+         i = (i + 1) & t->mask) {
+        continue;
+    }
+    return i;
+}
+
+static void counter_add(CounterTable *t, uint64_t key, uint64_t n);
+
+static void counter_grow(CounterTable *t)
+{
+    CounterTable old = *t;
+    size_t i;
+
+    counter_init(t, (old.mask + 1) * 2);
+    for (i = 0; i <= old.mask; i++) {
+        if (old.counts[i]) {
+            counter_add(t, old.keys[i], old.counts[i]);
+        }
+    }
+    counter_free(&old);
+}
+
+static inline void counter_add(CounterTable *t, uint64_t key, uint64_t n)
+{
+    size_t i = counter_slot(t, key);
+
+    if (!t->counts[i]) {
+        t->keys[i] = key;
+        t->counts[i] = n;
+        if (++t->used * 4 > (t->mask + 1) * 3) {
+            counter_grow(t);
+        }
+        return;
+    }
+    t->counts[i] += n;
+}
+
+static void counter_merge(CounterTable *dst, const CounterTable *src)
+{
+    size_t i;
+
+    for (i = 0; i <= src->mask; i++) {
+        if (src->counts[i]) {
+            counter_add(dst, src->keys[i], src->counts[i]);
+        }
+    }
+}
+
+static uint64_t counter_get(const CounterTable *t, uint64_t key)
+{
+    return t->counts[counter_slot(t, key)];
+}
+
+static int cmp_count_desc(const void *a, const void *b)
+{
+    const uint64_t *ea = a, *eb = b;
+
+    if (ea[1] != eb[1]) {
+        return ea[1] > eb[1] ? -1 : 1;
+    }
+    return ea[0] < eb[0] ? -1 : (ea[0] > eb[0]);
+}
+
+/* Return the entries as (key, count) pairs, most frequent first. */
+static uint64_t *counter_sorted(const CounterTable *t)
+{
+    uint64_t *pairs = g_new(uint64_t, 2 * t->used + 2);
+    size_t i, n = 0;
+
+    for (i = 0; i <= t->mask; i++) {
+        if (t->counts[i]) {
+            pairs[2 * n] = t->keys[i];
+            pairs[2 * n + 1] = t->counts[i];
+            n++;
+        }
+    }
+    qsort(pairs, n, 2 * sizeof(uint64_t), cmp_count_desc);
+    return pairs;
+}
+
+static void stats_init(TraceStats *st)
+{
+    memset(st, 0, sizeof(*st));
+    counter_init(&st->pcs, 1 << 16);
+    counter_init(&st->opclass, 256);
+    counter_init(&st->asid_insns, 64);
+    counter_init(&st->asid_cap_mem, 64);
+}
+
+static void stats_merge(TraceStats *dst, const TraceStats *src)
+{
+    int i;
+
+    dst->insns += src->insns;
+    dst->traps += src->traps;
+    dst->interrupts += src->interrupts;
+    dst->mode_switches += src->mode_switches;
+    dst->starts += src->starts;
+    dst->stops += src->stops;
+    dst->loads += src->loads;
+    dst->stores += src->stores;
+    for (i = 0; i < 2; i++) {
+        dst->cap_reg_writes[i] += src->cap_reg_writes[i];
+        dst->cap_loads[i] += src->cap_loads[i];
+        dst->cap_stores[i] += src->cap_stores[i];
+    }
+    dst->sealed_reg_writes += src->sealed_reg_writes;
+    dst->bad_items += src->bad_items;
+    counter_merge(&dst->pcs, &src->pcs);
+    counter_merge(&dst->opclass, &src->opclass);
+    counter_merge(&dst->asid_insns, &src->asid_insns);
+    counter_merge(&dst->asid_cap_mem, &src->asid_cap_mem);
+}
+
+static void stats_free(TraceStats *st)
+{
+    counter_free(&st->pcs);
+    counter_free(&st->opclass);
+    counter_free(&st->asid_insns);
+    counter_free(&st->asid_cap_mem);
+}
+
+/*
+ * Coarse instruction class used for the instruction mix. @insn holds the
+ * instruction bytes in guest memory order.
+ */
+#define OPCLASS_COMPRESSED 0x100
+
+static uint64_t insn_opclass(const uint8_t *insn, size_t len)
+{
+    if (len == 0) {
+        return UINT64_MAX;
+    }
+    switch (trace.arch) {
+    case ARCH_RISCV:
+        if ((insn[0] & 3) != 3) {
+            /* quadrant and funct3 of a compressed instruction */
+            return OPCLASS_COMPRESSED | (insn[0] & 3) |
+                   (len > 1 ? (insn[1] >> 5) << 2 : 0);
+        }
+        return insn[0] & 0x7f;
+    case ARCH_MIPS:
+        return insn[0] >> 2;
+    case ARCH_AARCH64:
+        return len < 4 ? UINT64_MAX : (insn[3] >> 1) & 0xf;
+    default:
+        return insn[0];
+    }
+}
+
+static const char *riscv_opcode_names[128] = {
+    [0x03] = "LOAD", [0x07] = "LOAD-FP", [0x0b] = "CUSTOM-0",
+    [0x0f] = "MISC-MEM", [0x13] = "OP-IMM", [0x17] = "AUIPC",
+    [0x1b] = "OP-IMM-32", [0x23] = "STORE", [0x27] = "STORE-FP",
+    [0x2f] = "AMO", [0x33] = "OP", [0x37] = "LUI", [0x3b] = "OP-32",
+    [0x43] = "MADD", [0x47] = "MSUB", [0x4b] = "NMSUB", [0x4f] = "NMADD",
+    [0x53] = "OP-FP", [0x5b] = "CHERI", [0x63] = "BRANCH",
+    [0x67] = "JALR", [0x6f] = "JAL", [0x73] = "SYSTEM",
+};
+
+static const char *mips_opcode_names[64] = {
+    [0x00] = "SPECIAL", [0x01] = "REGIMM", [0x02] = "J", [0x03] = "JAL",
+    [0x04] = "BEQ", [0x05] = "BNE", [0x06] = "BLEZ", [0x07] = "BGTZ",
+    [0x09] = "ADDIU", [0x0a] = "SLTI", [0x0b] = "SLTIU", [0x0c] = "ANDI",
+    [0x0d] = "ORI", [0x0e] = "XORI", [0x0f] = "LUI", [0x10] = "COP0",
+    [0x11] = "COP1", [0x12] = "COP2 (CHERI)", [0x19] = "DADDIU",
+    [0x1c] = "SPECIAL2", [0x1f] = "SPECIAL3", [0x20] = "LB", [0x21] = "LH",
+    [0x23] = "LW", [0x24] = "LBU", [0x25] = "LHU", [0x27] = "LWU",
+    [0x28] = "SB", [0x29] = "SH", [0x2b] = "SW", [0x32] = "LWC2 (CL*)",
+    [0x36] = "LDC2 (CLC)", [0x37] = "LD", [0x3a] = "SWC2 (CS*)",
+    [0x3e] = "SDC2 (CSC)", [0x3f] = "SD",
+};
+
+static const char *aarch64_op0_names[16] = {
+    "reserved", "unallocated", "SVE", "unallocated",
+    "load/store", "data processing (reg)", "load/store",
+    "data processing (SIMD/FP)", "data processing (imm)",
+    "data processing (imm)", "branch/exception/system",
+    "branch/exception/system", "load/store", "data processing (reg)",
+    "load/store", "data processing (SIMD/FP)",
+};
+
+static void format_opclass(char *buf, size_t size, uint64_t cls)
+{
+    const char *name = NULL;
+
+    if (cls == UINT64_MAX) {
+        snprintf(buf, size, "(no instruction bytes)");
+        return;
+    }
+    switch (trace.arch) {
+    case ARCH_RISCV:
+        if (cls & OPCLASS_COMPRESSED) {
+            snprintf(buf, size, "C.Q%u funct3=%u", (unsigned)(cls & 3),
+                     (unsigned)((cls >> 2) & 7));
+            return;
+        }
+        name = riscv_opcode_names[cls & 0x7f];
+        break;
+    case ARCH_MIPS:
+        name = mips_opcode_names[cls & 0x3f];
+        break;
+    case ARCH_AARCH64:
+        snprintf(buf, size, "op0=%u %s", (unsigned)cls,
+                 aarch64_op0_names[cls & 0xf]);
+        return;
+    default:
+        break;
+    }
+    if (name) {
+        snprintf(buf, size, "%s", name);
+    } else {
+        snprintf(buf, size, "opcode 0x%02" PRIx64, cls);
+    }
+}
+
+/* Bounds-checked reader for binary trace frames. */
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool err;
+} TraceReader;
+
+static inline uint8_t rd_u8(TraceReader *r)
+{
+    if (unlikely(r->p >= r->end)) {
+        r->err = true;
+        return 0;
+    }
+    return *r->p++;
+}
+
+static inline uint64_t rd_varint(TraceReader *r)
+{
+    uint64_t v = 0;
+    int shift;
+
+    for (shift = 0; shift < 64; shift += 7) {
+        uint8_t b = rd_u8(r);
+
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (b < 0x80) {
+            return v;
+        }
+    }
+    r->err = true;
+    return 0;
+}
+
+static inline int64_t rd_svarint(TraceReader *r)
+{
+    uint64_t v = rd_varint(r);
+
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline const uint8_t *rd_bytes(TraceReader *r, size_t *len)
+{
+    const uint8_t *p;
+
+    *len = rd_varint(r);
+    if (unlikely(*len > r->end - r->p)) {
+        r->err = true;
+        *len = 0;
+        return NULL;
+    }
+    p = r->p;
+    r->p += *len;
+    return p;
+}
+
+/* Skip a capability and return its tag, the sealed bit is stored in @sealed */
+static inline bool rd_cap(TraceReader *r, bool *sealed)
+{
+    uint8_t bits = rd_u8(r);
+
+    rd_varint(r);   /* cursor */
+    rd_svarint(r);  /* base - cursor */
+    rd_varint(r);   /* length */
+    rd_varint(r);   /* perms */
+    rd_svarint(r);  /* otype */
+    rd_varint(r);   /* pesbt */
+    *sealed = bits & 2;
+    return bits & 1;
+}
+
+static void binary_decode_frame(TraceStats *st, const uint8_t *data,
+                                size_t len)
+{
+    TraceReader r = { .p = data, .end = data + len };
+    uint64_t mask = trace.long_bits >= 64 ? UINT64_MAX :
+        (1ULL << trace.long_bits) - 1;
+    uint64_t pc = 0, asid = 0;
+    size_t n;
+
+    while (r.p < r.end && !r.err) {
+        uint8_t kind = rd_u8(&r);
+        uint8_t flags;
+        const uint8_t *insn;
+        uint64_t i, count;
+        bool sealed, tag;
+
+        switch (kind) {
+        case BTR_NAME:
+            rd_varint(&r);
+            rd_bytes(&r, &n);
+            break;
+        case BTR_START:
+        case BTR_STOP:
+            rd_u8(&r);
+            rd_varint(&r);
+            if (kind == BTR_START) {
+                st->starts++;
+            } else {
+                st->stops++;
+            }
+            break;
+        case BTR_INSN:
+            flags = rd_u8(&r);
+            pc = (pc + rd_svarint(&r)) & mask;
+            insn = rd_bytes(&r, &n);
+            if (flags & BTR_F_ASID) {
+                asid = rd_varint(&r);
+            }
+            if (flags & (BTR_F_TRAP | BTR_F_INTR)) {
+                rd_varint(&r);
+                rd_varint(&r);
+                if (flags & BTR_F_TRAP) {
+                    rd_varint(&r);
+                    st->traps++;
+                } else {
+                    st->interrupts++;
+                }
+            }
+            if (flags & BTR_F_MODE) {
+                rd_u8(&r);
+                st->mode_switches++;
+            }
+            if (r.err) {
+                break;
+            }
+            st->insns++;
+            counter_add(&st->pcs, pc, 1);
+            counter_add(&st->opclass, insn_opclass(insn, n), 1);
+            counter_add(&st->asid_insns, asid, 1);
+
+            count = rd_varint(&r);
+            for (i = 0; i < count && !r.err; i++) {
+                uint8_t rflags;
+
+                rd_varint(&r);
+                rflags = rd_u8(&r);
+                if (rflags & BTR_R_HOLDS) {
+                    tag = rd_cap(&r, &sealed);
+                    st->cap_reg_writes[tag]++;
+                    st->sealed_reg_writes += sealed;
+                } else {
+                    rd_varint(&r);
+                    if (rflags & BTR_R_CAP) {
+                        st->cap_reg_writes[0]++;
+                    }
+                }
+            }
+            count = rd_varint(&r);
+            for (i = 0; i < count && !r.err; i++) {
+                uint8_t mflags = rd_u8(&r);
+
+                rd_u8(&r);
+                rd_svarint(&r);
+                if (mflags & BTR_M_LD) {
+                    st->loads++;
+                } else if (mflags & BTR_M_ST) {
+                    st->stores++;
+                }
+                if (!(mflags & BTR_M_CAP)) {
+                    rd_varint(&r);
+                    continue;
+                }
+                tag = rd_cap(&r, &sealed);
+                if (mflags & BTR_M_LD) {
+                    st->cap_loads[tag]++;
+                } else {
+                    st->cap_stores[tag]++;
+                }
+                counter_add(&st->asid_cap_mem, asid, 1);
+            }
+            if (flags & BTR_F_TEXT) {
+                rd_bytes(&r, &n);
+            }
+            break;
+        default:
+            r.err = true;
+            break;
+        }
+    }
+    if (r.err) {
+        st->bad_items++;
+    }
+}
+
+static void cvtrace_decode(TraceStats *st, const uint8_t *data, size_t len)
+{
+    const cheri_trace_entry_t *e = (const cheri_trace_entry_t *)data;
+    size_t i, n = len / sizeof(*e);
+
+    for (i = 0; i < n; i++, e++) {
+        /* The emitter stores the instruction word as read in host order */
+        uint32_t inst = be32_to_cpu(e->inst);
+        uint64_t pc = be64_to_cpu(e->pc);
+        bool tag = be64_to_cpu(e->val2) >> 63;
+
+        st->insns++;
+        counter_add(&st->pcs, pc, 1);
+        counter_add(&st->opclass, insn_opclass((uint8_t *)&inst, 4), 1);
+        counter_add(&st->asid_insns, e->asid, 1);
+        if (e->exception != CTE_EXCEPTION_NONE) {
+            st->traps++;
+        }
+        switch (e->entry_type) {
+        case CTE_LD_GPR:
+            st->loads++;
+            break;
+        case CTE_ST_GPR:
+            st->stores++;
+            break;
+        case CTE_CAP:
+            st->cap_reg_writes[tag]++;
+            st->sealed_reg_writes += be64_to_cpu(e->val2) & 1;
+            break;
+        case CTE_LD_CAP:
+            st->loads++;
+            st->cap_loads[tag]++;
+            counter_add(&st->asid_cap_mem, e->asid, 1);
+            break;
+        case CTE_ST_CAP:
+            st->stores++;
+            st->cap_stores[tag]++;
+            counter_add(&st->asid_cap_mem, e->asid, 1);
+            break;
+        }
+    }
+}
+
+static void *trace_worker(void *opaque)
+{
+    TraceStats *st = opaque;
+    uint8_t *buf = NULL;
+#ifdef CONFIG_ZSTD
+    ZSTD_DCtx *dctx = NULL;
+
+    if (trace.zstd) {
+        dctx = ZSTD_createDCtx();
+        buf = g_malloc(trace.max_raw_len);
+    }
+#endif
+
+    for (;;) {
+        unsigned idx = qatomic_fetch_inc(&trace.next);
+        TraceWork *w;
+
+        if (idx >= trace.work->len) {
+            break;
+        }
+        w = &g_array_index(trace.work, TraceWork, idx);
+        if (trace.format == TRACE_CVTRACE) {
+            cvtrace_decode(st, w->data, w->len);
+            continue;
+        }
+#ifdef CONFIG_ZSTD
+        if (trace.zstd) {
+            size_t n = ZSTD_decompressDCtx(dctx, buf, w->raw_len,
+                                           w->data, w->len);
+            if (ZSTD_isError(n)) {
+                st->bad_items++;
+                continue;
+            }
+            binary_decode_frame(st, buf, n);
+            continue;
+        }
+#endif
+        binary_decode_frame(st, w->data, w->len);
+    }
+
+#ifdef CONFIG_ZSTD
+    ZSTD_freeDCtx(dctx);
+#endif
+    g_free(buf);
+    return NULL;
+}
+
+static TraceArch arch_from_name(const char *name)
+{
+    if (g_str_has_prefix(name, "riscv")) {
+        return ARCH_RISCV;
+    } else if (g_str_has_prefix(name, "mips")) {
+        return ARCH_MIPS;
+    } else if (g_str_has_prefix(name, "aarch64") ||
+               g_str_has_prefix(name, "morello")) {
+        return ARCH_AARCH64;
+    }
+    return ARCH_UNKNOWN;
+}
+
+/*
+ * Split a binary trace into its frames. Only the 12 byte frame headers are
+ * touched here, the payloads are left to the workers.
+ */
+static void binary_index(void)
+{
+    const uint8_t *p = trace.map + strlen(BTRACE_MAGIC);
+    const uint8_t *end = trace.map + trace.size;
+    unsigned name_len;
+
+    if (end - p < 5) {
+        error_report("truncated binary trace header");
+        exit(1);
+    }
+    if (p[0] != BTRACE_VERSION) {
+        error_report("unsupported binary trace version %u", p[0]);
+        exit(1);
+    }
+    trace.zstd = p[1] & BTRACE_HDR_ZSTD;
+    trace.long_bits = p[2];
+    trace.cap_size = p[3];
+    name_len = p[4];
+    p += 5;
+    if (end - p < name_len) {
+        error_report("truncated binary trace header");
+        exit(1);
+    }
+    memcpy(trace.target, p, MIN(name_len, sizeof(trace.target) - 1));
+    p += name_len;
+#ifndef CONFIG_ZSTD
+    if (trace.zstd) {
+        error_report("trace is zstd compressed but zstd support is disabled");
+        exit(1);
+    }
+#endif
+
+    while (end - p >= BTRACE_FRAME_HDR) {
+        TraceWork w;
+
+        w.raw_len = ldl_le_p(p + 4);
+        w.len = ldl_le_p(p + 8);
+        w.data = p + BTRACE_FRAME_HDR;
+        if (w.len > end - w.data) {
+            warn_report("ignoring truncated frame at offset %zu",
+                        (size_t)(p - trace.map));
+            break;
+        }
+        trace.max_raw_len = MAX(trace.max_raw_len, w.raw_len);
+        g_array_append_val(trace.work, w);
+        p = w.data + w.len;
+    }
+}
+
+static void cvtrace_index(void)
+{
+    size_t entry = sizeof(cheri_trace_entry_t);
+    size_t shard = (size_t)trace.shard_entries * entry;
+    size_t off;
+
+    /* The first entry holds the version byte and magic string. */
+    for (off = entry; off + entry <= trace.size; off += shard) {
+        TraceWork w = {
+            .data = trace.map + off,
+            .len = MIN(shard, (trace.size - off) / entry * entry),
+        };
+        g_array_append_val(trace.work, w);
+    }
+}
+
+static void print_summary(FILE *out, const TraceStats *st, int top,
+                          const char *path, unsigned nthreads,
+                          double seconds)
+{
+    uint64_t *pairs;
+    size_t i;
+
+    fprintf(out, "trace:               %s (%s%s%s)\n", path,
+            trace.format == TRACE_BINARY ? "binary" : "cvtrace",
+            trace.target[0] ? ", " : "", trace.target);
+    fprintf(out, "work items:          %u on %u threads in %.2fs"
+            " (%.1f MiB/s)\n", trace.work->len, nthreads, seconds,
+            trace.size / MAX(seconds, 1e-6) / (1024 * 1024));
+    if (st->bad_items) {
+        fprintf(out, "undecodable items:   %" PRIu64 "\n", st->bad_items);
+    }
+    fprintf(out, "instructions:        %" PRIu64 "\n", st->insns);
+    fprintf(out, "traps:               %" PRIu64 "\n", st->traps);
+    fprintf(out, "interrupts:          %" PRIu64 "\n", st->interrupts);
+    fprintf(out, "mode switches:       %" PRIu64 "\n", st->mode_switches);
+    if (trace.format == TRACE_BINARY) {
+        fprintf(out, "logging start/stop:  %" PRIu64 "/%" PRIu64 "\n",
+                st->starts, st->stops);
+    }
+    fprintf(out, "loads:               %" PRIu64 "\n", st->loads);
+    fprintf(out, "stores:              %" PRIu64 "\n", st->stores);
+
+    fprintf(out, "\ncapability operations (tagged/untagged):\n");
+    fprintf(out, "  register writes    %" PRIu64 "/%" PRIu64
+            " (%" PRIu64 " sealed)\n", st->cap_reg_writes[1],
+            st->cap_reg_writes[0], st->sealed_reg_writes);
+    fprintf(out, "  loads              %" PRIu64 "/%" PRIu64 "\n",
+            st->cap_loads[1], st->cap_loads[0]);
+    fprintf(out, "  stores             %" PRIu64 "/%" PRIu64 "\n",
+            st->cap_stores[1], st->cap_stores[0]);
+
+    fprintf(out, "\ninstruction mix:\n");
+    pairs = counter_sorted(&st->opclass);
+    for (i = 0; i < st->opclass.used && i < top; i++) {
+        char name[64];
+
+        format_opclass(name, sizeof(name), pairs[2 * i]);
+        fprintf(out, "  %-32s %12" PRIu64 " %6.2f%%\n", name,
+                pairs[2 * i + 1], 100.0 * pairs[2 * i + 1] / st->insns);
+    }
+    g_free(pairs);
+
+    fprintf(out, "\nhot PCs:\n");
+    pairs = counter_sorted(&st->pcs);
+    for (i = 0; i < st->pcs.used && i < top; i++) {
+        fprintf(out, "  0x%016" PRIx64 " %12" PRIu64 " %6.2f%%\n",
+                pairs[2 * i], pairs[2 * i + 1],
+                100.0 * pairs[2 * i + 1] / st->insns);
+    }
+    g_free(pairs);
+
+    fprintf(out, "\nper-ASID:\n");
+    fprintf(out, "  %8s %12s %8s %12s\n", "asid", "insns", "%", "cap mem");
+    pairs = counter_sorted(&st->asid_insns);
+    for (i = 0; i < st->asid_insns.used && i < top; i++) {
+        fprintf(out, "  %8" PRIu64 " %12" PRIu64 " %7.2f%% %12" PRIu64 "\n",
+                pairs[2 * i], pairs[2 * i + 1],
+                100.0 * pairs[2 * i + 1] / st->insns,
+                counter_get(&st->asid_cap_mem, pairs[2 * i]));
+    }
+    g_free(pairs);
+}
+
+static void usage(FILE *out)
+{
+    fprintf(out,
+            "\n"
+            "Summarize an instruction trace written with -cheri-trace-format\n"
+            "binary or cvtrace, using all host cores.\n"
+            "\n"
+            "usage: qemu-trace-stats [options] <trace file>\n"
+            "options:\n"
+            "    -h             print this text\n"
+            "    -j <threads>   number of worker threads (default: all CPUs)\n"
+            "    -n <count>     number of entries in top-N tables (default 20)\n"
+            "    -s <entries>   cvtrace entries per work item (default 1M)\n"
+            "    -a <arch>      guest architecture for the instruction mix\n"
+            "                   (riscv, mips, aarch64; binary traces record\n"
+            "                   it in the header)\n"
+            "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned nthreads = g_get_num_processors();
+    unsigned top = 20;
+    const char *arch = NULL;
+    QemuThread *threads;
+    TraceStats *stats, total;
+    gint64 start;
+    struct stat sb;
+    unsigned i;
+    int fd, rc;
+
+    error_init(argv[0]);
+    for (;;) {
+        rc = getopt(argc, argv, "hj:n:s:a:");
+        if (rc == -1) {
+            break;
+        }
+        switch (rc) {
+        case 'j':
+            if (qemu_strtoui(optarg, NULL, 10, &nthreads) < 0 ||
+                nthreads == 0) {
+                error_report("invalid thread count: %s", optarg);
+                exit(1);
+            }
+            break;
+        case 'n':
+            if (qemu_strtoui(optarg, NULL, 10, &top) < 0) {
+                error_report("invalid count: %s", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            if (qemu_strtoui(optarg, NULL, 10, &trace.shard_entries) < 0 ||
+                trace.shard_entries == 0) {
+                error_report("invalid work item size: %s", optarg);
+                exit(1);
+            }
+            break;
+        case 'a':
+            arch = optarg;
+            break;
+        case 'h':
+            usage(stdout);
+            exit(0);
+        default:
+            usage(stderr);
+            exit(1);
+        }
+    }
+    if (optind != argc - 1) {
+        usage(stderr);
+        exit(1);
+    }
+
+    fd = qemu_open_old(argv[optind], O_RDONLY);
+    if (fd < 0 || fstat(fd, &sb) < 0) {
+        error_report("could not open '%s': %s", argv[optind],
+                     strerror(errno));
+        exit(1);
+    }
+    trace.size = sb.st_size;
+    trace.map = mmap(NULL, trace.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace.map == MAP_FAILED) {
+        error_report("could not map '%s': %s", argv[optind], strerror(errno));
+        exit(1);
+    }
+    close(fd);
+
+    start = g_get_monotonic_time();
+    trace.work = g_array_new(false, false, sizeof(TraceWork));
+    if (trace.size >= strlen(BTRACE_MAGIC) &&
+        memcmp(trace.map, BTRACE_MAGIC, strlen(BTRACE_MAGIC)) == 0) {
+        trace.format = TRACE_BINARY;
+        binary_index();
+    } else if (trace.size >= sizeof(cheri_trace_entry_t) &&
+               trace.map[0] == CTE_QEMU_VERSION &&
+               memcmp(trace.map + 1, CTE_QEMU_MAGIC,
+                      strlen(CTE_QEMU_MAGIC)) == 0) {
+        trace.format = TRACE_CVTRACE;
+        cvtrace_index();
+    } else {
+        error_report("'%s' is neither a binary nor a cvtrace trace",
+                     argv[optind]);
+        exit(1);
+    }
+    trace.arch = arch_from_name(arch ? arch : trace.target);
+
+    nthreads = MAX(MIN(nthreads, trace.work->len), 1);
+    threads = g_new(QemuThread, nthreads);
+    stats = g_new(TraceStats, nthreads);
+    for (i = 0; i < nthreads; i++) {
+        stats_init(&stats[i]);
+        qemu_thread_create(&threads[i], "trace-stats", trace_worker,
+                           &stats[i], QEMU_THREAD_JOINABLE);
+    }
+    stats_init(&total);
+    for (i = 0; i < nthreads; i++) {
+        qemu_thread_join(&threads[i]);
+        stats_merge(&total, &stats[i]);
+        stats_free(&stats[i]);
+    }
+
+    print_summary(stdout, &total, top, argv[optind], nthreads,
+                  (g_get_monotonic_time() - start) / 1e6);
+    stats_free(&total);
+    munmap((void *)trace.map, trace.size);
+    return 0;
+}
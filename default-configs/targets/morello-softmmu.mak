@@ -9,3 +9,4 @@ TARGET_XML_FILES= gdb-xml/aarch64-core.xml gdb-xml/aarch64-fpu.xml gdb-xml/arm-c
 TARGET_CHERI=y
 TARGET_MORELLO=y
 TARGET_SUPPORTS_MTTCG=n
+TARGET_SUPPORTS_TB_CACHE=y
@@ -355,6 +355,36 @@ char *plugin_disas(CPUState *cpu, uint64_t addr, size_t size)
     return g_string_free(ds, false);
 }
 
+/*
+ * Disassemble a single instruction from a host buffer into a newly
+ * allocated string, without touching target memory.
+ */
+char *target_disas_buf_str(CPUState *cpu, void *code, unsigned long size,
+                           target_ulong vma)
+{
+    CPUDebug s;
+    GString *ds = g_string_new(NULL);
+
+    initialize_debug_target(&s, cpu);
+    s.info.read_memory_func = host_read_memory;
+    s.info.fprintf_func = plugin_printf;
+    s.info.stream = (FILE *)ds;  /* abuse this slot */
+    s.info.buffer = code;
+    s.info.buffer_vma = vma;
+    s.info.buffer_length = size;
+    s.info.print_address_func = plugin_print_address;
+
+    if (s.info.cap_arch >= 0 && cap_disas_plugin(&s.info, vma, size)) {
+        ; /* done */
+    } else if (s.info.print_insn) {
+        s.info.print_insn(vma, &s.info);
+    } else {
+        ; /* cannot disassemble -- return empty string */
+    }
+
+    return g_string_free(ds, false);
+}
+
 /* Disassemble this for me please... (debugging). */
 void disas(FILE *out, const void *code, unsigned long size)
 {
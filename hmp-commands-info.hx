@@ -283,6 +283,25 @@ SRST
     Show dynamic compiler info.
 ERST
 
+#if defined(TARGET_CHERI)
+    {
+        .name       = "cheri-tagmem",
+        .args_type  = "pages:-p,caps:-c",
+        .params     = "[-p] [-c]",
+        .help       = "show resident CHERI tag memory",
+        .cmd        = hmp_info_cheri_tagmem,
+    },
+#endif
+
+SRST
+  ``info cheri-tagmem [-p] [-c]``
+    Show the CHERI tag memory resident for each RAM block and the size of
+    the pool of reclaimed tag blocks. With ``-p``, also count the pages that
+    hold at least one tagged capability. With ``-c``, decode every tagged
+    capability and count how many there are, how many are sealed and how
+    many are executable.
+ERST
+
 #if defined(CONFIG_TCG)
     {
         .name       = "opcount",
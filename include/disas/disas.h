@@ -12,6 +12,8 @@ void target_disas(FILE *out, CPUState *cpu, target_ulong code,
                   target_ulong size);
 void target_disas_buf(FILE *out, CPUState *cpu, void *code, unsigned long size,
                       target_ulong pc, target_ulong max_insns);
+char *target_disas_buf_str(CPUState *cpu, void *code, unsigned long size,
+                           target_ulong pc);
 
 void monitor_disas(Monitor *mon, CPUState *cpu,
                    target_ulong pc, int nb_insn, int is_physical);
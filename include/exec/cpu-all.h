@@ -391,6 +391,18 @@ CPUArchState *cpu_copy(CPUArchState *env);
 #define TLB_BSWAP           (1 << (TARGET_PAGE_BITS_MIN - 5))
 /* Set if TLB entry writes ignored.  */
 #define TLB_DISCARD_WRITE   (1 << (TARGET_PAGE_BITS_MIN - 6))
+#ifdef TARGET_CHERI
+/*
+ * Set if stores to the page must update data and CHERI tags under the line
+ * lock (cheri_tagmem_atomic and the page may hold tags). Not part of
+ * TLB_FLAGS_MASK, which get_alignment_bits() requires to be clear of all
+ * alignment bits: being the lowest flag, it overlaps the alignment bits of
+ * accesses aligned to 1 << (TARGET_PAGE_BITS_MIN - 6) bytes or more (16 with
+ * the 1 KiB minimum pages of Arm, 64 with 4 KiB pages). Stores with such an
+ * alignment use a helper instead, see cheri_store_needs_helper().
+ */
+#define TLB_CHERI_TAGS      (1 << (TARGET_PAGE_BITS_MIN - 7))
+#endif
 
 /* Use this mask to check interception with an alignment mask
  * in a TCG backend.
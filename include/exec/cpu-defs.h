@@ -82,6 +82,10 @@ typedef uint64_t target_ulong;
 /* use a fully associative victim tlb of 8 entries */
 #define CPU_VTLB_SIZE 8
 
+/* use a 4-way set associative tlb of 32 entries for large pages */
+#define CPU_LTLB_SETS 8
+#define CPU_LTLB_WAYS 4
+
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
 #else
@@ -178,6 +182,8 @@ typedef struct CPUIOTLBEntry {
     (TLBENTRYCAP_FLAG_TRAP | TLBENTRYCAP_FLAG_CLEAR)
 #define TLBENTRYCAP_INVALID_WRITE_VALUE (TLBENTRYCAP_FLAG_TRAP)
     uintptr_t tagmem_write;
+    /* The RAMBlock the tag memory belongs to, NULL if there is none. */
+    RAMBlock *tag_ram;
 #endif
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
@@ -189,6 +195,23 @@ typedef struct CPUIOTLBEntry {
     })
 #define IOTLB_GET_TAGMEM_FLAGS(iotlbentry, rw)                                 \
     ((uintptr_t)iotlbentry->tagmem_##rw & TLBENTRYCAP_MASK);
+
+/*
+ * A guest mapping larger than TARGET_PAGE_SIZE, as passed to
+ * tlb_set_page_with_attrs(). The main tlb only holds the pages of it
+ * that were accessed; the others are refilled from this entry without
+ * walking the guest page tables again.
+ */
+typedef struct CPUTLBLargeEntry {
+    target_ulong vaddr;
+    /* ~(size - 1) */
+    target_ulong mask;
+    hwaddr paddr;
+    MemTxAttrs attrs;
+    /* Zero if the entry is unused */
+    int prot;
+} CPUTLBLargeEntry;
+
 /*
  * Data elements that are per MMU mode, minus the bits accessed by
  * the TCG fast path.
@@ -206,12 +229,21 @@ typedef struct CPUTLBDesc {
     int64_t window_begin_ns;
     /* maximum number of entries observed in the window */
     size_t window_max_entries;
+    /* number of tlb refills in the window, used to detect thrashing */
+    size_t window_fills;
     size_t n_used_entries;
     /* The next index to use in the tlb victim table.  */
     size_t vindex;
     /* The tlb victim table, in two parts.  */
     CPUTLBEntry vtable[CPU_VTLB_SIZE];
     CPUIOTLBEntry viotlb[CPU_VTLB_SIZE];
+    /*
+     * The large page tlb. Each size in use has its own set index, bit N
+     * of ltlb_sizes is set if entries of 1 << N bytes are present.
+     */
+    uint64_t ltlb_sizes;
+    uint8_t lindex[CPU_LTLB_SETS];
+    CPUTLBLargeEntry ltable[CPU_LTLB_SETS][CPU_LTLB_WAYS];
     /* The iotlb.  */
     CPUIOTLBEntry *iotlb;
 } CPUTLBDesc;
@@ -247,6 +279,10 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    /* Refills of the main tlb, by where the translation came from */
+    size_t fill_count;
+    size_t victim_hit_count;
+    size_t large_hit_count;
 } CPUTLBCommon;
 
 /*
@@ -183,6 +183,15 @@ void tlb_flush_all_cpus(CPUState *src_cpu);
  * the guests translation ends the TB.
  */
 void tlb_flush_all_cpus_synced(CPUState *src_cpu);
+/**
+ * tlb_flush_exclusive:
+ * @cpu: CPU whose TLB should be flushed
+ *
+ * Flush the entire TLB of @cpu immediately, even if it belongs to another
+ * vCPU thread. Only safe while no vCPU runs, i.e. from a start_exclusive()
+ * section such as async_safe_run_on_cpu() work.
+ */
+void tlb_flush_exclusive(CPUState *cpu);
 /**
  * tlb_flush_page_by_mmuidx:
  * @cpu: CPU whose TLB should be flushed
@@ -329,6 +338,9 @@ static inline void tlb_flush_all_cpus(CPUState *src_cpu)
 static inline void tlb_flush_all_cpus_synced(CPUState *src_cpu)
 {
 }
+static inline void tlb_flush_exclusive(CPUState *cpu)
+{
+}
 static inline void tlb_flush_page_by_mmuidx(CPUState *cpu,
                                             target_ulong addr, uint16_t idxmap)
 {
@@ -470,6 +482,7 @@ struct TranslationBlock {
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
 #define CF_LOG_INSTR 0x00100000   /* Generate calls to instruction tracing */
+#define CF_HOT         0x00200000 /* Retranslated after tb_hot_threshold samples */
 #define CF_CLUSTER_MASK 0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 /* cflags' mask for hashing/comparison */
@@ -524,6 +537,18 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /* Hash of the guest code, only set with the persistent TB cache */
+    uint64_t guest_hash;
+
+    /* Translated ahead of time by tb_prefetch_run() and not looked up yet */
+    bool prefetched;
+
+    /* Times the hot TB sampler found this TB, see tb_hot_sample() */
+    uint32_t hot_samples;
+
+    /* Generated code uses pointers to the heap, see tcg_const_heap_ptr() */
+    bool heap_ptrs;
 };
 
 extern bool parallel_cpus;
@@ -554,7 +579,8 @@ static inline uint32_t curr_cflags(CPUState *cpu)
     uint32_t flags = (parallel_cpus ? CF_PARALLEL : 0) |
                      (icount_enabled() ? CF_USE_ICOUNT : 0);
 #ifdef CONFIG_TCG_LOG_INSTR
-    if (cpu->log_state.loglevel_active && qemu_loglevel_mask(CPU_LOG_INSTR))
+    if (qemu_log_instr_dynamic ||
+        (cpu->log_state.loglevel_active && qemu_loglevel_mask(CPU_LOG_INSTR)))
         flags |= CF_LOG_INSTR;
 #endif
     return flags;
@@ -687,6 +713,16 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env, target_ulong addr);
 tb_page_addr_t get_page_addr_code_hostp(CPUArchState *env, target_ulong addr,
                                         void **hostp);
 
+/**
+ * get_page_addr_code_nofill() - full-system version
+ * @env: CPUArchState
+ * @addr: guest virtual address of guest code
+ *
+ * Like get_page_addr_code(), but returns -1 if @addr is not mapped by the
+ * TLB instead of filling it. This function never triggers an exception.
+ */
+tb_page_addr_t get_page_addr_code_nofill(CPUArchState *env, target_ulong addr);
+
 void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length);
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr);
 
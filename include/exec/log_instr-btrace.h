@@ -0,0 +1,36 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Constants of the compact binary trace (-cheri-trace-format binary),
+ * shared by the emitter in accel/tcg/log_instr.c and contrib/trace-stats.
+ * The file layout is described in log_instr.c and the record layout in
+ * scripts/qemu-btrace-decode.py.
+ */
+
+#pragma once
+
+#define BTRACE_MAGIC "QEMUBTRC"
+#define BTRACE_VERSION 1
+#define BTRACE_HDR_ZSTD 1
+/* u32 cpu index, u32 raw length, u32 stored length */
+#define BTRACE_FRAME_HDR 12
+
+/* Record types */
+#define BTR_INSN  1
+#define BTR_START 2
+#define BTR_STOP  3
+#define BTR_NAME  4
+
+/* BTR_INSN flags */
+#define BTR_F_ASID    1
+#define BTR_F_TRAP    2
+#define BTR_F_INTR    4
+#define BTR_F_MODE    8
+#define BTR_F_TEXT    16
+
+/* Register/memory record flags */
+#define BTR_R_CAP     1  /* Capability register */
+#define BTR_R_HOLDS   2  /* A capability follows instead of an integer */
+#define BTR_M_LD      1
+#define BTR_M_ST      2
+#define BTR_M_CAP     4
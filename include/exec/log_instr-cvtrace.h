@@ -0,0 +1,41 @@
+/*
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Layout of the CHERI stream trace (-cheri-trace-format cvtrace), shared
+ * by the emitter in accel/tcg/log_instr.c and contrib/trace-stats.
+ *
+ * The format is limited to one entry per instruction, each
+ * entry can hold at most one register modification and one
+ * memory address.
+ * Note that the CHERI format is the legacy MIPS format and
+ * assumes big-endian byte order.
+ */
+
+#pragma once
+
+typedef struct {
+    uint8_t entry_type;
+#define CTE_NO_REG  0   /* No register is changed. */
+#define CTE_GPR     1   /* GPR change (val2) */
+#define CTE_LD_GPR  2   /* Load into GPR (val2) from address (val1) */
+#define CTE_ST_GPR  3   /* Store from GPR (val2) to address (val1) */
+#define CTE_CAP     11  /* Cap change (val2,val3,val4,val5) */
+#define CTE_LD_CAP  12  /* Load Cap (val2,val3,val4,val5) from addr (val1) */
+#define CTE_ST_CAP  13  /* Store Cap (val2,val3,val4,val5) to addr (val1) */
+    uint8_t exception;  /* 0=none, 1=TLB Mod, 2=TLB Load, 3=TLB Store, etc. */
+#define CTE_EXCEPTION_NONE 31
+    uint16_t cycles;    /* Currently not used. */
+    uint32_t inst;      /* Encoded instruction. */
+    uint64_t pc;        /* PC value of instruction. */
+    uint64_t val1;      /* val1 is used for memory address. */
+    uint64_t val2;      /* val2, val3, val4, val5 are used for reg content. */
+    uint64_t val3;
+    uint64_t val4;
+    uint64_t val5;
+    uint8_t thread;     /* Hardware thread/CPU (i.e. cpu->cpu_index ) */
+    uint8_t asid;       /* Address Space ID */
+} __attribute__((packed)) cheri_trace_entry_t;
+
+/* Version 3 Cheri Stream Trace header info */
+#define CTE_QEMU_VERSION    (0x80U + 3)
+#define CTE_QEMU_MAGIC      "CheriTraceV03"
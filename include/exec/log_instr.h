@@ -180,6 +180,13 @@ struct TCGv_i64_d;
 extern struct TCGv_i64_d *qemu_log_printf_valid_entries;
 void qemu_log_printf_create_globals(void);
 
+/*
+ * Generate the commit of the previous instruction at the start of a new one.
+ * With -cheri-trace-trigger this tests the per-CPU logging state at run time
+ * and updates the trigger PC range hits, so TBs do not depend on it.
+ */
+void qemu_log_instr_gen_commit(struct DisasContextBase *base);
+
 /*
  * Request a flush of the TCG when changing loglevel outside of qemu_log_instr.
  * TODO(am2419): this should be removed from the interface.
@@ -243,6 +250,19 @@ void qemu_log_instr_drop(CPUArchState *env);
  */
 void qemu_log_instr_commit(CPUArchState *env);
 
+/*
+ * Check at translation time whether any instruction of a TB starting
+ * at @pc may be logged under the -dfilter ranges. TBs that can not match
+ * are translated without logging helpers.
+ */
+bool qemu_log_instr_tb_in_filter(target_ulong pc);
+
+/*
+ * Re-evaluate the -cheri-trace-trigger rules after the ASID of the CPU
+ * changed. Privilege mode changes are tracked by qemu_log_instr_mode_switch.
+ */
+void qemu_log_instr_trigger_update(CPUArchState *env);
+
 /*
  * Log changed general purpose register.
  */
@@ -331,6 +351,7 @@ void qemu_log_instr_extra(CPUArchState *env, const char *msg, ...);
 #define	qemu_log_instr_stop(env, mode, pc)
 #define	qemu_log_instr_mode_switch(...)
 #define qemu_log_instr_flush(env)
+#define qemu_log_instr_trigger_update(env)
 #define	qemu_log_instr_reg(...)
 #define	qemu_log_instr_cap(...)
 #define	qemu_log_instr_mem(...)
@@ -48,6 +48,8 @@ struct RAMBlock {
 
     /* Bitmap of CHERI tag bits */
     struct CheriTagMem *cheri_tags;
+    /* pages whose last CHERI tags sent during migration were non-zero */
+    unsigned long *cheri_tags_sent;
 
     /*
      * bitmap to track already cleared dirty bitmap.  When the bit is
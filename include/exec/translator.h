@@ -63,6 +63,8 @@ typedef enum DisasJumpType {
  * @num_insns: Number of translated instructions (including current).
  * @max_insns: Maximum number of instructions to be translated in this TB.
  * @singlestep_enabled: "Hardware" single stepping enabled.
+ * @successors: Static successors noted by translator_note_successor().
+ * @num_successors: Number of valid entries in @successors.
  *
  * Architecture-agnostic disassembly context.
  */
@@ -78,14 +80,28 @@ typedef struct DisasContextBase {
     // TIME. Within a basic block, this is possible to track for any runtime
     // use.
     uint8_t cap_compression_states[NUM_LAZY_CAP_REGS];
+    // Capability checks that have already passed earlier in this TB. For
+    // each register this records the permissions that were checked (implying
+    // tagged and unsealed) and a window of cursor-relative offsets known to
+    // be in bounds. Only valid until the register is next written.
+    struct {
+        uint32_t perms;
+        target_long lo, hi;
+    } cap_checked[NUM_LAZY_CAP_REGS];
+    // Set by instructions that keep cap_checked up to date themselves.
+    bool cap_checks_preserved;
 #endif
     DisasJumpType is_jmp;
     int num_insns;
     int max_insns;
     bool singlestep_enabled;
+    target_ulong successors[2];
+    int num_successors;
 #ifdef CONFIG_TCG_LOG_INSTR
     bool log_instr_enabled;
     uint8_t printf_used_ptr;
+    /* Trigger PC range hits of the previous instruction */
+    uint16_t log_instr_trigger_pc_hits;
 #endif
 } DisasContextBase;
 
@@ -139,6 +155,17 @@ typedef struct TranslatorOps {
     void (*disas_log)(const DisasContextBase *db, CPUState *cpu);
 } TranslatorOps;
 
+/**
+ * translator_note_successor:
+ * @db: Disassembly context
+ * @dest: guest PC of a TB that may directly follow this one
+ *
+ * Called by targets for the static destinations of the TB they are
+ * translating, e.g. from their goto_tb helper. Only used as a hint for
+ * translating TBs ahead of time.
+ */
+void translator_note_successor(DisasContextBase *db, target_ulong dest);
+
 /**
  * translator_loop:
  * @ops: Target-specific operations.
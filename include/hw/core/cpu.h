@@ -147,6 +147,10 @@ struct TranslationBlock;
  * @gdb_core_xml_file: File name for core registers GDB XML description.
  * @gdb_stop_before_watchpoint: Indicates whether GDB expects the CPU to stop
  *           before the insn which triggers a watchpoint rather than after it.
+ * @tlb_fill_linear: Set if a size larger than a page that @tlb_fill passes
+ *       to tlb_set_page() always describes a single linear mapping with the
+ *       same permissions and attributes, so that the softmmu may map the
+ *       other pages of it without calling @tlb_fill again.
  * @gdb_arch_name: Optional callback that returns the architecture name known
  * to GDB. The caller must free the returned string with g_free.
  * @gdb_get_dynamic_xml: Callback to return dynamically generated XML for the
@@ -231,6 +235,7 @@ struct CPUClass {
     /* Keep non-pointer data at the end to minimize holes.  */
     int gdb_num_core_regs;
     bool gdb_stop_before_watchpoint;
+    bool tlb_fill_linear;
 };
 
 /*
@@ -415,6 +420,18 @@ struct CPUState {
 
     /* Accessed in parallel; all accesses must be atomic */
     struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];
+    /*
+     * TB lookup statistics. Only written by the vCPU thread itself, but
+     * read atomically by the monitor ("info jit").
+     * tb_exit_lookups counts TB lookups done in the main loop after leaving
+     * generated code, tb_ptr_lookups counts lookup_and_goto_ptr lookups that
+     * stayed in generated code and tb_ptr_misses those that did not.
+     */
+    size_t tb_exit_lookups;
+    size_t tb_ptr_lookups;
+    size_t tb_ptr_misses;
+    /* Set by the hot TB sampler, the next TB looked up is a sample */
+    bool tb_hot_sample;
 
     struct GDBRegisterState *gdb_regs;
     int gdb_num_regs;
@@ -38,6 +38,9 @@
  * bitmap_set_atomic(dst, pos, nbits)   Set specified bit area with atomic ops
  * bitmap_clear(dst, pos, nbits)		Clear specified bit area
  * bitmap_test_and_clear_atomic(dst, pos, nbits)    Test and clear area
+ * bitmap_count_and_clear_atomic(dst, pos, nbits)   Clear area, count set bits
+ * bitmap_index_mark_atomic(index, map, word)   Note that map word is non-zero
+ * bitmap_index_find_next(map, index, nbits, pos)  Next set bit, using index
  * bitmap_find_next_zero_area(buf, len, pos, n, mask)	Find bit free area
  * bitmap_to_le(dst, src, nbits)      Convert bitmap to little endian
  * bitmap_from_le(dst, src, nbits)    Convert bitmap from little endian
@@ -249,10 +252,26 @@ static inline long bitmap_count_one_with_offset(const unsigned long *bitmap,
            bitmap_count_one(bitmap_start, redundant_bits);
 }
 
+/*
+ * A bitmap index has one bit per word of @map that may be non-zero. Whoever
+ * turns a word of @map from zero to non-zero (with an atomic RMW) must mark
+ * it in the index afterwards. Words that become zero again are unmarked
+ * lazily by bitmap_index_find_next().
+ */
+static inline void bitmap_index_mark_atomic(unsigned long *index, long word)
+{
+    if (!(qatomic_read(&index[BIT_WORD(word)]) & BIT_MASK(word))) {
+        set_bit_atomic(word, index);
+    }
+}
+
 void bitmap_set(unsigned long *map, long i, long len);
 void bitmap_set_atomic(unsigned long *map, long i, long len);
 void bitmap_clear(unsigned long *map, long start, long nr);
 bool bitmap_test_and_clear_atomic(unsigned long *map, long start, long nr);
+long bitmap_count_and_clear_atomic(unsigned long *map, long start, long nr);
+long bitmap_index_find_next(const unsigned long *map, unsigned long *index,
+                            long size, long offset);
 void bitmap_copy_and_clear_atomic(unsigned long *dst, unsigned long *src,
                                   long nr);
 unsigned long bitmap_find_next_zero_area(unsigned long *map,
@@ -156,6 +156,7 @@ void qemu_log_needs_buffers(void);
 void qemu_set_log_filename(const char *filename, Error **errp);
 void qemu_set_dfilter_ranges(const char *ranges, Error **errp);
 bool qemu_log_in_addr_range(uint64_t addr);
+bool qemu_log_any_in_addr_range(uint64_t lob, uint64_t upb);
 int qemu_str_to_log_mask(const char *str);
 
 /* Print a usage message listing all the valid logging categories
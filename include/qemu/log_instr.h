@@ -53,11 +53,19 @@
 typedef enum {
     QLI_FMT_TEXT = 0,
     QLI_FMT_CVTRACE = 1,
-    QLI_FMT_NOP = 2
+    QLI_FMT_NOP = 2,
+    QLI_FMT_BINARY = 3,
+    QLI_FMT_PERFETTO = 4
 } qemu_log_instr_fmt_t;
 
 extern qemu_log_instr_fmt_t qemu_log_instr_format;
 
+/*
+ * Translate every TB with logging instrumentation and decide at run time,
+ * per CPU, whether to log. Set when -cheri-trace-trigger rules are given.
+ */
+extern bool qemu_log_instr_dynamic;
+
 /*
  * CPU mode. This unifies the logging codes for CPU mode switches.
  * we take the same approach as with TCG DisasJumpType, where target
@@ -99,6 +107,7 @@ static inline qemu_log_instr_fmt_t qemu_log_instr_get_format()
 }
 
 struct cpu_log_instr_info;
+struct log_instr_sample_ring;
 
 typedef union {
     char charv;
@@ -134,6 +143,8 @@ typedef struct {
     bool force_drop;
     /* We are starting to log at the next commit */
     bool starting;
+    /* Mask of the trigger rules whose PC range contains the current PC */
+    uint16_t trigger_pc_hits;
     /* Per-CPU flags */
     int flags;
 #define QEMU_LOG_INSTR_FLAG_BUFFERED 1
@@ -144,6 +155,13 @@ typedef struct {
     size_t ring_head;
     /* Ring buffer index of the first entry to dump */
     size_t ring_tail;
+    /* Private per-CPU state of the trace format */
+    void *fmt_data;
+    /* Bump allocator for the extra text of entries not yet emitted */
+    char *txt_arena;
+    size_t txt_arena_used;
+    /* Samples not yet written out by the sampling profiler */
+    struct log_instr_sample_ring *sample_ring;
 
     qemu_log_printf_buf_t qemu_log_printf_buf;
 } cpu_log_instr_state_t;
@@ -161,6 +179,32 @@ int qemu_log_instr_global_switch(int log_flags);
  */
 void qemu_log_instr_set_buffer_size(unsigned long buffer_size);
 
+/*
+ * Write out what the trace format still buffers and stop its writer thread.
+ * Called on the orderly exit paths, after which nothing is traced any more.
+ */
+void qemu_log_instr_shutdown(void);
+
+/*
+ * Enable the sampling profiler (-cheri-profile) with the given options.
+ * Sampling starts once the machine has been created.
+ */
+void qemu_log_instr_sample_parse_opts(const char *optarg);
+
+/*
+ * Stop the sampling profiler and write out the remaining samples. Called by
+ * qemu_cleanup() once the vCPUs have been paused.
+ */
+void qemu_log_instr_sample_shutdown(void);
+
+/*
+ * Add a -cheri-trace-trigger rule. Logging is only active on a CPU while at
+ * least one rule matches its ASID, PC and privilege mode.
+ */
+void qemu_log_instr_trigger_parse_opts(const char *optarg);
+
 #else /* ! CONFIG_TCG_LOG_INSTR */
 #define qemu_log_instr_set_format(fmt) ((void)0)
+#define qemu_log_instr_sample_shutdown() ((void)0)
+#define qemu_log_instr_shutdown() ((void)0)
 #endif /* ! CONFIG_TCG_LOG_INSTR */
@@ -26,6 +26,8 @@ enum qemu_plugin_event {
     QEMU_PLUGIN_EV_VCPU_SYSCALL_RET,
     QEMU_PLUGIN_EV_FLUSH,
     QEMU_PLUGIN_EV_ATEXIT,
+    QEMU_PLUGIN_EV_VCPU_CAP_MEM,
+    QEMU_PLUGIN_EV_VCPU_CAP_INLINE,
     QEMU_PLUGIN_EV_MAX, /* total number of plugin events we support */
 };
 
@@ -56,6 +58,7 @@ union qemu_plugin_cb_sig {
     qemu_plugin_vcpu_mem_cb_t        vcpu_mem;
     qemu_plugin_vcpu_syscall_cb_t    vcpu_syscall;
     qemu_plugin_vcpu_syscall_ret_cb_t vcpu_syscall_ret;
+    qemu_plugin_vcpu_cap_mem_cb_t    vcpu_cap_mem;
     void *generic;
 };
 
@@ -179,6 +182,10 @@ void qemu_plugin_vcpu_syscall_ret(CPUState *cpu, int64_t num, int64_t ret);
 
 void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t meminfo);
 
+void qemu_plugin_vcpu_cap_mem_cb(CPUState *cpu, uint64_t vaddr,
+                                 uint64_t cursor, bool tag, bool is_store);
+void qemu_plugin_vcpu_cap_op_cb(CPUState *cpu, enum qemu_plugin_cap_op op);
+
 void qemu_plugin_flush_cb(void);
 
 void qemu_plugin_atexit_cb(void);
@@ -234,6 +241,15 @@ static inline void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
                                            uint32_t meminfo)
 { }
 
+static inline void qemu_plugin_vcpu_cap_mem_cb(CPUState *cpu, uint64_t vaddr,
+                                               uint64_t cursor, bool tag,
+                                               bool is_store)
+{ }
+
+static inline void qemu_plugin_vcpu_cap_op_cb(CPUState *cpu,
+                                              enum qemu_plugin_cap_op op)
+{ }
+
 static inline void qemu_plugin_flush_cb(void)
 { }
 
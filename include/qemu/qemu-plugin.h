@@ -52,7 +52,7 @@ typedef uint64_t qemu_plugin_id_t;
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 0
+#define QEMU_PLUGIN_VERSION 1
 
 typedef struct {
     /* string describing architecture */
@@ -370,6 +370,104 @@ void
 qemu_plugin_register_vcpu_syscall_ret_cb(qemu_plugin_id_t id,
                                          qemu_plugin_vcpu_syscall_ret_cb_t cb);
 
+/*
+ * CHERI capabilities
+ *
+ * On targets without CHERI support qemu_plugin_read_capreg() always fails
+ * and the capability callbacks are never invoked.
+ *
+ * Added in API version 1.
+ */
+
+/**
+ * struct qemu_plugin_cap - a decompressed capability
+ * @cursor: the address of the capability
+ * @base: the lower bound
+ * @top: the upper bound (exclusive), UINT64_MAX if the top is 2^64
+ * @perms: architectural and user permissions in the format of CGetPerm
+ * @otype: the object type, -1 if the capability is unsealed
+ * @tag: the validity tag
+ */
+struct qemu_plugin_cap {
+    uint64_t cursor;
+    uint64_t base;
+    uint64_t top;
+    uint64_t perms;
+    int64_t otype;
+    bool tag;
+};
+
+#define QEMU_PLUGIN_CAPREG_PCC (-1)
+#define QEMU_PLUGIN_CAPREG_DDC (-2)
+
+/**
+ * qemu_plugin_read_capreg() - read a capability register of the current vCPU
+ * @regnum: general purpose capability register number, or one of
+ *          QEMU_PLUGIN_CAPREG_PCC/QEMU_PLUGIN_CAPREG_DDC
+ * @cap: filled in with the register contents
+ *
+ * Can only be called from a callback running on a vCPU. The cursor of PCC is
+ * only up to date in callbacks registered with QEMU_PLUGIN_CB_R_REGS or
+ * QEMU_PLUGIN_CB_RW_REGS.
+ *
+ * Returns: true on success, false if @regnum is invalid or the target does
+ * not support capabilities.
+ */
+bool qemu_plugin_read_capreg(int regnum, struct qemu_plugin_cap *cap);
+
+/**
+ * typedef qemu_plugin_vcpu_cap_mem_cb_t - capability load/store callback
+ * @id: plugin ID
+ * @vcpu_index: the executing vCPU
+ * @vaddr: the virtual address of the access
+ * @cursor: the address field of the capability that was loaded or stored
+ * @tag: the tag bit that was read from or written to memory
+ * @is_store: true for stores, false for loads
+ *
+ * Called for every capability-sized access after the tag memory has been
+ * read or updated, i.e. once the access can no longer fault.
+ */
+typedef void
+(*qemu_plugin_vcpu_cap_mem_cb_t)(qemu_plugin_id_t id, unsigned int vcpu_index,
+                                 uint64_t vaddr, uint64_t cursor, bool tag,
+                                 bool is_store);
+
+void qemu_plugin_register_vcpu_cap_mem_cb(qemu_plugin_id_t id,
+                                          qemu_plugin_vcpu_cap_mem_cb_t cb);
+
+/*
+ * Capability operations that inline counters can be attached to.
+ */
+enum qemu_plugin_cap_op {
+    QEMU_PLUGIN_CAP_LOAD,
+    QEMU_PLUGIN_CAP_LOAD_TAGGED,
+    QEMU_PLUGIN_CAP_STORE,
+    QEMU_PLUGIN_CAP_STORE_TAGGED,
+    QEMU_PLUGIN_CAP_SETBOUNDS,
+    QEMU_PLUGIN_CAP_SEAL,
+    QEMU_PLUGIN_CAP_UNSEAL,
+    QEMU_PLUGIN_CAP_OP_MAX,
+};
+
+/**
+ * qemu_plugin_register_vcpu_cap_inline() - inline op on capability operations
+ * @id: plugin ID
+ * @cap_op: the capability operation to count
+ * @op: the type of qemu_plugin_op (e.g. ADD_U64)
+ * @ptr: the target memory location for the op
+ * @imm: the op data (e.g. 1)
+ *
+ * Perform @op on @ptr with @imm every time @cap_op is executed, without
+ * calling back into the plugin. As with the other inline ops, @ptr is
+ * shared between all vCPUs.
+ *
+ * Can only be called from qemu_plugin_install().
+ */
+void qemu_plugin_register_vcpu_cap_inline(qemu_plugin_id_t id,
+                                          enum qemu_plugin_cap_op cap_op,
+                                          enum qemu_plugin_op op, void *ptr,
+                                          uint64_t imm);
+
 
 /**
  * qemu_plugin_insn_disas() - return disassembly string for instruction
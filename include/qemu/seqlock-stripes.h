@@ -0,0 +1,58 @@
+/*
+ * Striped sequence locks
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A fixed, power of two sized array of sequence locks, each of which covers
+ * every object whose key maps to it. Writers hold the stripe's spinlock while
+ * updating an object, readers retry if a writer raced with them. Each stripe
+ * has its own cache line, so unrelated keys rarely share one.
+ */
+
+#ifndef QEMU_SEQLOCK_STRIPES_H
+#define QEMU_SEQLOCK_STRIPES_H
+
+#include "qemu/seqlock.h"
+#include "qemu/thread.h"
+
+typedef struct SeqLockStripe {
+    QemuSpin lock;
+    QemuSeqLock sequence;
+} QEMU_ALIGNED(64) SeqLockStripe;
+
+static inline void seqlock_stripes_init(SeqLockStripe *stripes, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        qemu_spin_init(&stripes[i].lock);
+        seqlock_init(&stripes[i].sequence);
+    }
+}
+
+static inline SeqLockStripe *seqlock_stripe(SeqLockStripe *stripes, size_t n,
+                                            uintptr_t key)
+{
+    return &stripes[key & (n - 1)];
+}
+
+static inline void seqlock_stripe_write_lock(SeqLockStripe *s)
+{
+    seqlock_write_lock(&s->sequence, &s->lock);
+}
+
+static inline void seqlock_stripe_write_unlock(SeqLockStripe *s)
+{
+    seqlock_write_unlock(&s->sequence, &s->lock);
+}
+
+static inline unsigned seqlock_stripe_read_begin(SeqLockStripe *s)
+{
+    return seqlock_read_begin(&s->sequence);
+}
+
+static inline bool seqlock_stripe_read_retry(SeqLockStripe *s, unsigned start)
+{
+    return seqlock_read_retry(&s->sequence, start);
+}
+
+#endif
@@ -9,6 +9,8 @@
 #define SYSEMU_TCG_H
 
 void tcg_exec_init(unsigned long tb_size, int splitwx);
+/* Write the persistent TB cache, once the vCPUs have been stopped */
+void tb_cache_save(void);
 
 #ifdef CONFIG_TCG
 extern bool tcg_allowed;
@@ -609,6 +609,8 @@ typedef struct TCGProfile {
     int temp_count_max;
     int64_t temp_count;
     int64_t del_op_count;
+    int64_t gvn_op_count; /* ops replaced by tcg_optimize_gvn() */
+    int64_t insn_count; /* guest instructions translated */
     int64_t code_in_len;
     int64_t code_out_len;
     int64_t search_out_len;
@@ -638,6 +640,7 @@ struct TCGContext {
 
     TCGRegSet reserved_regs;
     uint32_t tb_cflags; /* cflags of the current TB */
+    bool tb_heap_ptrs; /* the current TB embeds pointers to the heap */
     intptr_t current_frame_offset;
     intptr_t frame_start;
     intptr_t frame_end;
@@ -914,6 +917,11 @@ TranslationBlock *tcg_tb_alloc(TCGContext *s);
 void tcg_region_init(void);
 void tb_destroy(TranslationBlock *tb);
 void tcg_region_reset_all(void);
+void tcg_region_claim(size_t n, void *end);
+size_t tcg_region_get_bounds(size_t i, void **pstart, void **pend);
+void tcg_region_foreach_used(void (*fn)(size_t i, void *start, void *end,
+                                        void *opaque),
+                             void *opaque);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
@@ -1121,6 +1129,10 @@ TCGOp *tcg_op_insert_before(TCGContext *s, TCGOp *op, TCGOpcode opc);
 TCGOp *tcg_op_insert_after(TCGContext *s, TCGOp *op, TCGOpcode opc);
 
 void tcg_optimize(TCGContext *s);
+/* Set by -accel tcg,gvn=on */
+extern bool tcg_gvn_enabled;
+void tcg_optimize_gvn(TCGContext *s);
+void tcg_optimize_env_stores(TCGContext *s);
 
 TCGv_i32 tcg_const_i32(int32_t val);
 TCGv_i64 tcg_const_i64(int64_t val);
@@ -1139,6 +1151,17 @@ TCGv_vec tcg_const_ones_vec_matching(TCGv_vec);
 # define tcg_const_local_ptr(x)  ((TCGv_ptr)tcg_const_local_i64((intptr_t)(x)))
 #endif
 
+/*
+ * A constant pointer to memory that is not part of the QEMU executable,
+ * e.g. allocated at startup. Such TBs are not kept by the TB cache, the
+ * pointer would not be valid in another run.
+ */
+static inline TCGv_ptr tcg_const_heap_ptr(const void *p)
+{
+    tcg_ctx->tb_heap_ptrs = true;
+    return tcg_const_ptr(p);
+}
+
 TCGLabel *gen_new_label(void);
 
 /**
@@ -2372,6 +2372,15 @@ bool migrate_validate_uuid(void)
     return s->enabled_capabilities[MIGRATION_CAPABILITY_VALIDATE_UUID];
 }
 
+bool migrate_cheri_tags(void)
+{
+    MigrationState *s;
+
+    s = migrate_get_current();
+
+    return s->enabled_capabilities[MIGRATION_CAPABILITY_CHERI_TAGS];
+}
+
 bool migrate_use_events(void)
 {
     MigrationState *s;
@@ -3783,6 +3792,7 @@ static Property migration_properties[] = {
     DEFINE_PROP_MIG_CAP("x-block", MIGRATION_CAPABILITY_BLOCK),
     DEFINE_PROP_MIG_CAP("x-return-path", MIGRATION_CAPABILITY_RETURN_PATH),
     DEFINE_PROP_MIG_CAP("x-multifd", MIGRATION_CAPABILITY_MULTIFD),
+    DEFINE_PROP_MIG_CAP("x-cheri-tags", MIGRATION_CAPABILITY_CHERI_TAGS),
 
     DEFINE_PROP_END_OF_LIST(),
 };
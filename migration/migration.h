@@ -314,6 +314,7 @@ bool migrate_zero_blocks(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_ignore_shared(void);
 bool migrate_validate_uuid(void);
+bool migrate_cheri_tags(void);
 
 bool migrate_auto_converge(void);
 bool migrate_use_multifd(void);
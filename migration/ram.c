@@ -56,6 +56,9 @@
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#ifdef TARGET_CHERI
+#include "target/cheri-common/cheri_tagmem.h"
+#endif
 
 /***********************************************************/
 /* ram save/restore */
@@ -75,6 +78,8 @@
 #define RAM_SAVE_FLAG_XBZRLE   0x40
 /* 0x80 is reserved in migration.h start with 0x100 next */
 #define RAM_SAVE_FLAG_COMPRESS_PAGE    0x100
+/* CHERI tags of a page, sent before the page data (see save_cheri_tags) */
+#define RAM_SAVE_FLAG_CHERI_TAGS       0x200
 
 static inline bool is_zero_range(uint8_t *p, uint64_t size)
 {
@@ -1639,6 +1644,60 @@ static bool save_compress_page(RAMState *rs, RAMBlock *block, ram_addr_t offset)
     return false;
 }
 
+#ifdef TARGET_CHERI
+/**
+ * save_cheri_tags: send the CHERI tags of a page
+ *
+ * With the cheri-tags capability, pages that hold tags are preceded by
+ * their tags so that the destination never sees stale tags, no matter how
+ * (or on which channel) the page data is sent. Tags only change together
+ * with a write to the page, so the RAM dirty bitmap also tracks tag
+ * changes. Sending them ahead of the data means that in postcopy they are
+ * in place before the page is.
+ *
+ * The destination starts without any tags, so untagged pages are only
+ * sent a (one byte) record if their last record had tags, to clear them.
+ *
+ * @rs: current RAM state
+ * @block: block that contains the page we want to send
+ * @offset: offset inside the block for the page
+ */
+static void save_cheri_tags(RAMState *rs, RAMBlock *block, ram_addr_t offset)
+{
+    unsigned long tags[BITS_TO_LONGS(TARGET_PAGE_SIZE / CHERI_CAP_SIZE)];
+    size_t nbits = TARGET_PAGE_SIZE / CHERI_CAP_SIZE;
+    unsigned long page = offset >> TARGET_PAGE_BITS;
+    bool tagged;
+    size_t len;
+
+    if (!block->cheri_tags_sent) {
+        return;
+    }
+    tagged = cheri_tag_save_page(block, offset, tags);
+    if (!tagged && !test_bit(page, block->cheri_tags_sent)) {
+        return;
+    }
+    /* Compressed pages still queued refer to the last block sent. */
+    if (block != rs->last_sent_block && save_page_use_compression(rs)) {
+        flush_compressed_data(rs);
+    }
+    len = save_page_header(rs, rs->f, block,
+                           offset | RAM_SAVE_FLAG_CHERI_TAGS);
+    if (!tagged) {
+        clear_bit(page, block->cheri_tags_sent);
+        qemu_put_byte(rs->f, 0);
+        len += 1;
+    } else {
+        set_bit(page, block->cheri_tags_sent);
+        bitmap_to_le(tags, tags, nbits);
+        qemu_put_byte(rs->f, 1);
+        qemu_put_buffer(rs->f, (uint8_t *)tags, DIV_ROUND_UP(nbits, 8));
+        len += 1 + DIV_ROUND_UP(nbits, 8);
+    }
+    ram_counters.transferred += len;
+}
+#endif
+
 /**
  * ram_save_target_page: save one target page
  *
@@ -1655,6 +1714,10 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
     int res;
 
+#ifdef TARGET_CHERI
+    save_cheri_tags(rs, block, offset);
+#endif
+
     if (control_save_page(rs, block, offset, &res)) {
         return res;
     }
@@ -1890,6 +1953,8 @@ static void ram_save_cleanup(void *opaque)
         block->clear_bmap = NULL;
         g_free(block->bmap);
         block->bmap = NULL;
+        g_free(block->cheri_tags_sent);
+        block->cheri_tags_sent = NULL;
     }
 
     xbzrle_cleanup();
@@ -2331,6 +2396,9 @@ static void ram_list_init_bitmaps(void)
             bitmap_set(block->bmap, 0, pages);
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
+            if (block->cheri_tags && migrate_cheri_tags()) {
+                block->cheri_tags_sent = bitmap_new(pages);
+            }
         }
     }
 }
@@ -2783,6 +2851,86 @@ static inline void *host_from_ram_block_offset(RAMBlock *block,
     return block->host + offset;
 }
 
+#ifdef TARGET_CHERI
+/*
+ * load_cheri_tags: load the tags sent by save_cheri_tags()
+ *
+ * Returns 0 for success or -EINVAL for a bad stream.
+ */
+static int load_cheri_tags(QEMUFile *f, ram_addr_t addr, int flags)
+{
+    unsigned long tags[BITS_TO_LONGS(TARGET_PAGE_SIZE / CHERI_CAP_SIZE)];
+    size_t nbits = TARGET_PAGE_SIZE / CHERI_CAP_SIZE;
+    RAMBlock *block = ram_block_from_stream(f, flags);
+    uint8_t ch;
+
+    if (!block || !offset_in_ramblock(block, addr)) {
+        error_report("Illegal RAM offset " RAM_ADDR_FMT " for CHERI tags",
+                     addr);
+        return -EINVAL;
+    }
+    if (!block->cheri_tags) {
+        error_report("RAM block %s has no CHERI tag memory", block->idstr);
+        return -EINVAL;
+    }
+    ch = qemu_get_byte(f);
+    if (ch == 0) {
+        memset(tags, 0, sizeof(tags));
+    } else if (ch == 1) {
+        memset(tags, 0, sizeof(tags));
+        qemu_get_buffer(f, (uint8_t *)tags, DIV_ROUND_UP(nbits, 8));
+        bitmap_from_le(tags, tags, nbits);
+    } else {
+        error_report("Invalid CHERI tag encoding: %d", ch);
+        return -EINVAL;
+    }
+    cheri_tag_load_page(block, addr, tags);
+    return 0;
+}
+
+/*
+ * Drop all tags before loading, the stream only contains tags for the
+ * pages it sends (e.g. loadvm on a running guest).
+ */
+static void cheri_tags_load_setup(void)
+{
+    unsigned long zero[BITS_TO_LONGS(TARGET_PAGE_SIZE / CHERI_CAP_SIZE)];
+    RAMBlock *rb;
+
+    memset(zero, 0, sizeof(zero));
+
+    RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
+        if (!rb->cheri_tags) {
+            continue;
+        }
+        ram_addr_t len = rb->used_length;
+        for (ram_addr_t off = cheri_tag_find_next(rb, 0, len); off < len;
+             off = cheri_tag_find_next(rb, off, len)) {
+            off = QEMU_ALIGN_DOWN(off, TARGET_PAGE_SIZE);
+            cheri_tag_load_page(rb, off, zero);
+            off += TARGET_PAGE_SIZE;
+        }
+    }
+}
+
+/* Whether cheri_tags_pin_all() pinned the tag blocks for postcopy */
+static bool cheri_tags_pinned;
+
+static void cheri_tags_pin_all(bool pin)
+{
+    RAMBlock *rb;
+
+    if (cheri_tags_pinned == pin) {
+        return;
+    }
+    RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
+        cheri_tag_pin(rb, pin);
+    }
+    cheri_tags_pinned = pin;
+    cheri_tag_load_done();
+}
+#endif
+
 static inline void *colo_cache_from_block_offset(RAMBlock *block,
                              ram_addr_t offset, bool record_bitmap)
 {
@@ -3130,6 +3278,9 @@ static int ram_load_setup(QEMUFile *f, void *opaque)
 
     xbzrle_load_setup();
     ramblock_recv_map_init();
+#ifdef TARGET_CHERI
+    cheri_tags_load_setup();
+#endif
 
     return 0;
 }
@@ -3149,6 +3300,10 @@ static int ram_load_cleanup(void *opaque)
         g_free(rb->receivedmap);
         rb->receivedmap = NULL;
     }
+#ifdef TARGET_CHERI
+    cheri_tag_load_done();
+    cheri_tags_pin_all(false);
+#endif
 
     return 0;
 }
@@ -3166,6 +3321,13 @@ static int ram_load_cleanup(void *opaque)
  */
 int ram_postcopy_incoming_init(MigrationIncomingState *mis)
 {
+#ifdef TARGET_CHERI
+    /*
+     * Tags are loaded while vCPUs run, so no TLB entry may have cached a
+     * missing tag block that is allocated later on.
+     */
+    cheri_tags_pin_all(true);
+#endif
     return postcopy_ram_incoming_init(mis);
 }
 
@@ -3311,6 +3473,11 @@ static int ram_load_postcopy(QEMUFile *f)
             /* normal exit */
             multifd_recv_sync_main();
             break;
+#ifdef TARGET_CHERI
+        case RAM_SAVE_FLAG_CHERI_TAGS:
+            ret = load_cheri_tags(f, addr, flags);
+            break;
+#endif
         default:
             error_report("Unknown combination of migration flags: 0x%x"
                          " (postcopy mode)", flags);
@@ -3586,6 +3753,11 @@ static int ram_load_precopy(QEMUFile *f)
             /* normal exit */
             multifd_recv_sync_main();
             break;
+#ifdef TARGET_CHERI
+        case RAM_SAVE_FLAG_CHERI_TAGS:
+            ret = load_cheri_tags(f, addr, flags);
+            break;
+#endif
         default:
             if (flags & RAM_SAVE_FLAG_HOOK) {
                 ram_control_load_hook(f, RAM_CONTROL_HOOK, NULL);
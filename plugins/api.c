@@ -42,6 +42,9 @@
 #include "exec/exec-all.h"
 #include "disas/disas.h"
 #include "plugin.h"
+#ifdef TARGET_CHERI
+#include "cheri-lazy-capregs.h"
+#endif
 #ifndef CONFIG_USER_ONLY
 #include "qemu/plugin-memory.h"
 #include "hw/boards.h"
@@ -245,6 +248,42 @@ bool qemu_plugin_mem_is_store(qemu_plugin_meminfo_t info)
     return !!(info & TRACE_MEM_ST);
 }
 
+/*
+ * Capability register queries
+ */
+
+bool qemu_plugin_read_capreg(int regnum, struct qemu_plugin_cap *cap)
+{
+#ifdef TARGET_CHERI
+    CPUState *cpu = current_cpu;
+    CPUArchState *env;
+    const cap_register_t *c;
+
+    if (cpu == NULL) {
+        return false;
+    }
+    env = cpu->env_ptr;
+    if (regnum == QEMU_PLUGIN_CAPREG_PCC) {
+        c = cheri_get_recent_pcc(env);
+    } else if (regnum == QEMU_PLUGIN_CAPREG_DDC) {
+        c = cheri_get_ddc(env);
+    } else if (regnum >= 0 && regnum < NUM_LAZY_CAP_REGS) {
+        c = get_readonly_capreg(env, regnum);
+    } else {
+        return false;
+    }
+    cap->cursor = cap_get_cursor(c);
+    cap->base = cap_get_base(c);
+    cap->top = cap_get_top(c);
+    cap->perms = COMBINED_PERMS_VALUE(c);
+    cap->otype = cap_is_unsealed(c) ? -1 : cap_get_otype_unsigned(c);
+    cap->tag = c->cr_tag;
+    return true;
+#else
+    return false;
+#endif
+}
+
 /*
  * Virtual Memory queries
  */
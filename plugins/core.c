@@ -458,6 +458,92 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr, uint32_t info)
     }
 }
 
+void qemu_plugin_vcpu_cap_mem_cb(CPUState *cpu, uint64_t vaddr,
+                                 uint64_t cursor, bool tag, bool is_store)
+{
+    struct qemu_plugin_cb *cb, *next;
+    enum qemu_plugin_event ev = QEMU_PLUGIN_EV_VCPU_CAP_MEM;
+
+    if (!test_bit(ev, cpu->plugin_mask)) {
+        return;
+    }
+
+    QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[ev], entry, next) {
+        qemu_plugin_vcpu_cap_mem_cb_t func = cb->f.vcpu_cap_mem;
+
+        func(cb->ctx->id, cpu->cpu_index, vaddr, cursor, tag, is_store);
+    }
+}
+
+void qemu_plugin_vcpu_cap_op_cb(CPUState *cpu, enum qemu_plugin_cap_op op)
+{
+    struct qemu_plugin_cb *cb, *next;
+    enum qemu_plugin_event ev = QEMU_PLUGIN_EV_VCPU_CAP_INLINE;
+
+    if (!test_bit(ev, cpu->plugin_mask)) {
+        return;
+    }
+
+    QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[ev], entry, next) {
+        GArray *arr = cb->ctx->cap_inline[op];
+        size_t i;
+
+        if (arr == NULL) {
+            continue;
+        }
+        for (i = 0; i < arr->len; i++) {
+            exec_inline_op(&g_array_index(arr, struct qemu_plugin_dyn_cb, i));
+        }
+    }
+}
+
+void qemu_plugin_register_vcpu_cap_mem_cb(qemu_plugin_id_t id,
+                                          qemu_plugin_vcpu_cap_mem_cb_t cb)
+{
+    plugin_register_cb(id, QEMU_PLUGIN_EV_VCPU_CAP_MEM, cb);
+}
+
+/* Dummy callback, only used to gate qemu_plugin_vcpu_cap_op_cb() */
+static void plugin_cap_inline_enable(void)
+{
+}
+
+void qemu_plugin_register_vcpu_cap_inline(qemu_plugin_id_t id,
+                                          enum qemu_plugin_cap_op cap_op,
+                                          enum qemu_plugin_op op, void *ptr,
+                                          uint64_t imm)
+{
+    struct qemu_plugin_ctx *ctx;
+
+    g_assert(cap_op < QEMU_PLUGIN_CAP_OP_MAX);
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    ctx = plugin_id_to_ctx_locked(id);
+    /* vCPUs walk the arrays without locking, so only allow this at install */
+    if (!ctx->installing) {
+        error_report("%s: capability inline ops can only be registered "
+                     "from qemu_plugin_install", __func__);
+        return;
+    }
+    plugin_register_inline_op(&ctx->cap_inline[cap_op], QEMU_PLUGIN_MEM_RW,
+                              op, ptr, imm);
+    plugin_register_cb(id, QEMU_PLUGIN_EV_VCPU_CAP_INLINE,
+                       plugin_cap_inline_enable);
+}
+
+/* Must be called once the callbacks of @ctx have been unregistered. */
+void plugin_free_cap_inline__locked(struct qemu_plugin_ctx *ctx)
+{
+    int i;
+
+    for (i = 0; i < QEMU_PLUGIN_CAP_OP_MAX; i++) {
+        if (ctx->cap_inline[i]) {
+            g_array_free(ctx->cap_inline[i], true);
+            ctx->cap_inline[i] = NULL;
+        }
+    }
+}
+
 void qemu_plugin_atexit_cb(void)
 {
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
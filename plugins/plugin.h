@@ -56,6 +56,12 @@ struct qemu_plugin_ctx {
      * to strdup plugin args.
      */
     struct qemu_plugin_desc *desc;
+    /*
+     * Inline ops attached to capability operations, one array of
+     * struct qemu_plugin_dyn_cb per enum qemu_plugin_cap_op. Only modified
+     * during install and in exclusive context, so vCPUs can read it freely.
+     */
+    GArray *cap_inline[QEMU_PLUGIN_CAP_OP_MAX];
     bool installing;
     bool uninstalling;
     bool resetting;
@@ -68,6 +74,8 @@ void plugin_register_inline_op(GArray **arr,
                                enum qemu_plugin_op op, void *ptr,
                                uint64_t imm);
 
+void plugin_free_cap_inline__locked(struct qemu_plugin_ctx *ctx);
+
 void plugin_reset_uninstall(qemu_plugin_id_t id,
                             qemu_plugin_simple_cb_t cb,
                             bool reset);
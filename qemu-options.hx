@@ -117,6 +117,10 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tb-cache=file (keep TCG translations in file across runs)\n"
+    "                prefetch=on|off (translate predicted TBs on idle vCPUs)\n"
+    "                gvn=on|off (value numbering and env load/store elimination)\n"
+    "                hot-threshold=n (retranslate TBs sampled n times with gvn)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
@@ -150,6 +154,47 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``prefetch=on|off``
+        With ``thread=multi``, queue the direct branch targets of every
+        translated block, and have vCPU threads whose vCPU is halted
+        translate them before going to sleep, so that the running vCPUs
+        find them already translated. A queued block is only translated
+        if the idle vCPU is in the same mode and already has the code
+        mapped in its TLB. ``info jit`` shows how many of the blocks
+        translated ahead of time were used. The default is off.
+
+    ``gvn=on|off``
+        Run a value numbering pass over every translation block, which
+        replaces recomputed values and reloads of CPU state fields with
+        copies of a temporary that still holds them, followed by a pass
+        that removes stores to CPU state fields overwritten later in the
+        same block. It makes translation slower in exchange for fewer
+        host instructions; the number of replaced ops is shown by
+        ``info jit`` in builds with the TCG profiler. The default is off.
+
+    ``hot-threshold=n``
+        Retranslate hot translation blocks with the passes of
+        ``gvn=on``. Every millisecond of guest time each vCPU leaves the
+        generated code once, and the block it runs next is sampled. A
+        block sampled ``n`` times is translated again, so only the code
+        the guest spends its time in pays for the slower translation.
+        ``info jit`` shows the number of samples and retranslations. The
+        default is 0, which disables sampling.
+
+    ``tb-cache=file``
+        Keep the translated code in ``file`` across runs. At exit the
+        translation blocks generated since the last flush are written to
+        ``file``; the next run maps them back and uses a cached block
+        instead of translating it again if the guest code it was
+        translated from is unchanged. Hits and misses are shown by
+        ``info jit``. Translated code is not relocatable, so the cache is
+        only used by the same QEMU executable with the same machine, CPU
+        and ``-smp`` configuration, and only when QEMU is loaded at the
+        same address, i.e. with a non-PIE build or with address space
+        randomization disabled (``setarch -R``). Only use cache files
+        written by a trusted QEMU, they contain host code. The cache is
+        only supported for Arm AArch64 and Morello targets.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefor taking advantage of
@@ -4117,10 +4162,58 @@ SRST
 ERST
 
 DEF("cheri-trace-format", HAS_ARG, QEMU_OPTION_cheri_trace_format, \
-"-cheri-trace-format [text|cvtrace]     Select CHERI trace mode.\n", QEMU_ARCH_ALL)
+"-cheri-trace-format [text|cvtrace|binary|perfetto]     Select CHERI trace mode.\n", QEMU_ARCH_ALL)
 SRST
 ``-cheri-trace-format type``
-    Set CHERI trace format to <type> (text or cvtrace)
+    Set CHERI trace format to <type> (text, cvtrace, binary or perfetto).
+    The binary format is a compact, zstd-compressed encoding written by a
+    background thread; decode it with ``scripts/qemu-btrace-decode.py``.
+    The perfetto format is a protobuf trace with one track per CPU that can
+    be opened directly in the Perfetto UI (https://ui.perfetto.dev).
+ERST
+
+DEF("cheri-profile", HAS_ARG, QEMU_OPTION_cheri_profile, \
+    "-cheri-profile [file=]path[,format=folded|perf][,period=us|insns=n][,ring=n]\n"
+    "                sample guest PCs and write a profile to path\n", QEMU_ARCH_ALL)
+SRST
+``-cheri-profile [file=]path[,format=folded|perf][,period=us|insns=n][,ring=n]``
+    Periodically sample the PC, ASID, privilege mode and (on CHERI targets)
+    the PCC bounds of every CPU and write the result to ``path``. This is
+    much cheaper than instruction tracing and is meant for profiling long
+    running workloads.
+
+    By default a sample is taken every ``period`` microseconds (1000) of
+    host time. With ``-icount``, ``insns`` takes a sample every ``n``
+    guest instructions instead. Each CPU buffers up to ``ring`` samples
+    (4096, rounded up to a power of two); they are written out from the
+    main loop at every sampling tick. Samples taken while a CPU's buffer is
+    full are dropped and counted in a warning at shutdown.
+
+    ``folded`` (the default) writes one line per distinct stack with its
+    sample count at shutdown, which can be passed to ``flamegraph.pl``
+    directly. ``perf`` writes every sample in ``perf script`` format,
+    suitable for ``stackcollapse-perf.pl`` and other perf tooling.
+ERST
+
+DEF("cheri-trace-trigger", HAS_ARG, QEMU_OPTION_cheri_trace_trigger, \
+    "-cheri-trace-trigger [asid=n][,start=addr][,end=addr][,mode=user|kernel|any]\n"
+    "                only trace while a trigger rule matches\n", QEMU_ARCH_ALL)
+SRST
+``-cheri-trace-trigger [asid=n][,start=addr][,end=addr][,mode=user|kernel|any]``
+    Restrict instruction tracing to the CPUs and code matching a rule. A
+    rule matches while the CPU runs with address space ``asid``, executes
+    code in ``[start, end)`` and is in the given privilege ``mode``; any
+    constraint that is left out always matches. The option can be given
+    up to 16 times, tracing is active while any rule matches. Use it
+    together with ``-d instr`` (or ``-d instr,uinstr``) or start tracing
+    from the guest or the monitor as usual.
+
+    With trigger rules, every translation block carries the tracing
+    instrumentation and checks at run time whether tracing is active on
+    its CPU. Starting and stopping tracing, from triggers, the guest or
+    the monitor, then never flushes the translation cache or stops the
+    other CPUs. A rule without constraints is useful to get this
+    behaviour for guest-controlled tracing.
 ERST
 
 DEF("cheri-c2e-on-unrepresentable", 0, QEMU_OPTION_cheri_c2e_on_unrepresentable, \
@@ -4144,6 +4237,27 @@ SRST
     Generate debugger exception when a capability fault is taken.
 ERST
 
+DEF("cheri-tagmem", HAS_ARG, QEMU_OPTION_cheri_tagmem, \
+    "-cheri-tagmem [backend=]sparse|flat|indexed[,blocksize=n]\n"
+    "                select the CHERI tag memory representation\n", QEMU_ARCH_ALL)
+SRST
+``-cheri-tagmem [backend=]sparse|flat|indexed[,blocksize=n]``
+    Select how CHERI tags are stored.
+
+    ``sparse`` (the default) allocates bitmaps of ``blocksize`` tags (4096
+    by default) on demand and frees them again once they no longer contain
+    any tags. Smaller blocks use less memory for sparsely tagged guests,
+    larger blocks mean fewer TLB flushes when new blocks are allocated.
+
+    ``flat`` reserves one bitmap per RAM block up front and lets the host
+    kernel populate it on demand. It never flushes the TLB for tag memory
+    but memory that was tagged once stays resident.
+
+    ``indexed`` is like ``flat`` but also keeps an index of the non-zero
+    parts of the bitmap, which makes scanning for tags faster at the cost
+    of an extra atomic update when a group of tags is first set.
+ERST
+
 #ifdef CONFIG_RVFI_DII
 DEF("rvfi-dii-port", HAS_ARG, QEMU_OPTION_rvfi_dii_port, \
     "-rvfi-dii-port <port>     Run QEMU in RVFI-DII mode, listing on <port>\n", QEMU_ARCH_RISCV)
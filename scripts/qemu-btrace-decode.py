@@ -0,0 +1,211 @@
+#!/usr/bin/env python3
+#
+# Decode instruction traces written with -cheri-trace-format binary.
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# The trace consists of a header followed by frames of per-CPU records, see
+# the description of the binary trace format in accel/tcg/log_instr.c.
+# Every frame can be decoded on its own, so frames() can be used to split
+# the work of post-processing a trace.
+#
+# Record layout (varint = unsigned LEB128, svarint = zigzag LEB128):
+#   NAME:  0x04 id:varint len:varint name
+#   START: 0x02 loglevel:u8 pc:varint
+#   STOP:  0x03 loglevel:u8 pc:varint
+#   INSN:  0x01 flags:u8 pc-delta:svarint insn-len:varint insn-bytes
+#          [asid:varint]                          if flags & ASID
+#          [code:varint vector:varint]            if flags & (TRAP | INTR)
+#          [fault-addr:varint]                    if flags & TRAP
+#          [mode:u8]                              if flags & MODE
+#          nregs:varint (name-id:varint rflags:u8 (cap | value:varint))*
+#                                 a cap follows iff rflags & HOLDS
+#          nmem:varint (mflags:u8 size:u8 addr-delta:svarint
+#                       (cap | value:varint))*
+#          [len:varint text]                      if flags & TEXT
+#   cap:   bits:u8 (tag, sealed) cursor:varint base-delta:svarint
+#          length:varint perms:varint otype:svarint pesbt:varint
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"QEMUBTRC"
+HDR_ZSTD = 1
+
+BTR_INSN, BTR_START, BTR_STOP, BTR_NAME = 1, 2, 3, 4
+F_ASID, F_TRAP, F_INTR, F_MODE, F_TEXT = 1, 2, 4, 8, 16
+R_CAP, R_HOLDS = 1, 2
+M_LD, M_ST, M_CAP = 1, 2, 4
+
+MODE_NAMES = ["User", "Supervisor", "Hypervisor", "Debug",
+              "Target1", "Target2", "Target3", "Target4"]
+
+
+class Header:
+    def __init__(self, f):
+        magic = f.read(len(MAGIC))
+        if magic != MAGIC:
+            raise ValueError("not a QEMU binary trace")
+        (self.version, self.flags, self.long_bits, self.cap_size,
+         name_len) = struct.unpack("<5B", f.read(5))
+        self.target = f.read(name_len).decode()
+        if self.version != 1:
+            raise ValueError("unsupported trace version %d" % self.version)
+        self.mask = (1 << self.long_bits) - 1
+
+
+def frames(f, header):
+    """Yield (cpu, raw payload) for each frame of the trace."""
+    decompress = None
+    if header.flags & HDR_ZSTD:
+        try:
+            import zstandard
+        except ImportError:
+            sys.exit("trace is zstd compressed, please install python3-zstandard")
+        dctx = zstandard.ZstdDecompressor()
+        decompress = dctx.decompress
+    while True:
+        hdr = f.read(12)
+        if len(hdr) < 12:
+            return
+        cpu, raw_len, stored_len = struct.unpack("<3I", hdr)
+        data = f.read(stored_len)
+        if decompress:
+            data = decompress(data, max_output_size=raw_len)
+        yield cpu, data
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def done(self):
+        return self.pos >= len(self.data)
+
+    def u8(self):
+        v = self.data[self.pos]
+        self.pos += 1
+        return v
+
+    def varint(self):
+        result, shift = 0, 0
+        while True:
+            b = self.u8()
+            result |= (b & 0x7f) << shift
+            if b < 0x80:
+                return result
+            shift += 7
+
+    def svarint(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+    def bytes(self):
+        n = self.varint()
+        v = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return v
+
+
+def read_cap(r, mask):
+    bits = r.u8()
+    cursor = r.varint()
+    return {
+        "tag": bits & 1,
+        "sealed": bool(bits & 2),
+        "cursor": cursor,
+        "base": (cursor + r.svarint()) & mask,
+        "length": r.varint(),
+        "perms": r.varint(),
+        "otype": r.svarint(),
+        "pesbt": r.varint(),
+    }
+
+
+def format_cap(c):
+    return ("v:%d s:%d p:%08x otype:%d b:%016x l:%016x cursor:%016x" %
+            (c["tag"], c["sealed"], c["perms"], c["otype"], c["base"],
+             c["length"], c["cursor"]))
+
+
+def decode_frame(cpu, data, header):
+    """Yield text lines for one frame."""
+    mask = header.mask
+    r = Reader(data)
+    names = {}
+    pc = addr = asid = 0
+    while not r.done():
+        kind = r.u8()
+        if kind == BTR_NAME:
+            ident = r.varint()
+            names[ident] = r.bytes().decode()
+        elif kind in (BTR_START, BTR_STOP):
+            level = r.u8()
+            where = r.varint()
+            what = "Requested" if kind == BTR_START else "Disabled"
+            user = " user-mode only" if level == 2 else ""
+            yield "[%d:%d] %s%s instruction logging @ %016x" % (
+                cpu, asid, what, user, where)
+        elif kind == BTR_INSN:
+            flags = r.u8()
+            pc = (pc + r.svarint()) & mask
+            insn = r.bytes()
+            if flags & F_ASID:
+                asid = r.varint()
+            yield "[%d:%d] %016x: %s" % (cpu, asid, pc, insn.hex())
+            if flags & (F_TRAP | F_INTR):
+                code, vector = r.varint(), r.varint()
+                if flags & F_TRAP:
+                    yield "-> Exception #%u vector 0x%x fault-addr 0x%x" % (
+                        code, vector, r.varint())
+                else:
+                    yield "-> Interrupt #%04x vector 0x%x" % (code, vector)
+            if flags & F_MODE:
+                yield "-> Switch to %s mode" % MODE_NAMES[r.u8()]
+            for _ in range(r.varint()):
+                name = names[r.varint()]
+                rflags = r.u8()
+                if rflags & R_HOLDS:
+                    yield "    Write %s|%s" % (name,
+                                              format_cap(read_cap(r, mask)))
+                else:
+                    yield "    Write %s = %016x" % (name, r.varint())
+            for _ in range(r.varint()):
+                mflags, size = r.u8(), r.u8()
+                addr = (addr + r.svarint()) & mask
+                direction = "Read" if mflags & M_LD else "Write"
+                if mflags & M_CAP:
+                    yield "    Cap Memory %s [%016x] = %s" % (
+                        direction, addr, format_cap(read_cap(r, mask)))
+                else:
+                    yield "    Memory %s [%016x] = %0*x" % (
+                        direction, addr, 2 * size, r.varint())
+            if flags & F_TEXT:
+                yield r.bytes().decode(errors="replace").rstrip("\n")
+        else:
+            raise ValueError("bad record type %d in frame of cpu %d" %
+                             (kind, cpu))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Decode a QEMU binary instruction trace.")
+    parser.add_argument("trace", type=argparse.FileType("rb"),
+                        help="binary trace file (the -D log file)")
+    parser.add_argument("--cpu", type=int, default=None,
+                        help="only decode the given CPU index")
+    args = parser.parse_args()
+
+    header = Header(args.trace)
+    out = sys.stdout
+    for cpu, data in frames(args.trace, header):
+        if args.cpu is not None and cpu != args.cpu:
+            continue
+        for line in decode_frame(cpu, data, header):
+            out.write(line + "\n")
+
+
+if __name__ == "__main__":
+    main()
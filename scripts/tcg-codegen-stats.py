@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+#
+# Count guest and host instructions in QEMU -d in_asm,out_asm logs.
+#
+# SPDX-License-Identifier: BSD-2-Clause
+#
+# Every translated block is logged as an "IN:" section with one line per
+# guest instruction and an "OUT:" section with one line per host
+# instruction, followed by an optional "data:" part holding constants.
+# The counts are static: each TB counts once however often it runs.
+#
+# Without --base, prints the host instructions per guest instruction of
+# each log and of all logs together. With --base, the logs are compared
+# pairwise against the base logs, e.g. runs with -accel tcg,gvn=off
+# (base) against runs with -accel tcg,gvn=on:
+#
+#   tcg-codegen-stats.py --base a.off.log b.off.log -- a.on.log b.on.log
+
+import argparse
+import os
+import re
+import sys
+
+INSN_RE = re.compile(r"^0x[0-9a-fA-F]+:")
+
+
+class Stats:
+    def __init__(self):
+        self.tbs = 0
+        self.guest = 0
+        self.host = 0
+
+    def add(self, other):
+        self.tbs += other.tbs
+        self.guest += other.guest
+        self.host += other.host
+
+    def ratio(self):
+        return self.host / self.guest if self.guest else 0.0
+
+
+def parse_log(path):
+    stats = Stats()
+    section = None
+    with open(path, errors="replace") as f:
+        for line in f:
+            if line.startswith("IN:"):
+                section = "in"
+                stats.tbs += 1
+            elif line.startswith("OUT:"):
+                section = "out"
+            elif not line.strip():
+                section = None
+            elif section == "out" and line.lstrip().startswith("data:"):
+                section = None
+            elif INSN_RE.match(line):
+                if section == "in":
+                    stats.guest += 1
+                elif section == "out":
+                    stats.host += 1
+    return stats
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Host instructions per guest instruction in QEMU logs")
+    parser.add_argument("--base", nargs="+", default=[],
+                        help="logs to compare against, one per log")
+    parser.add_argument("logs", nargs="+", help="-d in_asm,out_asm logs")
+    args = parser.parse_args()
+
+    if args.base and len(args.base) != len(args.logs):
+        parser.error("--base needs as many logs as are compared")
+
+    total, base_total = Stats(), Stats()
+    for i, log in enumerate(args.logs):
+        stats = parse_log(log)
+        total.add(stats)
+        name = os.path.basename(log)
+        line = "%-32s %6d TBs %8d guest %9d host %6.2f host/guest" % (
+            name, stats.tbs, stats.guest, stats.host, stats.ratio())
+        if args.base:
+            base = parse_log(args.base[i])
+            base_total.add(base)
+            line += " (base %6.2f)" % base.ratio()
+        print(line)
+
+    line = "%-32s %6d TBs %8d guest %9d host %6.2f host/guest" % (
+        "total", total.tbs, total.guest, total.host, total.ratio())
+    if args.base:
+        change = (total.ratio() / base_total.ratio() - 1) * 100 \
+            if base_total.ratio() else 0.0
+        line += " (base %6.2f, %+.1f%%)" % (base_total.ratio(), change)
+    print(line)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -172,6 +172,7 @@ static const char *qtest_log;
 
 #ifdef TARGET_CHERI
 #include "target/cheri-common/cheri_defs.h"
+#include "target/cheri-common/cheri_tagmem.h"
 bool cheri_c2e_on_unrepresentable = false;
 bool cheri_debugger_on_unrepresentable = false;
 bool cheri_debugger_on_trap = false;
@@ -3752,6 +3753,10 @@ void qemu_init(int argc, char **argv, char **envp)
                     qemu_log_instr_set_format(QLI_FMT_TEXT);
                 } else if (strcmp(optarg, "cvtrace") == 0) {
                     qemu_log_instr_set_format(QLI_FMT_CVTRACE);
+                } else if (strcmp(optarg, "binary") == 0) {
+                    qemu_log_instr_set_format(QLI_FMT_BINARY);
+                } else if (strcmp(optarg, "perfetto") == 0) {
+                    qemu_log_instr_set_format(QLI_FMT_PERFETTO);
                 } else {
                     printf("Invalid choice for cheri-trace-format: '%s'\n", optarg);
                     exit(1);
@@ -3760,6 +3765,12 @@ void qemu_init(int argc, char **argv, char **envp)
             case QEMU_OPTION_cheri_trace_buffer_size:
                 qemu_log_instr_set_buffer_size(strtoul(optarg, NULL, 0));
                 break;
+            case QEMU_OPTION_cheri_profile:
+                qemu_log_instr_sample_parse_opts(optarg);
+                break;
+            case QEMU_OPTION_cheri_trace_trigger:
+                qemu_log_instr_trigger_parse_opts(optarg);
+                break;
 #endif /* CONFIG_TCG_LOG_INSTR */
 
 #ifdef TARGET_CHERI
@@ -3772,6 +3783,9 @@ void qemu_init(int argc, char **argv, char **envp)
             case QEMU_OPTION_cheri_debugger_on_trap:
                 cheri_debugger_on_trap = true;
                 break;
+            case QEMU_OPTION_cheri_tagmem:
+                cheri_tagmem_parse_opts(optarg);
+                break;
 #endif /* TARGET_CHERI */
 #ifdef CONFIG_RVFI_DII
             case QEMU_OPTION_rvfi_dii_debug:
@@ -4715,6 +4729,9 @@ void qemu_cleanup(void)
     /* No more vcpu or device emulation activity beyond this point */
     vm_shutdown();
     replay_finish();
+    tb_cache_save();
+    qemu_log_instr_sample_shutdown();
+    qemu_log_instr_shutdown();
 
     job_cancel_sync_all();
     bdrv_close_all();
@@ -368,6 +368,8 @@ void helper_branch_sealed_pair(CPUArchState *env, uint32_t cn, uint32_t cm,
         !cap_has_perms(&data, CAP_PERM_EXECUTE)) {
         cap_set_unsealed(&target);
         cap_set_unsealed(&data);
+        cheri_stat_inc(env, unseal);
+        qemu_plugin_vcpu_cap_op_cb(env_cpu(env), QEMU_PLUGIN_CAP_UNSEAL);
     } else {
         target.cr_tag = 0;
     }
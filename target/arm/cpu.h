@@ -226,6 +226,7 @@ typedef struct ARMPACKey {
 
 #ifdef TARGET_CHERI
 #include "cheri-lazy-capregs-types.h"
+#include "cheri-statcounters.h"
 typedef aligned_cap_register_t AARCH_REG_TYPE;
 #else
 typedef uint64_t AARCH_REG_TYPE;
@@ -781,14 +782,7 @@ typedef struct CPUARMState {
     uint64_t chcr_el2;
     uint64_t cscr_el3;
 
-    // Some statcounters:
-    uint64_t statcounters_cap_read;
-    uint64_t statcounters_cap_read_tagged;
-    uint64_t statcounters_cap_write;
-    uint64_t statcounters_cap_write_tagged;
-
-    uint64_t statcounters_imprecise_setbounds;
-    uint64_t statcounters_unrepresentable_caps;
+    CheriStatCounters cheri_stats;
 
 #endif
 } CPUARMState;
@@ -3663,6 +3657,27 @@ static inline bool arm_cpu_bswap_data(CPUARMState *env)
 void cpu_get_tb_cpu_state(CPUARMState *env, target_ulong *pc,
                           target_ulong *cs_base, uint32_t *flags);
 
+#ifdef TARGET_SUPPORTS_TB_CACHE
+/*
+ * Append the CPU state that the translator reads directly rather than
+ * through the TB flags to @key. A persistent TB cache is only reused by a
+ * CPU for which all of it matches, see accel/tcg/tb-cache.c.
+ */
+static inline void cpu_tb_cache_key(CPUARMState *env, GByteArray *key)
+{
+    ARMCPU *cpu = env_archcpu(env);
+
+    /* QOM zeroes the object, so the padding in isar is stable. */
+    g_byte_array_append(key, (const guint8 *)&cpu->isar, sizeof(cpu->isar));
+    g_byte_array_append(key, (const guint8 *)&env->features,
+                        sizeof(env->features));
+    g_byte_array_append(key, (const guint8 *)&cpu->dcz_blocksize,
+                        sizeof(cpu->dcz_blocksize));
+    g_byte_array_append(key, (const guint8 *)&cpu->sve_max_vq,
+                        sizeof(cpu->sve_max_vq));
+}
+#endif
+
 enum {
     QEMU_PSCI_CONDUIT_DISABLED = 0,
     QEMU_PSCI_CONDUIT_SMC = 1,
@@ -12648,6 +12648,7 @@ bool get_phys_addr(CPUARMState *env, target_ulong address,
         if (arm_feature(env, ARM_FEATURE_EL2)) {
             hwaddr ipa;
             int s2_prot;
+            target_ulong s2_page_size;
             int ret;
             ARMCacheAttrs cacheattrs2 = {};
 
@@ -12665,8 +12666,10 @@ bool get_phys_addr(CPUARMState *env, target_ulong address,
             ret = get_phys_addr_lpae(env, ipa, access_type, ARMMMUIdx_Stage2,
                                      mmu_idx == ARMMMUIdx_E10_0,
                                      phys_ptr, attrs, &s2_prot,
-                                     page_size, fi, &cacheattrs2);
+                                     &s2_page_size, fi, &cacheattrs2);
             fi->s2addr = ipa;
+            /* The combined mapping is only linear within the smaller one. */
+            *page_size = MIN(*page_size, s2_page_size);
             /* Combine the S1 and S2 perms.  */
             // LC_CLEAR and LC_TRAP are sadly inverted as they DISALLOW behavior
             *prot =
@@ -2298,7 +2298,7 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
         uint32_t syndrome;
 
         gen_a64_set_pc_im(s->pc_curr);
-        tmpptr = tcg_const_ptr(ri);
+        tmpptr = tcg_const_heap_ptr(ri);
         syndrome = syn_aa64_sysregtrap_impl(op0, op1, op2, crn, crm, rt, isread,
                                             is_morello);
         tcg_syn = tcg_const_i32(syndrome);
@@ -2450,7 +2450,7 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
             if (ri->type & ARM_CP_CONST) {
                 assert(0 && "TODO");
             } else if (ri->readfn_cap) {
-                TCGv_ptr tmpptr = tcg_const_ptr(ri);
+                TCGv_ptr tmpptr = tcg_const_heap_ptr(ri);
                 TCGv_i32 regno = tcg_const_i32(rt);
                 gen_helper_get_cp_cap(tcg_rt, cpu_env, tmpptr, regno);
                 tcg_temp_free_i32(regno);
@@ -2463,7 +2463,7 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
             if (ri->type & ARM_CP_CONST) {
                 return;
             } else if (ri->writefn_cap) {
-                TCGv_ptr tmpptr = tcg_const_ptr(ri);
+                TCGv_ptr tmpptr = tcg_const_heap_ptr(ri);
                 TCGv_i32 regno = tcg_const_i32(rt);
                 gen_helper_set_cp_cap(cpu_env, tmpptr, tcg_rt, regno);
                 tcg_temp_free_i32(regno);
@@ -2483,7 +2483,7 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
             tcg_gen_movi_i64(tcg_rt, ri->resetvalue);
         } else if (ri->readfn) {
             TCGv_ptr tmpptr;
-            tmpptr = tcg_const_ptr(ri);
+            tmpptr = tcg_const_heap_ptr(ri);
             gen_helper_get_cp_reg64(tcg_rt, cpu_env, tmpptr);
             tcg_temp_free_ptr(tmpptr);
         } else {
@@ -2496,7 +2496,7 @@ static void handle_sys(DisasContext *s, uint32_t insn, bool isread,
             return;
         } else if (ri->writefn) {
             TCGv_ptr tmpptr;
-            tmpptr = tcg_const_ptr(ri);
+            tmpptr = tcg_const_heap_ptr(ri);
             gen_helper_set_cp_reg64(cpu_env, tmpptr, tcg_rt);
             tcg_temp_free_ptr(tmpptr);
         } else {
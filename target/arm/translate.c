@@ -4698,7 +4698,7 @@ static void do_coproc_insn(DisasContext *s, int cpnum, int is64,
 
             gen_set_condexec(s);
             gen_set_pc_im(s, s->pc_curr);
-            tmpptr = tcg_const_ptr(ri);
+            tmpptr = tcg_const_heap_ptr(ri);
             tcg_syn = tcg_const_i32(syndrome);
             tcg_isread = tcg_const_i32(isread);
             gen_helper_access_check_cp_reg(cpu_env, tmpptr, tcg_syn,
@@ -4745,7 +4745,7 @@ static void do_coproc_insn(DisasContext *s, int cpnum, int is64,
                 } else if (ri->readfn) {
                     TCGv_ptr tmpptr;
                     tmp64 = tcg_temp_new_i64();
-                    tmpptr = tcg_const_ptr(ri);
+                    tmpptr = tcg_const_heap_ptr(ri);
                     gen_helper_get_cp_reg64(tmp64, cpu_env, tmpptr);
                     tcg_temp_free_ptr(tmpptr);
                 } else {
@@ -4766,7 +4766,7 @@ static void do_coproc_insn(DisasContext *s, int cpnum, int is64,
                 } else if (ri->readfn) {
                     TCGv_ptr tmpptr;
                     tmp = tcg_temp_new_i32();
-                    tmpptr = tcg_const_ptr(ri);
+                    tmpptr = tcg_const_heap_ptr(ri);
                     gen_helper_get_cp_reg(tmp, cpu_env, tmpptr);
                     tcg_temp_free_ptr(tmpptr);
                 } else {
@@ -4798,7 +4798,7 @@ static void do_coproc_insn(DisasContext *s, int cpnum, int is64,
                 tcg_temp_free_i32(tmplo);
                 tcg_temp_free_i32(tmphi);
                 if (ri->writefn) {
-                    TCGv_ptr tmpptr = tcg_const_ptr(ri);
+                    TCGv_ptr tmpptr = tcg_const_heap_ptr(ri);
                     gen_helper_set_cp_reg64(cpu_env, tmpptr, tmp64);
                     tcg_temp_free_ptr(tmpptr);
                 } else {
@@ -4810,7 +4810,7 @@ static void do_coproc_insn(DisasContext *s, int cpnum, int is64,
                     TCGv_i32 tmp;
                     TCGv_ptr tmpptr;
                     tmp = load_reg(s, rt);
-                    tmpptr = tcg_const_ptr(ri);
+                    tmpptr = tcg_const_heap_ptr(ri);
                     gen_helper_set_cp_reg(cpu_env, tmpptr, tmp);
                     tcg_temp_free_ptr(tmpptr);
                     tcg_temp_free_i32(tmp);
@@ -38,6 +38,7 @@
 #include "cheri_utils.h"
 #include "cheri-archspecific.h"
 #include "qemu/qemu-print.h"
+#include "qemu/stats64.h"
 #include "cheri-archspecific.h"
 
 extern bool cheri_c2e_on_unrepresentable;
@@ -46,7 +47,7 @@ extern bool cheri_debugger_on_unrepresentable;
 static inline void
 _became_unrepresentable(CPUArchState *env, uint16_t reg, uintptr_t retpc)
 {
-    env->statcounters_unrepresentable_caps++;
+    cheri_stat_inc(env, unrepresentable_caps);
 #ifdef TARGET_MIPS
     if (cheri_debugger_on_unrepresentable)
         do_raise_exception(env, EXCP_DEBUG, retpc);
@@ -73,12 +74,16 @@ struct bounds_bucket {
 #define NUM_BOUNDS_BUCKETS 13
 extern struct bounds_bucket bounds_buckets[NUM_BOUNDS_BUCKETS];
 
+/*
+ * These are shared by all vCPUs and read by query-cheri-stats while the guest
+ * runs, hence Stat64 rather than plain counters.
+ */
 struct oob_stats_info {
     const char* operation;
-    uint64_t num_uses;
-    uint64_t unrepresentable; // Number of OOB caps that were unrepresentable
-    uint64_t after_bounds[ARRAY_SIZE(bounds_buckets) + 1]; // Number of OOB caps created pointing to after end
-    uint64_t before_bounds[ARRAY_SIZE(bounds_buckets) + 1];  // Number of OOB caps created pointing to before start
+    Stat64 num_uses;
+    Stat64 unrepresentable; // Number of OOB caps that were unrepresentable
+    Stat64 after_bounds[ARRAY_SIZE(bounds_buckets) + 1]; // Number of OOB caps created pointing to after end
+    Stat64 before_bounds[ARRAY_SIZE(bounds_buckets) + 1];  // Number of OOB caps created pointing to before start
 };
 
 #define DEFINE_CHERI_STAT(op) \
@@ -139,9 +144,10 @@ static inline void check_out_of_bounds_stat(CPUArchState *env,
     int64_t howmuch =
         _howmuch_out_of_bounds(env, capreg, info->operation, retpc);
     if (howmuch > 0) {
-        info->after_bounds[out_of_bounds_stat_index(howmuch)]++;
+        stat64_add(&info->after_bounds[out_of_bounds_stat_index(howmuch)], 1);
     } else if (howmuch < 0) {
-        info->before_bounds[out_of_bounds_stat_index(llabs(howmuch))]++;
+        stat64_add(&info->before_bounds[out_of_bounds_stat_index(llabs(howmuch))],
+                   1);
     }
 }
 
@@ -151,7 +157,7 @@ static inline void became_unrepresentable(CPUArchState *env, uint16_t reg,
     const cap_register_t *capreg = get_readonly_capreg(env, reg);
     /* unrepresentable implies more than one out of bounds: */
     check_out_of_bounds_stat(env, info, capreg, retpc);
-    info->unrepresentable++;
+    stat64_add(&info->unrepresentable, 1);
     qemu_log_instr_or_mask_msg(env, CPU_LOG_CHERI_BOUNDS,
         "BOUNDS: Unrepresentable capability created using %s, pc=%016" PRIx64
         " ASID=%u\n", info->operation, cheri_get_current_pc(env, retpc)),
@@ -159,43 +165,63 @@ static inline void became_unrepresentable(CPUArchState *env, uint16_t reg,
     _became_unrepresentable(env, reg, retpc);
 }
 
+struct oob_stats_snapshot {
+    uint64_t num_uses;
+    uint64_t unrepresentable;
+    uint64_t after_bounds[ARRAY_SIZE(bounds_buckets) + 1];
+    uint64_t before_bounds[ARRAY_SIZE(bounds_buckets) + 1];
+};
+
+static inline void read_out_of_bounds_stats(const struct oob_stats_info *info,
+                                            struct oob_stats_snapshot *snap)
+{
+    snap->num_uses = stat64_get(&info->num_uses);
+    snap->unrepresentable = stat64_get(&info->unrepresentable);
+    for (int i = 0; i < ARRAY_SIZE(snap->after_bounds); i++) {
+        snap->after_bounds[i] = stat64_get(&info->after_bounds[i]);
+        snap->before_bounds[i] = stat64_get(&info->before_bounds[i]);
+    }
+}
+
 static inline void dump_out_of_bounds_stats(FILE* f, const struct oob_stats_info *info)
 {
+    struct oob_stats_snapshot snap;
 
-    qemu_fprintf(f, "Number of %ss: %" PRIu64 "\n", info->operation, info->num_uses);
-    uint64_t total_out_of_bounds = info->after_bounds[0];
+    read_out_of_bounds_stats(info, &snap);
+    qemu_fprintf(f, "Number of %ss: %" PRIu64 "\n", info->operation, snap.num_uses);
+    uint64_t total_out_of_bounds = snap.after_bounds[0];
     // one past the end is fine according to ISO C
-    qemu_fprintf(f, "  One past the end:           %" PRIu64 "\n", info->after_bounds[0]);
+    qemu_fprintf(f, "  One past the end:           %" PRIu64 "\n", snap.after_bounds[0]);
     assert(bounds_buckets[0].howmuch == 1);
     // All the others are invalid:
     for (int i = 1; i < ARRAY_SIZE(bounds_buckets); i++) {
-        qemu_fprintf(f, "  Out of bounds by up to %s: %" PRIu64 "\n", bounds_buckets[i].name, info->after_bounds[i]);
-        total_out_of_bounds += info->after_bounds[i];
+        qemu_fprintf(f, "  Out of bounds by up to %s: %" PRIu64 "\n", bounds_buckets[i].name, snap.after_bounds[i]);
+        total_out_of_bounds += snap.after_bounds[i];
     }
     qemu_fprintf(f, "  Out of bounds by over  %s: %" PRIu64 "\n",
-        bounds_buckets[ARRAY_SIZE(bounds_buckets) - 1].name, info->after_bounds[ARRAY_SIZE(bounds_buckets)]);
-    total_out_of_bounds += info->after_bounds[ARRAY_SIZE(bounds_buckets)];
+        bounds_buckets[ARRAY_SIZE(bounds_buckets) - 1].name, snap.after_bounds[ARRAY_SIZE(bounds_buckets)]);
+    total_out_of_bounds += snap.after_bounds[ARRAY_SIZE(bounds_buckets)];
 
 
     // One before the start is invalid though:
     for (int i = 0; i < ARRAY_SIZE(bounds_buckets); i++) {
-        qemu_fprintf(f, "  Before bounds by up to -%s: %" PRIu64 "\n", bounds_buckets[i].name, info->before_bounds[i]);
-        total_out_of_bounds += info->before_bounds[i];
+        qemu_fprintf(f, "  Before bounds by up to -%s: %" PRIu64 "\n", bounds_buckets[i].name, snap.before_bounds[i]);
+        total_out_of_bounds += snap.before_bounds[i];
     }
     qemu_fprintf(f, "  Before bounds by over  -%s: %" PRIu64 "\n",
-        bounds_buckets[ARRAY_SIZE(bounds_buckets) - 1].name, info->before_bounds[ARRAY_SIZE(bounds_buckets)]);
-    total_out_of_bounds += info->before_bounds[ARRAY_SIZE(bounds_buckets)];
+        bounds_buckets[ARRAY_SIZE(bounds_buckets) - 1].name, snap.before_bounds[ARRAY_SIZE(bounds_buckets)]);
+    total_out_of_bounds += snap.before_bounds[ARRAY_SIZE(bounds_buckets)];
 
 
     // unrepresentable, i.e. massively out of bounds:
-    qemu_fprintf(f, "  Became unrepresentable due to out-of-bounds: %" PRIu64 "\n", info->unrepresentable);
-    total_out_of_bounds += info->unrepresentable; // TODO: count how far it was out of bounds for this stat
+    qemu_fprintf(f, "  Became unrepresentable due to out-of-bounds: %" PRIu64 "\n", snap.unrepresentable);
+    total_out_of_bounds += snap.unrepresentable; // TODO: count how far it was out of bounds for this stat
 
     qemu_fprintf(f, "Total out of bounds %ss: %" PRIu64 " (%f%%)\n", info->operation, total_out_of_bounds,
-        info->num_uses == 0 ? 0.0 : ((double)(100 * total_out_of_bounds) / (double)info->num_uses));
+        snap.num_uses == 0 ? 0.0 : ((double)(100 * total_out_of_bounds) / (double)snap.num_uses));
     qemu_fprintf(f, "Total out of bounds %ss (excluding one past the end): %" PRIu64 " (%f%%)\n",
-        info->operation, total_out_of_bounds - info->after_bounds[0],
-        info->num_uses == 0 ? 0.0 : ((double)(100 * (total_out_of_bounds - info->after_bounds[0])) / (double)info->num_uses));
+        info->operation, total_out_of_bounds - snap.after_bounds[0],
+        snap.num_uses == 0 ? 0.0 : ((double)(100 * (total_out_of_bounds - snap.after_bounds[0])) / (double)snap.num_uses));
 }
 
 // Common cross-architecture stats:
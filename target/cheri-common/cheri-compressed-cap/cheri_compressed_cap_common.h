@@ -430,6 +430,18 @@ static inline bool _cc_N(compute_base_top)(_cc_bounds_bits bounds, _cc_addr_t cu
     return true;
 }
 
+static inline void _cc_N(check_decompressed)(const _cc_cap_t* cdp) {
+    if (cdp->cr_tag) {
+        _cc_debug_assert(cdp->cr_base <= _CC_N(MAX_ADDR));
+#ifndef CC_IS_MORELLO
+        // Morello is perfectly happy using settag to create capabilities with length greater than 2^64.
+        _cc_debug_assert(cdp->_cr_top <= _CC_N(MAX_TOP));
+        _cc_debug_assert(cdp->cr_base <= cdp->_cr_top);
+#endif
+        _cc_debug_assert(_CC_EXTRACT_FIELD(cdp->cr_pesbt, RESERVED) == 0);
+    }
+}
+
 static inline void _cc_N(decompress_raw)(_cc_addr_t pesbt, _cc_addr_t cursor, bool tag, _cc_cap_t* cdp) {
     cdp->cr_tag = tag;
     cdp->_cr_cursor = cursor;
@@ -439,15 +451,7 @@ static inline void _cc_N(decompress_raw)(_cc_addr_t pesbt, _cc_addr_t cursor, bo
     bool valid = _cc_N(compute_base_top)(bounds, cursor, &cdp->cr_base, &cdp->_cr_top);
     cdp->cr_bounds_valid = valid;
     cdp->cr_exp = bounds.E;
-    if (tag) {
-        _cc_debug_assert(cdp->cr_base <= _CC_N(MAX_ADDR));
-#ifndef CC_IS_MORELLO
-        // Morello is perfectly happy using settag to create capabilities with length greater than 2^64.
-        _cc_debug_assert(cdp->_cr_top <= _CC_N(MAX_TOP));
-        _cc_debug_assert(cdp->cr_base <= cdp->_cr_top);
-#endif
-        _cc_debug_assert(_CC_EXTRACT_FIELD(pesbt, RESERVED) == 0);
-    }
+    _cc_N(check_decompressed)(cdp);
 }
 
 /*
@@ -457,6 +461,204 @@ static inline void _cc_N(decompress_mem)(uint64_t pesbt, uint64_t cursor, bool t
     _cc_N(decompress_raw)(pesbt ^ _CC_N(NULL_XOR_MASK), cursor, tag, cdp);
 }
 
+/*
+ * Batch decompression.
+ *
+ * decompress_raw_batch()/decompress_mem_batch() produce exactly the same
+ * results as calling decompress_raw()/decompress_mem() on each element, but
+ * evaluate extract_bounds_bits() and compute_base_top() for _CC_BATCH_LANES
+ * capabilities at a time. The lane kernel is written with GCC/clang vector
+ * extensions, so it compiles to NEON on AArch64 and SSE2 on x86_64. On x86_64
+ * a second copy compiled for AVX2 (which adds per-lane variable shifts and
+ * 64-bit compares) is selected at runtime when the host supports it.
+ * Define _CC_NO_VECTOR_DECOMPRESS to always use the scalar code.
+ */
+#ifndef _CC_BATCH_LANES
+#define _CC_BATCH_LANES 4
+#if defined(__GNUC__) && !defined(_CC_NO_VECTOR_DECOMPRESS)
+#define _CC_HAVE_VECTOR_DECOMPRESS
+typedef uint64_t _cc_u64xN __attribute__((vector_size(_CC_BATCH_LANES * sizeof(uint64_t))));
+#if defined(__x86_64__) && !defined(__AVX2__)
+#define _CC_HAVE_AVX2_DECOMPRESS
+#endif
+#endif
+#endif
+
+#ifdef _CC_HAVE_VECTOR_DECOMPRESS
+#define _CC_VEXTRACT_FIELD(value, name)                                                                                \
+    (((value) >> (uint64_t)_CC_N(FIELD_##name##_START)) & (uint64_t)_CC_N(FIELD_##name##_MAX_VALUE))
+#define _CC_VMASK(cond) ((_cc_u64xN)(cond))
+
+typedef void (*_cc_N(decompress_lanes_fn))(const _cc_addr_t* pesbt, const _cc_addr_t* cursor, const bool* tags,
+                                           uint64_t xor_mask, _cc_cap_t* cdp);
+
+// Compute the LEN_WIDTH-bit value (a_top + correction) @ bits @ zeros(E) split into the low 64 bits and bit 64.
+static inline __attribute__((always_inline)) void
+_cc_N(vec_assemble_bound)(const _cc_u64xN* a_top, const _cc_u64xN* correction, const _cc_u64xN* bits,
+                          const _cc_u64xN* E, _cc_u64xN* lo, _cc_u64xN* hi) {
+    const _cc_u64xN x = (*a_top + *correction) & (uint64_t)_CC_MAX_ADDR;
+    const _cc_u64xN v = (x << _CC_MANTISSA_WIDTH) | *bits;
+    *lo = v << *E;
+#if _CC_LEN_WIDTH > 64
+    // Bit 64 is bit (64 - E) of v, which for E == 0 lies above the 64 bits computed for v.
+    const _cc_u64xN e_zero = _CC_VMASK(*E == 0);
+    *hi = (((v >> ((64 - *E) & 63)) & ~e_zero) | ((x >> (64 - _CC_MANTISSA_WIDTH)) & e_zero)) & 1;
+#else
+    const _cc_u64xN zero = {0};
+    *lo &= _CC_BITMASK64(_CC_LEN_WIDTH);
+    *hi = zero;
+#endif
+}
+
+static inline __attribute__((always_inline)) void _cc_N(decompress_lanes_impl)(const _cc_addr_t* pesbt_in,
+                                                                             const _cc_addr_t* cursor_in,
+                                                                             const bool* tags, uint64_t xor_mask,
+                                                                             _cc_cap_t* cdp) {
+    _cc_u64xN pesbt, cursor;
+    for (int i = 0; i < _CC_BATCH_LANES; i++) {
+        pesbt[i] = pesbt_in[i] ^ xor_mask;
+        cursor[i] = cursor_in[i];
+    }
+
+    // extract_bounds_bits()
+    const _cc_u64xN ie = _CC_VEXTRACT_FIELD(pesbt, INTERNAL_EXPONENT);
+    const _cc_u64xN ie_mask = -ie;
+    const _cc_u64xN E = (_CC_VEXTRACT_FIELD(pesbt, EXPONENT_LOW_PART) |
+                         (_CC_VEXTRACT_FIELD(pesbt, EXPONENT_HIGH_PART) << (uint64_t)_CC_EXP_LOW_WIDTH)) &
+                        ie_mask;
+#ifdef CC_IS_MORELLO
+    const _cc_u64xN pesbt_ze = pesbt ^ (uint64_t)_CC_N(NULL_XOR_MASK);
+#else
+    const _cc_u64xN pesbt_ze = pesbt;
+#endif
+    _cc_u64xN B = ((_CC_VEXTRACT_FIELD(pesbt, EXP_NONZERO_BOTTOM) << (uint64_t)_CC_EXP_LOW_WIDTH) & ie_mask) |
+                  (_CC_VEXTRACT_FIELD(pesbt_ze, EXP_ZERO_BOTTOM) & ~ie_mask);
+    _cc_u64xN T = ((_CC_VEXTRACT_FIELD(pesbt, EXP_NONZERO_TOP) << (uint64_t)_CC_EXP_HIGH_WIDTH) & ie_mask) |
+                  (_CC_VEXTRACT_FIELD(pesbt_ze, EXP_ZERO_TOP) & ~ie_mask);
+    const _cc_u64xN L_carry = _CC_VMASK(T < (B & (_CC_BITMASK64(_CC_MANTISSA_WIDTH) >> 2))) & 1;
+    T |= (((B >> (_CC_MANTISSA_WIDTH - 2)) + L_carry + ie) & 3) << (_CC_MANTISSA_WIDTH - 2);
+#ifdef CC_IS_MORELLO
+    const _cc_u64xN max_encodable = ie_mask & _CC_VMASK(E == CC128_MAX_ENCODABLE_EXPONENT);
+    B &= ~max_encodable;
+    T &= ~max_encodable;
+#endif
+
+    // compute_base_top()
+    const _cc_u64xN large_e = _CC_VMASK(E > _CC_MAX_EXPONENT);
+#ifdef CC_IS_MORELLO
+    cursor &= (uint64_t)_CC_CURSOR_MASK;
+    cursor |= _CC_VMASK((cursor & ((_CC_CURSOR_MASK >> 1) + 1)) != 0) & ~(uint64_t)_CC_CURSOR_MASK;
+#endif
+    const _cc_u64xN Ec = (E & ~large_e) | ((uint64_t)_CC_MAX_EXPONENT & large_e);
+    const _cc_u64xN a3 = (cursor >> (Ec + (_CC_MANTISSA_WIDTH - 3))) & 7;
+    const _cc_u64xN B3 = B >> (_CC_MANTISSA_WIDTH - 3);
+    const _cc_u64xN T3 = T >> (_CC_MANTISSA_WIDTH - 3);
+    const _cc_u64xN R3 = (B3 - 1) & 7;
+    const _cc_u64xN aHi = _CC_VMASK(a3 < R3) & 1;
+    const _cc_u64xN correction_base = (_CC_VMASK(B3 < R3) & 1) - aHi;
+    const _cc_u64xN correction_top = (_CC_VMASK(T3 < R3) & 1) - aHi;
+    const _cc_u64xN a_top_shift = Ec + _CC_MANTISSA_WIDTH;
+    const _cc_u64xN a_top = (cursor >> (a_top_shift & 63)) & ~_CC_VMASK(a_top_shift >= _CC_ADDR_WIDTH);
+
+    _cc_u64xN base, base_hi, top, top_hi;
+    _cc_N(vec_assemble_bound)(&a_top, &correction_base, &B, &Ec, &base, &base_hi);
+    _cc_N(vec_assemble_bound)(&a_top, &correction_top, &T, &Ec, &top, &top_hi);
+    (void)base_hi; // the top bit of base is stripped below
+
+    const _cc_u64xN base2 = (base >> (_CC_ADDR_WIDTH - 1)) & 1;
+#if _CC_LEN_WIDTH > 64
+    const _cc_u64xN top2 = (top_hi << 1) | (top >> 63);
+#else
+    const _cc_u64xN top2 = (top >> (_CC_ADDR_WIDTH - 1)) & 3;
+#endif
+    const _cc_u64xN flip_top = _CC_VMASK(Ec < _CC_MAX_EXPONENT - 1) & _CC_VMASK(top2 - base2 > 1);
+#if _CC_LEN_WIDTH > 64
+    top_hi ^= flip_top & 1;
+#else
+    top ^= flip_top & ((uint64_t)1 << _CC_ADDR_WIDTH);
+#endif
+#ifdef CC_IS_MORELLO
+    base &= ~large_e;
+    top &= ~large_e;
+    top_hi = (top_hi & ~large_e) | (large_e & 1);
+    const _cc_u64xN valid = ~large_e | _CC_VMASK(E == CC128_MAX_ENCODABLE_EXPONENT);
+#endif
+
+    for (int i = 0; i < _CC_BATCH_LANES; i++) {
+        cdp[i].cr_tag = tags[i];
+        cdp[i]._cr_cursor = cursor_in[i];
+        cdp[i].cr_pesbt = (_cc_addr_t)pesbt[i];
+        cdp[i].cr_base = (_cc_addr_t)base[i];
+#if _CC_LEN_WIDTH > 64
+        cdp[i]._cr_top = ((_cc_length_t)top_hi[i] << 64) | top[i];
+#else
+        cdp[i]._cr_top = top[i];
+#endif
+#ifdef CC_IS_MORELLO
+        cdp[i].cr_bounds_valid = valid[i] & 1;
+#else
+        cdp[i].cr_bounds_valid = true;
+#endif
+        cdp[i].cr_exp = (uint8_t)E[i];
+        _cc_N(check_decompressed)(&cdp[i]);
+    }
+}
+
+static inline void _cc_N(decompress_lanes)(const _cc_addr_t* pesbt, const _cc_addr_t* cursor, const bool* tags,
+                                          uint64_t xor_mask, _cc_cap_t* cdp) {
+    _cc_N(decompress_lanes_impl)(pesbt, cursor, tags, xor_mask, cdp);
+}
+
+#ifdef _CC_HAVE_AVX2_DECOMPRESS
+static inline __attribute__((target("avx2"))) void _cc_N(decompress_lanes_avx2)(const _cc_addr_t* pesbt,
+                                                                              const _cc_addr_t* cursor,
+                                                                              const bool* tags, uint64_t xor_mask,
+                                                                              _cc_cap_t* cdp) {
+    _cc_N(decompress_lanes_impl)(pesbt, cursor, tags, xor_mask, cdp);
+}
+#endif
+
+static inline _cc_N(decompress_lanes_fn) _cc_N(select_decompress_lanes)(void) {
+#ifdef _CC_HAVE_AVX2_DECOMPRESS
+    if (__builtin_cpu_supports("avx2")) {
+        return _cc_N(decompress_lanes_avx2);
+    }
+#endif
+    return _cc_N(decompress_lanes);
+}
+#undef _CC_VEXTRACT_FIELD
+#undef _CC_VMASK
+#endif // _CC_HAVE_VECTOR_DECOMPRESS
+
+static inline void _cc_N(decompress_batch_impl)(const _cc_addr_t* pesbt, const _cc_addr_t* cursor, const bool* tags,
+                                               uint64_t xor_mask, _cc_cap_t* cdp, size_t n) {
+    size_t i = 0;
+#ifdef _CC_HAVE_VECTOR_DECOMPRESS
+    const size_t nvec = n - n % _CC_BATCH_LANES;
+    if (nvec) {
+        _cc_N(decompress_lanes_fn) kernel = _cc_N(select_decompress_lanes)();
+        for (; i < nvec; i += _CC_BATCH_LANES) {
+            kernel(&pesbt[i], &cursor[i], &tags[i], xor_mask, &cdp[i]);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        _cc_N(decompress_raw)(pesbt[i] ^ xor_mask, cursor[i], tags[i], &cdp[i]);
+    }
+}
+
+/// Decompress the n capabilities (pesbt[i], cursor[i], tags[i]) into cdp[i].
+static inline void _cc_N(decompress_raw_batch)(const _cc_addr_t* pesbt, const _cc_addr_t* cursor, const bool* tags,
+                                              _cc_cap_t* cdp, size_t n) {
+    _cc_N(decompress_batch_impl)(pesbt, cursor, tags, 0, cdp, n);
+}
+
+/// Same as decompress_raw_batch() but with the in-memory pesbt representation.
+static inline void _cc_N(decompress_mem_batch)(const _cc_addr_t* pesbt, const _cc_addr_t* cursor, const bool* tags,
+                                              _cc_cap_t* cdp, size_t n) {
+    _cc_N(decompress_batch_impl)(pesbt, cursor, tags, _CC_N(NULL_XOR_MASK), cdp, n);
+}
+
 static inline bool _cc_N(is_cap_sealed)(const _cc_cap_t* cp) { return _cc_N(get_otype)(cp) != _CC_N(OTYPE_UNSEALED); }
 
 // Update ebt bits in pesbt
@@ -972,6 +1174,14 @@ public:
     static inline void decompress_mem(addr_t pesbt, addr_t cursor, bool tag, cap_t* cdp) {
         _cc_N(decompress_mem)(pesbt, cursor, tag, cdp);
     }
+    static inline void decompress_raw_batch(const addr_t* pesbt, const addr_t* cursor, const bool* tags, cap_t* cdp,
+                                            size_t n) {
+        _cc_N(decompress_raw_batch)(pesbt, cursor, tags, cdp, n);
+    }
+    static inline void decompress_mem_batch(const addr_t* pesbt, const addr_t* cursor, const bool* tags, cap_t* cdp,
+                                            size_t n) {
+        _cc_N(decompress_mem_batch)(pesbt, cursor, tags, cdp, n);
+    }
     static inline bounds_bits extract_bounds_bits(addr_t pesbt) { return _cc_N(extract_bounds_bits)(pesbt); }
     static inline bool setbounds(cap_t* cap, addr_t req_base, length_t req_top) {
         return _cc_N(setbounds)(cap, req_base, req_top);
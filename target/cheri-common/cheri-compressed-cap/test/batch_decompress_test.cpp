@@ -0,0 +1,160 @@
+#include "../cheri_compressed_cap.h"
+#include <cinttypes>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN // This tells Catch to provide a main() - only do this in one cpp file
+#include "sail_wrapper.h"
+#include "test_util.h"
+
+#include "decode_inputs.cpp"
+
+template <typename cap_t> static bool same_fields(const cap_t& a, const cap_t& b) {
+    return a._cr_cursor == b._cr_cursor && a.cr_pesbt == b.cr_pesbt && a._cr_top == b._cr_top &&
+           a.cr_base == b.cr_base && a.cr_tag == b.cr_tag && a.cr_bounds_valid == b.cr_bounds_valid &&
+           a.cr_exp == b.cr_exp && a.cr_extra == b.cr_extra;
+}
+
+// Decode all inputs with the batch API and compare every result against the scalar decompress_raw() and sail.
+template <class Handler>
+static bool check_batch_decode(const std::vector<typename Handler::addr_t>& pesbt,
+                               const std::vector<typename Handler::addr_t>& cursor) {
+    const size_t n = pesbt.size();
+    // Arbitrary bit patterns can have invalid bounds, so they must not be tagged.
+    std::unique_ptr<bool[]> tags(new bool[n]());
+    std::vector<typename Handler::cap_t> batch(n);
+    memset(batch.data(), 0, n * sizeof(typename Handler::cap_t));
+    Handler::decompress_raw_batch(pesbt.data(), cursor.data(), tags.get(), batch.data(), n);
+
+    int failure_count = 0;
+    for (size_t i = 0; i < n; i++) {
+        typename Handler::cap_t scalar, sail_result;
+        memset(&scalar, 0, sizeof(scalar));
+        memset(&sail_result, 0, sizeof(sail_result));
+        Handler::decompress_raw(pesbt[i], cursor[i], false, &scalar);
+        Handler::sail_decode_raw(pesbt[i], cursor[i], false, &sail_result);
+        CAPTURE(i, pesbt[i], cursor[i]);
+        CAPTURE(batch[i]);
+        CAPTURE(scalar);
+        bool success = same_fields(batch[i], scalar);
+        CHECK(same_fields(batch[i], scalar));
+        CHECK(sail_result.cr_base == batch[i].cr_base);
+        CHECK(sail_result._cr_top == batch[i]._cr_top);
+        CHECK(sail_result._cr_cursor == batch[i]._cr_cursor);
+        success = success && sail_result.cr_base == batch[i].cr_base && sail_result._cr_top == batch[i]._cr_top;
+        if (!success && ++failure_count > 10)
+            break;
+    }
+    return failure_count == 0;
+}
+
+template <class Handler> static void check_batch_sizes(const std::vector<typename Handler::addr_t>& pesbt) {
+    // Exercise every tail length, and start offsets that are not a multiple of the lane count.
+    for (size_t offset = 0; offset < 2 * _CC_BATCH_LANES; offset++) {
+        for (size_t n = 0; n < 4 * _CC_BATCH_LANES && offset + n <= pesbt.size(); n++) {
+            typename Handler::cap_t batch[4 * _CC_BATCH_LANES];
+            bool tags[4 * _CC_BATCH_LANES] = {};
+            memset(batch, 0xaa, sizeof(batch));
+            Handler::decompress_mem_batch(&pesbt[offset], &pesbt[offset], tags, batch, n);
+            for (size_t i = 0; i < n; i++) {
+                typename Handler::cap_t scalar;
+                memset(&scalar, 0xaa, sizeof(scalar));
+                Handler::decompress_mem(pesbt[offset + i], pesbt[offset + i], false, &scalar);
+                CAPTURE(offset, n, i);
+                REQUIRE(same_fields(batch[i], scalar));
+            }
+            // Entries past n must not be written.
+            for (size_t i = n; i < 4 * _CC_BATCH_LANES; i++) {
+                REQUIRE(batch[i].cr_tag == 0xaa);
+            }
+        }
+    }
+}
+
+template <class Handler, typename test_input>
+static void split_inputs(const test_input* inputs, size_t n, std::vector<typename Handler::addr_t>& pesbt,
+                         std::vector<typename Handler::addr_t>& cursor) {
+    for (size_t i = 0; i < n; i++) {
+        pesbt.push_back(inputs[i].pesbt);
+        cursor.push_back(inputs[i].cursor);
+    }
+}
+
+template <class Handler>
+static void random_inputs(size_t n, std::vector<typename Handler::addr_t>& pesbt,
+                          std::vector<typename Handler::addr_t>& cursor) {
+    std::mt19937_64 rng(0xc4e21);
+    for (size_t i = 0; i < n; i++) {
+        pesbt.push_back((typename Handler::addr_t)rng());
+        cursor.push_back((typename Handler::addr_t)rng());
+    }
+}
+
+TEST_CASE("Batch decompression matches sail for sail-generated 128-bit inputs", "[batch]") {
+    std::vector<TestAPI128::addr_t> pesbt, cursor;
+    split_inputs<TestAPI128>(inputs128, array_lengthof(inputs128), pesbt, cursor);
+    REQUIRE(check_batch_decode<TestAPI128>(pesbt, cursor));
+}
+
+TEST_CASE("Batch decompression matches sail for random 128-bit inputs", "[batch]") {
+    std::vector<TestAPI128::addr_t> pesbt, cursor;
+    random_inputs<TestAPI128>(100000, pesbt, cursor);
+    REQUIRE(check_batch_decode<TestAPI128>(pesbt, cursor));
+}
+
+TEST_CASE("Batch decompression handles partial 128-bit batches", "[batch]") {
+    std::vector<TestAPI128::addr_t> pesbt, cursor;
+    split_inputs<TestAPI128>(inputs128, 64, pesbt, cursor);
+    check_batch_sizes<TestAPI128>(pesbt);
+}
+
+#ifndef CC_IS_MORELLO
+TEST_CASE("Batch decompression matches sail for sail-generated 64-bit inputs", "[batch]") {
+    std::vector<TestAPI64::addr_t> pesbt, cursor;
+    split_inputs<TestAPI64>(inputs64, array_lengthof(inputs64), pesbt, cursor);
+    REQUIRE(check_batch_decode<TestAPI64>(pesbt, cursor));
+}
+
+TEST_CASE("Batch decompression matches sail for random 64-bit inputs", "[batch]") {
+    std::vector<TestAPI64::addr_t> pesbt, cursor;
+    random_inputs<TestAPI64>(100000, pesbt, cursor);
+    REQUIRE(check_batch_decode<TestAPI64>(pesbt, cursor));
+}
+
+TEST_CASE("Batch decompression handles partial 64-bit batches", "[batch]") {
+    std::vector<TestAPI64::addr_t> pesbt, cursor;
+    split_inputs<TestAPI64>(inputs64, 64, pesbt, cursor);
+    check_batch_sizes<TestAPI64>(pesbt);
+}
+#endif
+
+#ifdef _CC_HAVE_AVX2_DECOMPRESS
+// The batch API only uses one of the kernels on a given host, so compare the baseline kernel with AVX2 directly.
+TEST_CASE("Baseline and AVX2 decompression kernels agree", "[batch]") {
+    if (!__builtin_cpu_supports("avx2")) {
+        WARN("Host does not support AVX2, skipping");
+        return;
+    }
+    std::mt19937_64 rng(0xa2c2);
+    for (int i = 0; i < 100000; i++) {
+        cc128_addr_t pesbt[_CC_BATCH_LANES], cursor[_CC_BATCH_LANES];
+        bool tags[_CC_BATCH_LANES] = {};
+        cc128_cap_t baseline[_CC_BATCH_LANES], avx2[_CC_BATCH_LANES];
+        for (int j = 0; j < _CC_BATCH_LANES; j++) {
+            pesbt[j] = rng();
+            cursor[j] = rng();
+        }
+        memset(baseline, 0, sizeof(baseline));
+        memset(avx2, 0, sizeof(avx2));
+        cc128_decompress_lanes(pesbt, cursor, tags, 0, baseline);
+        cc128_decompress_lanes_avx2(pesbt, cursor, tags, 0, avx2);
+        for (int j = 0; j < _CC_BATCH_LANES; j++) {
+            CAPTURE(pesbt[j], cursor[j]);
+            REQUIRE(same_fields(baseline[j], avx2[j]));
+        }
+    }
+}
+#endif
@@ -48,7 +48,7 @@ static inline void derive_cap_from_pcc(CPUArchState *env, uint32_t cd,
                                        struct oob_stats_info *oob_info)
 {
 #ifdef DO_CHERI_STATISTICS
-    oob_info->num_uses++;
+    stat64_add(&oob_info->num_uses, 1);
 #else
     (void)oob_info;
 #endif
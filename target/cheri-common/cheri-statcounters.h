@@ -0,0 +1,74 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Per-vCPU capability event counters shared by all CHERI targets.
+ *
+ * The counters are only ever written by the vCPU thread that owns them, but
+ * they can be read at any time by the monitor (query-cheri-stats). With
+ * 64-bit atomics a relaxed load and store is enough for that, so increments
+ * need no locked RMW. Other hosts use Stat64 to keep the reads from tearing.
+ */
+#pragma once
+
+#include "qemu/atomic.h"
+#include "qemu/stats64.h"
+
+#ifdef CONFIG_ATOMIC64
+typedef uint64_t CheriStat;
+
+static inline void cheri_stat_inc_one(CheriStat *s)
+{
+    qatomic_set__nocheck(s, qatomic_read__nocheck(s) + 1);
+}
+
+static inline uint64_t cheri_stat_get(CheriStat *s)
+{
+    return qatomic_read__nocheck(s);
+}
+#else
+typedef Stat64 CheriStat;
+
+static inline void cheri_stat_inc_one(CheriStat *s)
+{
+    stat64_add(s, 1);
+}
+
+static inline uint64_t cheri_stat_get(CheriStat *s)
+{
+    return stat64_get(s);
+}
+#endif
+
+typedef struct CheriStatCounters {
+    CheriStat cap_read;
+    CheriStat cap_read_tagged;
+    CheriStat cap_write;
+    CheriStat cap_write_tagged;
+
+    CheriStat setbounds;
+    CheriStat imprecise_setbounds;
+    CheriStat unrepresentable_caps;
+
+    CheriStat seal;
+    CheriStat unseal;
+
+    CheriStat itlb_miss;
+    CheriStat dtlb_miss;
+} CheriStatCounters;
+
+#define cheri_stat_inc(env, name) cheri_stat_inc_one(&(env)->cheri_stats.name)
+
+#define cheri_stat_read(env, name) cheri_stat_get(&(env)->cheri_stats.name)
+
+/*
+ * Called whenever the target has to walk the guest page tables (or, on MIPS,
+ * raise a TLB refill exception) to resolve an access.
+ */
+#define cheri_stat_tlb_miss(env, access_type)                                  \
+    do {                                                                       \
+        if ((access_type) == MMU_INST_FETCH) {                                 \
+            cheri_stat_inc(env, itlb_miss);                                    \
+        } else {                                                               \
+            cheri_stat_inc(env, dtlb_miss);                                    \
+        }                                                                      \
+    } while (0)
@@ -84,4 +84,84 @@ static inline void disas_capreg_reset_all(DisasContextBase *ctx)
     }
 }
 
+/*
+ * Tracking of capability checks that can be elided for the rest of the TB.
+ * Since TBs are straight-line code, a check that was emitted earlier in the
+ * TB has passed by the time any later instruction executes. The recorded
+ * state is dropped after every instruction that does not call
+ * disas_capreg_checks_preserve(), so only instructions known to invalidate
+ * every register they write can keep it alive.
+ */
+static inline void disas_capreg_checks_reset_all(DisasContextBase *ctx)
+{
+    memset(ctx->cap_checked, 0, sizeof(ctx->cap_checked));
+}
+
+static inline bool disas_capreg_checks_tracked(int reg)
+{
+    return reg < NUM_LAZY_CAP_REGS && !lazy_capreg_number_is_special(reg);
+}
+
+static inline void disas_capreg_checks_invalidate(DisasContextBase *ctx,
+                                                  int reg)
+{
+    if (reg < NUM_LAZY_CAP_REGS) {
+        ctx->cap_checked[reg].perms = 0;
+        ctx->cap_checked[reg].lo = ctx->cap_checked[reg].hi = 0;
+    }
+}
+
+static inline void disas_capreg_checks_preserve(DisasContextBase *ctx)
+{
+    ctx->cap_checks_preserved = true;
+}
+
+// Whether reg is known to be tagged, unsealed and to have perms.
+static inline bool disas_capreg_checks_have_perms(DisasContextBase *ctx,
+                                                  int reg, uint32_t perms)
+{
+    return disas_capreg_checks_tracked(reg) &&
+           (ctx->cap_checked[reg].perms & perms) == perms &&
+           ctx->cap_checked[reg].perms != 0;
+}
+
+// Whether cursor + [offset, offset + size) of reg is known to be in bounds.
+static inline bool disas_capreg_checks_in_bounds(DisasContextBase *ctx,
+                                                 int reg, target_long offset,
+                                                 uint32_t size)
+{
+    return disas_capreg_checks_tracked(reg) &&
+           offset >= ctx->cap_checked[reg].lo &&
+           offset + (target_long)size <= ctx->cap_checked[reg].hi;
+}
+
+static inline void disas_capreg_checks_record_perms(DisasContextBase *ctx,
+                                                    int reg, uint32_t perms)
+{
+    if (disas_capreg_checks_tracked(reg)) {
+        ctx->cap_checked[reg].perms |= perms;
+    }
+}
+
+// Overlapping windows are merged. Disjoint ones are not, since the addresses
+// between them could wrap around the end of the address space.
+static inline void disas_capreg_checks_record_bounds(DisasContextBase *ctx,
+                                                     int reg,
+                                                     target_long offset,
+                                                     uint32_t size)
+{
+    target_long end = offset + (target_long)size;
+
+    if (!disas_capreg_checks_tracked(reg)) {
+        return;
+    }
+    if (offset < ctx->cap_checked[reg].hi && ctx->cap_checked[reg].lo < end) {
+        ctx->cap_checked[reg].lo = MIN(ctx->cap_checked[reg].lo, offset);
+        ctx->cap_checked[reg].hi = MAX(ctx->cap_checked[reg].hi, end);
+    } else {
+        ctx->cap_checked[reg].lo = offset;
+        ctx->cap_checked[reg].hi = end;
+    }
+}
+
 #endif // TARGET_CHERI
@@ -58,31 +58,6 @@ static inline void gen_cap_debug(DisasContext *ctx, int rx)
     tcg_temp_free_i32(tmp);
 }
 
-#define _gen_cap_check(type)                                                   \
-    static inline void generate_cap_##type##_check(                            \
-        TCGv_cap_checked_ptr resultaddr, uint32_t capreg, TCGv offset,         \
-        MemOp op)                                                              \
-    {                                                                          \
-        TCGv_i32 tcs = tcg_const_i32(capreg);                                  \
-        TCGv_i32 tsize = tcg_const_i32(memop_size(op));                        \
-        gen_helper_cap_##type##_check(resultaddr, cpu_env, tcs, offset,        \
-                                      tsize);                                  \
-        tcg_temp_free_i32(tsize);                                              \
-        tcg_temp_free_i32(tcs);                                                \
-    }                                                                          \
-    static inline void generate_cap_##type##_check_imm(                        \
-        TCGv_cap_checked_ptr resultaddr, uint32_t capreg, target_long offset,  \
-        MemOp op)                                                              \
-    {                                                                          \
-        TCGv toffset = tcg_const_tl(offset);                                   \
-        generate_cap_##type##_check(resultaddr, capreg, toffset, op);          \
-        tcg_temp_free(toffset);                                                \
-    }
-
-_gen_cap_check(load)
-_gen_cap_check(store)
-_gen_cap_check(rmw)
-
 #if CHERI_CAP_BITS == 128
 // FIXME: assumes small endian order between two 64-bit halves in a 128-bit
 // integer.
@@ -2250,4 +2225,193 @@ static inline void gen_cap_memop_checks(DisasContext *ctx, int regnum,
 #endif
 }
 
+// Checks that cursor + offset of capreg is in bounds for a memory access of
+// op, and that capreg is tagged, unsealed and has perms (unless check_perms is
+// false because that is already known). The common case is handled inline
+// using the decompressed register, the cap_{load,store,rmw}_check helper is
+// only called if any check fails to raise the appropriate exception. Because
+// of the branches, this will kill every temp other than offset, which is
+// copied before the first branch.
+static inline void gen_cap_offset_checks(DisasContext *ctx,
+                                         TCGv_cap_checked_ptr resultaddr,
+                                         uint32_t capreg, TCGv offset,
+                                         MemOp op, uint32_t perms,
+                                         bool check_perms)
+{
+    bool load = perms & CAP_PERM_LOAD;
+    bool store = perms & CAP_PERM_STORE;
+    void (*check_helper)(TCGv_cap_checked_ptr, TCGv_env, TCGv_i32, TCGv,
+                         TCGv_i32) =
+        (load && store) ? gen_helper_cap_rmw_check
+                        : (load ? gen_helper_cap_load_check
+                                : gen_helper_cap_store_check);
+    TCGv_i32 tcs, tsize;
+
+    // $ddc (register zero on MIPS) and the NULL register are not lazy
+    // capregs, let the helper deal with those.
+    if (capreg >= NUM_LAZY_CAP_REGS || lazy_capreg_number_is_special(capreg)) {
+        tcs = tcg_const_i32(capreg);
+        tsize = tcg_const_i32(memop_size(op));
+        check_helper(resultaddr, cpu_env, tcs, offset, tsize);
+        tcg_temp_free_i32(tsize);
+        tcg_temp_free_i32(tcs);
+        return;
+    }
+
+    TCGv local_offset = tcg_temp_local_new();
+    TCGv local_addr = tcg_temp_local_new();
+    tcg_gen_mov_tl(local_offset, offset);
+    // This may branch around the decompression helper.
+    gen_ensure_cap_decompressed(ctx, capreg);
+
+    TCGv result = tcg_temp_new();
+    TCGv tmp = tcg_temp_new();
+    size_t reg_offset = gp_register_offset(capreg);
+#ifdef TARGET_AARCH64
+    tcg_gen_mov_tl(local_addr, local_offset);
+#else
+    gen_cap_get_cursor(ctx, capreg, local_addr);
+    tcg_gen_add_tl(local_addr, local_addr, local_offset);
+#endif
+
+    if (check_perms) {
+        // Tagged. Loaded directly since capreg is now fully decompressed.
+        tcg_gen_ld8u_tl(result, cpu_env,
+                        reg_offset + offsetof(cap_register_t, cr_tag));
+        // Unsealed
+        gen_cap_get_unsealed(ctx, capreg, tmp);
+        tcg_gen_and_tl(result, result, tmp);
+        // Perms
+        gen_cap_has_perms(ctx, capreg, perms, tmp);
+        tcg_gen_and_tl(result, result, tmp);
+    } else {
+        tcg_gen_movi_tl(result, 1);
+    }
+    // Base
+    tcg_gen_ld_tl(tmp, cpu_env, reg_offset + offsetof(cap_register_t, cr_base));
+    tcg_gen_setcond_tl(TCG_COND_GEU, tmp, local_addr, tmp);
+    tcg_gen_and_tl(result, result, tmp);
+    // Top. Unlike gen_cap_addr_below_top() this does not assume an aligned
+    // address, so addr + size is compared against top without wrapping.
+#if CHERI_CAP_BITS == 128
+    {
+        TCGv_i64 end_lo = tcg_temp_new_i64();
+        TCGv_i64 end_hi = tcg_temp_new_i64();
+        TCGv_i64 top = tcg_const_i64(0);
+        TCGv_i64 size = tcg_const_i64(memop_size(op));
+        tcg_gen_add2_i64(end_lo, end_hi, local_addr, top, size, top);
+        // (end_hi:end_lo) <= (top_hi:top_lo)
+        tcg_gen_ld_i64(top, cpu_env,
+                       reg_offset + offsetof(cap_register_t, _cr_top) +
+                           CAP_TOP_LOBYTES_OFFSET);
+        tcg_gen_setcond_i64(TCG_COND_LEU, end_lo, end_lo, top);
+        tcg_gen_ld_i64(top, cpu_env,
+                       reg_offset + offsetof(cap_register_t, _cr_top) +
+                           CAP_TOP_HIBYTES_OFFSET);
+        tcg_gen_setcond_i64(TCG_COND_EQ, size, end_hi, top);
+        tcg_gen_and_i64(end_lo, end_lo, size);
+        tcg_gen_setcond_i64(TCG_COND_LTU, size, end_hi, top);
+        tcg_gen_or_i64(end_lo, end_lo, size);
+        tcg_gen_and_i64(result, result, end_lo);
+        tcg_temp_free_i64(size);
+        tcg_temp_free_i64(top);
+        tcg_temp_free_i64(end_hi);
+        tcg_temp_free_i64(end_lo);
+    }
+#else
+    {
+        // Addresses are 32 bits, so addr + size cannot wrap in 64 bits.
+        TCGv_i64 end = tcg_temp_new_i64();
+        TCGv_i64 top = tcg_temp_new_i64();
+        tcg_gen_extu_tl_i64(end, local_addr);
+        tcg_gen_addi_i64(end, end, memop_size(op));
+        tcg_gen_ld_i64(top, cpu_env,
+                       reg_offset + offsetof(cap_register_t, _cr_top));
+        tcg_gen_setcond_i64(TCG_COND_LEU, end, end, top);
+        tcg_gen_trunc_i64_tl(tmp, end);
+        tcg_gen_and_tl(result, result, tmp);
+        tcg_temp_free_i64(top);
+        tcg_temp_free_i64(end);
+    }
+#endif
+#ifdef TARGET_AARCH64
+    // On Morello all invalid exponent caps are always out of bounds.
+    gen_cap_load_bounds_valid(ctx, capreg, tmp);
+    tcg_gen_and_tl(result, result, tmp);
+#endif
+    cheri_tcg_printf_verbose("cdd", "Reg %d inline check of %lx: %d\n", capreg,
+                             local_addr, result);
+
+    TCGLabel *skip = gen_new_label();
+    tcg_gen_brcondi_tl(TCG_COND_NE, result, 0, skip);
+    tcg_temp_free(result);
+    tcg_temp_free(tmp);
+    // Failure path: the helper repeats the checks and raises the exception.
+    tcs = tcg_const_i32(capreg);
+    tsize = tcg_const_i32(memop_size(op));
+    check_helper(resultaddr, cpu_env, tcs, local_offset, tsize);
+    tcg_temp_free_i32(tsize);
+    tcg_temp_free_i32(tcs);
+    gen_set_label(skip);
+    tcg_gen_mov_tl((TCGv)resultaddr, local_addr);
+
+    tcg_temp_free(local_addr);
+    tcg_temp_free(local_offset);
+}
+
+// Emits the checks for capreg + offset that have not already passed earlier
+// in the TB, see disas_capreg_checks_preserve().
+static inline void gen_cap_offset_checks_tracked(
+    DisasContext *ctx, TCGv_cap_checked_ptr resultaddr, uint32_t capreg,
+    TCGv offset, MemOp op, uint32_t perms)
+{
+    bool check_perms =
+        !disas_capreg_checks_have_perms(&ctx->base, capreg, perms);
+    gen_cap_offset_checks(ctx, resultaddr, capreg, offset, op, perms,
+                          check_perms);
+    disas_capreg_checks_record_perms(&ctx->base, capreg, perms);
+}
+
+// Constant offsets can additionally skip the bounds check if an earlier access
+// in the TB already covered [offset, offset + size).
+static inline void gen_cap_offset_checks_tracked_imm(
+    DisasContext *ctx, TCGv_cap_checked_ptr resultaddr, uint32_t capreg,
+    target_long offset, MemOp op, uint32_t perms)
+{
+    if (disas_capreg_checks_have_perms(&ctx->base, capreg, perms) &&
+        disas_capreg_checks_in_bounds(&ctx->base, capreg, offset,
+                                      memop_size(op))) {
+        cheri_tcg_printf_verbose("cc", "Reg %d check of offset %d elided\n",
+                                 capreg, (int)offset);
+        gen_cap_get_cursor(ctx, capreg, (TCGv)resultaddr);
+        tcg_gen_addi_tl((TCGv)resultaddr, (TCGv)resultaddr, offset);
+        return;
+    }
+    TCGv toffset = tcg_const_tl(offset);
+    gen_cap_offset_checks_tracked(ctx, resultaddr, capreg, toffset, op, perms);
+    tcg_temp_free(toffset);
+    disas_capreg_checks_record_bounds(&ctx->base, capreg, offset,
+                                      memop_size(op));
+}
+
+#define _gen_cap_check(type, perms)                                            \
+    static inline void generate_cap_##type##_check(                            \
+        TCGv_cap_checked_ptr resultaddr, DisasContext *ctx, uint32_t capreg,   \
+        TCGv offset, MemOp op)                                                 \
+    {                                                                          \
+        gen_cap_offset_checks_tracked(ctx, resultaddr, capreg, offset, op,     \
+                                      perms);                                  \
+    }                                                                          \
+    static inline void generate_cap_##type##_check_imm(                        \
+        TCGv_cap_checked_ptr resultaddr, DisasContext *ctx, uint32_t capreg,   \
+        target_long offset, MemOp op)                                          \
+    {                                                                          \
+        gen_cap_offset_checks_tracked_imm(ctx, resultaddr, capreg, offset, op, \
+                                          perms);                              \
+    }
+
+_gen_cap_check(load, CAP_PERM_LOAD)
+_gen_cap_check(store, CAP_PERM_STORE)
+_gen_cap_check(rmw, CAP_PERM_LOAD | CAP_PERM_STORE)
+
 #endif // TARGET_CHERI
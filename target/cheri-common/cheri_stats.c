@@ -0,0 +1,95 @@
+/*-
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * QMP access to the per-vCPU capability statcounters (cheri-statcounters.h)
+ * and the out-of-bounds statistics (cheri-bounds-stats.h).
+ */
+#include "qemu/osdep.h"
+#include "cpu.h"
+#include "hw/core/cpu.h"
+#include "qapi/qapi-commands-misc-target.h"
+#include "cheri-helper-utils.h"
+
+static CheriStatsList *query_cheri_cpu_stats(void)
+{
+    CheriStatsList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+        CheriStats *stats = g_new0(CheriStats, 1);
+
+        stats->cpu_index = cpu->cpu_index;
+        stats->cap_loads = cheri_stat_read(env, cap_read);
+        stats->cap_loads_tagged = cheri_stat_read(env, cap_read_tagged);
+        stats->cap_stores = cheri_stat_read(env, cap_write);
+        stats->cap_stores_tagged = cheri_stat_read(env, cap_write_tagged);
+        stats->setbounds = cheri_stat_read(env, setbounds);
+        stats->setbounds_imprecise = cheri_stat_read(env, imprecise_setbounds);
+        stats->unrepresentable = cheri_stat_read(env, unrepresentable_caps);
+        stats->seals = cheri_stat_read(env, seal);
+        stats->unseals = cheri_stat_read(env, unseal);
+        stats->itlb_misses = cheri_stat_read(env, itlb_miss);
+        stats->dtlb_misses = cheri_stat_read(env, dtlb_miss);
+
+        *tail = g_new0(CheriStatsList, 1);
+        (*tail)->value = stats;
+        tail = &(*tail)->next;
+    }
+    return head;
+}
+
+#ifdef DO_CHERI_STATISTICS
+static const struct oob_stats_info *const bounds_stats[] = {
+    &oob_info_cincoffset,       &oob_info_csetoffset,
+    &oob_info_csetaddr,         &oob_info_candaddr,
+    &oob_info_cfromptr,         &oob_info_cgetpccsetoffset,
+    &oob_info_cgetpccincoffset, &oob_info_cgetpccsetaddr,
+    &oob_info_misc,
+};
+
+static CheriBoundsStats *query_cheri_bounds_stats(
+    const struct oob_stats_info *info)
+{
+    CheriBoundsStats *stats = g_new0(CheriBoundsStats, 1);
+    CheriBoundsBucketList **tail = &stats->buckets;
+    struct oob_stats_snapshot snap;
+
+    read_out_of_bounds_stats(info, &snap);
+    stats->operation = g_strdup(info->operation);
+    stats->uses = snap.num_uses;
+    stats->unrepresentable = snap.unrepresentable;
+    for (int i = 0; i < ARRAY_SIZE(snap.after_bounds); i++) {
+        CheriBoundsBucket *bucket = g_new0(CheriBoundsBucket, 1);
+
+        if (i < ARRAY_SIZE(bounds_buckets)) {
+            bucket->has_limit = true;
+            bucket->limit = bounds_buckets[i].howmuch;
+        }
+        bucket->after = snap.after_bounds[i];
+        bucket->before = snap.before_bounds[i];
+        *tail = g_new0(CheriBoundsBucketList, 1);
+        (*tail)->value = bucket;
+        tail = &(*tail)->next;
+    }
+    return stats;
+}
+#endif
+
+CheriStatsInfo *qmp_query_cheri_stats(Error **errp)
+{
+    CheriStatsInfo *info = g_new0(CheriStatsInfo, 1);
+
+    info->cpus = query_cheri_cpu_stats();
+#ifdef DO_CHERI_STATISTICS
+    CheriBoundsStatsList **tail = &info->bounds;
+
+    info->has_bounds = true;
+    for (int i = 0; i < ARRAY_SIZE(bounds_stats); i++) {
+        *tail = g_new0(CheriBoundsStatsList, 1);
+        (*tail)->value = query_cheri_bounds_stats(bounds_stats[i]);
+        tail = &(*tail)->next;
+    }
+#endif
+    return info;
+}
@@ -37,8 +37,20 @@
 #include "exec/ramblock.h"
 #include "cheri_defs.h"
 #include "cheri-helper-utils.h"
-// XXX: use hbitmap? Or a different data structure?
 #include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/option.h"
+#include "qemu/seqlock-stripes.h"
+#include "qemu/host-utils.h"
+#include "qemu/rcu.h"
+#include "qemu/units.h"
+#include "exec/ramlist.h"
+#include "monitor/monitor.h"
+#include "monitor/hmp-target.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/thread.h"
+#include "tcg/tcg.h"
 #include "glib/ghash.h"
 
 #if defined(TARGET_MIPS)
@@ -59,25 +71,69 @@
  * capability-sized word in physical memory.  This allows capabilities
  * to be safely loaded and stored in meory without loss of integrity.
  *
- * For emulation purposes the tag is stored in a two-level array containing
- * fixed size bitmaps. To reduce the amount of memory needed the tag flag array
- * is allocated sparsely, 4K tags at at time, and on demand.
- * This 4K number is arbitary and depending on the workload other sizes may be
- * better.
+ * For emulation purposes the tags are stored in one of the following
+ * backends, selected with -cheri-tagmem before the machine is created:
  *
- * Note: We also support an mode where we use one byte per tag. This makes it
- * easy to set or unset a tag without the need of locking or atomics.
- * This requires eight times the memory.
+ * - "sparse" (default): a two-level array containing fixed size bitmaps. To
+ *   reduce the amount of memory needed the tag flag array is allocated
+ *   sparsely, 4K tags (tunable with blocksize=) at a time, and on demand.
+ *   Pages without a tag block are mapped as ALL_ZERO_TAGBLK in the TLB, so
+ *   the first tagged store to such a block requires a TLB shootdown.
+ * - "flat": one bitmap per RAMBlock in lazily allocated anonymous memory. The
+ *   host kernel maps untouched parts to the shared zero page, so memory use
+ *   grows with the touched part of the bitmap, but it is never returned.
+ *   Lookups never have to allocate or flush the TLB.
+ * - "indexed": like "flat" but additionally maintains an index with one bit
+ *   per bitmap word that may be non-zero (see bitmap_index_mark_atomic()).
+ *   This costs one more atomic OR whenever a word changes from zero to
+ *   non-zero but makes cheri_tag_find_next() skip large untagged ranges
+ *   quickly.
  *
- * As tag accesses are not atomic with regard to data writes/reads spurious
- * invalid capabilities could be created in a threaded context.
- * Therefore, we don't use atomic bitwise RMW operations and the one byte per
- * tag variant actually performs slightly worse due to increased memory usage.
+ * In all cases the TLB caches a pointer to the tag bitmap words of the page.
  *
- * FIXME: find a solution to make tags safe (or just always disable multi-tcg)
+ * Individual tag bits are always updated using atomic bitwise RMW operations,
+ * but on their own those are not atomic with regard to the data writes/reads
+ * of the capability-sized word they describe, so spurious invalid (or even
+ * valid!) capabilities could be created in a threaded context.
  *
- * XXX Should consider adding a reference count per tag block so that
- * blocks can be deallocated when no longer used maybe.
+ * When running with MTTCG we therefore switch to "atomic tag memory"
+ * (cheri_tagmem_atomic): every tag granule is covered by one of a fixed
+ * number of striped sequence locks (keyed by host address). Capability stores
+ * and plain data stores to pages that have a tag block update data and tag
+ * while holding the line lock, and capability loads read data and tag inside
+ * a seqlock read section that is retried if a writer raced with it. This makes
+ * capability loads/stores linearizable with respect to all TCG data stores.
+ * Pages that may hold tags are mapped with TLB_CHERI_TAGS in this mode, so
+ * plain stores to them leave the inline fast path and clear the tag under the
+ * line lock (cheri_tag_store_data_locked()). Which pages those are is kept in
+ * a per-RAMBlock bitmap with one bit per page (tagged_pages), whatever the
+ * backend; all other pages are mapped as ALL_ZERO_TAGBLK and stores to them
+ * stay inline. The bit is set by the first capability store to the page:
+ * all vCPUs flush their TLBs (as when a new tag block is allocated) and the
+ * storing instruction is restarted, so no vCPU can still hold a stale
+ * ALL_ZERO_TAGBLK entry once the first tag is set. The reclaim pass below
+ * clears the bits of pages that no longer hold any tags.
+ *
+ * Atomic RMW instructions and DMA writes still clear the tag after updating
+ * the data, so a malicious guest racing those against capability loads from
+ * another vCPU could still observe a stale tag.
+ *
+ * Every tag block has a population count of the tags that are set in it.
+ * Tag blocks are carved out of naturally aligned chunks whose first slot holds
+ * the counts for the other blocks in that chunk, so the count can be found from
+ * the bitmap pointers cached in the iotlb. Once enough blocks have dropped to
+ * a population of zero (or, with atomic tag memory, enough pages have lost
+ * their last tag), an exclusive reclaim pass (cheri_tag_reclaim_work())
+ * flushes all TLBs, unhooks all empty blocks and returns the blocks to a free
+ * pool after an RCU grace period (DMA invalidation does not use the TLB).
+ * Chunks that are entirely free are returned to the host once the pool has
+ * grown large. "info cheri-tagmem" shows the resident tag memory per RAMBlock.
+ *
+ * The population counts (or the bitmap index) also act as summaries for
+ * cheri_tag_range_has_tags() and cheri_tag_find_next(), which let host code
+ * skip untagged memory without looking at the bitmaps. Guest tag queries
+ * (cloadtags) already take the equivalent shortcut through the
+ * ALL_ZERO_TAGBLK pointer cached in the TLB.
  *
  * FIXME: rewrite using somethign more like the upcoming MTE changes (https://github.com/rth7680/qemu/commits/tgt-arm-mte-user)
  *
@@ -90,11 +146,31 @@
  * DMA write and the tag invalidate.
  */
 
-#define CAP_TAGBLK_SHFT     12          // 2^12 or 4096 tags per block
-#define CAP_TAGBLK_MSK      ((1 << CAP_TAGBLK_SHFT) - 1)
-#define CAP_TAGBLK_SIZE       (1 << CAP_TAGBLK_SHFT)
+typedef enum CheriTagMemBackend {
+    CHERI_TAGMEM_SPARSE,
+    CHERI_TAGMEM_FLAT,
+    CHERI_TAGMEM_INDEXED,
+} CheriTagMemBackend;
+
+static const char *const cheri_tagmem_backend_names[] = {
+    [CHERI_TAGMEM_SPARSE] = "sparse",
+    [CHERI_TAGMEM_FLAT] = "flat",
+    [CHERI_TAGMEM_INDEXED] = "indexed",
+};
+
+static CheriTagMemBackend cheri_tagmem_backend = CHERI_TAGMEM_SPARSE;
+static unsigned cap_tagblk_shft = 12; // 2^12 or 4096 tags per block
+
+#define CAP_TAGBLK_SHFT     cap_tagblk_shft
+#define CAP_TAGBLK_MSK      ((1UL << CAP_TAGBLK_SHFT) - 1)
+#define CAP_TAGBLK_SIZE       (1UL << CAP_TAGBLK_SHFT)
 #define CAP_TAGBLK_IDX(tag_idx) ((tag_idx) & CAP_TAGBLK_MSK)
+#define CAP_TAGBLK_BYTES    (CAP_TAGBLK_SIZE / BITS_PER_BYTE)
+/* Upper limit for blocksize=, keeps chunks (see below) at most 1 MiB. */
+#define CAP_TAGBLK_MAX_SHFT 16
 #define TAGS_PER_PAGE        (TARGET_PAGE_SIZE / CHERI_CAP_SIZE)
+/* Size of the bitmap words holding the tags of one page */
+#define TAG_BYTES_PER_PAGE   (BITS_TO_LONGS(TAGS_PER_PAGE) * sizeof(unsigned long))
 
 #ifndef CAP_TAG_GET_MANY_SHFT
 #error "Define a CAP_TAG_GET_MANY_SHFT in appropriate cheri-archspecific.h"
@@ -113,52 +189,531 @@ _Static_assert(CAP_TAG_GET_MANY_SHFT <= 3, "");
 #define CAP_TAG_GET_MANY_MASK ((1 << (1UL << CAP_TAG_GET_MANY_SHFT)) - 1UL)
 #define CAP_TAG_MANY_DATA_SIZE (CHERI_CAP_SIZE << CAP_TAG_GET_MANY_SHFT)
 
+bool cheri_tagmem_atomic;
+
+/*
+ * Striped line locks used for cheri_tagmem_atomic. Adjacent tag granules map
+ * to different stripes, so false sharing between unrelated capability
+ * accesses is rare. Zero-initialized stripes are unlocked.
+ */
+#define CAP_TAG_LINE_LOCKS (1 << 10)
+
+static SeqLockStripe cheri_tag_line_locks[CAP_TAG_LINE_LOCKS];
+
+/*
+ * Set when this vCPU thread had to allocate a tag block while running with
+ * cheri_tagmem_atomic. The instruction that triggered the allocation must be
+ * restarted after all other vCPUs have flushed their TLBs.
+ */
+static __thread bool cheri_tag_new_block_pending;
+
+static inline void cheri_tag_reclaim_kick(void);
+
+static inline QEMU_ALWAYS_INLINE SeqLockStripe *
+cheri_tag_line_lock(const void *host)
+{
+    return seqlock_stripe(cheri_tag_line_locks, CAP_TAG_LINE_LOCKS,
+                          (uintptr_t)host / CHERI_CAP_SIZE);
+}
+
+void cheri_tag_line_write_lock(const void *host)
+{
+    seqlock_stripe_write_lock(cheri_tag_line_lock(host));
+}
+
+void cheri_tag_line_write_unlock(const void *host)
+{
+    seqlock_stripe_write_unlock(cheri_tag_line_lock(host));
+    cheri_tag_reclaim_kick();
+}
+
+unsigned cheri_tag_line_read_begin(const void *host)
+{
+    return seqlock_stripe_read_begin(cheri_tag_line_lock(host));
+}
+
+bool cheri_tag_line_read_retry(const void *host, unsigned start)
+{
+    return seqlock_stripe_read_retry(cheri_tag_line_lock(host), start);
+}
+
+static inline QEMU_ALWAYS_INLINE void
+cheri_tag_check_new_block(CPUArchState *env, uintptr_t pc)
+{
+    if (unlikely(cheri_tag_new_block_pending)) {
+        cheri_tag_new_block_pending = false;
+        /*
+         * Other vCPUs may still have ALL_ZERO_TAGBLK cached for this page and
+         * would not lock the line for plain stores. Exit to the main loop so
+         * that the synced TLB flush completes before we set any tags.
+         */
+        cpu_loop_exit_restore(env_cpu(env), pc);
+    }
+}
+
+static inline size_t num_tags(RAMBlock *ram)
+{
+    return memory_region_size(ram->mr) / CHERI_CAP_SIZE;
+}
+
 static inline size_t num_tagblocks(RAMBlock* ram)
 {
-    uint64_t memory_size = memory_region_size(ram->mr);
-    size_t result = DIV_ROUND_UP(memory_size, CHERI_CAP_SIZE * CAP_TAGBLK_SIZE);
-    assert(result == (memory_size / CHERI_CAP_SIZE) >> CAP_TAGBLK_SHFT);
-    return result;
+    return DIV_ROUND_UP(num_tags(ram), CAP_TAGBLK_SIZE);
+}
+
+/* A sparse tag block is a bitmap of CAP_TAGBLK_SIZE bits. */
+typedef unsigned long CheriTagBlock;
+
+/*
+ * Slot 0 of every chunk holds the population counts of the other slots. The
+ * number of slots is limited so that chunks for large blocks stay small.
+ */
+#define CAP_TAGCHUNK_SLOTS  MIN(CAP_TAGBLK_BYTES / sizeof(uint32_t), 128)
+#define CAP_TAGCHUNK_SIZE   (CAP_TAGBLK_BYTES * CAP_TAGCHUNK_SLOTS)
+
+struct CheriTagMem {
+    /* sparse: number of non-NULL entries in blocks[] */
+    size_t resident_blocks;
+    /* flat/indexed: the bitmap holding all tags of this RAMBlock */
+    unsigned long *bitmap;
+    size_t bitmap_size;
+    /* indexed: one bit per word of bitmap that may be non-zero */
+    unsigned long *index;
+    /* cheri_tagmem_atomic: one bit per page that may hold tags */
+    unsigned long *tagged_pages;
+    /* sparse: the tag blocks */
+    CheriTagBlock *blocks[];
+};
+
+/*
+ * Once this many blocks have dropped to zero tags we schedule a reclaim pass.
+ * This avoids stopping all vCPUs every time a single block becomes empty.
+ */
+#define CAP_TAGBLK_RECLAIM_THRESHOLD 1024
+
+/*
+ * Likewise, the number of pages that lost their last tag, with atomic tag
+ * memory, before a reclaim pass maps them without TLB_CHERI_TAGS again.
+ */
+#define CAP_TAGPAGE_RECLAIM_THRESHOLD 1024
+
+static QemuMutex cheri_tag_pool_lock;
+/* Free (all-zero) tag blocks, linked through their first bitmap word. */
+static CheriTagBlock *cheri_tag_pool;
+static size_t cheri_tag_pool_blocks;
+static size_t cheri_tag_empty_blocks;
+static size_t cheri_tag_empty_pages;
+static bool cheri_tag_reclaim_scheduled;
+
+static void __attribute__((__constructor__)) cheri_tag_pool_init(void)
+{
+    qemu_mutex_init(&cheri_tag_pool_lock);
+}
+
+/* The count of slot 0 is unused, it holds the number of slots in use. */
+static inline QEMU_ALWAYS_INLINE uint32_t *tagchunk_used(void *tagmem)
+{
+    return (uint32_t *)((uintptr_t)tagmem &
+                        ~(uintptr_t)(CAP_TAGCHUNK_SIZE - 1));
+}
+
+static inline QEMU_ALWAYS_INLINE uint32_t *tagblock_population(void *tagmem)
+{
+    uintptr_t chunk = (uintptr_t)tagmem & ~(uintptr_t)(CAP_TAGCHUNK_SIZE - 1);
+    size_t slot = ((uintptr_t)tagmem - chunk) / CAP_TAGBLK_BYTES;
+    cheri_debug_assert(slot != 0 && "Pointer into chunk header?");
+    return (uint32_t *)chunk + slot;
+}
+
+/* Called when a word of the bitmap of an indexed tagmem becomes non-zero. */
+static inline void tagmem_index_word(RAMBlock *ram, unsigned long *p)
+{
+    struct CheriTagMem *tm = ram->cheri_tags;
+
+    cheri_debug_assert(p >= tm->bitmap && p < tm->bitmap + tm->bitmap_size);
+    bitmap_index_mark_atomic(tm->index, p - tm->bitmap);
+}
+
+static void cheri_tag_reclaim_work(CPUState *cpu, run_on_cpu_data data);
+
+/*
+ * Set when this thread emptied the block that crossed the reclaim threshold.
+ * Population counts drop while line locks are held, so the reclaim pass is
+ * only scheduled by cheri_tag_reclaim_kick() once those have been released.
+ */
+static __thread bool cheri_tag_reclaim_wanted;
+
+static inline void cheri_tag_reclaim_kick(void)
+{
+    if (unlikely(cheri_tag_reclaim_wanted)) {
+        cheri_tag_reclaim_wanted = false;
+        if (first_cpu && !qatomic_xchg(&cheri_tag_reclaim_scheduled, true)) {
+            async_safe_run_on_cpu(first_cpu, cheri_tag_reclaim_work,
+                                  RUN_ON_CPU_NULL);
+        }
+    }
+}
+
+static inline QEMU_ALWAYS_INLINE void
+tagblock_population_add(void *tagmem, int delta)
+{
+    if (delta >= 0) {
+        qatomic_add(tagblock_population(tagmem), delta);
+    } else if (qatomic_fetch_sub(tagblock_population(tagmem), -delta) ==
+               -delta) {
+        /* Block is now empty, maybe time to reclaim some blocks. */
+        if (qatomic_fetch_inc(&cheri_tag_empty_blocks) + 1 >=
+            CAP_TAGBLK_RECLAIM_THRESHOLD) {
+            cheri_tag_reclaim_wanted = true;
+        }
+    }
+}
+
+static inline bool cheri_tag_page_armed(RAMBlock *ram, ram_addr_t offset)
+{
+    unsigned long *tagged_pages = ram->cheri_tags->tagged_pages;
+    size_t page = offset >> TARGET_PAGE_BITS;
+
+    return (qatomic_read(&tagged_pages[BIT_WORD(page)]) & BIT_MASK(page)) != 0;
+}
+
+static inline void cheri_tag_page_arm(RAMBlock *ram, ram_addr_t offset)
+{
+    set_bit_atomic(offset >> TARGET_PAGE_BITS, ram->cheri_tags->tagged_pages);
+}
+
+/* Called with atomic tag memory when @n pages may have lost their last tag. */
+static void cheri_tag_pages_emptied(size_t n)
+{
+    if (qatomic_fetch_add(&cheri_tag_empty_pages, n) + n >=
+        CAP_TAGPAGE_RECLAIM_THRESHOLD) {
+        cheri_tag_reclaim_wanted = true;
+    }
 }
 
-typedef struct CheriTagBlock {
-    DECLARE_BITMAP(tag_bitmap, CAP_TAGBLK_SIZE);
-} CheriTagBlock;
+/*
+ * Called with atomic tag memory after the bitmap word @p dropped to zero.
+ * Counts the page as empty if none of its other words hold tags either.
+ */
+static void cheri_tag_word_emptied(unsigned long *p)
+{
+    void *page = QEMU_ALIGN_PTR_DOWN(p, TAG_BYTES_PER_PAGE);
+
+    if (buffer_is_zero(page, TAG_BYTES_PER_PAGE)) {
+        cheri_tag_pages_emptied(1);
+    }
+}
 
+static void cheri_tag_pool_put_locked(CheriTagBlock *tagblk)
+{
+    cheri_debug_assert(*tagblock_population(tagblk) == 0);
+    tagblk[0] = (unsigned long)cheri_tag_pool;
+    cheri_tag_pool = tagblk;
+    cheri_tag_pool_blocks++;
+    (*tagchunk_used(tagblk))--;
+}
+
+static CheriTagBlock *cheri_tag_pool_get(void)
+{
+    CheriTagBlock *tagblk;
+
+    qemu_mutex_lock(&cheri_tag_pool_lock);
+    if (!cheri_tag_pool) {
+        /* Refill the pool with a new chunk. */
+        void *chunk = qemu_memalign(CAP_TAGCHUNK_SIZE, CAP_TAGCHUNK_SIZE);
+        memset(chunk, 0, CAP_TAGCHUNK_SIZE);
+        *tagchunk_used(chunk) = CAP_TAGCHUNK_SLOTS - 1;
+        for (size_t i = CAP_TAGCHUNK_SLOTS - 1; i > 0; i--) {
+            cheri_tag_pool_put_locked(
+                (CheriTagBlock *)((char *)chunk + i * CAP_TAGBLK_BYTES));
+        }
+    }
+    tagblk = cheri_tag_pool;
+    cheri_tag_pool = (CheriTagBlock *)tagblk[0];
+    cheri_tag_pool_blocks--;
+    (*tagchunk_used(tagblk))++;
+    qemu_mutex_unlock(&cheri_tag_pool_lock);
+
+    tagblk[0] = 0;
+    return tagblk;
+}
 
 static CheriTagBlock *cheri_tag_new_tagblk(RAMBlock *ram, uint64_t tagidx)
 {
     CheriTagBlock *tagblk, *old;
 
-    tagblk = g_malloc0(sizeof(CheriTagBlock));
-    if (tagblk == NULL) {
-        error_report("Can't allocate tag block.");
-        exit(1);
-    }
+    tagblk = cheri_tag_pool_get();
 
-    CheriTagBlock **tagmem = (CheriTagBlock **)ram->cheri_tags;
+    CheriTagBlock **tagmem = ram->cheri_tags->blocks;
     size_t tagblock_index = (tagidx >> CAP_TAGBLK_SHFT);
     /* Possible race here so use atomic compare and swap. */
     cheri_debug_assert(tagblock_index < num_tagblocks(ram) &&
                        "Tag index out of bounds");
     old = qatomic_cmpxchg(&tagmem[tagblock_index], NULL, tagblk);
     if (old != NULL) {
-        /* Lost the race, free. */
-        g_free(tagblk);
+        /* Lost the race, return it to the pool. */
+        qemu_mutex_lock(&cheri_tag_pool_lock);
+        cheri_tag_pool_put_locked(tagblk);
+        qemu_mutex_unlock(&cheri_tag_pool_lock);
         return old;
     } else {
+        qatomic_inc(&ram->cheri_tags->resident_blocks);
         return tagblk;
     }
 }
 
+typedef struct CheriTagReclaim {
+    struct rcu_head rcu;
+    size_t nblocks;
+    CheriTagBlock *blocks[];
+} CheriTagReclaim;
+
+/*
+ * Return chunks whose blocks are all in the free pool to the host, once the
+ * pool holds more than this many blocks.
+ */
+#define CAP_TAGBLK_POOL_KEEP CAP_TAGBLK_RECLAIM_THRESHOLD
+
+static void cheri_tag_pool_trim_locked(void)
+{
+    CheriTagBlock *tagblk = cheri_tag_pool, *prev = NULL;
+    GHashTable *chunks;
+
+    if (cheri_tag_pool_blocks <= CAP_TAGBLK_POOL_KEEP) {
+        return;
+    }
+    chunks = g_hash_table_new(NULL, NULL);
+    while (tagblk) {
+        CheriTagBlock *next = (CheriTagBlock *)tagblk[0];
+        if (*tagchunk_used(tagblk) == 0) {
+            if (prev) {
+                prev[0] = (unsigned long)next;
+            } else {
+                cheri_tag_pool = next;
+            }
+            cheri_tag_pool_blocks--;
+            g_hash_table_add(chunks, tagchunk_used(tagblk));
+        } else {
+            prev = tagblk;
+        }
+        tagblk = next;
+    }
+
+    GHashTableIter iter;
+    gpointer chunk;
+    g_hash_table_iter_init(&iter, chunks);
+    while (g_hash_table_iter_next(&iter, &chunk, NULL)) {
+        qemu_vfree(chunk);
+    }
+    g_hash_table_destroy(chunks);
+}
+
+static void cheri_tag_reclaim_free(CheriTagReclaim *reclaim)
+{
+    qemu_mutex_lock(&cheri_tag_pool_lock);
+    for (size_t i = 0; i < reclaim->nblocks; i++) {
+        cheri_tag_pool_put_locked(reclaim->blocks[i]);
+    }
+    cheri_tag_pool_trim_locked();
+    qemu_mutex_unlock(&cheri_tag_pool_lock);
+    g_free(reclaim);
+}
+
+/*
+ * Runs while all vCPUs are stopped, so no tags can be set concurrently (DMA
+ * can only clear tags). The TLBs of all vCPUs are flushed right here, before
+ * any empty block is unhooked, so no vCPU can resume with a cached pointer
+ * into one. The blocks are only reused once every RCU reader (e.g.
+ * cheri_tag_phys_invalidate()) has finished.
+ */
+static void cheri_tag_reclaim_work(CPUState *cpu, run_on_cpu_data data)
+{
+    RAMBlock *block;
+    CPUState *other;
+    GPtrArray *empty = g_ptr_array_new();
+
+    qatomic_set(&cheri_tag_empty_blocks, 0);
+    qatomic_set(&cheri_tag_empty_pages, 0);
+    CPU_FOREACH(other) {
+        tlb_flush_exclusive(other);
+    }
+    RCU_READ_LOCK_GUARD();
+    RAMBLOCK_FOREACH(block) {
+        if (!block->cheri_tags) {
+            continue;
+        }
+        unsigned long *tagged_pages = block->cheri_tags->tagged_pages;
+        if (tagged_pages) {
+            /* Pages without tags go back to inline stores. */
+            size_t npages = DIV_ROUND_UP(num_tags(block), TAGS_PER_PAGE);
+            for (size_t page = find_first_bit(tagged_pages, npages);
+                 page < npages;
+                 page = find_next_bit(tagged_pages, npages, page + 1)) {
+                if (!cheri_tag_range_has_tags(block,
+                                              page << TARGET_PAGE_BITS,
+                                              TARGET_PAGE_SIZE)) {
+                    qatomic_and(&tagged_pages[BIT_WORD(page)],
+                                ~BIT_MASK(page));
+                }
+            }
+        }
+        if (cheri_tagmem_backend != CHERI_TAGMEM_SPARSE) {
+            continue;
+        }
+        CheriTagBlock **tagmem = block->cheri_tags->blocks;
+        for (size_t i = 0; i < num_tagblocks(block); i++) {
+            CheriTagBlock *tagblk = qatomic_read(&tagmem[i]);
+            if (tagblk && qatomic_read(tagblock_population(tagblk)) == 0) {
+                qatomic_set(&tagmem[i], NULL);
+                qatomic_dec(&block->cheri_tags->resident_blocks);
+                g_ptr_array_add(empty, tagblk);
+            }
+        }
+    }
+
+    if (empty->len) {
+        CheriTagReclaim *reclaim = g_malloc(
+            sizeof(CheriTagReclaim) + empty->len * sizeof(CheriTagBlock *));
+        reclaim->nblocks = empty->len;
+        memcpy(reclaim->blocks, empty->pdata,
+               empty->len * sizeof(CheriTagBlock *));
+        call_rcu(reclaim, cheri_tag_reclaim_free, rcu);
+    }
+    g_ptr_array_free(empty, true);
+    qatomic_set(&cheri_tag_reclaim_scheduled, false);
+}
+
+/* Capabilities that the -c sweep of "info cheri-tagmem" decodes at a time */
+#define CAP_SWEEP_BATCH 64
+
+typedef struct CheriCapSweep {
+    size_t tagged;
+    size_t sealed;
+    size_t executable;
+} CheriCapSweep;
+
+static void cheri_cap_sweep_batch(CheriCapSweep *sweep,
+                                  const target_ulong *pesbt,
+                                  const target_ulong *cursor, size_t n)
+{
+    cap_register_t caps[CAP_SWEEP_BATCH];
+    bool tags[CAP_SWEEP_BATCH];
+
+    memset(tags, true, sizeof(tags));
+    CAP_cc(decompress_mem_batch)(pesbt, cursor, tags, caps, n);
+    for (size_t i = 0; i < n; i++) {
+        sweep->tagged++;
+        if (!cap_is_unsealed(&caps[i])) {
+            sweep->sealed++;
+        }
+        if (cap_has_perms(&caps[i], CAP_PERM_EXECUTE)) {
+            sweep->executable++;
+        }
+    }
+}
+
+/*
+ * Decode every tagged capability in @block. Only words with their tag set
+ * are read, and those are decompressed CAP_SWEEP_BATCH at a time. Stores by
+ * running vCPUs may race with the sweep, so the result is a snapshot.
+ */
+static void cheri_cap_sweep(RAMBlock *block, CheriCapSweep *sweep)
+{
+    target_ulong pesbt[CAP_SWEEP_BATCH], cursor[CAP_SWEEP_BATCH];
+    ram_addr_t len = block->used_length;
+    size_t n = 0;
+
+    for (ram_addr_t off = cheri_tag_find_next(block, 0, len); off < len;
+         off = cheri_tag_find_next(block, off + CHERI_CAP_SIZE, len)) {
+        uint8_t *host = ramblock_ptr(block, off);
+
+#if TARGET_LONG_BITS == 32
+        pesbt[n] = ldl_p(host + CHERI_MEM_OFFSET_METADATA);
+        cursor[n] = ldl_p(host + CHERI_MEM_OFFSET_CURSOR);
+#else
+        pesbt[n] = ldq_p(host + CHERI_MEM_OFFSET_METADATA);
+        cursor[n] = ldq_p(host + CHERI_MEM_OFFSET_CURSOR);
+#endif
+        if (++n == CAP_SWEEP_BATCH) {
+            cheri_cap_sweep_batch(sweep, pesbt, cursor, n);
+            n = 0;
+        }
+    }
+    if (n) {
+        cheri_cap_sweep_batch(sweep, pesbt, cursor, n);
+    }
+}
+
+void hmp_info_cheri_tagmem(Monitor *mon, const QDict *qdict)
+{
+    RAMBlock *block;
+    size_t total = 0;
+
+    monitor_printf(mon, "backend: %s\n",
+                   cheri_tagmem_backend_names[cheri_tagmem_backend]);
+    RCU_READ_LOCK_GUARD();
+    RAMBLOCK_FOREACH(block) {
+        if (!block->cheri_tags) {
+            continue;
+        }
+        if (qdict_get_try_bool(qdict, "pages", false)) {
+            ram_addr_t len = block->used_length;
+            size_t tagged = 0;
+            ram_addr_t off = cheri_tag_find_next(block, 0, len);
+            while (off < len) {
+                tagged++;
+                off = QEMU_ALIGN_DOWN(off, TARGET_PAGE_SIZE) + TARGET_PAGE_SIZE;
+                off = cheri_tag_find_next(block, off, len);
+            }
+            monitor_printf(mon, "%s: %zu/%zu pages tagged\n", block->idstr,
+                           tagged, (size_t)(len / TARGET_PAGE_SIZE));
+            if (block->cheri_tags->tagged_pages) {
+                monitor_printf(mon, "%s: %zu pages mapped for locked stores\n",
+                               block->idstr,
+                               (size_t)bitmap_count_one(
+                                   block->cheri_tags->tagged_pages,
+                                   DIV_ROUND_UP(num_tags(block),
+                                                TAGS_PER_PAGE)));
+            }
+        }
+        if (qdict_get_try_bool(qdict, "caps", false)) {
+            CheriCapSweep sweep = { 0 };
+
+            cheri_cap_sweep(block, &sweep);
+            monitor_printf(mon, "%s: %zu tagged capabilities, %zu sealed, "
+                           "%zu executable\n", block->idstr, sweep.tagged,
+                           sweep.sealed, sweep.executable);
+        }
+        if (cheri_tagmem_backend != CHERI_TAGMEM_SPARSE) {
+            /* The host kernel decides what is resident. */
+            monitor_printf(mon, "%s: %zu KiB tag bitmap reserved\n",
+                           block->idstr,
+                           block->cheri_tags->bitmap_size *
+                               sizeof(unsigned long) / KiB);
+            continue;
+        }
+        size_t resident = qatomic_read(&block->cheri_tags->resident_blocks);
+        monitor_printf(mon,
+                       "%s: %zu/%zu tag blocks resident (%zu KiB)\n",
+                       block->idstr, resident, num_tagblocks(block),
+                       resident * CAP_TAGBLK_BYTES / KiB);
+        total += resident;
+    }
+    if (cheri_tagmem_backend == CHERI_TAGMEM_SPARSE) {
+        monitor_printf(mon, "total: %zu KiB resident, %zu KiB in free pool\n",
+                       total * CAP_TAGBLK_BYTES / KiB,
+                       qatomic_read(&cheri_tag_pool_blocks) *
+                           CAP_TAGBLK_BYTES / KiB);
+    }
+}
+
 static inline QEMU_ALWAYS_INLINE CheriTagBlock *cheri_tag_block(size_t tag_index,
                                                                 RAMBlock *ram)
 {
     const size_t tagbock_index = tag_index >> CAP_TAGBLK_SHFT;
     cheri_debug_assert(ram->cheri_tags);
     cheri_debug_assert(tagbock_index < num_tagblocks(ram));
-    CheriTagBlock **tagmem = (CheriTagBlock **)ram->cheri_tags;
-    return tagmem[tagbock_index];
+    return qatomic_read(&ram->cheri_tags->blocks[tagbock_index]);
 }
 
 static inline QEMU_ALWAYS_INLINE bool tagblock_get_tag_tagmem(void *tagmem,
@@ -171,11 +726,18 @@ static inline QEMU_ALWAYS_INLINE bool tagblock_get_tag_tagmem(void *tagmem,
     return (word & BIT_MASK(index)) != 0;
 }
 
-static inline QEMU_ALWAYS_INLINE bool tagblock_get_tag(CheriTagBlock *block,
-                                                       size_t block_index)
+/*
+ * Returns a pointer to the tag bitmap word holding @tag_index, or NULL if no
+ * tags can be set in it (i.e. a missing sparse block).
+ */
+static inline QEMU_ALWAYS_INLINE unsigned long *
+cheri_tag_words(RAMBlock *ram, size_t tag_index)
 {
-    return block ? tagblock_get_tag_tagmem(block->tag_bitmap, block_index)
-                 : false;
+    if (cheri_tagmem_backend != CHERI_TAGMEM_SPARSE) {
+        return ram->cheri_tags->bitmap + BIT_WORD(tag_index);
+    }
+    CheriTagBlock *tagblk = cheri_tag_block(tag_index, ram);
+    return tagblk ? tagblk + BIT_WORD(CAP_TAGBLK_IDX(tag_index)) : NULL;
 }
 
 static inline QEMU_ALWAYS_INLINE int
@@ -189,25 +751,35 @@ tagblock_get_tag_many_tagmem(void *tagmem, size_t block_index)
 }
 
 static inline QEMU_ALWAYS_INLINE void
-tagblock_set_tag_tagmem(void *tagmem, size_t block_index)
+tagblock_set_tag_tagmem(RAMBlock *ram, void *tagmem, size_t block_index)
 {
     unsigned long *p = (unsigned long *)tagmem + BIT_WORD(block_index);
+    unsigned long old = qatomic_fetch_or(p, BIT_MASK(block_index));
 
-    qatomic_or(p, BIT_MASK(block_index));
+    if (old & BIT_MASK(block_index)) {
+        return;
+    }
+    if (cheri_tagmem_backend == CHERI_TAGMEM_SPARSE) {
+        tagblock_population_add(p, 1);
+    } else if (cheri_tagmem_backend == CHERI_TAGMEM_INDEXED && old == 0) {
+        tagmem_index_word(ram, p);
+    }
 }
 
 static inline QEMU_ALWAYS_INLINE void
-tagblock_set_tag_many_tagmem(void *tagmem, size_t block_index, uint8_t tags)
+tagblock_set_tag_many_tagmem(RAMBlock *ram, void *tagmem, size_t block_index,
+                             uint8_t tags)
 {
     unsigned long *p = (unsigned long *)tagmem + BIT_WORD(block_index);
     size_t shift = block_index % BITS_PER_LONG;
     unsigned long mask = CAP_TAG_GET_MANY_MASK << shift;
     unsigned long tags_shifted = ((unsigned long)tags << shift) & mask;
+    unsigned long old;
 
     if (likely(tags_shifted == 0)) {
-        qatomic_and(p, ~mask);
+        old = qatomic_fetch_and(p, ~mask);
     } else {
-        unsigned long old, new, cmp;
+        unsigned long new, cmp;
         cmp = qatomic_read(p);
         do {
             old = cmp;
@@ -215,20 +787,96 @@ tagblock_set_tag_many_tagmem(void *tagmem, size_t block_index, uint8_t tags)
             cmp = qatomic_cmpxchg(p, old, new);
         } while (cmp != old);
     }
+    if (cheri_tagmem_backend == CHERI_TAGMEM_SPARSE) {
+        int delta = ctpopl(tags_shifted) - ctpopl(old & mask);
+        if (delta) {
+            tagblock_population_add(p, delta);
+        }
+    } else if (cheri_tagmem_backend == CHERI_TAGMEM_INDEXED && old == 0 &&
+               tags_shifted) {
+        tagmem_index_word(ram, p);
+    }
+    if (cheri_tagmem_atomic && old && !tags_shifted && !(old & ~mask)) {
+        cheri_tag_word_emptied(p);
+    }
 }
 
 static inline QEMU_ALWAYS_INLINE void tagblock_clear_tag_tagmem(void *tagmem,
                                                                 size_t index)
 {
     unsigned long *p = (unsigned long *)tagmem + BIT_WORD(index);
+    unsigned long old = qatomic_fetch_and(p, ~BIT_MASK(index));
 
-    qatomic_and(p, ~BIT_MASK(index));
+    if (!(old & BIT_MASK(index))) {
+        return;
+    }
+    /* The bitmap index is cleaned up lazily by cheri_tag_find_next(). */
+    if (cheri_tagmem_backend == CHERI_TAGMEM_SPARSE) {
+        tagblock_population_add(p, -1);
+    }
+    if (cheri_tagmem_atomic && old == BIT_MASK(index)) {
+        cheri_tag_word_emptied(p);
+    }
 }
 
-static inline QEMU_ALWAYS_INLINE void tagblock_clear_tag(CheriTagBlock *block,
-                                                         size_t block_index)
+static QemuOptsList qemu_cheri_tagmem_opts = {
+    .name = "cheri-tagmem",
+    .implied_opt_name = "backend",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_cheri_tagmem_opts.head),
+    .desc = {
+        {
+            .name = "backend",
+            .type = QEMU_OPT_STRING,
+            .help = "sparse, flat or indexed",
+        }, {
+            .name = "blocksize",
+            .type = QEMU_OPT_NUMBER,
+            .help = "number of tags per block for the sparse backend",
+        },
+        { /* end of list */ }
+    },
+};
+
+void cheri_tagmem_parse_opts(const char *optarg)
 {
-    tagblock_clear_tag_tagmem(block->tag_bitmap, block_index);
+    QemuOpts *opts =
+        qemu_opts_parse_noisily(&qemu_cheri_tagmem_opts, optarg, true);
+    if (!opts) {
+        exit(1);
+    }
+    const char *backend = qemu_opt_get(opts, "backend");
+    if (backend) {
+        int i;
+        for (i = 0; i < ARRAY_SIZE(cheri_tagmem_backend_names); i++) {
+            if (strcmp(backend, cheri_tagmem_backend_names[i]) == 0) {
+                break;
+            }
+        }
+        if (i == ARRAY_SIZE(cheri_tagmem_backend_names)) {
+            error_report("Invalid choice for cheri-tagmem backend: '%s'",
+                         backend);
+            exit(1);
+        }
+        cheri_tagmem_backend = i;
+    }
+    uint64_t blocksize = qemu_opt_get_number(opts, "blocksize", 0);
+    if (blocksize) {
+        if (cheri_tagmem_backend != CHERI_TAGMEM_SPARSE) {
+            error_report("cheri-tagmem blocksize is only valid for the "
+                         "sparse backend");
+            exit(1);
+        }
+        /* The lower bound of TAGS_PER_PAGE is checked in cheri_tag_init(). */
+        if (!is_power_of_2(blocksize) || blocksize < BITS_PER_LONG ||
+            blocksize > (1UL << CAP_TAGBLK_MAX_SHFT)) {
+            error_report("cheri-tagmem blocksize must be a power of two "
+                         "between %d and %lu", BITS_PER_LONG,
+                         1UL << CAP_TAGBLK_MAX_SHFT);
+            exit(1);
+        }
+        cap_tagblk_shft = ctz64(blocksize);
+    }
+    qemu_opts_del(opts);
 }
 
 void cheri_tag_init(MemoryRegion *mr, uint64_t memory_size)
@@ -238,19 +886,38 @@ void cheri_tag_init(MemoryRegion *mr, uint64_t memory_size)
            "Incorrect tag mem size passed?");
     assert(mr->ram_block->cheri_tags == NULL && "Already initialized?");
 
-    size_t cheri_ntagblks = num_tagblocks(mr->ram_block);
-    mr->ram_block->cheri_tags =
-        g_malloc0(cheri_ntagblks * sizeof(CheriTagBlock *));
-    if (mr->ram_block->cheri_tags == NULL) {
-        error_report("%s: Can't allocated tag memory", __func__);
-        exit(-1);
+    /* The TLB caches one tag pointer per page, so a page must fit a block. */
+    if (CAP_TAGBLK_SIZE < TAGS_PER_PAGE) {
+        error_report("cheri-tagmem blocksize must be at least %zu",
+                     (size_t)TAGS_PER_PAGE);
+        exit(1);
+    }
+    struct CheriTagMem *tm;
+    if (cheri_tagmem_backend == CHERI_TAGMEM_SPARSE) {
+        size_t cheri_ntagblks = num_tagblocks(mr->ram_block);
+        tm = g_malloc0(sizeof(struct CheriTagMem) +
+                       cheri_ntagblks * sizeof(CheriTagBlock *));
+    } else {
+        uint64_t align = qemu_real_host_page_size;
+        tm = g_new0(struct CheriTagMem, 1);
+        tm->bitmap_size = BITS_TO_LONGS(num_tags(mr->ram_block));
+        tm->bitmap = qemu_anon_ram_alloc(
+            ROUND_UP(tm->bitmap_size * sizeof(unsigned long), align), &align,
+            false);
+        if (tm->bitmap == NULL) {
+            error_report("%s: Can't allocated tag memory", __func__);
+            exit(-1);
+        }
+        if (cheri_tagmem_backend == CHERI_TAGMEM_INDEXED) {
+            tm->index = bitmap_new(tm->bitmap_size);
+        }
     }
     if (qemu_tcg_mttcg_enabled()) {
-        warn_report("The CHERI tagged memory implementation is not thread-safe "
-                    "and therefore not compatible with MTTCG. Capability tags "
-                    "may mysteriously appear/disappear. Run with \"--accel "
-                    "tcg,thread=single\" to fix.");
+        tm->tagged_pages = bitmap_new(DIV_ROUND_UP(num_tags(mr->ram_block),
+                                                   TAGS_PER_PAGE));
+        cheri_tagmem_atomic = true;
     }
+    mr->ram_block->cheri_tags = tm;
 }
 
 void *cheri_tagmem_for_addr(CPUArchState *env, target_ulong vaddr,
@@ -273,14 +940,34 @@ void *cheri_tagmem_for_addr(CPUArchState *env, target_ulong vaddr,
     }
 
     uint64_t tag = ram_offset / CHERI_CAP_SIZE;
+    CheriTagBlock *tagblk = NULL;
+    bool flush = false;
 #ifndef TARGET_AARCH64
     // AArch64 seems to use different sizes. Might be worth looking into.
     cheri_debug_assert(size == TARGET_PAGE_SIZE && "Unexpected size");
 #endif
-    CheriTagBlock *tagblk = cheri_tag_block(tag, ram);
+    if (cheri_tagmem_atomic && !cheri_tag_page_armed(ram, ram_offset)) {
+        /*
+         * No tags on this page: map it as ALL_ZERO_TAGBLK, and thus without
+         * TLB_CHERI_TAGS, until the first capability store to it.
+         */
+        if (!tag_write) {
+            goto all_zero;
+        }
+        cheri_tag_page_arm(ram, ram_offset);
+        flush = true;
+    }
+    if (cheri_tagmem_backend == CHERI_TAGMEM_SPARSE) {
+        tagblk = cheri_tag_block(tag, ram);
+        if (tag_write && !tagblk) {
+            cheri_tag_new_tagblk(ram, tag);
+            tagblk = cheri_tag_block(tag, ram);
+            cheri_debug_assert(tagblk);
+            flush = true;
+        }
+    }
 
-    if (tag_write && !tagblk) {
-        cheri_tag_new_tagblk(ram, tag);
+    if (flush) {
         CPUState *cpu = env_cpu(env);
         /*
          * A vaddr-based shootdown is insufficient as multiple mappings may
@@ -292,15 +979,20 @@ void *cheri_tagmem_for_addr(CPUArchState *env, target_ulong vaddr,
          * this instruction and THEN exit.
          */
         tlb_flush(cpu);
-        tagblk = cheri_tag_block(tag, ram);
-        cheri_debug_assert(tagblk);
+        if (cheri_tagmem_atomic) {
+            cheri_tag_new_block_pending = true;
+        }
     }
 
+    if (cheri_tagmem_backend != CHERI_TAGMEM_SPARSE) {
+        return ram->cheri_tags->bitmap + BIT_WORD(tag);
+    }
     if (tagblk != NULL) {
         const size_t tagblk_index = CAP_TAGBLK_IDX(tag);
-        return tagblk->tag_bitmap + BIT_WORD(tagblk_index);
+        return tagblk + BIT_WORD(tagblk_index);
     }
 
+all_zero:
     if (!(*prot & PAGE_SC_CLEAR)) {
         // Add in a (fake) SC_TRAP to prompt a TLB refill if a tag is stored
         // to this location. See the comment around TLBENTRYCAP_INVALID_WRITE_*.
@@ -337,6 +1029,15 @@ static inline void *get_tagmem_from_iotlb_entry(CPUArchState *env,
     }
 }
 
+/* The RAMBlock owning the tag memory returned by the function above. */
+static inline RAMBlock *get_tag_ram_from_iotlb_entry(CPUArchState *env,
+                                                     target_ulong vaddr,
+                                                     int mmu_idx)
+{
+    return env_tlb(env)->d[mmu_idx].iotlb[tlb_index(env, mmu_idx, vaddr)]
+        .tag_ram;
+}
+
 typedef struct TagOffset {
     target_ulong value;
 } TagOffset;
@@ -358,13 +1059,24 @@ static QEMU_ALWAYS_INLINE target_ulong tag_offset_to_addr(TagOffset offset)
 }
 
 static void *cheri_tag_invalidate_one(CPUArchState *env, target_ulong vaddr,
-                                      uintptr_t pc, int mmu_idx);
+                                      uintptr_t pc, int mmu_idx,
+                                      bool lock_line);
 
 void *cheri_tag_invalidate_aligned(CPUArchState *env, target_ulong vaddr,
                                    uintptr_t pc, int mmu_idx)
 {
     cheri_debug_assert(QEMU_IS_ALIGNED(vaddr, CHERI_CAP_SIZE));
-    return cheri_tag_invalidate_one(env, vaddr, pc, mmu_idx);
+    void *host = cheri_tag_invalidate_one(env, vaddr, pc, mmu_idx, false);
+    cheri_tag_reclaim_kick();
+    return host;
+}
+
+void *cheri_tag_invalidate_aligned_lock_line(CPUArchState *env,
+                                             target_ulong vaddr, uintptr_t pc,
+                                             int mmu_idx)
+{
+    cheri_debug_assert(QEMU_IS_ALIGNED(vaddr, CHERI_CAP_SIZE));
+    return cheri_tag_invalidate_one(env, vaddr, pc, mmu_idx, true);
 }
 
 void cheri_tag_invalidate(CPUArchState *env, target_ulong vaddr, int32_t size,
@@ -377,7 +1089,8 @@ void cheri_tag_invalidate(CPUArchState *env, target_ulong vaddr, int32_t size,
     TagOffset tag_end = addr_to_tag_offset(last_addr);
     if (likely(tag_start.value == tag_end.value)) {
         // Common case, only one tag (i.e. an aligned store)
-        cheri_tag_invalidate_one(env, vaddr, pc, mmu_idx);
+        cheri_tag_invalidate_one(env, vaddr, pc, mmu_idx, false);
+        cheri_tag_reclaim_kick();
         return;
     }
     // Unaligned store -> can cross a capabiblity alignment boundary and
@@ -413,12 +1126,13 @@ void cheri_tag_invalidate(CPUArchState *env, target_ulong vaddr, int32_t size,
 #endif
     for (target_ulong addr = tag_offset_to_addr(tag_start);
          addr <= tag_offset_to_addr(tag_end); addr += CHERI_CAP_SIZE) {
-        cheri_tag_invalidate_one(env, addr, pc, mmu_idx);
+        cheri_tag_invalidate_one(env, addr, pc, mmu_idx, false);
     }
+    cheri_tag_reclaim_kick();
 }
 
 static void *cheri_tag_invalidate_one(CPUArchState *env, target_ulong vaddr,
-                                      uintptr_t pc, int mmu_idx)
+                                      uintptr_t pc, int mmu_idx, bool lock_line)
 {
     /*
      * When resolving this address in the TLB, treat it like a data store
@@ -437,6 +1151,10 @@ static void *cheri_tag_invalidate_one(CPUArchState *env, target_ulong vaddr,
     void *tagmem =
         get_tagmem_from_iotlb_entry(env, vaddr, mmu_idx, true, &tagmem_flags);
 
+    if (lock_line) {
+        cheri_tag_line_write_lock(host_addr);
+    }
+
     if (tagmem == ALL_ZERO_TAGBLK) {
         // All tags for this page are zero -> no need to invalidate. We also
         // couldn't invalidate if we wanted to since ALL_ZERO_TAGBLK is not a
@@ -464,6 +1182,41 @@ static void *cheri_tag_invalidate_one(CPUArchState *env, target_ulong vaddr,
     return host_addr;
 }
 
+/*
+ * Clear tags [@tag, @end_tag) of @ram a bitmap word at a time, skipping
+ * missing and all-zero parts. Used for DMA and other bulk writes.
+ */
+static void cheri_tag_clear_range(RAMBlock *ram, size_t tag, size_t end_tag)
+{
+    size_t npages = DIV_ROUND_UP(end_tag - tag, TAGS_PER_PAGE);
+    bool cleared_any = false;
+
+    if (cheri_tagmem_backend != CHERI_TAGMEM_SPARSE) {
+        /* The bitmap index is cleaned up lazily by cheri_tag_find_next(). */
+        cleared_any = bitmap_count_and_clear_atomic(ram->cheri_tags->bitmap,
+                                                    tag, end_tag - tag) != 0;
+        tag = end_tag;
+    }
+    while (tag < end_tag) {
+        size_t blk_end = MIN(QEMU_ALIGN_DOWN(tag, CAP_TAGBLK_SIZE) +
+                                 CAP_TAGBLK_SIZE, end_tag);
+        CheriTagBlock *tagblk = cheri_tag_block(tag, ram);
+        if (tagblk && qatomic_read(tagblock_population(tagblk))) {
+            long cleared = bitmap_count_and_clear_atomic(
+                tagblk, CAP_TAGBLK_IDX(tag), blk_end - tag);
+            if (cleared) {
+                tagblock_population_add(tagblk, -cleared);
+                cleared_any = true;
+            }
+        }
+        tag = blk_end;
+    }
+    if (cleared_any && cheri_tagmem_atomic) {
+        /* Cheaper than checking each page, the reclaim pass does that. */
+        cheri_tag_pages_emptied(npages);
+    }
+}
+
 void cheri_tag_phys_invalidate(CPUArchState *env, RAMBlock *ram,
                                ram_addr_t ram_offset, ram_addr_t len,
                                const target_ulong *vaddr)
@@ -478,24 +1231,184 @@ void cheri_tag_phys_invalidate(CPUArchState *env, RAMBlock *ram,
     ram_addr_t endaddr = (uint64_t)(ram_offset + len);
     ram_addr_t startaddr = QEMU_ALIGN_DOWN(ram_offset, CHERI_CAP_SIZE);
 
+    if (likely(!env || !qemu_log_instr_enabled(env))) {
+        cheri_tag_clear_range(ram, startaddr / CHERI_CAP_SIZE,
+                              DIV_ROUND_UP(endaddr, CHERI_CAP_SIZE));
+        cheri_tag_reclaim_kick();
+        return;
+    }
+
     for(ram_addr_t addr = startaddr; addr < endaddr; addr += CHERI_CAP_SIZE) {
         uint64_t tag = addr / CHERI_CAP_SIZE;
-        CheriTagBlock *tagblk = cheri_tag_block(tag, ram);
-        if (tagblk != NULL) {
-            const size_t tagblk_index = CAP_TAGBLK_IDX(tag);
+        unsigned long *words = cheri_tag_words(ram, tag);
+        if (words != NULL) {
+            const size_t word_index = BIT_WORD(tag) * BITS_PER_LONG;
+            const size_t bit = tag - word_index;
             if (unlikely(env && vaddr && qemu_log_instr_enabled(env))) {
                 target_ulong write_vaddr =
                     QEMU_ALIGN_DOWN(*vaddr, CHERI_CAP_SIZE) + (addr - startaddr);
                 qemu_log_instr_extra(env, "    Cap Tag Write [" TARGET_FMT_lx
                     "/" RAM_ADDR_FMT "] %d -> 0\n", write_vaddr, addr,
-                    tagblock_get_tag(tagblk, tagblk_index));
+                    tagblock_get_tag_tagmem(words, bit));
             } else if (unlikely(env && qemu_log_instr_enabled(env))) {
                 qemu_log_instr_extra(env, "    Cap Tag ramaddr Write ["
                     RAM_ADDR_FMT "] %d -> 0\n", addr,
-                    tagblock_get_tag(tagblk, tagblk_index));
+                    tagblock_get_tag_tagmem(words, bit));
+            }
+            // changed |= tagblock_get_tag_tagmem(words, bit);
+            tagblock_clear_tag_tagmem(words, bit);
+        }
+    }
+    cheri_tag_reclaim_kick();
+}
+
+ram_addr_t cheri_tag_find_next(RAMBlock *ram, ram_addr_t start,
+                               ram_addr_t end)
+{
+    struct CheriTagMem *tm = ram->cheri_tags;
+    size_t tag = QEMU_ALIGN_DOWN(start, CHERI_CAP_SIZE) / CHERI_CAP_SIZE;
+    size_t end_tag = MIN(DIV_ROUND_UP(end, CHERI_CAP_SIZE), num_tags(ram));
+
+    if (!tm) {
+        return end;
+    }
+    while (tag < end_tag) {
+        if (cheri_tagmem_backend == CHERI_TAGMEM_SPARSE) {
+            CheriTagBlock *tagblk = cheri_tag_block(tag, ram);
+            size_t blk_end = MIN(QEMU_ALIGN_DOWN(tag, CAP_TAGBLK_SIZE) +
+                                     CAP_TAGBLK_SIZE, end_tag);
+            if (tagblk && qatomic_read(tagblock_population(tagblk))) {
+                size_t base = tag - CAP_TAGBLK_IDX(tag);
+                size_t found = find_next_bit(tagblk, blk_end - base,
+                                             tag - base) + base;
+                if (found < blk_end) {
+                    return found * CHERI_CAP_SIZE;
+                }
             }
-            // changed |= tagblock_get_tag(tagblk, tagblk_index);
-            tagblock_clear_tag(tagblk, tagblk_index);
+            tag = blk_end;
+            continue;
+        }
+        if (cheri_tagmem_backend == CHERI_TAGMEM_FLAT) {
+            size_t found = find_next_bit(tm->bitmap, end_tag, tag);
+            return found < end_tag ? found * CHERI_CAP_SIZE : end;
+        }
+        /* indexed: only look at words that may have tags set. */
+        size_t found = bitmap_index_find_next(tm->bitmap, tm->index, end_tag,
+                                              tag);
+        return found < end_tag ? found * CHERI_CAP_SIZE : end;
+    }
+    return end;
+}
+
+bool cheri_tag_range_has_tags(RAMBlock *ram, ram_addr_t start, ram_addr_t len)
+{
+    if (!ram->cheri_tags || !len) {
+        return false;
+    }
+    if (QEMU_IS_ALIGNED(start, TARGET_PAGE_SIZE) && len == TARGET_PAGE_SIZE) {
+        /* Common case of a single page: one block, a handful of words. */
+        size_t tag = start / CHERI_CAP_SIZE;
+        unsigned long *words = cheri_tag_words(ram, tag);
+        if (!words || (cheri_tagmem_backend == CHERI_TAGMEM_SPARSE &&
+                       !qatomic_read(tagblock_population(words)))) {
+            return false;
+        }
+        return !buffer_is_zero(words, TAGS_PER_PAGE / BITS_PER_BYTE);
+    }
+    return cheri_tag_find_next(ram, start, start + len) < start + len;
+}
+
+bool cheri_tag_save_page(RAMBlock *ram, ram_addr_t offset,
+                         unsigned long *tags)
+{
+    size_t tag = offset / CHERI_CAP_SIZE;
+    size_t nwords = BITS_TO_LONGS(TAGS_PER_PAGE);
+    unsigned long any = 0;
+
+    cheri_debug_assert(QEMU_IS_ALIGNED(offset, TARGET_PAGE_SIZE));
+    if (!cheri_tag_range_has_tags(ram, offset, TARGET_PAGE_SIZE)) {
+        memset(tags, 0, nwords * sizeof(unsigned long));
+        return false;
+    }
+    /* A page never spans tag blocks, see cheri_tag_init(). */
+    unsigned long *words = cheri_tag_words(ram, tag);
+    for (size_t i = 0; i < nwords; i++) {
+        tags[i] = words ? qatomic_read(&words[i]) : 0;
+        any |= tags[i];
+    }
+    return any != 0;
+}
+
+/*
+ * Set when loading allocated a tag block or marked a page as tagged that vCPU
+ * TLBs may still map as ALL_ZERO_TAGBLK, see cheri_tag_load_done().
+ */
+static bool cheri_tag_load_flush;
+
+void cheri_tag_load_page(RAMBlock *ram, ram_addr_t offset,
+                         const unsigned long *tags)
+{
+    size_t tag = offset / CHERI_CAP_SIZE;
+    size_t nwords = BITS_TO_LONGS(TAGS_PER_PAGE);
+    unsigned long *words = cheri_tag_words(ram, tag);
+
+    cheri_debug_assert(QEMU_IS_ALIGNED(offset, TARGET_PAGE_SIZE));
+    if (cheri_tagmem_atomic && !cheri_tag_page_armed(ram, offset) &&
+        find_first_bit(tags, TAGS_PER_PAGE) != TAGS_PER_PAGE) {
+        cheri_tag_page_arm(ram, offset);
+        qatomic_set(&cheri_tag_load_flush, true);
+    }
+    if (!words) {
+        if (find_first_bit(tags, TAGS_PER_PAGE) == TAGS_PER_PAGE) {
+            return;
+        }
+        CheriTagBlock *tagblk = cheri_tag_new_tagblk(ram, tag);
+        words = tagblk + BIT_WORD(CAP_TAGBLK_IDX(tag));
+        qatomic_set(&cheri_tag_load_flush, true);
+    }
+    for (size_t i = 0; i < nwords; i++) {
+        unsigned long old = qatomic_xchg(&words[i], tags[i]);
+        if (cheri_tagmem_backend == CHERI_TAGMEM_SPARSE) {
+            int delta = ctpopl(tags[i]) - ctpopl(old);
+            if (delta) {
+                tagblock_population_add(&words[i], delta);
+            }
+        } else if (cheri_tagmem_backend == CHERI_TAGMEM_INDEXED && !old &&
+                   tags[i]) {
+            tagmem_index_word(ram, &words[i]);
+        }
+    }
+    cheri_tag_reclaim_kick();
+}
+
+void cheri_tag_pin(RAMBlock *ram, bool pin)
+{
+    if (!ram->cheri_tags || cheri_tagmem_backend != CHERI_TAGMEM_SPARSE) {
+        return;
+    }
+    for (size_t i = 0; i < num_tagblocks(ram); i++) {
+        CheriTagBlock *tagblk = cheri_tag_block(i << CAP_TAGBLK_SHFT, ram);
+        if (!tagblk) {
+            cheri_debug_assert(pin && "Pinned block was reclaimed?");
+            if (!pin) {
+                continue;
+            }
+            tagblk = cheri_tag_new_tagblk(ram, i << CAP_TAGBLK_SHFT);
+            qatomic_set(&cheri_tag_load_flush, true);
+        }
+        /* The extra count keeps the block from ever being reclaimed. */
+        tagblock_population_add(tagblk, pin ? 1 : -1);
+    }
+    cheri_tag_reclaim_kick();
+}
+
+void cheri_tag_load_done(void)
+{
+    CPUState *cpu;
+
+    if (qatomic_xchg(&cheri_tag_load_flush, false)) {
+        CPU_FOREACH(cpu) {
+            tlb_flush(cpu);
         }
     }
 }
@@ -521,8 +1434,9 @@ void cheri_tag_phys_invalidate(CPUArchState *env, RAMBlock *ram,
 #define clear_capcause_reg(env)
 #endif
 
-void *cheri_tag_set(CPUArchState *env, target_ulong vaddr, int reg,
-                    hwaddr *ret_paddr, uintptr_t pc, int mmu_idx)
+static inline QEMU_ALWAYS_INLINE void *
+cheri_tag_set_impl(CPUArchState *env, target_ulong vaddr, int reg,
+                   hwaddr *ret_paddr, uintptr_t pc, int mmu_idx, bool lock_line)
 {
     /*
      * This attempt to resolve a virtual address may cause both a data store
@@ -539,11 +1453,16 @@ void *cheri_tag_set(CPUArchState *env, target_ulong vaddr, int reg,
     if (unlikely(!host_addr)) {
         return NULL;
     }
+    cheri_tag_check_new_block(env, pc);
 
     uintptr_t tagmem_flags;
     void *tagmem = get_tagmem_from_iotlb_entry(env, vaddr, mmu_idx,
                                                /*write=*/true, &tagmem_flags);
 
+    if (lock_line) {
+        cheri_tag_line_write_lock(host_addr);
+    }
+
     /* Clear + ALL_ZERO_TAGBLK means no tags can be stored here. */
     if ((tagmem_flags & TLBENTRYCAP_FLAG_CLEAR) &&
         (tagmem == ALL_ZERO_TAGBLK)) {
@@ -569,17 +1488,29 @@ void *cheri_tag_set(CPUArchState *env, target_ulong vaddr, int reg,
         vaddr, qemu_ram_addr_from_host(host_addr),
         tagblock_get_tag_tagmem(tagmem, tag_offset));
 
-    tagblock_set_tag_tagmem(tagmem, tag_offset);
+    tagblock_set_tag_tagmem(get_tag_ram_from_iotlb_entry(env, vaddr, mmu_idx),
+                            tagmem, tag_offset);
     return host_addr;
 }
 
-bool cheri_tag_get(CPUArchState *env, target_ulong vaddr, int reg,
-                   hwaddr *ret_paddr, int *prot, uintptr_t pc, int mmu_idx,
-                   void *host_addr)
+void *cheri_tag_set(CPUArchState *env, target_ulong vaddr, int reg,
+                    hwaddr *ret_paddr, uintptr_t pc, int mmu_idx)
+{
+    return cheri_tag_set_impl(env, vaddr, reg, ret_paddr, pc, mmu_idx, false);
+}
+
+void *cheri_tag_set_lock_line(CPUArchState *env, target_ulong vaddr, int reg,
+                              hwaddr *ret_paddr, uintptr_t pc, int mmu_idx)
 {
+    return cheri_tag_set_impl(env, vaddr, reg, ret_paddr, pc, mmu_idx, true);
+}
 
-    if (host_addr == NULL) {
-        host_addr = probe_read(env, vaddr, 1, mmu_idx, pc);
+void *cheri_tag_lookup(CPUArchState *env, target_ulong vaddr,
+                       hwaddr *ret_paddr, int *prot, uintptr_t pc, int mmu_idx,
+                       void **host_addr)
+{
+    if (*host_addr == NULL) {
+        *host_addr = probe_read(env, vaddr, 1, mmu_idx, pc);
     }
     handle_paddr_return(read);
 
@@ -599,20 +1530,39 @@ bool cheri_tag_get(CPUArchState *env, target_ulong vaddr, int reg,
             *prot |= PAGE_LC_TRAP_ANY;
         }
     }
+    return tagmem;
+}
 
+bool cheri_tag_read(void *tagmem, target_ulong vaddr)
+{
     /*
      * Squash happens in the caller, so read the tagblk even if
      * TLBENTRYCAP_FLAG_CLEAR
      */
-    bool result =
-        (tagmem == ALL_ZERO_TAGBLK)
-            ? 0
-            : tagblock_get_tag_tagmem(tagmem, page_vaddr_to_tag_offset(vaddr));
+    return (tagmem == ALL_ZERO_TAGBLK)
+               ? 0
+               : tagblock_get_tag_tagmem(tagmem,
+                                         page_vaddr_to_tag_offset(vaddr));
+}
 
-    // XXX: Not atomic w.r.t. writes to tag memory
+void cheri_tag_log_read(CPUArchState *env, target_ulong vaddr,
+                        void *host_addr, bool tag)
+{
     qemu_maybe_log_instr_extra(
         env, "    Cap Tag Read [" TARGET_FMT_lx "/" RAM_ADDR_FMT "] -> %d\n",
-        vaddr, qemu_ram_addr_from_host(host_addr), result);
+        vaddr, qemu_ram_addr_from_host(host_addr), tag);
+}
+
+bool cheri_tag_get(CPUArchState *env, target_ulong vaddr, int reg,
+                   hwaddr *ret_paddr, int *prot, uintptr_t pc, int mmu_idx,
+                   void *host_addr)
+{
+    void *tagmem = cheri_tag_lookup(env, vaddr, ret_paddr, prot, pc, mmu_idx,
+                                    &host_addr);
+    bool result = cheri_tag_read(tagmem, vaddr);
+
+    // XXX: Not atomic w.r.t. writes to tag memory
+    cheri_tag_log_read(env, vaddr, host_addr, result);
     return result;
 }
 
@@ -662,6 +1612,7 @@ void cheri_tag_set_many(CPUArchState *env, uint32_t tags, target_ulong vaddr,
     clear_capcause_reg(env);
 
     handle_paddr_return(write);
+    cheri_tag_check_new_block(env, pc);
 
     uintptr_t tagmem_flags;
     void *tagmem =
@@ -683,5 +1634,154 @@ void cheri_tag_set_many(CPUArchState *env, uint32_t tags, target_ulong vaddr,
 
     cheri_debug_assert(tagmem);
 
-    tagblock_set_tag_many_tagmem(tagmem, page_vaddr_to_tag_offset(vaddr), tags);
+    tagblock_set_tag_many_tagmem(
+        get_tag_ram_from_iotlb_entry(env, vaddr, mmu_idx), tagmem,
+        page_vaddr_to_tag_offset(vaddr), tags);
+    cheri_tag_reclaim_kick();
+}
+
+static inline QEMU_ALWAYS_INLINE void
+cheri_tag_store_data_host(void *haddr, uint64_t val, MemOp op)
+{
+    switch (op & (MO_SIZE | MO_BSWAP)) {
+    case MO_UB:
+        stb_p(haddr, val);
+        break;
+    case MO_BEUW:
+        stw_be_p(haddr, val);
+        break;
+    case MO_LEUW:
+        stw_le_p(haddr, val);
+        break;
+    case MO_BEUL:
+        stl_be_p(haddr, val);
+        break;
+    case MO_LEUL:
+        stl_le_p(haddr, val);
+        break;
+    case MO_BEQ:
+        stq_be_p(haddr, val);
+        break;
+    case MO_LEQ:
+        stq_le_p(haddr, val);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void cheri_tag_store_data_slow(CPUArchState *env, target_ulong vaddr,
+                                      uint64_t val, TCGMemOpIdx oi,
+                                      uintptr_t pc)
+{
+    switch (get_memop(oi) & (MO_SIZE | MO_BSWAP)) {
+    case MO_UB:
+        helper_ret_stb_mmu(env, vaddr, val, oi, pc);
+        break;
+    case MO_BEUW:
+        helper_be_stw_mmu(env, vaddr, val, oi, pc);
+        break;
+    case MO_LEUW:
+        helper_le_stw_mmu(env, vaddr, val, oi, pc);
+        break;
+    case MO_BEUL:
+        helper_be_stl_mmu(env, vaddr, val, oi, pc);
+        break;
+    case MO_LEUL:
+        helper_le_stl_mmu(env, vaddr, val, oi, pc);
+        break;
+    case MO_BEQ:
+        helper_be_stq_mmu(env, vaddr, val, oi, pc);
+        break;
+    case MO_LEQ:
+        helper_le_stq_mmu(env, vaddr, val, oi, pc);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+void cheri_tag_store_data_locked(CPUArchState *env, target_ulong vaddr,
+                                 void *host_addr, uint64_t val, MemOp op,
+                                 int mmu_idx)
+{
+    uintptr_t tagmem_flags;
+    void *tagmem =
+        get_tagmem_from_iotlb_entry(env, vaddr, mmu_idx, true, &tagmem_flags);
+
+    cheri_debug_assert(tagmem != ALL_ZERO_TAGBLK);
+    target_ulong tag_offset = page_vaddr_to_tag_offset(vaddr);
+    cheri_tag_line_write_lock(host_addr);
+    if (qemu_log_instr_enabled(env)) {
+        qemu_log_instr_extra(
+            env,
+            "    Cap Tag Write [" TARGET_FMT_lx "/" RAM_ADDR_FMT "] %d -> 0\n",
+            vaddr, qemu_ram_addr_from_host(host_addr),
+            tagblock_get_tag_tagmem(tagmem, tag_offset));
+    }
+    cheri_tag_store_data_host(host_addr, val, op);
+    tagblock_clear_tag_tagmem(tagmem, tag_offset);
+    cheri_tag_line_write_unlock(host_addr);
+    cheri_tag_reclaim_kick();
+}
+
+void cheri_tag_store_data_keep(CPUArchState *env, target_ulong vaddr,
+                               uint64_t val, uint32_t oi, uintptr_t pc)
+{
+    const MemOp op = get_memop(oi);
+    const int mmu_idx = get_mmuidx(oi);
+    const unsigned size = memop_size(op);
+    const unsigned a_bits = get_alignment_bits(op);
+    void *host_addr = NULL;
+
+    if (likely(addr_to_tag_offset(vaddr).value ==
+               addr_to_tag_offset(vaddr + size - 1).value &&
+               (vaddr & ((1 << a_bits) - 1)) == 0)) {
+        host_addr = probe_write(env, vaddr, size, mmu_idx, pc);
+    }
+    if (unlikely(!host_addr)) {
+        /* Not RAM (or split), so there are no tags to keep. */
+        cheri_tag_store_data_slow(env, vaddr, val, oi, pc);
+        return;
+    }
+    cheri_tag_line_write_lock(host_addr);
+    cheri_tag_store_data_host(host_addr, val, op);
+    cheri_tag_line_write_unlock(host_addr);
+}
+
+void cheri_tag_store_data_atomic(CPUArchState *env, target_ulong vaddr,
+                                 uint64_t val, uint32_t oi, uintptr_t pc)
+{
+    const MemOp op = get_memop(oi);
+    const int mmu_idx = get_mmuidx(oi);
+    const unsigned size = memop_size(op);
+    const unsigned a_bits = get_alignment_bits(op);
+    void *host_addr = NULL;
+
+    /*
+     * Only stores that stay within one tag granule can be done under a single
+     * line lock. Anything else (including stores that must raise an alignment
+     * fault) goes through the normal softmmu store helpers.
+     */
+    if (likely(addr_to_tag_offset(vaddr).value ==
+               addr_to_tag_offset(vaddr + size - 1).value &&
+               (vaddr & ((1 << a_bits) - 1)) == 0)) {
+        /* Take any TLB faults and watchpoints before locking the line. */
+        host_addr = probe_write(env, vaddr, size, mmu_idx, pc);
+    }
+    if (unlikely(!host_addr)) {
+        cheri_tag_store_data_slow(env, vaddr, val, oi, pc);
+        cheri_tag_invalidate(env, vaddr, size, pc, mmu_idx);
+        return;
+    }
+
+    uintptr_t tagmem_flags;
+    void *tagmem =
+        get_tagmem_from_iotlb_entry(env, vaddr, mmu_idx, true, &tagmem_flags);
+    if (tagmem == ALL_ZERO_TAGBLK) {
+        /* See cheri_tag_check_new_block() for why no lock is needed. */
+        cheri_tag_store_data_host(host_addr, val, op);
+        return;
+    }
+    cheri_tag_store_data_locked(env, vaddr, host_addr, val, op, mmu_idx);
 }
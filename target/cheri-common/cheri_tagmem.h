@@ -37,6 +37,12 @@
 #include "exec/memory.h"
 
 #if defined(TARGET_CHERI)
+/*
+ * Set when tag updates must be linearizable with data stores (i.e. when
+ * running with MTTCG). See the comment at the top of cheri_tagmem.c.
+ */
+extern bool cheri_tagmem_atomic;
+
 /* Note: for cheri_tag_phys_invalidate, env may be NULL */
 void cheri_tag_phys_invalidate(CPUArchState *env, RAMBlock *ram,
                                ram_addr_t offset, size_t len,
@@ -57,6 +63,43 @@ void cheri_tag_invalidate(CPUArchState *env, target_ulong vaddr, int32_t size,
  */
 void *cheri_tag_invalidate_aligned(CPUArchState *env, target_ulong vaddr,
                                    uintptr_t pc, int mmu_idx);
+/**
+ * Like cheri_tag_invalidate_aligned(), but if the returned host address is
+ * non-NULL the line lock for it is held on return and must be released with
+ * cheri_tag_line_write_unlock() after the data has been written.
+ */
+void *cheri_tag_invalidate_aligned_lock_line(CPUArchState *env,
+                                             target_ulong vaddr, uintptr_t pc,
+                                             int mmu_idx);
+/**
+ * Perform a TCG data store of @p val and clear the tag(s) it overlaps while
+ * holding the corresponding line lock. Only used if cheri_tagmem_atomic.
+ */
+void cheri_tag_store_data_atomic(CPUArchState *env, target_ulong vaddr,
+                                 uint64_t val, uint32_t oi, uintptr_t pc);
+/**
+ * Like cheri_tag_store_data_atomic() but leaves the tag alone, for stores
+ * whose tag invalidation is conditional and done separately.
+ */
+void cheri_tag_store_data_keep(CPUArchState *env, target_ulong vaddr,
+                               uint64_t val, uint32_t oi, uintptr_t pc);
+/**
+ * Store @p val to @p host_addr and clear its tag under the line lock. Called
+ * from the softmmu store slow path for TLB_CHERI_TAGS pages, after all TLB
+ * faults and watchpoints have been taken.
+ */
+void cheri_tag_store_data_locked(CPUArchState *env, target_ulong vaddr,
+                                 void *host_addr, uint64_t val, MemOp op,
+                                 int mmu_idx);
+/*
+ * Per-line sequence locks for cheri_tagmem_atomic, keyed by the host address
+ * of the capability-sized granule. Writers must hold the lock while updating
+ * data and tag, readers retry if cheri_tag_line_read_retry() returns true.
+ */
+void cheri_tag_line_write_lock(const void *host);
+void cheri_tag_line_write_unlock(const void *host);
+unsigned cheri_tag_line_read_begin(const void *host);
+bool cheri_tag_line_read_retry(const void *host, unsigned start);
 /**
  * If probe_read() has already been called, the result can be passed as the
  * @p host_addr argument to avoid another (expensive) probe_read() call.
@@ -64,6 +107,17 @@ void *cheri_tag_invalidate_aligned(CPUArchState *env, target_ulong vaddr,
 bool cheri_tag_get(CPUArchState *env, target_ulong vaddr, int reg,
                    hwaddr *ret_paddr, int *prot, uintptr_t pc, int mmu_idx,
                    void *host_addr);
+/**
+ * cheri_tag_get() split into its parts, so that only cheri_tag_read() has to
+ * be repeated inside a line lock read section. cheri_tag_lookup() returns the
+ * tag memory of the page (probing it if *@p host_addr is NULL).
+ */
+void *cheri_tag_lookup(CPUArchState *env, target_ulong vaddr,
+                       hwaddr *ret_paddr, int *prot, uintptr_t pc, int mmu_idx,
+                       void **host_addr);
+bool cheri_tag_read(void *tagmem, target_ulong vaddr);
+void cheri_tag_log_read(CPUArchState *env, target_ulong vaddr,
+                        void *host_addr, bool tag);
 /*
  * Get/set many currently don't have an mmu_idx because no targets currently
  * require it.
@@ -79,6 +133,52 @@ void cheri_tag_set_many(CPUArchState *env, uint32_t tags, target_ulong vaddr,
  */
 void *cheri_tag_set(CPUArchState *env, target_ulong vaddr, int reg,
                     hwaddr *ret_paddr, uintptr_t pc, int mmu_idx);
+/**
+ * Like cheri_tag_set(), but returns with the line lock held (see
+ * cheri_tag_invalidate_aligned_lock_line()).
+ */
+void *cheri_tag_set_lock_line(CPUArchState *env, target_ulong vaddr, int reg,
+                              hwaddr *ret_paddr, uintptr_t pc, int mmu_idx);
+
+/**
+ * Select the tag memory backend from a -cheri-tagmem option string. Must be
+ * called before any RAM is created.
+ */
+void cheri_tagmem_parse_opts(const char *optarg);
+/**
+ * Find the first tagged capability in [@start, @end) of @ram.
+ * @return its offset in @ram or @end if there is none.
+ */
+ram_addr_t cheri_tag_find_next(RAMBlock *ram, ram_addr_t start,
+                               ram_addr_t end);
+/**
+ * Check whether any capability in [@start, @start + @len) of @ram is tagged,
+ * using the per-block summaries so that untagged memory (e.g. for revocation
+ * sweeps, dump or migration) can be skipped cheaply. A single page is O(1).
+ */
+bool cheri_tag_range_has_tags(RAMBlock *ram, ram_addr_t start, ram_addr_t len);
+
+/*
+ * Migration support: copy the TARGET_PAGE_SIZE / CHERI_CAP_SIZE tags of the
+ * page at @offset in @ram to or from a host-endian bitmap.
+ * cheri_tag_save_page() returns false if none of the tags are set.
+ */
+bool cheri_tag_save_page(RAMBlock *ram, ram_addr_t offset,
+                         unsigned long *tags);
+void cheri_tag_load_page(RAMBlock *ram, ram_addr_t offset,
+                         const unsigned long *tags);
+/**
+ * Allocate all tag blocks of @ram and stop them from being reclaimed until
+ * unpinned again. Used while postcopy places pages behind running vCPUs'
+ * backs, since those must never have cached a missing tag block in the TLB.
+ */
+void cheri_tag_pin(RAMBlock *ram, bool pin);
+/**
+ * Flush the TLBs of all CPUs if cheri_tag_load_page() or cheri_tag_pin()
+ * allocated tag blocks, since a TLB may still map those pages to the shared
+ * all-zero block. Must be called before vCPUs run on the loaded tags.
+ */
+void cheri_tag_load_done(void);
 
 void *cheri_tagmem_for_addr(CPUArchState *env, target_ulong vaddr,
                             RAMBlock *ram, ram_addr_t ram_offset, size_t size,
@@ -61,10 +61,10 @@
 
 #ifdef DO_CHERI_STATISTICS
 
-static DEFINE_CHERI_STAT(cgetpccsetoffset);
-static DEFINE_CHERI_STAT(cgetpccincoffset);
-static DEFINE_CHERI_STAT(cgetpccsetaddr);
-static DEFINE_CHERI_STAT(misc);
+DEFINE_CHERI_STAT(cgetpccsetoffset);
+DEFINE_CHERI_STAT(cgetpccincoffset);
+DEFINE_CHERI_STAT(cgetpccsetaddr);
+DEFINE_CHERI_STAT(misc);
 
 #endif
 
@@ -104,7 +104,7 @@ try_set_cap_cursor(CPUArchState *env, const cap_register_t *cptr,
 {
     DEFINE_RESULT_VALID;
 #ifdef DO_CHERI_STATISTICS
-    oob_info->num_uses++;
+    stat64_add(&oob_info->num_uses, 1);
 #endif
 
     if (unlikely(cptr->cr_tag && is_cap_sealed(cptr))) {
@@ -222,6 +222,38 @@ void CHERI_HELPER_IMPL(cheri_invalidate_tags_condition(
     }
 }
 
+/*
+ * Data store + tag invalidation for cheri_tagmem_atomic (the store is not
+ * emitted inline in that case).
+ */
+void CHERI_HELPER_IMPL(cheri_atomic_tags_st_i32(CPUArchState *env,
+                                                target_ulong vaddr,
+                                                uint32_t val, TCGMemOpIdx oi))
+{
+    cheri_tag_store_data_atomic(env, vaddr, val, oi, GETPC());
+}
+
+void CHERI_HELPER_IMPL(cheri_atomic_tags_st_i64(CPUArchState *env,
+                                                target_ulong vaddr,
+                                                uint64_t val, TCGMemOpIdx oi))
+{
+    cheri_tag_store_data_atomic(env, vaddr, val, oi, GETPC());
+}
+
+void CHERI_HELPER_IMPL(cheri_keep_tags_st_i32(CPUArchState *env,
+                                              target_ulong vaddr,
+                                              uint32_t val, TCGMemOpIdx oi))
+{
+    cheri_tag_store_data_keep(env, vaddr, val, oi, GETPC());
+}
+
+void CHERI_HELPER_IMPL(cheri_keep_tags_st_i64(CPUArchState *env,
+                                              target_ulong vaddr,
+                                              uint64_t val, TCGMemOpIdx oi))
+{
+    cheri_tag_store_data_keep(env, vaddr, val, oi, GETPC());
+}
+
 /// Implementations of individual instructions start here
 
 /// Two operand inspection instructions:
@@ -471,6 +503,8 @@ void CHERI_HELPER_IMPL(cinvoke(CPUArchState *env, uint32_t code_regnum,
         cap_set_unsealed(&idc);
         cap_register_t target = *code_cap;
         cap_set_unsealed(&target);
+        cheri_stat_inc(env, unseal);
+        qemu_plugin_vcpu_cap_op_cb(env_cpu(env), QEMU_PLUGIN_CAP_UNSEAL);
         update_next_pcc_for_tcg(env, &target, 0);
         update_capreg(env, CINVOKE_DATA_REGNUM, &idc);
     }
@@ -527,6 +561,8 @@ void CHERI_HELPER_IMPL(csealentry(CPUArchState *env, uint32_t cd, uint32_t cs))
         cap_register_t result = *csp;
         // capability can now only be used in cjr/cjalr
         cap_make_sealed_entry(&result);
+        cheri_stat_inc(env, seal);
+        qemu_plugin_vcpu_cap_op_cb(env_cpu(env), QEMU_PLUGIN_CAP_SEAL);
         update_capreg(env, cd, &result);
     }
 }
@@ -734,6 +770,8 @@ static void cseal_common(CPUArchState *env, uint32_t cd, uint32_t cs,
     } else {
         cap_register_t result = *csp;
         cap_set_sealed(&result, (uint32_t)ct_base_plus_offset);
+        cheri_stat_inc(env, seal);
+        qemu_plugin_vcpu_cap_op_cb(env_cpu(env), QEMU_PLUGIN_CAP_SEAL);
         update_capreg(env, cd, &result);
     }
 }
@@ -799,6 +837,8 @@ void CHERI_HELPER_IMPL(cunseal(CPUArchState *env, uint32_t cd, uint32_t cs,
         }
         CAP_cc(update_perms)(&result, new_perms);
         cap_set_unsealed(&result);
+        cheri_stat_inc(env, unseal);
+        qemu_plugin_vcpu_cap_op_cb(env_cpu(env), QEMU_PLUGIN_CAP_UNSEAL);
         update_capreg(env, cd, &result);
     }
 }
@@ -894,7 +934,7 @@ void CHERI_HELPER_IMPL(cfromptr(CPUArchState *env, uint32_t cd, uint32_t cb,
 {
     GET_HOST_RETPC();
 #ifdef DO_CHERI_STATISTICS
-    OOB_INFO(cfromptr)->num_uses++;
+    stat64_add(&OOB_INFO(cfromptr)->num_uses, 1);
 #endif
     // CFromPtr traps on cbp == NULL so we use reg0 as $ddc to save encoding
     // space (and for backwards compat with old binaries).
@@ -972,8 +1012,10 @@ static void do_setbounds(bool must_be_exact, CPUArchState *env, uint32_t cd,
      * representable.
      */
     const bool exact = CAP_cc(setbounds)(&result, new_base, new_top);
+    cheri_stat_inc(env, setbounds);
+    qemu_plugin_vcpu_cap_op_cb(env_cpu(env), QEMU_PLUGIN_CAP_SETBOUNDS);
     if (!exact)
-        env->statcounters_imprecise_setbounds++;
+        cheri_stat_inc(env, imprecise_setbounds);
     if (must_be_exact && !exact) {
         raise_cheri_exception_or_invalidate(env, CapEx_InexactBounds, cb);
     }
@@ -1238,6 +1280,22 @@ void squash_mutable_permissions(CPUArchState *env, target_ulong *pesbt,
 #endif
 }
 
+/* Notify TCG plugins once a capability access can no longer fault. */
+static inline void cheri_plugin_cap_mem(CPUArchState *env, target_ulong vaddr,
+                                        target_ulong cursor, bool tag,
+                                        bool is_store)
+{
+    CPUState *cpu = env_cpu(env);
+
+    qemu_plugin_vcpu_cap_op_cb(cpu, is_store ? QEMU_PLUGIN_CAP_STORE
+                                             : QEMU_PLUGIN_CAP_LOAD);
+    if (tag) {
+        qemu_plugin_vcpu_cap_op_cb(cpu, is_store ? QEMU_PLUGIN_CAP_STORE_TAGGED
+                                                 : QEMU_PLUGIN_CAP_LOAD_TAGGED);
+    }
+    qemu_plugin_vcpu_cap_mem_cb(cpu, vaddr, cursor, tag, is_store);
+}
+
 bool load_cap_from_memory_raw_tag_mmu_idx(
     CPUArchState *env, target_ulong *pesbt, target_ulong *cursor, uint32_t cb,
     const cap_register_t *source, target_ulong vaddr, target_ulong retpc,
@@ -1254,6 +1312,8 @@ bool load_cap_from_memory_raw_tag_mmu_idx(
     void *host = probe_read(env, vaddr, CHERI_CAP_SIZE, mmu_idx, retpc);
     // When writing back pesbt we have to XOR with the NULL mask to ensure that
     // NULL capabilities have an all-zeroes representation.
+    int prot;
+    bool tag;
     if (likely(host)) {
         // Fast path, host address in TLB
 #if TARGET_LONG_BITS == 32
@@ -1263,9 +1323,23 @@ bool load_cap_from_memory_raw_tag_mmu_idx(
 #else
 #error "Unhandled target long width"
 #endif
-        *pesbt = ld_cap_word_p((char *)host + CHERI_MEM_OFFSET_METADATA) ^
-                CAP_NULL_XOR_MASK;
-        *cursor = ld_cap_word_p((char *)host + CHERI_MEM_OFFSET_CURSOR);
+        /*
+         * With atomic tag memory, data and tag must come from the same store,
+         * so retry if another vCPU updated this line while we were reading.
+         */
+        void *tagmem = cheri_tag_lookup(env, vaddr, physaddr, &prot, retpc,
+                                        mmu_idx, &host);
+        unsigned seq = 0;
+        do {
+            if (cheri_tagmem_atomic) {
+                seq = cheri_tag_line_read_begin(host);
+            }
+            *pesbt = ld_cap_word_p((char *)host + CHERI_MEM_OFFSET_METADATA) ^
+                    CAP_NULL_XOR_MASK;
+            *cursor = ld_cap_word_p((char *)host + CHERI_MEM_OFFSET_CURSOR);
+            tag = cheri_tag_read(tagmem, vaddr);
+        } while (cheri_tagmem_atomic && cheri_tag_line_read_retry(host, seq));
+        cheri_tag_log_read(env, vaddr, host, tag);
 #undef ld_cap_word_p
     } else {
         // Slow path for e.g. IO regions.
@@ -1274,10 +1348,9 @@ bool load_cap_from_memory_raw_tag_mmu_idx(
         *pesbt = cpu_ld_cap_word_ra(env, vaddr + CHERI_MEM_OFFSET_METADATA, retpc) ^
                 CAP_NULL_XOR_MASK;
         *cursor = cpu_ld_cap_word_ra(env, vaddr + CHERI_MEM_OFFSET_CURSOR, retpc);
+        tag = cheri_tag_get(env, vaddr, cb, physaddr, &prot, retpc, mmu_idx,
+                            host);
     }
-    int prot;
-    bool tag =
-        cheri_tag_get(env, vaddr, cb, physaddr, &prot, retpc, mmu_idx, host);
     if (raw_tag) {
         *raw_tag = tag;
     }
@@ -1286,9 +1359,10 @@ bool load_cap_from_memory_raw_tag_mmu_idx(
     if (tag)
         squash_mutable_permissions(env, pesbt, source);
 
-    env->statcounters_cap_read++;
+    cheri_stat_inc(env, cap_read);
     if (tag)
-        env->statcounters_cap_read_tagged++;
+        cheri_stat_inc(env, cap_read_tagged);
+    cheri_plugin_cap_mem(env, vaddr, *cursor, tag, false);
 
 #if defined(TARGET_RISCV) && defined(CONFIG_RVFI_DII)
     env->rvfi_dii_trace.MEM.rvfi_mem_addr = vaddr;
@@ -1381,17 +1455,25 @@ void store_cap_to_memory_mmu_index(CPUArchState *env, uint32_t cs,
      * Touching the tags will take both the data write TLB fault and
      * capability write TLB fault before updating anything.  Thereafter, the
      * data stores will not take additional faults, so there is no risk of
-     * accidentally tagging a shorn data write.  This, like the rest of the
-     * tag logic, is not multi-TCG-thread safe.
+     * accidentally tagging a shorn data write.  With atomic tag memory the
+     * line lock is held from the tag update until both data words have been
+     * written, so other vCPUs never observe a partial capability.
      */
 
-    env->statcounters_cap_write++;
+    cheri_stat_inc(env, cap_write);
+    const bool lock_line = cheri_tagmem_atomic;
     void *host = NULL;
     if (tag) {
-        env->statcounters_cap_write_tagged++;
-        host = cheri_tag_set(env, vaddr, cs, NULL, retpc, mmu_idx);
+        cheri_stat_inc(env, cap_write_tagged);
+        host = lock_line
+                   ? cheri_tag_set_lock_line(env, vaddr, cs, NULL, retpc,
+                                             mmu_idx)
+                   : cheri_tag_set(env, vaddr, cs, NULL, retpc, mmu_idx);
     } else {
-        host = cheri_tag_invalidate_aligned(env, vaddr, retpc, mmu_idx);
+        host = lock_line ? cheri_tag_invalidate_aligned_lock_line(
+                               env, vaddr, retpc, mmu_idx)
+                         : cheri_tag_invalidate_aligned(env, vaddr, retpc,
+                                                        mmu_idx);
     }
     // When writing back pesbt we have to XOR with the NULL mask to ensure that
     // NULL capabilities have an all-zeroes representation.
@@ -1407,6 +1489,9 @@ void store_cap_to_memory_mmu_index(CPUArchState *env, uint32_t cs,
         st_cap_word_p((char*)host + CHERI_MEM_OFFSET_METADATA, pesbt_for_mem);
         st_cap_word_p((char*)host + CHERI_MEM_OFFSET_CURSOR, cursor);
 #undef st_cap_word_p
+        if (lock_line) {
+            cheri_tag_line_write_unlock(host);
+        }
     } else {
         // Slow path for e.g. IO regions.
         qemu_maybe_log_instr_extra(env, "Using slow path for store to guest "
@@ -1416,6 +1501,7 @@ void store_cap_to_memory_mmu_index(CPUArchState *env, uint32_t cs,
         cpu_st_cap_word_ra(env, vaddr + CHERI_MEM_OFFSET_CURSOR, cursor,
                            retpc);
     }
+    cheri_plugin_cap_mem(env, vaddr, cursor, tag, true);
 #if defined(TARGET_RISCV) && defined(CONFIG_RVFI_DII)
     env->rvfi_dii_trace.MEM.rvfi_mem_addr = vaddr;
     env->rvfi_dii_trace.MEM.rvfi_mem_wdata[0] = cursor;
@@ -1294,6 +1294,9 @@ void helper_mtc0_entryhi(CPUMIPSState *env, target_ulong arg1)
     if ((old & tlb_flush_mask) != (val & tlb_flush_mask)) {
         tlb_flush(env_cpu(env));
     }
+    if ((old ^ val) & env->CP0_EntryHi_ASID_mask) {
+        qemu_log_instr_trigger_update(env);
+    }
     log_instr_cop0_update(env, CP0_REGISTER_10, 0, env->CP0_EntryHi);
 }
 
@@ -11,6 +11,7 @@
 #ifdef TARGET_CHERI
 #include "cheri_defs.h"
 #include "cheri-lazy-capregs-types.h"
+#include "cheri-statcounters.h"
 #endif
 
 #define TCG_GUEST_DEFAULT_MO (0)
@@ -1228,16 +1229,7 @@ struct CPUMIPSState {
     uint64_t statcounters_icount_kernel;
     /* The other ones are CHERI only for now */
 #if defined(TARGET_CHERI)
-    uint64_t statcounters_itlb_miss;
-    uint64_t statcounters_dtlb_miss;
-    uint64_t statcounters_cap_read;
-    uint64_t statcounters_cap_read_tagged;
-    uint64_t statcounters_cap_write;
-    uint64_t statcounters_cap_write_tagged;
-
-    uint64_t statcounters_imprecise_setbounds;
-    uint64_t statcounters_unrepresentable_caps;
-    /* TODO: we could implement the TLB ones as well */
+    CheriStatCounters cheri_stats;
 
     /*
      * See section 3.9.2 (Table 3.3) of the CHERI Architecture Reference v7.
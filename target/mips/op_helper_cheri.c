@@ -237,7 +237,11 @@ static target_ulong ccall_common(CPUArchState *env, uint32_t cs, uint32_t cb, ui
             cap_register_t idc = *cbp;
             // Use of !allow_unsealed rather than !cap_is_unsealed used on purpose.
             // This should function like a jump and a move in the CCall2 case.
-            if (!allow_unsealed) cap_set_unsealed(&idc);
+            if (!allow_unsealed) {
+                cap_set_unsealed(&idc);
+                cheri_stat_inc(env, unseal);
+                qemu_plugin_vcpu_cap_op_cb(env_cpu(env), QEMU_PLUGIN_CAP_UNSEAL);
+            }
             update_capreg(env, CINVOKE_DATA_REGNUM, &idc);
             // The capability register is loaded into PCC during delay slot
             env->active_tc.CapBranchTarget = *csp;
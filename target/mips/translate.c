@@ -6946,6 +6946,7 @@ static inline bool use_goto_tb(DisasContext *ctx, target_ulong dest)
 
 static inline void gen_goto_tb(DisasContext *ctx, int n, target_ulong dest)
 {
+    translator_note_successor(&ctx->base, dest);
     if (use_goto_tb(ctx, dest)) {
         tcg_gen_goto_tb(n);
         gen_save_pc(dest);
@@ -14373,7 +14374,12 @@ static void gen_branch(DisasContext *ctx, int insn_bytes)
                 save_cpu_state(ctx, 0);
                 gen_helper_0e0i(raise_exception, EXCP_DEBUG);
             }
-            tcg_gen_exit_tb(NULL, 0);
+            /*
+             * The new PCC bounds (and MIPS_HFLAG_CP0) are part of the TB
+             * lookup key, so helper_lookup_tb_ptr() will find the right TB
+             * without going back to the main loop.
+             */
+            tcg_gen_lookup_and_goto_ptr();
             break;
 #endif /* TARGET_CHERI */
         default:
@@ -818,7 +818,7 @@ static inline void generate_cap_load(DisasContext *ctx, int32_t rd, int32_t cb,
     gen_load_gpr(t1, rt);
     tcg_gen_addi_tl(t1, t1, cload_sign_extend(offset) * memop_size(op));
 
-    generate_cap_load_check(vaddr, cb, t1, op);
+    generate_cap_load_check(vaddr, ctx, cb, t1, op);
     tcg_gen_qemu_ld_tl_with_checked_addr(t1, vaddr, ctx->mem_idx, op);
     gen_store_gpr(t1, rd);
 
@@ -900,7 +900,7 @@ static inline void generate_cstore(DisasContext *ctx, int32_t rs, int32_t cb,
     gen_load_gpr(t0, rt);  // t0 <- register offset
     tcg_gen_addi_tl(t0, t0, cload_sign_extend(offset) * size);
 
-    generate_cap_store_check(taddr, cb, t0, op);
+    generate_cap_store_check(taddr, ctx, cb, t0, op);
 
     gen_load_gpr(t0, rs); // t0 <- load value to store
     tcg_gen_qemu_st_tl_with_checked_addr(t0, taddr, ctx->mem_idx, op);
@@ -102,6 +102,7 @@ typedef struct CPURISCVState CPURISCVState;
 
 #ifdef TARGET_CHERI
 #include "cheri-lazy-capregs-types.h"
+#include "cheri-statcounters.h"
 #endif
 #include "pmp.h"
 
@@ -291,14 +292,7 @@ struct CPURISCVState {
     float_status fp_status;
 
 #ifdef TARGET_CHERI
-    // Some statcounters:
-    uint64_t statcounters_cap_read;
-    uint64_t statcounters_cap_read_tagged;
-    uint64_t statcounters_cap_write;
-    uint64_t statcounters_cap_write_tagged;
-
-    uint64_t statcounters_imprecise_setbounds;
-    uint64_t statcounters_unrepresentable_caps;
+    CheriStatCounters cheri_stats;
 
 #endif
 
@@ -1107,6 +1107,9 @@ bool riscv_cpu_tlb_fill(CPUState *cs, vaddr address, int size,
     int prot = 0;
     hwaddr pa = 0;
     target_ulong tlb_size = 0;
+#ifdef TARGET_CHERI
+    cheri_stat_tlb_miss(env, access_type);
+#endif
     int ret = riscv_cpu_tlb_fill_impl(env, address, size, access_type, mmu_idx,
                                       &pmp_violation, &first_stage_error, &prot,
                                       &pa, retaddr);
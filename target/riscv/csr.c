@@ -946,10 +946,15 @@ static int write_satp(CPURISCVState *env, int csrno, target_ulong val)
         if (env->priv == PRV_S && get_field(env->mstatus, MSTATUS_TVM)) {
             return -RISCV_EXCP_ILLEGAL_INST;
         } else {
-            if ((val ^ env->satp) & SATP_ASID) {
+            bool asid_changed = (val ^ env->satp) & SATP_ASID;
+
+            if (asid_changed) {
                 tlb_flush(env_cpu(env));
             }
             env->satp = val;
+            if (asid_changed) {
+                qemu_log_instr_trigger_update(env);
+            }
         }
     }
     return 0;
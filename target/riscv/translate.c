@@ -243,6 +243,7 @@ static inline void _gen_set_gpr(DisasContext *ctx, int reg_num_dst, TCGv t,
 {
     if (reg_num_dst != 0) {
 #ifdef TARGET_CHERI
+        disas_capreg_checks_invalidate(&ctx->base, reg_num_dst);
         if (clear_pesbt)
             gen_lazy_cap_set_int(
                 ctx, reg_num_dst); // Reset the register type to int.
@@ -268,6 +269,7 @@ static inline void _gen_set_gpr_const(DisasContext *ctx, int reg_num_dst,
 {
     if (reg_num_dst != 0) {
 #ifdef TARGET_CHERI
+        disas_capreg_checks_invalidate(&ctx->base, reg_num_dst);
         gen_lazy_cap_set_int(ctx,
                              reg_num_dst); // Reset the register type to int.
         tcg_gen_movi_tl(_cpu_cursors_do_not_access_directly[reg_num_dst], value);
@@ -292,6 +294,18 @@ static inline void _gen_set_gpr_const(DisasContext *ctx, int reg_num_dst,
 #define gen_set_gpr(reg_num_dst, t) _gen_set_gpr(ctx, reg_num_dst, t, true)
 #define gen_set_gpr_const(reg_num_dst, t) _gen_set_gpr_const(ctx, reg_num_dst, t)
 
+/*
+ * Called by instructions that write GPRs only with gen_set_gpr(), which
+ * invalidates the written register, to keep the record of capability checks
+ * that passed earlier in this TB.
+ */
+static inline void preserve_cap_checks(DisasContext *ctx)
+{
+#ifdef TARGET_CHERI
+    disas_capreg_checks_preserve(&ctx->base);
+#endif
+}
+
 #ifdef CONFIG_TCG_LOG_INSTR
 static inline void gen_riscv_log_instr(DisasContext *ctx, uint32_t opcode,
                                        int width)
@@ -332,6 +346,7 @@ static void gen_goto_tb(DisasContext *ctx, int n, target_ulong dest,
     if (bounds_check)
         gen_check_branch_target(ctx, dest);
 
+    translator_note_successor(&ctx->base, dest);
     if (use_goto_tb(ctx, dest)) {
         /* chaining is only allowed when the jump is to the same page */
         tcg_gen_goto_tb(n);
@@ -627,6 +642,7 @@ static bool gen_arith_imm_fn(DisasContext *ctx, arg_i *a,
 
     gen_set_gpr(a->rd, source1);
     tcg_temp_free(source1);
+    preserve_cap_checks(ctx);
     return true;
 }
 
@@ -645,6 +661,7 @@ static bool gen_arith_imm_tl(DisasContext *ctx, arg_i *a,
     gen_set_gpr(a->rd, source1);
     tcg_temp_free(source1);
     tcg_temp_free(source2);
+    preserve_cap_checks(ctx);
     return true;
 }
 
@@ -726,6 +743,7 @@ static bool gen_arith(DisasContext *ctx, arg_r *a,
     gen_set_gpr(a->rd, source1);
     tcg_temp_free(source1);
     tcg_temp_free(source2);
+    preserve_cap_checks(ctx);
     return true;
 }
 
@@ -744,6 +762,7 @@ static bool gen_shift(DisasContext *ctx, arg_r *a,
     gen_set_gpr(a->rd, source1);
     tcg_temp_free(source1);
     tcg_temp_free(source2);
+    preserve_cap_checks(ctx);
     return true;
 }
 
@@ -783,16 +802,19 @@ static inline bool trans_cincoffsetimm(DisasContext *ctx, arg_cincoffsetimm *a)
 static inline TCGv_cap_checked_ptr _get_capmode_dependent_addr(
     DisasContext *ctx, int reg_num, target_long regoffs,
 #ifdef TARGET_CHERI
-    void (*gen_check_cap)(TCGv_cap_checked_ptr, uint32_t, target_long, MemOp),
+    void (*gen_check_cap)(TCGv_cap_checked_ptr, DisasContext *, uint32_t,
+                          target_long, MemOp),
     void (*check_ddc)(TCGv_cap_checked_ptr, DisasContext *, TCGv, target_ulong),
 #endif
     MemOp mop)
 
 {
     TCGv_cap_checked_ptr result = tcg_temp_new_cap_checked();
+    // Users only write GPRs with gen_set_gpr(), so this is safe.
+    preserve_cap_checks(ctx);
 #ifdef TARGET_CHERI
     if (ctx->capmode) {
-        gen_check_cap(result, reg_num, regoffs, mop);
+        gen_check_cap(result, ctx, reg_num, regoffs, mop);
     } else {
         generate_get_ddc_checked_gpr_plus_offset(result, ctx, reg_num, regoffs,
                                                  mop, check_ddc);
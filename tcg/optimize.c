@@ -1548,3 +1548,472 @@ void tcg_optimize(TCGContext *s)
         }
     }
 }
+
+#define MAX_DEAD_STORE_RANGES 16
+
+typedef struct {
+    intptr_t start;
+    intptr_t end;
+} EnvRange;
+
+/* Size of the env access done by a plain load or store, 0 for other ops */
+static int env_access_size(TCGOpcode opc, bool *is_store)
+{
+    *is_store = false;
+    switch (opc) {
+    CASE_OP_32_64(ld8u):
+    CASE_OP_32_64(ld8s):
+        return 1;
+    CASE_OP_32_64(ld16u):
+    CASE_OP_32_64(ld16s):
+        return 2;
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+        return 4;
+    case INDEX_op_ld_i64:
+        return 8;
+    CASE_OP_32_64(st8):
+        *is_store = true;
+        return 1;
+    CASE_OP_32_64(st16):
+        *is_store = true;
+        return 2;
+    case INDEX_op_st_i32:
+    case INDEX_op_st32_i64:
+        *is_store = true;
+        return 4;
+    case INDEX_op_st_i64:
+        *is_store = true;
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static bool env_range_overlaps(const EnvRange *a, intptr_t start, intptr_t end)
+{
+    return a->start < end && start < a->end;
+}
+
+/*
+ * Collect the env fields backing TCG globals. Register allocation loads
+ * and syncs these implicitly, so explicit accesses to them are left alone.
+ */
+static EnvRange *env_global_ranges(TCGContext *s, TCGTemp *env, int *n)
+{
+    EnvRange *globals = tcg_malloc(sizeof(EnvRange) * s->nb_globals);
+    int i;
+
+    *n = 0;
+    for (i = 0; i < s->nb_globals; i++) {
+        TCGTemp *ts = &s->temps[i];
+
+        if (!ts->fixed_reg && ts->mem_base == env) {
+            globals[*n].start = ts->mem_offset;
+            globals[*n].end = ts->mem_offset +
+                (ts->type == TCG_TYPE_I32 ? 4 : 8);
+            (*n)++;
+        }
+    }
+    return globals;
+}
+
+static bool env_range_is_global(const EnvRange *globals, int n,
+                                intptr_t start, intptr_t end)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (env_range_overlaps(&globals[i], start, end)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Remove stores to the CPU state that are overwritten within the same
+ * basic block before anything can read them. Walking the ops backwards,
+ * @pending holds the env ranges that are stored to later in the block
+ * with no load, helper call or guest memory access (which may fault and
+ * unwind to code reading the CPU state) in between. Fields backing TCG
+ * globals are left alone: register allocation accesses them implicitly.
+ *
+ * Like tcg_optimize_gvn(), this only runs with -accel tcg,gvn=on and for
+ * TBs retranslated as hot (CF_HOT).
+ */
+void tcg_optimize_env_stores(TCGContext *s)
+{
+    TCGTemp *env = tcgv_ptr_temp(cpu_env);
+    EnvRange pending[MAX_DEAD_STORE_RANGES];
+    EnvRange *globals;
+    int nb_globals, nb_pending = 0;
+    TCGOp *op, *op_prev;
+    int i, j;
+
+    globals = env_global_ranges(s, env, &nb_globals);
+
+    QTAILQ_FOREACH_REVERSE_SAFE(op, &s->ops, link, op_prev) {
+        TCGOpcode opc = op->opc;
+        const TCGOpDef *def = &tcg_op_defs[opc];
+        intptr_t start, end;
+        bool is_store, dead;
+        int size;
+
+        size = env_access_size(opc, &is_store);
+        if (size == 0) {
+            if (opc == INDEX_op_call || opc == INDEX_op_ld_vec ||
+                opc == INDEX_op_dupm_vec ||
+                (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS))) {
+                nb_pending = 0;
+            }
+            continue;
+        }
+        if (arg_temp(op->args[1]) != env) {
+            /* Could be a pointer into env */
+            if (!is_store) {
+                nb_pending = 0;
+            }
+            continue;
+        }
+
+        start = op->args[2];
+        end = start + size;
+        if (!is_store) {
+            for (i = j = 0; i < nb_pending; i++) {
+                if (!env_range_overlaps(&pending[i], start, end)) {
+                    pending[j++] = pending[i];
+                }
+            }
+            nb_pending = j;
+            continue;
+        }
+
+        /* Negative offsets hold CPUNegativeOffsetState, shared with I/O */
+        if (start < 0 || env_range_is_global(globals, nb_globals, start, end)) {
+            continue;
+        }
+
+        dead = false;
+        for (i = 0; i < nb_pending; i++) {
+            if (pending[i].start <= start && end <= pending[i].end) {
+                dead = true;
+                break;
+            }
+        }
+        if (dead) {
+            tcg_op_remove(s, op);
+        } else if (nb_pending < MAX_DEAD_STORE_RANGES) {
+            pending[nb_pending].start = start;
+            pending[nb_pending].end = end;
+            nb_pending++;
+        }
+    }
+}
+
+#define GVN_MAX_ARGS 8
+#define GVN_MAX_EXPRS 64
+#define GVN_MAX_LOADS 32
+
+/*
+ * A value number: the temp that first held the value, and the version of
+ * that temp at the time. Temp versions are kept in ts->state and bumped
+ * whenever the temp is written.
+ */
+typedef struct {
+    TCGTemp *ts;
+    uintptr_t ver;
+} GVNValue;
+
+/* A pure op whose result @val is still held by @out at version @out_ver */
+typedef struct {
+    TCGOpcode opc;
+    int nb_args;
+    TCGArg args[GVN_MAX_ARGS];
+    GVNValue in[GVN_MAX_ARGS];
+    GVNValue val;
+    TCGTemp *out;
+    uintptr_t out_ver;
+} GVNExpr;
+
+/* The value of env [start, end) as read by @ld_opc, held by @out */
+typedef struct {
+    intptr_t start;
+    intptr_t end;
+    TCGOpcode ld_opc;
+    TCGTemp *out;
+    uintptr_t out_ver;
+} GVNLoad;
+
+/*
+ * Value numbers of all temps. Instead of resetting every entry at the end
+ * of each basic block, entries are stamped with the block they were set in
+ * and an entry from an earlier block reads as the temp's current version.
+ */
+typedef struct {
+    GVNValue *vn;
+    unsigned *bb;
+    unsigned cur_bb;
+} GVNState;
+
+static inline GVNValue *gvn_value(GVNState *g, TCGArg arg)
+{
+    TCGTemp *ts = arg_temp(arg);
+    size_t i = temp_idx(ts);
+
+    if (g->bb[i] != g->cur_bb) {
+        g->bb[i] = g->cur_bb;
+        g->vn[i] = (GVNValue){ ts, ts->state };
+    }
+    return &g->vn[i];
+}
+
+static inline bool gvn_value_equal(const GVNValue *a, const GVNValue *b)
+{
+    return a->ts == b->ts && a->ver == b->ver;
+}
+
+/* Record that the output of the current op holds a new value */
+static inline void gvn_def(GVNState *g, TCGArg arg)
+{
+    TCGTemp *ts = arg_temp(arg);
+
+    ts->state++;
+    *gvn_value(g, arg) = (GVNValue){ ts, ts->state };
+}
+
+/*
+ * Turn @op into a copy from @src, which holds the value @val, into its
+ * output; the copy is dropped if it is the output itself.
+ */
+static void gvn_replace(TCGContext *s, GVNState *g, TCGOp *op,
+                        TCGTemp *src, GVNValue val)
+{
+    TCGTemp *dst = arg_temp(op->args[0]);
+
+#ifdef CONFIG_PROFILER
+    qatomic_set(&s->prof.gvn_op_count, s->prof.gvn_op_count + 1);
+#endif
+    if (dst == src) {
+        tcg_op_remove(s, op);
+        return;
+    }
+    op->opc = dst->type == TCG_TYPE_I32 ? INDEX_op_mov_i32 : INDEX_op_mov_i64;
+    op->args[1] = temp_arg(src);
+    dst->state++;
+    *gvn_value(g, op->args[0]) = val;
+}
+
+static bool gvn_expr_match(const GVNExpr *e, GVNState *g, const TCGOp *op,
+                           int nb_oargs, int nb_iargs, int nb_args)
+{
+    int i;
+
+    if (e->opc != op->opc || e->nb_args != nb_args ||
+        e->out->state != e->out_ver) {
+        return false;
+    }
+    for (i = nb_oargs; i < nb_args; i++) {
+        if (i < nb_oargs + nb_iargs) {
+            if (!gvn_value_equal(&e->in[i], gvn_value(g, op->args[i]))) {
+                return false;
+            }
+        } else if (e->args[i] != op->args[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool gvn_is_pure(TCGOpcode opc, const TCGOpDef *def)
+{
+    if (opc == INDEX_op_movi_i32 || opc == INDEX_op_movi_i64) {
+        return true;
+    }
+    return def->nb_oargs == 1 &&
+           def->nb_oargs + def->nb_iargs + def->nb_cargs <= GVN_MAX_ARGS &&
+           !(def->flags & (TCG_OPF_SIDE_EFFECTS | TCG_OPF_CALL_CLOBBER |
+                           TCG_OPF_VECTOR | TCG_OPF_NOT_PRESENT));
+}
+
+/*
+ * Value numbering within each basic block. A pure op that computes a
+ * value some temp still holds becomes a mov from that temp, and a load
+ * from env becomes a mov from the temp last loaded from or stored to the
+ * same field. Copies share the value number of their source, so
+ * recomputations from copied or re-materialized constants are found too.
+ *
+ * Known env values are forgotten on helper calls that may have side
+ * effects, on guest memory accesses (their slow path may change the CPU
+ * state), on stores through pointers other than env and on barriers. The
+ * fields before env (CPUNegativeOffsetState and CPUState) are changed by
+ * other threads and are never forwarded.
+ */
+bool tcg_gvn_enabled;
+
+void tcg_optimize_gvn(TCGContext *s)
+{
+    TCGTemp *env = tcgv_ptr_temp(cpu_env);
+    GVNState g = {
+        .vn = tcg_malloc(sizeof(GVNValue) * s->nb_temps),
+        .bb = tcg_malloc(sizeof(unsigned) * s->nb_temps),
+        .cur_bb = 1,
+    };
+    GVNExpr *exprs = tcg_malloc(sizeof(GVNExpr) * GVN_MAX_EXPRS);
+    GVNLoad loads[GVN_MAX_LOADS];
+    EnvRange *globals;
+    int nb_globals, nb_exprs = 0, next_expr = 0, nb_loads = 0;
+    TCGOp *op, *op_next;
+    int i, j;
+
+    globals = env_global_ranges(s, env, &nb_globals);
+    for (i = 0; i < s->nb_temps; i++) {
+        s->temps[i].state = 0;
+    }
+    memset(g.bb, 0, sizeof(unsigned) * s->nb_temps);
+
+    QTAILQ_FOREACH_SAFE(op, &s->ops, link, op_next) {
+        TCGOpcode opc = op->opc;
+        const TCGOpDef *def = &tcg_op_defs[opc];
+        int nb_oargs, nb_iargs, nb_args, size;
+        bool is_store;
+
+        if (opc == INDEX_op_call) {
+            TCGArg flags;
+
+            nb_oargs = TCGOP_CALLO(op);
+            nb_iargs = TCGOP_CALLI(op);
+            flags = op->args[nb_oargs + nb_iargs + 1];
+            if (!(flags & (TCG_CALL_NO_READ_GLOBALS |
+                           TCG_CALL_NO_WRITE_GLOBALS))) {
+                for (i = 0; i < s->nb_globals; i++) {
+                    gvn_def(&g, temp_arg(&s->temps[i]));
+                }
+            }
+            if (!(flags & TCG_CALL_NO_SIDE_EFFECTS)) {
+                nb_loads = 0;
+            }
+            for (i = 0; i < nb_oargs; i++) {
+                gvn_def(&g, op->args[i]);
+            }
+            continue;
+        }
+
+        if (def->flags & TCG_OPF_BB_END) {
+            /* Copies made on one path into a label do not hold on others */
+            g.cur_bb++;
+            nb_exprs = next_expr = nb_loads = 0;
+            continue;
+        }
+
+        nb_oargs = def->nb_oargs;
+        nb_iargs = def->nb_iargs;
+        nb_args = nb_oargs + nb_iargs + def->nb_cargs;
+
+        if (opc == INDEX_op_mov_i32 || opc == INDEX_op_mov_i64) {
+            GVNValue val = *gvn_value(&g, op->args[1]);
+
+            arg_temp(op->args[0])->state++;
+            *gvn_value(&g, op->args[0]) = val;
+            continue;
+        }
+
+        size = env_access_size(opc, &is_store);
+        if (size && arg_temp(op->args[1]) == env &&
+            (intptr_t)op->args[2] >= 0 &&
+            !env_range_is_global(globals, nb_globals, op->args[2],
+                                 op->args[2] + size)) {
+            intptr_t start = op->args[2];
+            intptr_t end = start + size;
+            GVNLoad *l;
+
+            if (is_store) {
+                for (i = j = 0; i < nb_loads; i++) {
+                    if (!(loads[i].start < end && start < loads[i].end)) {
+                        loads[j++] = loads[i];
+                    }
+                }
+                nb_loads = j;
+                if ((opc == INDEX_op_st_i32 || opc == INDEX_op_st_i64) &&
+                    nb_loads < GVN_MAX_LOADS) {
+                    l = &loads[nb_loads++];
+                    l->start = start;
+                    l->end = end;
+                    l->ld_opc = opc == INDEX_op_st_i32 ? INDEX_op_ld_i32
+                                                       : INDEX_op_ld_i64;
+                    l->out = arg_temp(op->args[0]);
+                    l->out_ver = l->out->state;
+                }
+                continue;
+            }
+
+            for (i = 0; i < nb_loads; i++) {
+                l = &loads[i];
+                if (l->ld_opc == opc && l->start == start &&
+                    l->out->state == l->out_ver) {
+                    gvn_replace(s, &g, op, l->out,
+                                *gvn_value(&g, temp_arg(l->out)));
+                    break;
+                }
+            }
+            if (i < nb_loads) {
+                continue;
+            }
+            gvn_def(&g, op->args[0]);
+            if (nb_loads < GVN_MAX_LOADS) {
+                l = &loads[nb_loads++];
+                l->start = start;
+                l->end = end;
+                l->ld_opc = opc;
+                l->out = arg_temp(op->args[0]);
+                l->out_ver = l->out->state;
+            }
+            continue;
+        }
+
+        if ((size && is_store && arg_temp(op->args[1]) != env) ||
+            opc == INDEX_op_st_vec ||
+            opc == INDEX_op_mb || (def->flags & TCG_OPF_SIDE_EFFECTS)) {
+            /* May write env through another pointer or change it */
+            nb_loads = 0;
+        }
+
+        if (!size && gvn_is_pure(opc, def)) {
+            GVNExpr *e;
+
+            for (i = 0; i < nb_exprs; i++) {
+                e = &exprs[i];
+                if (gvn_expr_match(e, &g, op, nb_oargs, nb_iargs, nb_args)) {
+                    gvn_replace(s, &g, op, e->out, e->val);
+                    break;
+                }
+            }
+            if (i < nb_exprs) {
+                continue;
+            }
+
+            /* Inputs are recorded first, the output may also be one */
+            e = &exprs[next_expr];
+            next_expr = (next_expr + 1) % GVN_MAX_EXPRS;
+            nb_exprs = MIN(nb_exprs + 1, GVN_MAX_EXPRS);
+            e->opc = opc;
+            e->nb_args = nb_args;
+            for (i = nb_oargs; i < nb_args; i++) {
+                e->args[i] = op->args[i];
+                if (i < nb_oargs + nb_iargs) {
+                    e->in[i] = *gvn_value(&g, op->args[i]);
+                }
+            }
+            gvn_def(&g, op->args[0]);
+            e->out = arg_temp(op->args[0]);
+            e->out_ver = e->out->state;
+            e->val = *gvn_value(&g, op->args[0]);
+            continue;
+        }
+
+        for (i = 0; i < nb_oargs; i++) {
+            gvn_def(&g, op->args[i]);
+        }
+    }
+}
@@ -33,6 +33,7 @@
 #include "exec/plugin-gen.h"
 #include "exec/log_instr.h"
 #include "cheri_defs.h"
+#include "cheri_tagmem.h"
 
 /* Reduce the number of ifdefs below.  This assumes that all uses of
    TCGV_HIGH and TCGV_LOW are properly protected by a conditional that
@@ -2929,6 +2930,27 @@ void handle_conditional_invalidate(TCGv_cap_checked_ptr checked_addr,
 #endif
 }
 
+#if defined(TARGET_CHERI)
+/*
+ * With atomic tag memory, inline stores to pages with tags take the softmmu
+ * slow path (TLB_CHERI_TAGS), which clears the tags under the line lock.
+ * Stores that must keep the tags, or whose alignment bits would overlap
+ * TLB_CHERI_TAGS in the fast path compare, need a helper instead.
+ */
+static bool cheri_store_needs_helper(MemOp memop, bool invalidate)
+{
+    if (!cheri_tagmem_atomic) {
+        return false;
+    }
+#ifdef CONFIG_SOFTMMU
+    return !invalidate ||
+           (TLB_CHERI_TAGS & ((1 << get_alignment_bits(memop)) - 1)) != 0;
+#else
+    return true;
+#endif
+}
+#endif
+
 static void tcg_gen_qemu_st_i32_with_checked_addr_cond_invalidate(
     TCGv_i32 val, TCGv_cap_checked_ptr addr, TCGArg idx, MemOp memop,
     bool invalidate)
@@ -2960,7 +2982,23 @@ static void tcg_gen_qemu_st_i32_with_checked_addr_cond_invalidate(
     addr = plugin_prep_mem_callbacks(addr);
     gen_rvfi_dii_set_field_zext_addr(MEM, mem_addr, addr);
     gen_rvfi_dii_set_field_zext_i32(MEM, mem_wdata[0], val);
+#if defined(TARGET_CHERI)
+    /* Atomic tag memory: the store itself also clears the tags. */
+    bool store_clears_tags = invalidate && cheri_tagmem_atomic;
+    if (cheri_store_needs_helper(memop, invalidate)) {
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop, idx));
+        if (invalidate) {
+            gen_helper_cheri_atomic_tags_st_i32(cpu_env, addr, val, oi);
+        } else {
+            gen_helper_cheri_keep_tags_st_i32(cpu_env, addr, val, oi);
+        }
+        tcg_temp_free_i32(oi);
+    } else {
+        gen_ldst_i32(INDEX_op_qemu_st_i32, val, addr, memop, idx);
+    }
+#else
     gen_ldst_i32(INDEX_op_qemu_st_i32, val, addr, memop, idx);
+#endif
     gen_rvfi_dii_set_field_const_i32(MEM, mem_wmask, memop_rvfi_mask(memop));
 
     plugin_gen_mem_callbacks(addr, info);
@@ -2972,7 +3010,7 @@ static void tcg_gen_qemu_st_i32_with_checked_addr_cond_invalidate(
     }
 #endif
 #if defined(TARGET_CHERI)
-    if (invalidate) {
+    if (invalidate && !store_clears_tags) {
         gen_helper_cheri_invalidate_tags(cpu_env, addr, tcoi);
     }
 #endif
@@ -3119,7 +3157,23 @@ void tcg_gen_qemu_st_i64_with_checked_addr_cond_invalidate(
     addr = plugin_prep_mem_callbacks(addr);
     gen_rvfi_dii_set_field_zext_addr(MEM, mem_addr, addr);
     gen_rvfi_dii_set_field(MEM, mem_wdata[0], val);
+#if defined(TARGET_CHERI)
+    /* Atomic tag memory: the store itself also clears the tags. */
+    bool store_clears_tags = invalidate && cheri_tagmem_atomic;
+    if (cheri_store_needs_helper(memop, invalidate)) {
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop, idx));
+        if (invalidate) {
+            gen_helper_cheri_atomic_tags_st_i64(cpu_env, addr, val, oi);
+        } else {
+            gen_helper_cheri_keep_tags_st_i64(cpu_env, addr, val, oi);
+        }
+        tcg_temp_free_i32(oi);
+    } else {
+        gen_ldst_i64(INDEX_op_qemu_st_i64, val, addr, memop, idx);
+    }
+#else
     gen_ldst_i64(INDEX_op_qemu_st_i64, val, addr, memop, idx);
+#endif
     gen_rvfi_dii_set_field_const_i32(MEM, mem_wmask, memop_rvfi_mask(memop));
 
     plugin_gen_mem_callbacks(addr, info);
@@ -3131,7 +3185,7 @@ void tcg_gen_qemu_st_i64_with_checked_addr_cond_invalidate(
     }
 #endif
 #if defined(TARGET_CHERI)
-    if (invalidate) {
+    if (invalidate && !store_clears_tags) {
         gen_helper_cheri_invalidate_tags(cpu_env, addr, tcoi);
     }
 #endif
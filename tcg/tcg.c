@@ -200,6 +200,7 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    void *claimed_end; /* end of code claimed in region current */
 };
 
 static struct tcg_region_state region;
@@ -569,6 +570,12 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
     s->code_gen_ptr = start;
     s->code_gen_buffer_size = end - start;
     s->code_gen_highwater = end - TCG_HIGHWATER;
+
+    /* Start after code claimed by tcg_region_claim() */
+    if (region.claimed_end > start && region.claimed_end <= end) {
+        s->code_gen_ptr = region.claimed_end;
+        region.claimed_end = NULL;
+    }
 }
 
 static bool tcg_region_alloc__locked(TCGContext *s)
@@ -618,6 +625,7 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.claimed_end = NULL;
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -630,6 +638,66 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+/*
+ * Mark regions [0, @n) as already holding code up to @end, which must lie
+ * in region @n - 1; e.g. because they were mapped from a persistent TB cache.
+ * The first context to allocate a region continues right after @end.
+ * Call before any context has allocated a region.
+ */
+void tcg_region_claim(size_t n, void *end)
+{
+    void *start, *rend;
+    size_t i;
+
+    qemu_mutex_lock(&region.lock);
+    g_assert(region.current == 0 && n > 0 && n <= region.n);
+    for (i = 0; i < n - 1; i++) {
+        tcg_region_bounds(i, &start, &rend);
+        region.agg_size_full += rend - start - TCG_HIGHWATER;
+    }
+    tcg_region_bounds(n - 1, &start, &rend);
+    g_assert(end > start && end <= rend);
+    region.current = n - 1;
+    region.claimed_end = end;
+    qemu_mutex_unlock(&region.lock);
+}
+
+/* Returns the number of regions and the bounds of region @i */
+size_t tcg_region_get_bounds(size_t i, void **pstart, void **pend)
+{
+    tcg_region_bounds(i, pstart, pend);
+    return region.n;
+}
+
+/*
+ * Calls @fn for the code in each region handed out since the last reset,
+ * in region order. The region a context is currently filling ends at its
+ * code_gen_ptr. Call from a safe-work context.
+ */
+void tcg_region_foreach_used(void (*fn)(size_t i, void *start, void *end,
+                                        void *opaque),
+                             void *opaque)
+{
+    unsigned int n_ctxs = qatomic_read(&n_tcg_ctxs);
+    unsigned int j;
+    void *start, *end;
+    size_t i;
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < region.current; i++) {
+        tcg_region_bounds(i, &start, &end);
+        for (j = 0; j < n_ctxs; j++) {
+            const TCGContext *s = qatomic_read(&tcg_ctxs[j]);
+
+            if (s->code_gen_buffer == start) {
+                end = s->code_gen_ptr;
+            }
+        }
+        fn(i, start, end, opaque);
+    }
+    qemu_mutex_unlock(&region.lock);
+}
+
 #ifdef CONFIG_USER_ONLY
 static size_t tcg_n_regions(void)
 {
@@ -1194,6 +1262,7 @@ void tcg_func_start(TCGContext *s)
     s->nb_ops = 0;
     s->nb_labels = 0;
     s->current_frame_offset = s->frame_start;
+    s->tb_heap_ptrs = false;
 
 #ifdef CONFIG_DEBUG_TCG
     s->goto_tb_issue_mask = 0;
@@ -4100,6 +4169,8 @@ void tcg_profile_snapshot(TCGProfile *prof, bool counters, bool table)
             PROF_ADD(prof, orig, temp_count);
             PROF_MAX(prof, orig, temp_count_max);
             PROF_ADD(prof, orig, del_op_count);
+            PROF_ADD(prof, orig, gvn_op_count);
+            PROF_ADD(prof, orig, insn_count);
             PROF_ADD(prof, orig, code_in_len);
             PROF_ADD(prof, orig, code_out_len);
             PROF_ADD(prof, orig, search_out_len);
@@ -4245,6 +4316,10 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
 
 #ifdef USE_TCG_OPTIMIZATIONS
     tcg_optimize(s);
+    if (tcg_gvn_enabled || (s->tb_cflags & CF_HOT)) {
+        tcg_optimize_gvn(s);
+        tcg_optimize_env_stores(s);
+    }
 #endif
 
 #ifdef CONFIG_PROFILER
@@ -4438,10 +4513,14 @@ void tcg_dump_info(void)
                 (double)s->op_count / tb_div_count, s->op_count_max);
     qemu_printf("deleted ops/TB      %0.2f\n",
                 (double)s->del_op_count / tb_div_count);
+    qemu_printf("value-numbered ops/TB %0.2f\n",
+                (double)s->gvn_op_count / tb_div_count);
     qemu_printf("avg temps/TB        %0.2f max=%d\n",
                 (double)s->temp_count / tb_div_count, s->temp_count_max);
     qemu_printf("avg host code/TB    %0.1f\n",
                 (double)s->code_out_len / tb_div_count);
+    qemu_printf("avg host code/insn  %0.1f\n",
+                s->insn_count ? (double)s->code_out_len / s->insn_count : 0);
     qemu_printf("avg search data/TB  %0.1f\n",
                 (double)s->search_out_len / tb_div_count);
     
@@ -0,0 +1,77 @@
+/*
+ * Bitmap range clear speed benchmark
+ *
+ * Models clearing CHERI tags (one bit per 16 bytes of guest memory) for
+ * DMA writes of 4 KiB to 1 MiB, with an empty, a sparsely and a fully
+ * tagged destination.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bitmap.h"
+
+#define BYTES_PER_TAG 16
+
+typedef struct BitmapClearOpts {
+    size_t range;   /* bytes of guest memory per clear */
+    unsigned density; /* one tag set every density tags, 0 for none */
+} BitmapClearOpts;
+
+static void fill_tags(unsigned long *map, long nbits, unsigned density)
+{
+    bitmap_zero(map, nbits);
+    for (long i = 0; density && i < nbits; i += density) {
+        set_bit(i, map);
+    }
+}
+
+static void test_clear_speed(const void *opaque)
+{
+    const BitmapClearOpts *opts = opaque;
+    const size_t total = 4 * GiB, pool = 256 * MiB;
+    const long nbits = pool / BYTES_PER_TAG;
+    const long range_bits = opts->range / BYTES_PER_TAG;
+    unsigned long *map = bitmap_new(nbits);
+    double elapsed = 0;
+    size_t remain;
+
+    for (remain = total; remain; remain -= pool) {
+        fill_tags(map, nbits, opts->density);
+        g_test_timer_start();
+        for (long start = 0; start < nbits; start += range_bits) {
+            bitmap_count_and_clear_atomic(map, start, range_bits);
+        }
+        elapsed += g_test_timer_elapsed();
+    }
+
+    g_test_message("clear: range %zu bytes density 1/%u %.2f GB/sec",
+                   opts->range, opts->density, total / elapsed / GiB);
+    g_free(map);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t ranges[] = { 4 * KiB, 64 * KiB, 1 * MiB };
+    static const unsigned densities[] = { 0, 64, 1 };
+    static BitmapClearOpts opts[ARRAY_SIZE(ranges) * ARRAY_SIZE(densities)];
+    char name[64];
+    int n = 0;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (int i = 0; i < ARRAY_SIZE(ranges); i++) {
+        for (int j = 0; j < ARRAY_SIZE(densities); j++, n++) {
+            opts[n].range = ranges[i];
+            opts[n].density = densities[j];
+            snprintf(name, sizeof(name),
+                     "/bitmap/benchmark/clear/range-%zu/density-%u",
+                     ranges[i], densities[j]);
+            g_test_add_data_func(name, &opts[n], test_clear_speed);
+        }
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,118 @@
+/*
+ * Bitmap index benchmark
+ *
+ * Models the CHERI tag memory backends: "flat" sets tag bits with an atomic
+ * OR and scans with find_next_bit(), "indexed" also marks the word in a
+ * bitmap index when it first becomes non-zero and scans with
+ * bitmap_index_find_next(). Tags are one bit per 16 bytes of a 1 GiB guest.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bitmap.h"
+
+#define BYTES_PER_TAG 16
+#define NBITS ((long)(1 * GiB / BYTES_PER_TAG))
+
+typedef struct BitmapIndexOpts {
+    bool indexed;
+    unsigned density; /* one tag set every density tags, 0 for none */
+} BitmapIndexOpts;
+
+static const char *backend(const BitmapIndexOpts *opts)
+{
+    return opts->indexed ? "indexed" : "flat";
+}
+
+static void fill_tags(const BitmapIndexOpts *opts, unsigned long *map,
+                      unsigned long *index)
+{
+    for (long i = 0; opts->density && i < NBITS; i += opts->density) {
+        unsigned long old = qatomic_fetch_or(&map[BIT_WORD(i)], BIT_MASK(i));
+
+        if (opts->indexed && !old) {
+            bitmap_index_mark_atomic(index, BIT_WORD(i));
+        }
+    }
+}
+
+static void test_set_speed(const void *opaque)
+{
+    const BitmapIndexOpts *opts = opaque;
+    unsigned long *map = bitmap_new(NBITS);
+    unsigned long *index = bitmap_new(BITS_TO_LONGS(NBITS));
+    double elapsed;
+
+    g_test_timer_start();
+    fill_tags(opts, map, index);
+    elapsed = g_test_timer_elapsed();
+
+    g_test_message("set: %s density 1/%u %.2f Mtags/sec", backend(opts),
+                   opts->density, NBITS / opts->density / elapsed / 1e6);
+    g_free(index);
+    g_free(map);
+}
+
+static void test_scan_speed(const void *opaque)
+{
+    const BitmapIndexOpts *opts = opaque;
+    unsigned long *map = bitmap_new(NBITS);
+    unsigned long *index = bitmap_new(BITS_TO_LONGS(NBITS));
+    const int rounds = 8;
+    long found = 0;
+    double elapsed;
+
+    fill_tags(opts, map, index);
+    g_test_timer_start();
+    for (int r = 0; r < rounds; r++) {
+        long i = -1;
+
+        do {
+            i = opts->indexed ?
+                bitmap_index_find_next(map, index, NBITS, i + 1) :
+                find_next_bit(map, NBITS, i + 1);
+            found++;
+        } while (i < NBITS);
+    }
+    elapsed = g_test_timer_elapsed();
+
+    g_assert_cmpint(found, ==,
+                    rounds * (opts->density ?
+                              DIV_ROUND_UP(NBITS, opts->density) + 1 : 1));
+    g_test_message("scan: %s density 1/%u %.2f GiB of guest memory/sec",
+                   backend(opts), opts->density, rounds / elapsed);
+    g_free(index);
+    g_free(map);
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned densities[] = { 0, 1 << 16, 1 << 10, 64, 1 };
+    static BitmapIndexOpts opts[2 * ARRAY_SIZE(densities)];
+    char name[64];
+    int n = 0;
+
+    g_test_init(&argc, &argv, NULL);
+
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < ARRAY_SIZE(densities); j++, n++) {
+            opts[n].indexed = i;
+            opts[n].density = densities[j];
+            if (densities[j]) {
+                snprintf(name, sizeof(name),
+                         "/bitmap-index/benchmark/set/%s/density-%u",
+                         backend(&opts[n]), densities[j]);
+                g_test_add_data_func(name, &opts[n], test_set_speed);
+            }
+            snprintf(name, sizeof(name),
+                     "/bitmap-index/benchmark/scan/%s/density-%u",
+                     backend(&opts[n]), densities[j]);
+            g_test_add_data_func(name, &opts[n], test_scan_speed);
+        }
+    }
+
+    return g_test_run();
+}
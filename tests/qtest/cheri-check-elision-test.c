@@ -0,0 +1,124 @@
+/*
+ * CHERI-RISC-V capability check elision test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Capability checks that passed earlier in a TB are not repeated for the
+ * same register. Each case runs two lw.cap through c1 in one TB, with one
+ * instruction in between that writes c1 as an integer, shrinks its bounds
+ * or moves its cursor. The second load must still trap. A control case
+ * writes an unrelated register and must not trap.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqos/libqtest.h"
+
+#define CODE_ADDR   0x80000000
+#define DATA_ADDR   0x80001000
+#define RESULT_ADDR 0x80002000
+
+/* Index of the instruction under test, and of the load that must trap */
+#define CASE_INSN 11
+#define SECOND_LOAD 12
+
+#define RISCV_EXCP_CHERI 0x1c
+#define CAP_LENGTH_VIOLATION 0x01
+#define CAP_TAG_VIOLATION 0x02
+/* mtval of a CHERI exception caused by c1 */
+#define C1_TVAL(cause) ((cause) | 1 << 5)
+
+static const uint32_t program[] = {
+    0x00000297,     /* auipc t0, 0 */
+    0x04028313,     /* addi  t1, t0, handler - . */
+    0x30531073,     /* csrw  mtvec, t1 */
+    0x000013b7,     /* lui   t2, 1 */
+    0x007283b3,     /* add   t2, t0, t2 (DATA_ADDR) */
+    0x00002e37,     /* lui   t3, 2 */
+    0x01c28e33,     /* add   t3, t0, t3 (RESULT_ADDR) */
+    0x021000db,     /* cspecialr c1, ddc */
+    0x207080db,     /* csetaddr c1, c1, t2 */
+    0x0100a0db,     /* csetbounds c1, c1, 16 */
+    0xfaa0855b,     /* lw.cap a0, (c1) */
+    0x00000013,     /* CASE_INSN */
+    0xfaa0855b,     /* lw.cap a0, (c1) */
+    0xfff00e93,     /* li    t4, -1 */
+    0x01de2023,     /* sw    t4, 0(t3) */
+    0x0000006f,     /* j     . */
+    /* handler: */
+    0x34102f73,     /* csrr  t5, mepc */
+    0x01ee2223,     /* sw    t5, 4(t3) */
+    0x34302ff3,     /* csrr  t6, mtval */
+    0x01fe2423,     /* sw    t6, 8(t3) */
+    0x34202ef3,     /* csrr  t4, mcause */
+    0x01de2023,     /* sw    t4, 0(t3) */
+    0x0000006f,     /* j     . */
+};
+
+typedef struct CheckElisionCase {
+    const char *name;
+    uint32_t insn;
+    uint32_t mcause;    /* 0 if the second load must not trap */
+    uint32_t mtval;
+} CheckElisionCase;
+
+static const CheckElisionCase cases[] = {
+    /* addi a0, a0, 1 */
+    { "other-reg", 0x00150513, 0, 0 },
+    /* addi ra, ra, 0: gen_set_gpr() clears the tag of c1 */
+    { "set-gpr", 0x00008093,
+      RISCV_EXCP_CHERI, C1_TVAL(CAP_TAG_VIOLATION) },
+    /* csetbounds c1, c1, 2: the 4-byte load no longer fits */
+    { "setbounds", 0x0020a0db,
+      RISCV_EXCP_CHERI, C1_TVAL(CAP_LENGTH_VIOLATION) },
+    /* cincoffset c1, c1, 16: the cursor is now at the top */
+    { "incoffset", 0x010090db,
+      RISCV_EXCP_CHERI, C1_TVAL(CAP_LENGTH_VIOLATION) },
+};
+
+static void test_check_elision(const void *data)
+{
+    const CheckElisionCase *c = data;
+    uint32_t code[ARRAY_SIZE(program)];
+    uint32_t mcause;
+    QTestState *qts;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(program); i++) {
+        code[i] = cpu_to_le32(i == CASE_INSN ? c->insn : program[i]);
+    }
+
+    /* Without firmware the reset vector jumps straight to CODE_ADDR */
+    qts = qtest_init("-machine virt -bios none -accel tcg -S");
+    qtest_memwrite(qts, CODE_ADDR, code, sizeof(code));
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+
+    while ((mcause = qtest_readl(qts, RESULT_ADDR)) == 0) {
+        g_usleep(1000);
+    }
+
+    if (!c->mcause) {
+        g_assert_cmphex(mcause, ==, UINT32_MAX);
+    } else {
+        g_assert_cmphex(mcause, ==, c->mcause);
+        g_assert_cmphex(qtest_readl(qts, RESULT_ADDR + 4), ==,
+                        CODE_ADDR + SECOND_LOAD * 4);
+        g_assert_cmphex(qtest_readl(qts, RESULT_ADDR + 8), ==, c->mtval);
+    }
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    size_t i;
+
+    g_test_init(&argc, &argv, NULL);
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        g_autofree char *path = g_strdup_printf("/cheri-check-elision/%s",
+                                                cases[i].name);
+        qtest_add_data_func(path, &cases[i], test_check_elision);
+    }
+    return g_test_run();
+}
@@ -0,0 +1,111 @@
+/*
+ * CHERI-MIPS capability jump chaining test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Boots a tiny Malta firmware that calls a function with its own, tight
+ * PCC bounds through CJALR and returns with CJR in a loop. Both jumps
+ * change the PCC bounds and thus the TB lookup key; they must be resolved
+ * by lookup_and_goto_ptr rather than by exits to the main loop. The exit
+ * rate per million guest instructions is reported with --verbose.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqos/libqtest.h"
+
+/* Physical address of the counter the loop stores to (kseg1 0xa0001000) */
+#define COUNTER_ADDR 0x1000
+#define N_CALLS 100000
+/* Guest instructions per loop iteration, including the delay slots */
+#define INSNS_PER_CALL 8
+
+static const uint32_t firmware[] = {
+    0x10000007,     /* b     start (skip the board ID Malta stores at 0x10) */
+    0x00000000,     /* nop */
+    0, 0, 0, 0, 0, 0,
+    /* start: */
+    0x400a6000,     /* mfc0  t2, $12 */
+    0x3c0b4000,     /* lui   t3, 0x4000 */
+    0x014b5025,     /* or    t2, t2, t3 */
+    0x408a6000,     /* mtc0  t2, $12 (Status.CU2) */
+    0x00000000,     /* nop */
+    0x3c08a000,     /* lui   t0, 0xa000 */
+    0x35081000,     /* ori   t0, t0, 0x1000 */
+    0x00004825,     /* move  t1, zero */
+    0x480107ff,     /* cgetpcc c1 */
+    0x4a61081c,     /* cincoffset c1, c1, func - . */
+    0x4a810810,     /* csetbounds c1, c1, 16 */
+    /* loop: */
+    0x4811083f,     /* cjalr c17, c1 */
+    0x00000000,     /* nop */
+    0x1000fffd,     /* b     loop */
+    0x00000000,     /* nop */
+    /* func: */
+    0x65290001,     /* daddiu t1, t1, 1 */
+    0xfd090000,     /* sd    t1, 0(t0) */
+    0x48111fff,     /* cjr   c17 */
+    0x00000000,     /* nop */
+};
+
+static void test_cap_jump_chaining(void)
+{
+    g_autofree char *dir = g_dir_make_tmp("cheri-jump-test-XXXXXX", NULL);
+    g_autofree char *bios_path = g_strdup_printf("%s/bios", dir);
+    uint32_t code[ARRAY_SIZE(firmware)];
+    size_t exit_lookups, ptr_lookups, ptr_misses;
+    uint64_t calls;
+    QTestState *qts;
+    const char *line;
+    char *info;
+    size_t i;
+
+    g_assert(dir);
+    for (i = 0; i < ARRAY_SIZE(firmware); i++) {
+        code[i] = cpu_to_be32(firmware[i]);
+    }
+    g_assert(g_file_set_contents(bios_path, (const char *)code,
+                                 sizeof(code), NULL));
+
+    qts = qtest_initf("-machine malta -accel tcg -bios %s", bios_path);
+    while ((calls = qtest_readq(qts, COUNTER_ADDR)) < N_CALLS) {
+        g_usleep(1000);
+    }
+
+    info = qtest_hmp(qts, "info jit");
+    line = strstr(info, "TB lookups on exit");
+    g_assert(line);
+    g_assert_cmpint(sscanf(line, "TB lookups on exit %zu", &exit_lookups),
+                    ==, 1);
+    line = strstr(info, "TB goto_ptr lookups");
+    g_assert(line);
+    g_assert_cmpint(sscanf(line, "TB goto_ptr lookups %zu (%zu missed)",
+                           &ptr_lookups, &ptr_misses), ==, 2);
+    g_free(info);
+    qtest_quit(qts);
+
+    g_test_message("%" PRIu64 " calls: %zu exit lookups (%.1f per million "
+                   "instructions), %zu goto_ptr lookups (%zu missed)",
+                   calls, exit_lookups,
+                   exit_lookups * 1e6 / (calls * INSNS_PER_CALL),
+                   ptr_lookups, ptr_misses);
+
+    /*
+     * Every call and every return is a goto_ptr lookup. Exiting to the main
+     * loop for each of them would make the exit count at least twice the
+     * number of calls.
+     */
+    g_assert_cmpuint(ptr_lookups - ptr_misses, >=, 2 * N_CALLS);
+    g_assert_cmpuint(exit_lookups, <, calls / 100);
+
+    unlink(bios_path);
+    rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/cheri-jump/chaining", test_cap_jump_chaining);
+    return g_test_run();
+}
@@ -0,0 +1,234 @@
+/*
+ * CHERI tag migration test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A RISC-V guest stores capabilities to three words and overwrites the
+ * middle one with plain data, then waits. After migrating it, the guest on
+ * the destination loads those words and a never written one as capabilities
+ * and reports their tags. With the cheri-tags capability the tags of the
+ * first and third words must survive both precopy and postcopy (which pins
+ * the destination's tag blocks while pages arrive); without it no tags are
+ * sent. The other two words must never come out tagged. The capability
+ * sweep of "info cheri-tagmem -c" must find the same tagged capabilities.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqos/libqtest.h"
+#include "qapi/qmp/qdict.h"
+#include "migration-helpers.h"
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_userfaultfd) && defined(CONFIG_EVENTFD)
+#include <sys/ioctl.h>
+#include <linux/userfaultfd.h>
+#endif
+
+#define CODE_ADDR   0x80000000
+#define DATA_ADDR   (CODE_ADDR + 0x1000)
+#define RESULT_ADDR (CODE_ADDR + 0x2000)
+/* 1 once the capabilities are stored, 2 once their tags are reported */
+#define RES_STATE   (RESULT_ADDR + 0)
+/* Written by the test on the destination to let the guest go on */
+#define RES_GO      (RESULT_ADDR + 8)
+#define RES_TAG(i)  (RESULT_ADDR + 16 + (i) * 8)
+
+static const uint32_t program[] = {
+    0x00000417,     /* auipc s0, 0 */
+    0x00001337,     /* lui   t1, 1 */
+    0x006404b3,     /* add   s1, s0, t1 (DATA_ADDR) */
+    0x00002337,     /* lui   t1, 2 */
+    0x00640933,     /* add   s2, s0, t1 (RESULT_ADDR) */
+    0x021000db,     /* cspecialr c1, ddc */
+    0x209080db,     /* csetaddr c1, c1, s1 */
+    0x0014c023,     /* sc    c1, 0(s1) */
+    0x0014c823,     /* sc    c1, 16(s1) */
+    0x0214c023,     /* sc    c1, 32(s1) */
+    0xfff00393,     /* li    t2, -1 */
+    0x0074b823,     /* sd    t2, 16(s1) */
+    0x00100e13,     /* li    t3, 1 */
+    0x01c93023,     /* sd    t3, 0(s2) (RES_STATE) */
+    /* wait: keep dirtying the result page so that precopy can't converge */
+    0x001f8f93,     /* addi  t6, t6, 1 */
+    0x03f93c23,     /* sd    t6, 56(s2) */
+    0x00893e83,     /* ld    t4, 8(s2) (RES_GO) */
+    0xfe0e8ae3,     /* beqz  t4, wait */
+    0x0004a10f,     /* lc    c2, 0(s1) */
+    0xfe410f5b,     /* cgettag t5, c2 */
+    0x01e93823,     /* sd    t5, 16(s2) (RES_TAG(0)) */
+    0x0104a10f,     /* lc    c2, 16(s1) */
+    0xfe410f5b,     /* cgettag t5, c2 */
+    0x01e93c23,     /* sd    t5, 24(s2) (RES_TAG(1)) */
+    0x0204a10f,     /* lc    c2, 32(s1) */
+    0xfe410f5b,     /* cgettag t5, c2 */
+    0x03e93023,     /* sd    t5, 32(s2) (RES_TAG(2)) */
+    0x0304a10f,     /* lc    c2, 48(s1) */
+    0xfe410f5b,     /* cgettag t5, c2 */
+    0x03e93423,     /* sd    t5, 40(s2) (RES_TAG(3)) */
+    0x00200e13,     /* li    t3, 2 */
+    0x01c93023,     /* sd    t3, 0(s2) (RES_STATE) */
+    0x0000006f,     /* j     . */
+};
+
+typedef struct CheriMigrationCase {
+    const char *name;
+    bool tags;
+    bool postcopy;
+} CheriMigrationCase;
+
+static const CheriMigrationCase cases[] = {
+    { "precopy", true, false },
+    { "postcopy", true, true },
+    { "no-cheri-tags", false, false },
+};
+
+static const char *tmpfs;
+
+#if defined(__linux__) && defined(__NR_userfaultfd) && defined(CONFIG_EVENTFD)
+static bool ufd_available(void)
+{
+    struct uffdio_api api_struct = { .api = UFFD_API };
+    int ufd = syscall(__NR_userfaultfd, O_CLOEXEC);
+    bool ok;
+
+    if (ufd == -1) {
+        return false;
+    }
+    ok = !ioctl(ufd, UFFDIO_API, &api_struct);
+    close(ufd);
+    return ok;
+}
+#else
+static bool ufd_available(void)
+{
+    return false;
+}
+#endif
+
+static void set_capability(QTestState *who, const char *capability)
+{
+    qobject_unref(wait_command(who,
+                               "{ 'execute': 'migrate-set-capabilities',"
+                               "  'arguments': { 'capabilities': [ {"
+                               "    'capability': %s, 'state': true } ] } }",
+                               capability));
+}
+
+static void set_parameter_int(QTestState *who, const char *parameter,
+                              long long value)
+{
+    qobject_unref(wait_command(who,
+                               "{ 'execute': 'migrate-set-parameters',"
+                               "  'arguments': { %s: %lld } }",
+                               parameter, value));
+}
+
+/* The number of tagged capabilities found by "info cheri-tagmem -c" */
+static size_t count_tagged_caps(QTestState *qts)
+{
+    g_autofree char *info = qtest_hmp(qts, "info cheri-tagmem -c");
+    g_auto(GStrv) lines = g_strsplit(info, "\n", -1);
+    size_t total = 0, n, sealed, exec;
+    int i;
+
+    for (i = 0; lines[i]; i++) {
+        const char *p = strstr(lines[i], ": ");
+
+        if (p && sscanf(p, ": %zu tagged capabilities, %zu sealed, "
+                        "%zu executable", &n, &sealed, &exec) == 3) {
+            /* The capabilities are derived from the almighty reset DDC */
+            g_assert_cmpuint(sealed, ==, 0);
+            g_assert_cmpuint(exec, ==, n);
+            total += n;
+        }
+    }
+    return total;
+}
+
+static void test_cheri_migration(const void *data)
+{
+    const CheriMigrationCase *c = data;
+    g_autofree char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    uint32_t code[ARRAY_SIZE(program)];
+    QTestState *from, *to;
+    size_t i;
+
+    if (c->postcopy && !ufd_available()) {
+        g_test_skip("userfaultfd not available");
+        return;
+    }
+    for (i = 0; i < ARRAY_SIZE(program); i++) {
+        code[i] = cpu_to_le32(program[i]);
+    }
+
+    from = qtest_init("-machine virt -bios none -accel tcg -S");
+    to = qtest_initf("-machine virt -bios none -accel tcg -incoming %s", uri);
+    if (c->tags) {
+        set_capability(from, "cheri-tags");
+        set_capability(to, "cheri-tags");
+    }
+    if (c->postcopy) {
+        set_capability(from, "postcopy-ram");
+        set_capability(to, "postcopy-ram");
+        /* Don't let precopy converge before postcopy starts */
+        set_parameter_int(from, "downtime-limit", 1);
+    }
+
+    got_stop = false;
+    qtest_memwrite(from, CODE_ADDR, code, sizeof(code));
+    qtest_qmp_assert_success(from, "{ 'execute': 'cont' }");
+    while (qtest_readq(from, RES_STATE) != 1) {
+        g_usleep(1000);
+    }
+    g_assert_cmpuint(count_tagged_caps(from), ==, 2);
+
+    migrate_qmp(from, uri, "{}");
+    if (c->postcopy) {
+        qobject_unref(wait_command(from,
+                                   "{ 'execute': 'migrate-start-postcopy' }"));
+    }
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    qtest_qmp_eventwait(to, "RESUME");
+    wait_for_migration_complete(from);
+
+    qtest_writeq(to, RES_GO, 1);
+    while (qtest_readq(to, RES_STATE) != 2) {
+        g_usleep(1000);
+    }
+    g_assert_cmpuint(qtest_readq(to, RES_TAG(0)), ==, c->tags);
+    g_assert_cmpuint(qtest_readq(to, RES_TAG(1)), ==, 0);
+    g_assert_cmpuint(qtest_readq(to, RES_TAG(2)), ==, c->tags);
+    g_assert_cmpuint(qtest_readq(to, RES_TAG(3)), ==, 0);
+    g_assert_cmpuint(count_tagged_caps(to), ==, c->tags ? 2 : 0);
+
+    qtest_quit(from);
+    qtest_quit(to);
+    unlink(uri + strlen("unix:"));
+}
+
+int main(int argc, char **argv)
+{
+    g_autofree char *tmpdir = g_dir_make_tmp("cheri-migration-test-XXXXXX",
+                                             NULL);
+    size_t i;
+    int ret;
+
+    g_assert(tmpdir);
+    tmpfs = tmpdir;
+    g_test_init(&argc, &argv, NULL);
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        g_autofree char *path = g_strdup_printf("/cheri-migration/%s",
+                                                cases[i].name);
+        qtest_add_data_func(path, &cases[i], test_cheri_migration);
+    }
+    ret = g_test_run();
+    rmdir(tmpdir);
+    return ret;
+}
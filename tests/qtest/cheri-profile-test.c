@@ -0,0 +1,99 @@
+/*
+ * -cheri-profile sampling profiler test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Runs a CHERI RISC-V machine with the sampling profiler for a short while,
+ * shuts it down through the orderly exit path and checks that the profile
+ * contains samples of every vCPU in the requested format, and that a machine
+ * that never runs is not sampled.
+ */
+
+#include "qemu/osdep.h"
+#include "libqos/libqtest.h"
+
+#define N_CPUS 2
+
+static char *run_profile(const char *format, const char *extra_args)
+{
+    g_autofree char *dir = g_dir_make_tmp("cheri-profile-test-XXXXXX", NULL);
+    g_autofree char *path = g_strdup_printf("%s/profile", dir);
+    QTestState *qts;
+    char *contents;
+
+    g_assert(dir);
+    qts = qtest_initf("-machine virt -smp %d -bios none -accel tcg "
+                      "-cheri-profile file=%s,format=%s,period=100,ring=16 %s",
+                      N_CPUS, path, format, extra_args);
+    /* Long enough to fill the small rings several times over */
+    g_usleep(200 * 1000);
+    /* SIGTERM takes the orderly shutdown path, which writes the profile */
+    qtest_quit(qts);
+
+    g_assert(g_file_get_contents(path, &contents, NULL, NULL));
+    unlink(path);
+    rmdir(dir);
+    return contents;
+}
+
+static void test_profile_folded(void)
+{
+    g_autofree char *contents = run_profile("folded", "");
+    g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+    uint64_t samples[N_CPUS] = { 0 };
+    int i;
+
+    for (i = 0; lines[i] && lines[i][0]; i++) {
+        const char *count = strrchr(lines[i], ' ');
+        int cpu;
+
+        /* cpu;mode;asid;pcc;symbol count */
+        g_assert(count);
+        g_assert_cmpint(sscanf(lines[i], "cpu%d;", &cpu), ==, 1);
+        g_assert_cmpint(cpu, >=, 0);
+        g_assert_cmpint(cpu, <, N_CPUS);
+        samples[cpu] += g_ascii_strtoull(count + 1, NULL, 10);
+    }
+    for (i = 0; i < N_CPUS; i++) {
+        g_assert_cmpuint(samples[i], >, 0);
+    }
+}
+
+static void test_profile_perf(void)
+{
+    g_autofree char *contents = run_profile("perf", "");
+    g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+    uint64_t samples[N_CPUS] = { 0 };
+    int i, cpu;
+
+    for (i = 0; lines[i]; i++) {
+        /* Record header; the stack lines start with a tab */
+        if (sscanf(lines[i], "cpu%d ", &cpu) == 1) {
+            g_assert(strstr(lines[i], "cpu-clock:"));
+            g_assert_cmpint(cpu, >=, 0);
+            g_assert_cmpint(cpu, <, N_CPUS);
+            g_assert(lines[i + 1] && lines[i + 1][0] == '\t');
+            samples[cpu]++;
+        }
+    }
+    for (i = 0; i < N_CPUS; i++) {
+        g_assert_cmpuint(samples[i], >, 0);
+    }
+}
+
+static void test_profile_stopped(void)
+{
+    g_autofree char *contents = run_profile("perf", "-S");
+
+    g_assert_cmpstr(contents, ==, "");
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/cheri-profile/folded", test_profile_folded);
+    qtest_add_func("/cheri-profile/perf", test_profile_perf);
+    qtest_add_func("/cheri-profile/stopped", test_profile_stopped);
+    return g_test_run();
+}
@@ -0,0 +1,113 @@
+/*
+ * QMP query-cheri-stats test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Starts a stopped two-vCPU CHERI RISC-V machine, checks that every vCPU
+ * reports zeroed counters, then lets it run and checks that the counters
+ * are readable while the guest runs and never go backwards.
+ */
+
+#include "qemu/osdep.h"
+#include "libqos/libqtest.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+
+#define N_CPUS 2
+
+static const char *const counters[] = {
+    "cap-loads", "cap-loads-tagged", "cap-stores", "cap-stores-tagged",
+    "setbounds", "setbounds-imprecise", "unrepresentable", "seals",
+    "unseals", "itlb-misses", "dtlb-misses",
+};
+#define ITLB_MISSES 9
+
+/* Read all counters into @values, indexed by cpu-index and counter */
+static void query_stats(QTestState *qts,
+                        uint64_t values[N_CPUS][ARRAY_SIZE(counters)])
+{
+    QDict *resp, *ret;
+    QList *cpus;
+    QListEntry *entry;
+    int n = 0;
+
+    resp = qtest_qmp(qts, "{ 'execute': 'query-cheri-stats' }");
+    g_assert(qdict_haskey(resp, "return"));
+    ret = qdict_get_qdict(resp, "return");
+    cpus = qdict_get_qlist(ret, "cpus");
+    g_assert(cpus);
+
+    QLIST_FOREACH_ENTRY(cpus, entry) {
+        QDict *cpu = qobject_to(QDict, qlist_entry_obj(entry));
+        int64_t index = qdict_get_int(cpu, "cpu-index");
+        size_t i;
+
+        g_assert_cmpint(index, >=, 0);
+        g_assert_cmpint(index, <, N_CPUS);
+        for (i = 0; i < ARRAY_SIZE(counters); i++) {
+            g_assert(qdict_haskey(cpu, counters[i]));
+            values[index][i] = qdict_get_int(cpu, counters[i]);
+        }
+        n++;
+    }
+    g_assert_cmpint(n, ==, N_CPUS);
+
+    /* Only built with DO_CHERI_STATISTICS */
+    if (qdict_haskey(ret, "bounds")) {
+        QList *bounds = qdict_get_qlist(ret, "bounds");
+
+        QLIST_FOREACH_ENTRY(bounds, entry) {
+            QDict *op = qobject_to(QDict, qlist_entry_obj(entry));
+
+            g_assert(qdict_get_str(op, "operation"));
+            g_assert(!qlist_empty(qdict_get_qlist(op, "buckets")));
+        }
+    }
+    qobject_unref(resp);
+}
+
+static void test_query_cheri_stats(void)
+{
+    uint64_t first[N_CPUS][ARRAY_SIZE(counters)];
+    uint64_t last[N_CPUS][ARRAY_SIZE(counters)];
+    QTestState *qts;
+    int cpu, i;
+
+    g_assert_cmpstr(counters[ITLB_MISSES], ==, "itlb-misses");
+    qts = qtest_initf("-machine virt -smp %d -bios none -accel tcg -S",
+                      N_CPUS);
+
+    query_stats(qts, first);
+    for (cpu = 0; cpu < N_CPUS; cpu++) {
+        for (i = 0; i < ARRAY_SIZE(counters); i++) {
+            g_assert_cmpuint(first[cpu][i], ==, 0);
+        }
+    }
+
+    /*
+     * Without firmware the harts start in the reset ROM and then run into
+     * empty RAM, which still needs instruction TLB fills.
+     */
+    memcpy(last, first, sizeof(last));
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+    do {
+        g_usleep(1000);
+        memcpy(first, last, sizeof(first));
+        query_stats(qts, last);
+        for (cpu = 0; cpu < N_CPUS; cpu++) {
+            for (i = 0; i < ARRAY_SIZE(counters); i++) {
+                g_assert_cmpuint(last[cpu][i], >=, first[cpu][i]);
+            }
+        }
+    } while (last[0][ITLB_MISSES] == 0);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/cheri-stats/query", test_query_cheri_stats);
+    return g_test_run();
+}
@@ -0,0 +1,137 @@
+/*
+ * CHERI-RISC-V tag memory race test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Runs 2, 4 and 8 harts with MTTCG on one capability-sized word. Even harts
+ * store a capability to it and overwrite it with plain stores; odd harts
+ * load it as a capability. A tagged load must return the capability that
+ * was stored: a tag paired with the plain data means a store updated the
+ * data and the tag separately. The iteration rate per hart count and tag
+ * memory backend is reported, to show how the locked stores scale and to
+ * compare the backends.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqos/libqtest.h"
+
+#define CODE_ADDR   0x80000000
+#define DATA_ADDR   (CODE_ADDR + 0x1000)
+/* Per hart: iterations, tagged loads, tagged loads of the wrong value */
+#define RESULT_ADDR(hart) (CODE_ADDR + 0x2000 + (hart) * 32)
+
+#define MIN_ITERS   100000
+
+/* Without firmware all harts start at CODE_ADDR with a0 = mhartid */
+static const uint32_t program[] = {
+    0x00000417,     /* auipc s0, 0 */
+    0x00001337,     /* lui   t1, 1 */
+    0x006404b3,     /* add   s1, s0, t1 (DATA_ADDR) */
+    0x00002337,     /* lui   t1, 2 */
+    0x00640933,     /* add   s2, s0, t1 */
+    0x00551313,     /* slli  t1, a0, 5 */
+    0x00690933,     /* add   s2, s2, t1 (RESULT_ADDR(a0)) */
+    0x021000db,     /* cspecialr c1, ddc */
+    0x209080db,     /* csetaddr c1, c1, s1 */
+    0xfff00393,     /* li    t2, -1 */
+    0x00157313,     /* andi  t1, a0, 1 */
+    0x00031e63,     /* bnez  t1, checker */
+    /* writer: */
+    0x0014c023,     /* sc    c1, 0(s1) */
+    0x00093e03,     /* ld    t3, 0(s2) */
+    0x001e0e13,     /* addi  t3, t3, 1 */
+    0x01c93023,     /* sd    t3, 0(s2) */
+    0x0074b023,     /* sd    t2, 0(s1) */
+    0xfedff06f,     /* j     writer */
+    /* checker: */
+    0x0004a10f,     /* lc    c2, 0(s1) */
+    0x00093e03,     /* ld    t3, 0(s2) */
+    0x001e0e13,     /* addi  t3, t3, 1 */
+    0x01c93023,     /* sd    t3, 0(s2) */
+    0xfe410edb,     /* cgettag t4, c2 */
+    0xfe0e86e3,     /* beqz  t4, checker */
+    0x00893e03,     /* ld    t3, 8(s2) */
+    0x001e0e13,     /* addi  t3, t3, 1 */
+    0x01c93423,     /* sd    t3, 8(s2) */
+    0xfef10f5b,     /* cgetaddr t5, c2 */
+    0xfc9f0ce3,     /* beq   t5, s1, checker */
+    0x01093e03,     /* ld    t3, 16(s2) */
+    0x001e0e13,     /* addi  t3, t3, 1 */
+    0x01c93823,     /* sd    t3, 16(s2) */
+    0xfc9ff06f,     /* j     checker */
+};
+
+typedef struct TagRaceCase {
+    const char *backend;
+    unsigned smp;
+} TagRaceCase;
+
+static void test_tag_race(const void *data)
+{
+    const TagRaceCase *c = data;
+    unsigned smp = c->smp;
+    uint32_t code[ARRAY_SIZE(program)];
+    uint64_t iters = 0, tagged = 0;
+    gint64 start, elapsed;
+    QTestState *qts;
+    unsigned hart;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(program); i++) {
+        code[i] = cpu_to_le32(program[i]);
+    }
+
+    qts = qtest_initf("-machine virt -bios none -smp %u "
+                      "-accel tcg,thread=multi -cheri-tagmem %s -S",
+                      smp, c->backend);
+    qtest_memwrite(qts, CODE_ADDR, code, sizeof(code));
+    start = g_get_monotonic_time();
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+
+    for (hart = 0; hart < smp; hart++) {
+        while (qtest_readq(qts, RESULT_ADDR(hart)) < MIN_ITERS) {
+            g_assert_cmpint(g_get_monotonic_time() - start, <,
+                            60 * G_USEC_PER_SEC);
+            g_usleep(1000);
+        }
+    }
+    qtest_qmp_assert_success(qts, "{ 'execute': 'stop' }");
+    elapsed = g_get_monotonic_time() - start;
+
+    for (hart = 0; hart < smp; hart++) {
+        iters += qtest_readq(qts, RESULT_ADDR(hart));
+        if (hart & 1) {
+            tagged += qtest_readq(qts, RESULT_ADDR(hart) + 8);
+            g_assert_cmpuint(qtest_readq(qts, RESULT_ADDR(hart) + 16), ==, 0);
+        }
+    }
+    g_test_message("%s, %u harts: %" PRIu64 " iterations in %" PRId64 " ms "
+                   "(%" PRIu64 " per ms), %" PRIu64 " tagged loads",
+                   c->backend, smp, iters, elapsed / 1000,
+                   iters * 1000 / MAX(elapsed, 1), tagged);
+    g_assert_cmpuint(tagged, >, 0);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *const backends[] = { "sparse", "flat", "indexed" };
+    static const unsigned smp[] = { 2, 4, 8 };
+    static TagRaceCase cases[ARRAY_SIZE(backends) * ARRAY_SIZE(smp)];
+    size_t i;
+
+    g_test_init(&argc, &argv, NULL);
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        TagRaceCase *c = &cases[i];
+        g_autofree char *path = NULL;
+
+        c->backend = backends[i / ARRAY_SIZE(smp)];
+        c->smp = smp[i % ARRAY_SIZE(smp)];
+        path = g_strdup_printf("/cheri-tag-race/%s/smp%u", c->backend, c->smp);
+        qtest_add_data_func(path, c, test_tag_race);
+    }
+    return g_test_run();
+}
@@ -0,0 +1,258 @@
+/*
+ * CHERI instruction trace format test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Traces a small RISC-V loop with -d instr, shuts the machine down through
+ * the orderly exit path and checks that the trace file can be decoded:
+ * binary traces with scripts/qemu-btrace-decode.py, Perfetto traces as a
+ * sequence of well-formed TracePacket protobufs.
+ *
+ * With -m perf it also measures how fast the loop runs while every
+ * instruction is traced to /dev/null in each format, compared to running
+ * it untraced, to benchmark the instruction commit path.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqos/libqtest.h"
+
+#define CODE_ADDR    0x80000000
+#define COUNTER_ADDR (CODE_ADDR + 0x100)
+#define N_ITERS      1000
+/* Instructions per loop iteration, and how long each rate is measured */
+#define LOOP_INSNS   3
+#define BENCH_SECS   2
+
+static const uint32_t program[] = {
+    0x00000297,     /* auipc t0, 0 */
+    0x00130313,     /* 1: addi t1, t1, 1 */
+    0x1062a023,     /* sw    t1, 0x100(t0) */
+    0xff9ff06f,     /* j     1b */
+};
+
+/* The PC of the addi, as printed by the decoders */
+#define LOOP_PC "0000000080000004"
+
+/* Run the loop with the given trace format and return the trace file path */
+static char *run_trace(const char *dir, const char *format)
+{
+    char *path = g_strdup_printf("%s/trace", dir);
+    uint32_t code[ARRAY_SIZE(program)];
+    QTestState *qts;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(program); i++) {
+        code[i] = cpu_to_le32(program[i]);
+    }
+
+    qts = qtest_initf("-machine virt -bios none -accel tcg -S "
+                      "-d instr -D %s -cheri-trace-format %s", path, format);
+    qtest_memwrite(qts, CODE_ADDR, code, sizeof(code));
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+    while (qtest_readl(qts, COUNTER_ADDR) < N_ITERS) {
+        g_usleep(1000);
+    }
+    /* SIGTERM takes the orderly shutdown path, which flushes the trace */
+    qtest_quit(qts);
+
+    g_assert(g_file_test(path, G_FILE_TEST_EXISTS));
+    return path;
+}
+
+static void test_trace_binary(void)
+{
+    const char *python = getenv("PYTHON");
+    const char *srcdir = getenv("QTEST_SOURCE_ROOT");
+    g_autofree char *dir = NULL;
+    g_autofree char *path = NULL;
+    g_autofree char *cmd = NULL;
+    g_autofree char *out = NULL;
+    int status;
+
+    if (!python || !srcdir) {
+        g_test_skip("PYTHON or QTEST_SOURCE_ROOT not set");
+        return;
+    }
+    dir = g_dir_make_tmp("cheri-trace-test-XXXXXX", NULL);
+    g_assert(dir);
+    path = run_trace(dir, "binary");
+    cmd = g_strdup_printf("%s %s/scripts/qemu-btrace-decode.py %s",
+                          python, srcdir, path);
+    g_assert(g_spawn_command_line_sync(cmd, &out, NULL, &status, NULL));
+    g_assert(g_spawn_check_exit_status(status, NULL));
+    g_assert(strstr(out, LOOP_PC ": "));
+
+    unlink(path);
+    rmdir(dir);
+}
+
+static bool pb_varint(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+    int shift;
+
+    *v = 0;
+    for (shift = 0; *p < end && shift < 64; shift += 7) {
+        uint8_t b = *(*p)++;
+
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Walk the fields of one protobuf message. Returns false unless the
+ * message is well formed and ends exactly at @end; counts the TracePacket
+ * fields seen in @fields.
+ */
+static bool pb_message(const uint8_t *p, const uint8_t *end,
+                       unsigned fields[64])
+{
+    while (p < end) {
+        uint64_t tag, v;
+
+        if (!pb_varint(&p, end, &tag)) {
+            return false;
+        }
+        switch (tag & 7) {
+        case 0:
+            if (!pb_varint(&p, end, &v)) {
+                return false;
+            }
+            break;
+        case 1:
+            if (end - p < 8) {
+                return false;
+            }
+            p += 8;
+            break;
+        case 2:
+            if (!pb_varint(&p, end, &v) || v > end - p) {
+                return false;
+            }
+            p += v;
+            break;
+        case 5:
+            if (end - p < 4) {
+                return false;
+            }
+            p += 4;
+            break;
+        default:
+            return false;
+        }
+        if (fields && (tag >> 3) < 64) {
+            fields[tag >> 3]++;
+        }
+    }
+    return p == end;
+}
+
+/* Fields of TracePacket, see protos/perfetto/trace/trace_packet.proto */
+#define PFT_PKT_TRACK_EVENT 11
+#define PFT_PKT_TRACK_DESC  60
+
+static void test_trace_perfetto(void)
+{
+    g_autofree char *dir = g_dir_make_tmp("cheri-trace-test-XXXXXX", NULL);
+    g_autofree char *path = NULL;
+    g_autofree char *contents = NULL;
+    unsigned fields[64] = { 0 };
+    unsigned packets = 0;
+    const uint8_t *p, *end;
+    gsize len;
+
+    g_assert(dir);
+    path = run_trace(dir, "perfetto");
+    g_assert(g_file_get_contents(path, &contents, &len, NULL));
+    p = (const uint8_t *)contents;
+    end = p + len;
+
+    /* A Trace is a sequence of "repeated TracePacket packet = 1" fields */
+    while (p < end) {
+        uint64_t tag, size;
+
+        g_assert(pb_varint(&p, end, &tag));
+        g_assert_cmphex(tag, ==, 1 << 3 | 2);
+        g_assert(pb_varint(&p, end, &size));
+        g_assert_cmpuint(size, <=, end - p);
+        g_assert(pb_message(p, p + size, fields));
+        p += size;
+        packets++;
+    }
+    g_test_message("%u packets", packets);
+    g_assert_cmpuint(fields[PFT_PKT_TRACK_DESC], >, 0);
+    g_assert_cmpuint(fields[PFT_PKT_TRACK_EVENT], >=, N_ITERS);
+
+    unlink(path);
+    rmdir(dir);
+}
+
+/* Guest instructions per second while running the loop with @args */
+static double loop_rate(const char *args)
+{
+    uint32_t code[ARRAY_SIZE(program)];
+    uint32_t start, end;
+    QTestState *qts;
+    gint64 t0, t1;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(program); i++) {
+        code[i] = cpu_to_le32(program[i]);
+    }
+    qts = qtest_initf("-machine virt -bios none -accel tcg -S %s", args);
+    qtest_memwrite(qts, CODE_ADDR, code, sizeof(code));
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+    /* Skip translation and trace setup */
+    while (qtest_readl(qts, COUNTER_ADDR) < N_ITERS) {
+        g_usleep(1000);
+    }
+    start = qtest_readl(qts, COUNTER_ADDR);
+    t0 = g_get_monotonic_time();
+    g_usleep(BENCH_SECS * G_USEC_PER_SEC);
+    end = qtest_readl(qts, COUNTER_ADDR);
+    t1 = g_get_monotonic_time();
+    qtest_quit(qts);
+
+    /* The counter is 32 bits wide, the difference is correct modulo 2^32 */
+    return (double)(uint32_t)(end - start) * LOOP_INSNS * G_USEC_PER_SEC /
+           (t1 - t0);
+}
+
+static void test_trace_throughput(void)
+{
+    static const char *const formats[] = {
+        "text", "cvtrace", "binary", "perfetto"
+    };
+    double untraced;
+    size_t i;
+
+    if (!g_test_perf()) {
+        g_test_skip("only run with -m perf");
+        return;
+    }
+    untraced = loop_rate("");
+    g_test_message("untraced: %.2f M insns/s", untraced / 1e6);
+    for (i = 0; i < ARRAY_SIZE(formats); i++) {
+        g_autofree char *args = g_strdup_printf(
+            "-d instr -D /dev/null -cheri-trace-format %s", formats[i]);
+        double traced = loop_rate(args);
+
+        g_test_message("%s: %.2f M insns/s (%.1fx slower than untraced)",
+                       formats[i], traced / 1e6, untraced / traced);
+        g_assert_cmpfloat(traced, >, 0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/cheri-trace/binary", test_trace_binary);
+    qtest_add_func("/cheri-trace/perfetto", test_trace_perfetto);
+    qtest_add_func("/cheri-trace/throughput", test_trace_throughput);
+    return g_test_run();
+}
@@ -0,0 +1,195 @@
+/*
+ * CHERI instruction trace trigger test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A RISC-V guest starts and stops instruction logging with magic nops on
+ * every iteration of a loop. Each iteration runs one marker instruction in
+ * machine mode with ASID 0, one with ASID 1, one inside a PC range, one in
+ * user mode and one in the machine mode trap handler. For each kind of
+ * -cheri-trace-trigger rule the text trace must contain exactly the markers
+ * that the rule selects, and toggling logging must not flush the TB cache.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqos/libqtest.h"
+
+#define CODE_ADDR    0x80000000
+#define COUNTER_ADDR (CODE_ADDR + 0x2000)
+#define N_ITERS      100
+
+#define MARK_KERNEL  (CODE_ADDR + 0x34)
+#define MARK_ASID    (CODE_ADDR + 0x44)
+#define MARK_RANGE   (CODE_ADDR + 0x54)
+#define MARK_USER    (CODE_ADDR + 0x68)
+#define MARK_TRAP    (CODE_ADDR + 0x78)
+/* The PC range around MARK_RANGE, up to the mepc write */
+#define RANGE_START  (CODE_ADDR + 0x50)
+#define RANGE_END    (CODE_ADDR + 0x5c)
+
+static const uint32_t program[] = {
+    0x00000417,     /* auipc s0, 0 */
+    0x00002337,     /* lui   t1, 2 */
+    0x00640933,     /* add   s2, s0, t1 (COUNTER_ADDR) */
+    0x07440293,     /* addi  t0, s0, 0x74 (trap) */
+    0x30529073,     /* csrw  mtvec, t0 */
+    0x000022b7,     /* lui   t0, 2 */
+    0x80028293,     /* addi  t0, t0, -2048 (MSTATUS_MPP) */
+    0x3002b073,     /* csrc  mstatus, t0 */
+    0x00100993,     /* li    s3, 1 */
+    0x02c99993,     /* slli  s3, s3, 44 (satp with ASID 1) */
+    0x06440a13,     /* addi  s4, s0, 0x64 (user) */
+    /* loop: */
+    0x01b02013,     /* slti  zero, zero, 0x1b (start logging) */
+    0x00000013,     /* nop */
+    0x001e0e13,     /* addi  t3, t3, 1 (MARK_KERNEL) */
+    0x00000013,     /* nop */
+    0x18099073,     /* csrw  satp, s3 */
+    0x00000013,     /* nop */
+    0x001e0e13,     /* addi  t3, t3, 1 (MARK_ASID) */
+    0x00000013,     /* nop */
+    0x18001073,     /* csrw  satp, zero */
+    0x00000013,     /* nop */
+    0x001e0e13,     /* addi  t3, t3, 1 (MARK_RANGE) */
+    0x00000013,     /* nop */
+    0x341a1073,     /* csrw  mepc, s4 */
+    0x30200073,     /* mret */
+    /* user: */
+    0x00000013,     /* nop */
+    0x001e0e13,     /* addi  t3, t3, 1 (MARK_USER) */
+    0x00000013,     /* nop */
+    0x00000073,     /* ecall */
+    /* trap: */
+    0x00000013,     /* nop */
+    0x001e0e13,     /* addi  t3, t3, 1 (MARK_TRAP) */
+    0x00093e83,     /* ld    t4, 0(s2) */
+    0x001e8e93,     /* addi  t4, t4, 1 */
+    0x01d93023,     /* sd    t4, 0(s2) */
+    0x01e02013,     /* slti  zero, zero, 0x1e (stop logging) */
+    0xfa1ff06f,     /* j     loop */
+};
+
+typedef struct TriggerCase {
+    const char *name;
+    const char *rule;
+    /* Whether MARK_KERNEL, MARK_ASID, MARK_RANGE, MARK_USER, MARK_TRAP log */
+    bool logged[5];
+    /* Nothing outside [RANGE_START, RANGE_END) may be logged */
+    bool range_only;
+} TriggerCase;
+
+static const uint64_t markers[] = {
+    MARK_KERNEL, MARK_ASID, MARK_RANGE, MARK_USER, MARK_TRAP,
+};
+
+static const TriggerCase cases[] = {
+    { "asid", "asid=1", { false, true, false, false, false } },
+    /* [RANGE_START, RANGE_END) */
+    { "range", "start=0x80000050,end=0x8000005c",
+      { false, false, true, false, false }, true },
+    { "user", "mode=user", { false, false, false, true, false } },
+    { "kernel", "mode=kernel", { true, true, true, false, true } },
+};
+
+static unsigned get_flush_count(QTestState *qts)
+{
+    g_autofree char *info = qtest_hmp(qts, "info jit");
+    const char *line = strstr(info, "TB flush count");
+    unsigned count;
+
+    g_assert(line);
+    g_assert_cmpint(sscanf(line, "TB flush count %u", &count), ==, 1);
+    return count;
+}
+
+/* The set of PCs of the instructions in a text trace */
+static GHashTable *parse_trace(const char *path)
+{
+    GHashTable *pcs = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                            g_free, NULL);
+    g_autofree char *contents = NULL;
+    g_auto(GStrv) lines = NULL;
+    int i;
+
+    g_assert(g_file_get_contents(path, &contents, NULL, NULL));
+    lines = g_strsplit(contents, "\n", -1);
+    for (i = 0; lines[i]; i++) {
+        /* "[cpu:asid] 0x<pc>:  <disassembly>" */
+        const char *p = strstr(lines[i], "] 0x");
+        uint64_t *pc;
+
+        if (lines[i][0] != '[' || !p) {
+            continue;
+        }
+        pc = g_new(uint64_t, 1);
+        *pc = g_ascii_strtoull(p + 2, NULL, 16);
+        g_hash_table_add(pcs, pc);
+    }
+    return pcs;
+}
+
+static void test_trace_trigger(const void *data)
+{
+    const TriggerCase *c = data;
+    g_autofree char *dir = g_dir_make_tmp("cheri-trace-trigger-XXXXXX", NULL);
+    g_autofree char *path = g_strdup_printf("%s/trace", dir);
+    uint32_t code[ARRAY_SIZE(program)];
+    unsigned flushes;
+    GHashTableIter iter;
+    GHashTable *pcs;
+    QTestState *qts;
+    uint64_t *pc;
+    size_t i;
+
+    g_assert(dir);
+    for (i = 0; i < ARRAY_SIZE(program); i++) {
+        code[i] = cpu_to_le32(program[i]);
+    }
+
+    /* Logging stays off until the guest starts it */
+    qts = qtest_initf("-machine virt -bios none -accel tcg -S -D %s "
+                      "-cheri-trace-format text -cheri-trace-trigger %s",
+                      path, c->rule);
+    qtest_memwrite(qts, CODE_ADDR, code, sizeof(code));
+    flushes = get_flush_count(qts);
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+    while (qtest_readq(qts, COUNTER_ADDR) < N_ITERS) {
+        g_usleep(1000);
+    }
+    g_assert_cmpuint(get_flush_count(qts), ==, flushes);
+    /* SIGTERM takes the orderly shutdown path, which flushes the trace */
+    qtest_quit(qts);
+
+    pcs = parse_trace(path);
+    g_test_message("%u distinct PCs logged", g_hash_table_size(pcs));
+    for (i = 0; i < ARRAY_SIZE(markers); i++) {
+        g_assert_cmpint(g_hash_table_contains(pcs, &markers[i]), ==,
+                        c->logged[i]);
+    }
+    if (c->range_only) {
+        g_hash_table_iter_init(&iter, pcs);
+        while (g_hash_table_iter_next(&iter, (gpointer *)&pc, NULL)) {
+            g_assert_cmphex(*pc, >=, RANGE_START);
+            g_assert_cmphex(*pc, <, RANGE_END);
+        }
+    }
+
+    g_hash_table_destroy(pcs);
+    unlink(path);
+    rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    size_t i;
+
+    g_test_init(&argc, &argv, NULL);
+    for (i = 0; i < ARRAY_SIZE(cases); i++) {
+        g_autofree char *path = g_strdup_printf("/cheri-trace-trigger/%s",
+                                                cases[i].name);
+        qtest_add_data_func(path, &cases[i], test_trace_trigger);
+    }
+    return g_test_run();
+}
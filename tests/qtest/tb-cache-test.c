@@ -0,0 +1,147 @@
+/*
+ * Persistent TCG translation cache test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Runs a tiny AArch64 loop three times with the same -accel tcg,tb-cache
+ * file: the first run writes the cache, the second must link cached TBs
+ * and the third, with a changed loop body, must find them stale. Runs with
+ * different CPU properties or code generation options must not load the
+ * cache at all.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/personality.h>
+#include "qemu/bswap.h"
+#include "libqos/libqtest.h"
+
+/* Counter the guest loop stores to, within the default virt RAM */
+#define COUNTER_ADDR 0x44000000
+
+static const uint32_t kernel[] = {
+    0xd2800000,     /* mov  x0, #0 */
+    0xd2a88001,     /* mov  x1, #0x44000000 */
+    0x91000400,     /* 1: add  x0, x0, #1 */
+    0xf9000020,     /* str  x0, [x1] */
+    0x17fffffe,     /* b    1b */
+};
+
+/* Index of the add, patched to "add x0, x0, #2" for the stale run */
+#define KERNEL_ADD 2
+#define KERNEL_ADD2 0x91000800
+
+typedef struct {
+    size_t loaded;
+    size_t hits;
+    size_t misses;
+    size_t stale;
+} TBCacheStats;
+
+static void write_kernel(const char *path, uint32_t add)
+{
+    uint32_t code[ARRAY_SIZE(kernel)];
+    FILE *f = fopen(path, "wb");
+    size_t i;
+
+    g_assert(f);
+    for (i = 0; i < ARRAY_SIZE(kernel); i++) {
+        code[i] = cpu_to_le32(i == KERNEL_ADD ? add : kernel[i]);
+    }
+    g_assert_cmpint(fwrite(code, sizeof(code), 1, f), ==, 1);
+    fclose(f);
+}
+
+static void run(const char *kernel_path, const char *cache_path,
+                const char *cpu, const char *accel_opts, TBCacheStats *stats)
+{
+    QTestState *qts;
+    char *info;
+    const char *line;
+
+    qts = qtest_initf("-machine virt -cpu %s -m 128M "
+                      "-accel tcg,tb-cache=%s%s -kernel %s",
+                      cpu, cache_path, accel_opts, kernel_path);
+
+    /* Wait until the loop has been translated and run */
+    while (qtest_readq(qts, COUNTER_ADDR) == 0) {
+        g_usleep(1000);
+    }
+
+    info = qtest_hmp(qts, "info jit");
+    line = strstr(info, "TB cache");
+    g_assert(line);
+    g_assert_cmpint(sscanf(line, "TB cache %zu loaded, %zu hits, "
+                           "%zu misses, %zu stale", &stats->loaded,
+                           &stats->hits, &stats->misses, &stats->stale),
+                    ==, 4);
+    g_free(info);
+
+    /* SIGTERM takes the orderly shutdown path, which writes the cache */
+    qtest_quit(qts);
+}
+
+static void test_tb_cache_round_trip(void)
+{
+    g_autofree char *dir = g_dir_make_tmp("tb-cache-test-XXXXXX", NULL);
+    g_autofree char *kernel_path = g_strdup_printf("%s/kernel", dir);
+    g_autofree char *cache_path = g_strdup_printf("%s/cache", dir);
+    TBCacheStats stats;
+
+    g_assert(dir);
+    write_kernel(kernel_path, kernel[KERNEL_ADD]);
+
+    run(kernel_path, cache_path, "max", "", &stats);
+    g_assert_cmpuint(stats.loaded, ==, 0);
+    g_assert_cmpuint(stats.hits, ==, 0);
+    g_assert(g_file_test(cache_path, G_FILE_TEST_EXISTS));
+
+    /* Same guest code: the boot code and the loop come from the cache */
+    run(kernel_path, cache_path, "max", "", &stats);
+    g_assert_cmpuint(stats.loaded, >, 0);
+    g_assert_cmpuint(stats.hits, >, 0);
+    g_assert_cmpuint(stats.stale, ==, 0);
+
+    /* Changed loop body: same lookup key, different guest code hash */
+    write_kernel(kernel_path, KERNEL_ADD2);
+    run(kernel_path, cache_path, "max", "", &stats);
+    g_assert_cmpuint(stats.loaded, >, 0);
+    g_assert_cmpuint(stats.stale, >, 0);
+
+    /*
+     * Same CPU type, but the translator sees other ID registers: the whole
+     * cache is ignored. Each of these runs rewrites it for its own options.
+     */
+    run(kernel_path, cache_path, "max,pmu=off", "", &stats);
+    g_assert_cmpuint(stats.loaded, ==, 0);
+    run(kernel_path, cache_path, "max,sve=off", "", &stats);
+    g_assert_cmpuint(stats.loaded, ==, 0);
+
+    /* Same CPU, other code generation options */
+    run(kernel_path, cache_path, "max,sve=off", ",gvn=on", &stats);
+    g_assert_cmpuint(stats.loaded, ==, 0);
+    run(kernel_path, cache_path, "max,sve=off", ",gvn=on", &stats);
+    g_assert_cmpuint(stats.loaded, >, 0);
+
+    unlink(kernel_path);
+    unlink(cache_path);
+    rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    /*
+     * Cached code is only used when QEMU is mapped at the same address in
+     * every run. The personality is inherited by the QEMU processes.
+     */
+    if (personality(ADDR_NO_RANDOMIZE) < 0) {
+        g_test_message("cannot disable address space randomization");
+        return 0;
+    }
+
+    qtest_add_func("/tb-cache/round-trip", test_tb_cache_round_trip);
+
+    return g_test_run();
+}
@@ -0,0 +1,115 @@
+/*
+ * Hot TB retranslation test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Runs a RISC-V loop with -accel tcg,hot-threshold=N and checks with
+ * "info jit" that the loop is retranslated as hot, that the retranslated
+ * code still counts correctly and that no samples are taken while the VM
+ * is stopped.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqos/libqtest.h"
+
+#define CODE_ADDR    0x80000000
+#define COUNTER_ADDR (CODE_ADDR + 0x100)
+#define CHECK_ADDR   (CODE_ADDR + 0x104)
+
+static const uint32_t program[] = {
+    0x00000297,     /* auipc t0, 0 */
+    0x00130313,     /* 1: addi t1, t1, 1 */
+    0x1062a023,     /* sw    t1, 0x100(t0) */
+    0x00231393,     /* slli  t2, t1, 2 */
+    0x1072a223,     /* sw    t2, 0x104(t0) */
+    0xff1ff06f,     /* j     1b */
+};
+
+static bool get_hot_info(QTestState *qts, size_t *samples,
+                         size_t *retranslated)
+{
+    char *info = qtest_hmp(qts, "info jit");
+    const char *line = strstr(info, "TB hot samples");
+    bool found = line != NULL;
+
+    if (found) {
+        g_assert_cmpint(sscanf(line, "TB hot samples %zu (%zu retranslated)",
+                               samples, retranslated), ==, 2);
+    }
+    g_free(info);
+    return found;
+}
+
+static QTestState *start_loop(const char *accel)
+{
+    uint32_t code[ARRAY_SIZE(program)];
+    QTestState *qts;
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(program); i++) {
+        code[i] = cpu_to_le32(program[i]);
+    }
+    qts = qtest_initf("-machine virt -bios none -accel %s -S", accel);
+    qtest_memwrite(qts, CODE_ADDR, code, sizeof(code));
+    qtest_qmp_assert_success(qts, "{ 'execute': 'cont' }");
+    return qts;
+}
+
+static void test_hot_retranslation(void)
+{
+    QTestState *qts = start_loop("tcg,hot-threshold=4");
+    size_t samples, retranslated, stopped_samples;
+    uint32_t count, check;
+    int i;
+
+    /* The loop is the only code running, it is sampled every millisecond */
+    for (i = 0; i < 10000; i++) {
+        g_assert(get_hot_info(qts, &samples, &retranslated));
+        if (retranslated) {
+            break;
+        }
+        g_usleep(1000);
+    }
+    g_test_message("%zu samples, %zu retranslated", samples, retranslated);
+    g_assert_cmpuint(retranslated, >, 0);
+
+    /* The hot code must still run the loop correctly */
+    count = qtest_readl(qts, COUNTER_ADDR);
+    while (qtest_readl(qts, COUNTER_ADDR) - count < 1000000) {
+        g_usleep(1000);
+    }
+    qtest_qmp_assert_success(qts, "{ 'execute': 'stop' }");
+    count = qtest_readl(qts, COUNTER_ADDR);
+    check = qtest_readl(qts, CHECK_ADDR);
+    g_assert_cmphex(check, ==, count << 2);
+
+    /* The virtual clock, and with it the sampler, stands still */
+    g_assert(get_hot_info(qts, &stopped_samples, &retranslated));
+    g_usleep(100 * 1000);
+    g_assert(get_hot_info(qts, &samples, &retranslated));
+    g_assert_cmpuint(samples, ==, stopped_samples);
+
+    qtest_quit(qts);
+}
+
+static void test_hot_disabled(void)
+{
+    QTestState *qts = start_loop("tcg");
+    size_t samples, retranslated;
+
+    while (qtest_readl(qts, COUNTER_ADDR) < 100000) {
+        g_usleep(1000);
+    }
+    g_assert_false(get_hot_info(qts, &samples, &retranslated));
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    qtest_add_func("/tb-hot/retranslation", test_hot_retranslation);
+    qtest_add_func("/tb-hot/disabled", test_hot_disabled);
+    return g_test_run();
+}
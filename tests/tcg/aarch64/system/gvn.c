@@ -0,0 +1,170 @@
+/*
+ * Checks for the TCG value numbering passes (-accel tcg,gvn=on).
+ *
+ * Each asm block is straight-line code and so ends up in a single TB that
+ * the pass sees as a whole. The blocks read a vector register, which is a
+ * load from env, then change it behind the pass's back through a helper
+ * call, a guest memory access or a narrower store to the same field, and
+ * read it again. The second read must not be forwarded from the first.
+ * read_d0() reads the register again in a TB of its own as the reference.
+ *
+ * gvn=on also removes env stores that are overwritten later in the block,
+ * so test_dead_stores() checks that stores only partly overwritten or read
+ * by a helper in between survive.
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+static int failed;
+
+static void check(const char *what, uint64_t got, uint64_t want)
+{
+    if (got != want) {
+        ml_printf("FAIL: %s: %lx != %lx\n", what, got, want);
+        failed = 1;
+    }
+}
+
+static uint64_t __attribute__((noinline)) read_d0(void)
+{
+    uint64_t r;
+
+    asm volatile("fmov %0, d0" : "=r"(r));
+    return r;
+}
+
+/* The crypto helpers write v0 through a pointer to env */
+static void test_call(void)
+{
+    uint64_t a = 0x0123456789abcdefull, before, after;
+
+    asm volatile(".arch_extension crypto\n\t"
+                 "movi v1.2d, #0\n\t"
+                 "fmov d0, %[a]\n\t"
+                 "fmov %[before], d0\n\t"
+                 "aese v0.16b, v1.16b\n\t"
+                 "fmov %[after], d0\n\t"
+                 : [before] "=&r"(before), [after] "=&r"(after)
+                 : [a] "r"(a)
+                 : "v0", "v1");
+    check("load before helper call", before, a);
+    check("load after helper call", after, read_d0());
+    if (after == a) {
+        ml_printf("FAIL: aese did not change v0\n");
+        failed = 1;
+    }
+}
+
+static void test_qemu_ld_st(void)
+{
+    static uint64_t mem = 0xfeedfacecafef00dull;
+    uint64_t a = 0x1111111111111111ull, b = 0x2222222222222222ull;
+    uint64_t before, loaded, stored;
+
+    asm volatile("fmov d0, %[a]\n\t"
+                 "fmov %[before], d0\n\t"
+                 "ldr d0, [%[p]]\n\t"
+                 "fmov %[loaded], d0\n\t"
+                 : [before] "=&r"(before), [loaded] "=&r"(loaded)
+                 : [a] "r"(a), [p] "r"(&mem)
+                 : "v0", "memory");
+    check("load before qemu_ld", before, a);
+    check("load after qemu_ld", loaded, 0xfeedfacecafef00dull);
+    check("load after qemu_ld (reference)", loaded, read_d0());
+
+    asm volatile("fmov d0, %[a]\n\t"
+                 "fmov %[before], d0\n\t"
+                 "str %[b], [%[p]]\n\t"
+                 "ldr d0, [%[p]]\n\t"
+                 "fmov %[stored], d0\n\t"
+                 : [before] "=&r"(before), [stored] "=&r"(stored)
+                 : [a] "r"(a), [b] "r"(b), [p] "r"(&mem)
+                 : "v0", "memory");
+    check("load after qemu_st/qemu_ld", stored, b);
+    check("load after qemu_st/qemu_ld (reference)", stored, read_d0());
+}
+
+/* Stores to part of a field must invalidate what is known about all of it */
+static void test_aliased_stores(void)
+{
+    uint64_t a = 0x0123456789abcdefull, before, word, byte;
+
+    asm volatile("fmov d0, %[a]\n\t"
+                 "fmov %[before], d0\n\t"
+                 "ins v0.s[1], %w[w]\n\t"
+                 "fmov %[word], d0\n\t"
+                 "ins v0.b[0], %w[b]\n\t"
+                 "fmov %[byte], d0\n\t"
+                 : [before] "=&r"(before), [word] "=&r"(word),
+                   [byte] "=&r"(byte)
+                 : [a] "r"(a), [w] "r"(0xdeadbeef), [b] "r"(0x5a)
+                 : "v0");
+    check("load before narrower stores", before, a);
+    check("load after 32-bit store", word, 0xdeadbeef89abcdefull);
+    check("load after 8-bit store", byte, 0xdeadbeef89abcd5aull);
+    check("load after 8-bit store (reference)", byte, read_d0());
+}
+
+/* A recomputation must not be replaced once one of its inputs changed */
+static void test_redefined_input(void)
+{
+    uint64_t a = 40, b = 2, r1, r2;
+
+    asm volatile("add %[r1], %[a], %[b]\n\t"
+                 "add %[a], %[a], #1\n\t"
+                 "add %[r2], %[a], %[b]\n\t"
+                 : [r1] "=&r"(r1), [r2] "=&r"(r2), [a] "+r"(a)
+                 : [b] "r"(b));
+    check("recomputation with a redefined input", r2, r1 + 1);
+}
+
+/* Only the second of two stores covering the same field may be removed */
+static void test_dead_stores(void)
+{
+    uint64_t a = 0x0123456789abcdefull, b = 0x1122334455667788ull;
+    uint64_t split, joined;
+
+    asm volatile("fmov d0, %[a]\n\t"
+                 "fmov d0, %[b]\n\t"
+                 : : [a] "r"(a), [b] "r"(b) : "v0");
+    check("store overwritten by a store", read_d0(), b);
+
+    asm volatile("fmov d0, %[a]\n\t"
+                 "ins v0.s[0], %w[w]\n\t"
+                 : : [a] "r"(a), [w] "r"(0xdeadbeef) : "v0");
+    check("store partly overwritten", read_d0(), 0x01234567deadbeefull);
+
+    /* aese reads v0 through a pointer, so the fmov must reach env first */
+    asm volatile(".arch_extension crypto\n\t"
+                 "movi v1.2d, #0\n\t"
+                 "fmov d0, %[a]\n\t"
+                 "b 1f\n"
+                 "1:\n\t"
+                 "aese v0.16b, v1.16b\n\t"
+                 "fmov %[split], d0\n\t"
+                 : [split] "=r"(split) : [a] "r"(a) : "v0", "v1");
+    asm volatile(".arch_extension crypto\n\t"
+                 "movi v1.2d, #0\n\t"
+                 "fmov d0, %[b]\n\t"
+                 "fmov d0, %[a]\n\t"
+                 "aese v0.16b, v1.16b\n\t"
+                 "fmov %[joined], d0\n\t"
+                 : [joined] "=r"(joined)
+                 : [a] "r"(a), [b] "r"(b)
+                 : "v0", "v1");
+    check("store read by a helper call", joined, split);
+}
+
+int main(void)
+{
+    test_call();
+    test_qemu_ld_st();
+    test_aliased_stores();
+    test_redefined_input();
+    test_dead_stores();
+    if (!failed) {
+        ml_printf("OK\n");
+    }
+    return failed;
+}
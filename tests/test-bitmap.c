@@ -123,6 +123,99 @@ static void check_bitmap_set(void)
     bitmap_set_case(bitmap_set_atomic);
 }
 
+static void check_bitmap_count_and_clear_atomic(void)
+{
+    unsigned long *bmap = bitmap_new(BMAP_SIZE);
+    long start, nr;
+
+    /* Every start/length within the first few words, with every bit set */
+    for (start = 0; start <= 2 * BITS_PER_LONG; start++) {
+        for (nr = 0; start + nr <= 4 * BITS_PER_LONG; nr++) {
+            bitmap_fill(bmap, BMAP_SIZE);
+            g_assert_cmpint(bitmap_count_and_clear_atomic(bmap, start, nr),
+                            ==, nr);
+            g_assert_cmpint(find_first_zero_bit(bmap, BMAP_SIZE), ==,
+                            nr ? start : BMAP_SIZE);
+            g_assert_cmpint(find_next_bit(bmap, BMAP_SIZE, start), ==,
+                            start + nr);
+        }
+    }
+
+    /* Sparse bits spanning several all-zero cache lines */
+    bitmap_zero(bmap, BMAP_SIZE);
+    set_bit(3, bmap);
+    set_bit(BMAP_SIZE / 2, bmap);
+    set_bit(BMAP_SIZE - 2, bmap);
+    g_assert_cmpint(bitmap_count_and_clear_atomic(bmap, 1, BMAP_SIZE - 2),
+                    ==, 3);
+    g_assert(bitmap_empty(bmap, BMAP_SIZE));
+    g_assert_cmpint(bitmap_count_and_clear_atomic(bmap, 0, BMAP_SIZE), ==, 0);
+
+    g_free(bmap);
+}
+
+static void index_set_bit(unsigned long *bmap, unsigned long *index, long nr)
+{
+    set_bit_atomic(nr, bmap);
+    bitmap_index_mark_atomic(index, BIT_WORD(nr));
+}
+
+static void check_bitmap_index_find_next(void)
+{
+    unsigned long *bmap = bitmap_new(BMAP_SIZE);
+    unsigned long *index = bitmap_new(BITS_TO_LONGS(BMAP_SIZE));
+    long nr;
+
+    g_assert_cmpint(bitmap_index_find_next(bmap, index, BMAP_SIZE, 0), ==,
+                    BMAP_SIZE);
+
+    index_set_bit(bmap, index, 5);
+    index_set_bit(bmap, index, BITS_PER_LONG + 1);
+    index_set_bit(bmap, index, BMAP_SIZE - 1);
+    g_assert_cmpint(bitmap_index_find_next(bmap, index, BMAP_SIZE, 0), ==, 5);
+    g_assert_cmpint(bitmap_index_find_next(bmap, index, BMAP_SIZE, 6), ==,
+                    BITS_PER_LONG + 1);
+    g_assert_cmpint(bitmap_index_find_next(bmap, index, BMAP_SIZE,
+                                           BITS_PER_LONG + 2), ==,
+                    BMAP_SIZE - 1);
+    /* Nothing below a smaller size: returns that size */
+    g_assert_cmpint(bitmap_index_find_next(bmap, index, BMAP_SIZE - 1,
+                                           BITS_PER_LONG + 2), ==,
+                    BMAP_SIZE - 1);
+
+    /* Bits that are not in the index are not found */
+    set_bit(BMAP_SIZE / 2, bmap);
+    g_assert_cmpint(bitmap_index_find_next(bmap, index, BMAP_SIZE,
+                                           BITS_PER_LONG + 2), ==,
+                    BMAP_SIZE - 1);
+    bitmap_index_mark_atomic(index, BIT_WORD(BMAP_SIZE / 2));
+    g_assert_cmpint(bitmap_index_find_next(bmap, index, BMAP_SIZE,
+                                           BITS_PER_LONG + 2), ==,
+                    BMAP_SIZE / 2);
+
+    /* Words cleared without touching the index are dropped from it */
+    bitmap_count_and_clear_atomic(bmap, 0, BMAP_SIZE - 1);
+    g_assert_cmpint(bitmap_index_find_next(bmap, index, BMAP_SIZE, 0), ==,
+                    BMAP_SIZE - 1);
+    g_assert_cmpint(find_first_bit(index, BITS_TO_LONGS(BMAP_SIZE)), ==,
+                    BIT_WORD(BMAP_SIZE - 1));
+
+    /* Every bit of a densely set bitmap is found in order */
+    for (nr = 0; nr < BMAP_SIZE; nr += 3) {
+        index_set_bit(bmap, index, nr);
+    }
+    for (nr = 0; nr < BMAP_SIZE; nr += 3) {
+        g_assert_cmpint(bitmap_index_find_next(bmap, index, BMAP_SIZE, nr),
+                        ==, nr);
+        g_assert_cmpint(bitmap_index_find_next(bmap, index, BMAP_SIZE,
+                                               nr + 1),
+                        ==, MIN(nr + 3, BMAP_SIZE));
+    }
+
+    g_free(index);
+    g_free(bmap);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -131,6 +224,10 @@ int main(int argc, char **argv)
                     check_bitmap_copy_with_offset);
     g_test_add_func("/bitmap/bitmap_set",
                     check_bitmap_set);
+    g_test_add_func("/bitmap/bitmap_count_and_clear_atomic",
+                    check_bitmap_count_and_clear_atomic);
+    g_test_add_func("/bitmap/bitmap_index_find_next",
+                    check_bitmap_index_find_next);
 
     g_test_run();
 
@@ -69,6 +69,25 @@ static void test_parse_range(void)
     g_assert(qemu_log_in_addr_range(0x2050));
     g_assert(qemu_log_in_addr_range(0x3050));
 
+    /* Unsorted, overlapping and adjacent ranges */
+    qemu_set_dfilter_ranges("0x5000+0x100,0x1000+0x100,0x1080..0x1200,"
+                            "0x1201..0x1300,0x3000+0x10", &error_abort);
+    g_assert_false(qemu_log_in_addr_range(0xfff));
+    g_assert(qemu_log_in_addr_range(0x1000));
+    g_assert(qemu_log_in_addr_range(0x1150));
+    g_assert(qemu_log_in_addr_range(0x1300));
+    g_assert_false(qemu_log_in_addr_range(0x1301));
+    g_assert(qemu_log_in_addr_range(0x300f));
+    g_assert_false(qemu_log_in_addr_range(0x3010));
+    g_assert(qemu_log_in_addr_range(0x50ff));
+    g_assert_false(qemu_log_in_addr_range(0x5100));
+
+    g_assert(qemu_log_any_in_addr_range(0x0, 0x1000));
+    g_assert(qemu_log_any_in_addr_range(0x1300, 0x2000));
+    g_assert_false(qemu_log_any_in_addr_range(0x1301, 0x2fff));
+    g_assert(qemu_log_any_in_addr_range(0x1301, 0x3000));
+    g_assert_false(qemu_log_any_in_addr_range(0x5100, UINT64_MAX));
+
     qemu_set_dfilter_ranges("0xffffffffffffffff-1", &error_abort);
     g_assert(qemu_log_in_addr_range(UINT64_MAX));
     g_assert_false(qemu_log_in_addr_range(UINT64_MAX - 1));
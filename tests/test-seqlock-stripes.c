@@ -0,0 +1,135 @@
+/*
+ * Striped seqlock stress test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Models the CHERI tag line locks: "capability" writers store a pair of
+ * words and set a tag, plain writers overwrite one word and clear the tag,
+ * and readers must never see a set tag with words from a plain store.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/seqlock-stripes.h"
+#include "qemu/thread.h"
+
+/* Fewer stripes than granules, so unrelated granules share stripes */
+#define N_STRIPES 16
+#define N_GRANULES 256
+#define N_ITERS 200000
+
+typedef struct Granule {
+    uint64_t w0;
+    uint64_t w1;
+    bool tag;
+} Granule;
+
+static SeqLockStripe stripes[N_STRIPES];
+static Granule granules[N_GRANULES];
+static bool stop;
+static unsigned long n_torn;
+static unsigned long n_tagged_reads;
+
+static SeqLockStripe *granule_stripe(Granule *g)
+{
+    return seqlock_stripe(stripes, N_STRIPES, g - granules);
+}
+
+static void *cap_writer(void *opaque)
+{
+    GRand *rand = g_rand_new_with_seed((uintptr_t)opaque);
+
+    for (int i = 0; i < N_ITERS; i++) {
+        Granule *g = &granules[g_rand_int_range(rand, 0, N_GRANULES)];
+        uint64_t v = ((uint64_t)g_rand_int(rand) << 32) | g_rand_int(rand);
+        SeqLockStripe *s = granule_stripe(g);
+
+        seqlock_stripe_write_lock(s);
+        qatomic_set(&g->w0, v);
+        qatomic_set(&g->w1, ~v);
+        qatomic_set(&g->tag, true);
+        seqlock_stripe_write_unlock(s);
+    }
+    g_rand_free(rand);
+    return NULL;
+}
+
+static void *data_writer(void *opaque)
+{
+    GRand *rand = g_rand_new_with_seed((uintptr_t)opaque);
+
+    for (int i = 0; i < N_ITERS; i++) {
+        Granule *g = &granules[g_rand_int_range(rand, 0, N_GRANULES)];
+        SeqLockStripe *s = granule_stripe(g);
+
+        seqlock_stripe_write_lock(s);
+        qatomic_set(&g->w0, g_rand_int(rand));
+        qatomic_set(&g->tag, false);
+        seqlock_stripe_write_unlock(s);
+    }
+    g_rand_free(rand);
+    return NULL;
+}
+
+static void *reader(void *opaque)
+{
+    GRand *rand = g_rand_new_with_seed((uintptr_t)opaque);
+
+    while (!qatomic_read(&stop)) {
+        Granule *g = &granules[g_rand_int_range(rand, 0, N_GRANULES)];
+        SeqLockStripe *s = granule_stripe(g);
+        uint64_t w0, w1;
+        unsigned seq;
+        bool tag;
+
+        do {
+            seq = seqlock_stripe_read_begin(s);
+            w0 = qatomic_read(&g->w0);
+            w1 = qatomic_read(&g->w1);
+            tag = qatomic_read(&g->tag);
+        } while (seqlock_stripe_read_retry(s, seq));
+
+        if (tag) {
+            qatomic_inc(&n_tagged_reads);
+            if (w1 != ~w0) {
+                qatomic_inc(&n_torn);
+            }
+        }
+    }
+    g_rand_free(rand);
+    return NULL;
+}
+
+static void test_stripes(void)
+{
+    QemuThread writers[4], readers[2];
+    size_t i;
+
+    seqlock_stripes_init(stripes, N_STRIPES);
+    for (i = 0; i < ARRAY_SIZE(readers); i++) {
+        qemu_thread_create(&readers[i], "reader", reader,
+                           (void *)(uintptr_t)(i + 100), QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < ARRAY_SIZE(writers); i++) {
+        qemu_thread_create(&writers[i], "writer",
+                           i & 1 ? data_writer : cap_writer,
+                           (void *)(uintptr_t)(i + 1), QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < ARRAY_SIZE(writers); i++) {
+        qemu_thread_join(&writers[i]);
+    }
+    qatomic_set(&stop, true);
+    for (i = 0; i < ARRAY_SIZE(readers); i++) {
+        qemu_thread_join(&readers[i]);
+    }
+
+    g_test_message("%lu tagged reads", n_tagged_reads);
+    g_assert_cmpuint(n_torn, ==, 0);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/seqlock-stripes/cap-vs-data", test_stripes);
+    return g_test_run();
+}
@@ -0,0 +1,159 @@
+/*
+ * qemu-trace-stats test
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * Writes a cvtrace with a known mix of entries and checks the counts that
+ * contrib/trace-stats reports for it. The trace is split into many small
+ * work items so that several workers decode it and their results are
+ * merged.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "exec/log_instr-cvtrace.h"
+
+#define TRACE_STATS "contrib/trace-stats/qemu-trace-stats"
+#define N_ENTRIES 10007
+#define N_PCS 5
+#define HOT_PC 0x80001000ull
+
+typedef struct {
+    uint64_t insns;
+    uint64_t traps;
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t cap_writes[2];
+    uint64_t cap_loads[2];
+    uint64_t cap_stores[2];
+} Expected;
+
+static const uint8_t entry_types[] = {
+    CTE_NO_REG, CTE_GPR, CTE_LD_GPR, CTE_ST_GPR, CTE_CAP, CTE_LD_CAP,
+    CTE_ST_CAP,
+};
+
+static void write_trace(const char *path, Expected *exp)
+{
+    cheri_trace_entry_t e;
+    FILE *f = fopen(path, "wb");
+    int i;
+
+    g_assert(f);
+    memset(&e, 0, sizeof(e));
+    ((uint8_t *)&e)[0] = CTE_QEMU_VERSION;
+    memcpy((uint8_t *)&e + 1, CTE_QEMU_MAGIC, strlen(CTE_QEMU_MAGIC));
+    g_assert_cmpint(fwrite(&e, sizeof(e), 1, f), ==, 1);
+
+    memset(exp, 0, sizeof(*exp));
+    for (i = 0; i < N_ENTRIES; i++) {
+        bool tag = (i / ARRAY_SIZE(entry_types)) & 1;
+
+        memset(&e, 0, sizeof(e));
+        e.entry_type = entry_types[i % ARRAY_SIZE(entry_types)];
+        e.exception = i % 13 ? CTE_EXCEPTION_NONE : 2;
+        e.inst = cpu_to_be32(0x00000013);
+        e.pc = cpu_to_be64(HOT_PC + 4 * (i % N_PCS));
+        e.val1 = cpu_to_be64(0x1000 + i);
+        e.val2 = cpu_to_be64(tag ? 1ull << 63 : 0);
+        e.asid = i % 3;
+        g_assert_cmpint(fwrite(&e, sizeof(e), 1, f), ==, 1);
+
+        exp->insns++;
+        exp->traps += e.exception != CTE_EXCEPTION_NONE;
+        switch (e.entry_type) {
+        case CTE_LD_GPR:
+            exp->loads++;
+            break;
+        case CTE_ST_GPR:
+            exp->stores++;
+            break;
+        case CTE_CAP:
+            exp->cap_writes[tag]++;
+            break;
+        case CTE_LD_CAP:
+            exp->loads++;
+            exp->cap_loads[tag]++;
+            break;
+        case CTE_ST_CAP:
+            exp->stores++;
+            exp->cap_stores[tag]++;
+            break;
+        }
+    }
+    fclose(f);
+}
+
+static uint64_t field(const char *out, const char *name)
+{
+    const char *line = strstr(out, name);
+    uint64_t v;
+
+    g_assert(line);
+    g_assert_cmpint(sscanf(line + strlen(name), " %" SCNu64, &v), ==, 1);
+    return v;
+}
+
+static void field_pair(const char *out, const char *name, uint64_t *pair)
+{
+    const char *line = strstr(out, name);
+
+    g_assert(line);
+    g_assert_cmpint(sscanf(line + strlen(name), " %" SCNu64 "/%" SCNu64,
+                           &pair[1], &pair[0]), ==, 2);
+}
+
+static void test_cvtrace(void)
+{
+    g_autofree char *dir = g_dir_make_tmp("trace-stats-test-XXXXXX", NULL);
+    g_autofree char *path = g_strdup_printf("%s/trace.cvtrace", dir);
+    g_autofree char *cmd = NULL;
+    g_autofree char *out = NULL;
+    g_autofree char *pc = NULL;
+    const char *caps;
+    uint64_t pair[2], hot;
+    Expected exp;
+    int status;
+
+    g_assert(dir);
+    write_trace(path, &exp);
+
+    cmd = g_strdup_printf(TRACE_STATS " -j 4 -s 1000 -a riscv %s", path);
+    g_assert(g_spawn_command_line_sync(cmd, &out, NULL, &status, NULL));
+    g_assert(g_spawn_check_exit_status(status, NULL));
+
+    g_assert_cmpuint(field(out, "work items:"), ==,
+                     DIV_ROUND_UP(N_ENTRIES, 1000));
+    g_assert_cmpuint(field(out, "instructions:"), ==, exp.insns);
+    g_assert_cmpuint(field(out, "traps:"), ==, exp.traps);
+    g_assert_cmpuint(field(out, "loads:"), ==, exp.loads);
+    g_assert_cmpuint(field(out, "stores:"), ==, exp.stores);
+
+    caps = strstr(out, "capability operations");
+    g_assert(caps);
+    field_pair(caps, "register writes", pair);
+    g_assert_cmpuint(pair[1], ==, exp.cap_writes[1]);
+    g_assert_cmpuint(pair[0], ==, exp.cap_writes[0]);
+    field_pair(caps, "loads", pair);
+    g_assert_cmpuint(pair[1], ==, exp.cap_loads[1]);
+    g_assert_cmpuint(pair[0], ==, exp.cap_loads[0]);
+    field_pair(caps, "stores", pair);
+    g_assert_cmpuint(pair[1], ==, exp.cap_stores[1]);
+    g_assert_cmpuint(pair[0], ==, exp.cap_stores[0]);
+
+    /* N_ENTRIES % N_PCS != 0, so HOT_PC is the most frequent one */
+    pc = g_strdup_printf("0x%016" PRIx64, (uint64_t)HOT_PC);
+    hot = field(strstr(out, "hot PCs:"), pc);
+    g_assert_cmpuint(hot, ==, DIV_ROUND_UP(N_ENTRIES, N_PCS));
+
+    unlink(path);
+    rmdir(dir);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/trace-stats/cvtrace", test_cvtrace);
+    return g_test_run();
+}
@@ -13,6 +13,7 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/atomic.h"
+#include "qemu/cutils.h"
 
 /*
  * bitmaps provide an array of bits, implemented using an
@@ -287,6 +288,106 @@ bool bitmap_test_and_clear_atomic(unsigned long *map, long start, long nr)
     return dirty != 0;
 }
 
+long bitmap_count_and_clear_atomic(unsigned long *map, long start, long nr)
+{
+    unsigned long *p = map + BIT_WORD(start);
+    const long size = start + nr;
+    int bits_to_clear = BITS_PER_LONG - (start % BITS_PER_LONG);
+    unsigned long mask_to_clear = BITMAP_FIRST_WORD_MASK(start);
+    long cleared = 0;
+
+    assert(start >= 0 && nr >= 0);
+
+    /* First word */
+    if (nr - bits_to_clear > 0) {
+        if (*p & mask_to_clear) {
+            cleared += ctpopl(qatomic_fetch_and(p, ~mask_to_clear) &
+                              mask_to_clear);
+        }
+        nr -= bits_to_clear;
+        bits_to_clear = BITS_PER_LONG;
+        mask_to_clear = ~0UL;
+        p++;
+    }
+
+    /* Full words, skipping all-zero runs a cache line at a time */
+    if (bits_to_clear == BITS_PER_LONG) {
+        const long line = 64 / sizeof(unsigned long);
+        long words = nr / BITS_PER_LONG;
+
+        if (buffer_is_zero(p, words * sizeof(unsigned long))) {
+            p += words;
+            nr -= words * BITS_PER_LONG;
+        }
+        for (; nr >= line * BITS_PER_LONG; nr -= line * BITS_PER_LONG) {
+            unsigned long any = 0;
+            for (long i = 0; i < line; i++) {
+                any |= p[i];
+            }
+            for (long i = 0; any && i < line; i++) {
+                if (p[i]) {
+                    cleared += ctpopl(qatomic_xchg(&p[i], 0));
+                }
+            }
+            p += line;
+        }
+        for (; nr >= BITS_PER_LONG; nr -= BITS_PER_LONG, p++) {
+            if (*p) {
+                cleared += ctpopl(qatomic_xchg(p, 0));
+            }
+        }
+    }
+
+    /* Last word */
+    if (nr) {
+        mask_to_clear &= BITMAP_LAST_WORD_MASK(size);
+        if (*p & mask_to_clear) {
+            cleared += ctpopl(qatomic_fetch_and(p, ~mask_to_clear) &
+                              mask_to_clear);
+        }
+    }
+
+    return cleared;
+}
+
+/*
+ * Like find_next_bit(), but only looks at the words of @map that are marked
+ * in @index (see bitmap_index_mark_atomic()). Marks of words found to be zero
+ * are dropped. @map may be modified concurrently; a word is re-marked if it
+ * became non-zero again while its mark was being dropped.
+ */
+long bitmap_index_find_next(const unsigned long *map, unsigned long *index,
+                            long size, long offset)
+{
+    const long nwords = BITS_TO_LONGS(size);
+
+    while (offset < size) {
+        long word = find_next_bit(index, nwords, BIT_WORD(offset));
+        unsigned long bits;
+
+        if (word >= nwords) {
+            break;
+        }
+        if (word > BIT_WORD(offset)) {
+            offset = word * BITS_PER_LONG;
+        }
+        bits = qatomic_read(&map[word]);
+        if (!bits) {
+            qatomic_and(&index[BIT_WORD(word)], ~BIT_MASK(word));
+            if (qatomic_read(&map[word])) {
+                set_bit_atomic(word, index);
+                continue;
+            }
+        }
+        bits &= BITMAP_FIRST_WORD_MASK(offset);
+        if (bits) {
+            return MIN(word * BITS_PER_LONG + ctzl(bits), size);
+        }
+        offset = (word + 1) * BITS_PER_LONG;
+    }
+    return size;
+}
+
 void bitmap_copy_and_clear_atomic(unsigned long *dst, unsigned long *src,
                                   long nr)
 {
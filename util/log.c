@@ -198,24 +198,82 @@ void qemu_set_log_filename(const char *filename, Error **errp)
     }
 }
 
+/*
+ * The debug filter is kept sorted and without overlapping ranges, so that
+ * lookups are a binary search. Returns the index of the first range that
+ * ends at or after @addr.
+ */
+static guint dfilter_lower_bound(uint64_t addr)
+{
+    guint lo = 0, hi = debug_regions->len;
+
+    while (lo < hi) {
+        guint mid = lo + (hi - lo) / 2;
+
+        if (range_upb(&g_array_index(debug_regions, Range, mid)) < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
 /* Returns true if addr is in our debug filter or no filter defined
  */
 bool qemu_log_in_addr_range(uint64_t addr)
 {
     if (debug_regions) {
-        int i = 0;
-        for (i = 0; i < debug_regions->len; i++) {
-            Range *range = &g_array_index(debug_regions, Range, i);
-            if (range_contains(range, addr)) {
-                return true;
-            }
-        }
-        return false;
+        guint i = dfilter_lower_bound(addr);
+
+        return i < debug_regions->len &&
+            range_contains(&g_array_index(debug_regions, Range, i), addr);
     } else {
         return true;
     }
 }
 
+/* Returns true if any address in [lob, upb] is in our debug filter or no
+ * filter defined
+ */
+bool qemu_log_any_in_addr_range(uint64_t lob, uint64_t upb)
+{
+    if (debug_regions) {
+        guint i = dfilter_lower_bound(lob);
+
+        return i < debug_regions->len &&
+            range_lob(&g_array_index(debug_regions, Range, i)) <= upb;
+    } else {
+        return true;
+    }
+}
+
+static gint dfilter_range_compare(gconstpointer a, gconstpointer b)
+{
+    uint64_t lob_a = range_lob((Range *)a), lob_b = range_lob((Range *)b);
+
+    return lob_a < lob_b ? -1 : lob_a > lob_b;
+}
+
+/* Sort the debug filter and merge overlapping or adjacent ranges */
+static void dfilter_normalize(void)
+{
+    Range *ranges = (Range *)debug_regions->data;
+    guint i, n = 0;
+
+    g_array_sort(debug_regions, dfilter_range_compare);
+    for (i = 0; i < debug_regions->len; i++) {
+        if (n > 0 && (range_upb(&ranges[n - 1]) == UINT64_MAX ||
+                      range_lob(&ranges[i]) <= range_upb(&ranges[n - 1]) + 1)) {
+            range_set_bounds(&ranges[n - 1], range_lob(&ranges[n - 1]),
+                             MAX(range_upb(&ranges[n - 1]),
+                                 range_upb(&ranges[i])));
+        } else {
+            ranges[n++] = ranges[i];
+        }
+    }
+    g_array_set_size(debug_regions, n);
+}
 
 void qemu_set_dfilter_ranges(const char *filter_spec, Error **errp)
 {
@@ -285,6 +343,7 @@ void qemu_set_dfilter_ranges(const char *filter_spec, Error **errp)
         range_set_bounds(&range, lob, upb);
         g_array_append_val(debug_regions, range);
     }
+    dfilter_normalize();
 out:
     g_strfreev(ranges);
 }